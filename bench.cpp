@@ -0,0 +1,440 @@
+#include "streams.hpp"
+
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <string>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Throughput/latency benchmarks of the streams library against stdio,
+// iostreams and raw syscalls. Every measurement is emitted as one JSON object
+// per line so runs can be diffed and tracked over time:
+//
+//   bench [--quick] [--cold] [--out FILE] [--dir LABEL=PATH]...
+//
+// Without --dir the suite runs on /dev/shm (tmpfs) and the current directory
+// (disk). --cold drops the page cache of the input file before each read run.
+
+namespace {
+
+struct options {
+  bool quick = false;
+  bool cold = false;
+  static constexpr size_t MAX_DIRS = 8;
+  struct {
+    std::string label;
+    std::string path;
+  } dirs[MAX_DIRS];
+  size_t ndirs = 0;
+};
+
+struct result {
+  char const *fs;
+  char const *bench;
+  char const *impl;
+  size_t fileSize;
+  size_t bufferSize;
+  size_t lineLength;
+  size_t ops;
+  double seconds;
+};
+
+ofstream *results = nullptr;
+
+void report(result const &r) {
+  char line[512];
+  auto const mbps = r.seconds > 0
+                        ? static_cast<double>(r.fileSize) / r.seconds / 1e6
+                        : 0.0;
+  auto const nsPerOp =
+      r.ops != 0 ? r.seconds * 1e9 / static_cast<double>(r.ops) : 0.0;
+  auto len = snprintf(
+      line, sizeof(line),
+      "{\"fs\":\"%s\",\"bench\":\"%s\",\"impl\":\"%s\",\"file_size\":%zu,"
+      "\"buffer_size\":%zu,\"line_length\":%zu,\"ops\":%zu,"
+      "\"seconds\":%.6f,\"mb_per_s\":%.2f,\"ns_per_op\":%.1f}\n",
+      r.fs, r.bench, r.impl, r.fileSize, r.bufferSize, r.lineLength, r.ops,
+      r.seconds, mbps, nsPerOp);
+  results->write(array<char>(line, static_cast<size_t>(len)));
+  results->flush();
+}
+
+template <typename F> double timed(F &&body) {
+  auto const start = std::chrono::steady_clock::now();
+  body();
+  auto const stop = std::chrono::steady_clock::now();
+  return std::chrono::duration<double>(stop - start).count();
+}
+
+uint64_t xorshift(uint64_t &state) {
+  state ^= state << 13;
+  state ^= state >> 7;
+  state ^= state << 17;
+  return state;
+}
+
+// Writes `size` bytes of printable text whose lines average `lineLength`.
+bool generate(std::string const &path, size_t size, size_t lineLength) {
+  int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666);
+  if (fd == -1)
+    return false;
+  array<char> chunk{1 << 16};
+  uint64_t state = 0x9E3779B97F4A7C15ull ^ lineLength;
+  size_t written = 0;
+  while (written < size) {
+    auto const n = min(chunk.capacity(), size - written);
+    for (size_t i = 0; i < n; ++i) {
+      auto const r = xorshift(state);
+      chunk[i] = r % lineLength == 0 ? '\n' : static_cast<char>('a' + r % 26);
+    }
+    if (::write(fd, chunk.data(), n) != static_cast<ssize_t>(n)) {
+      ::close(fd);
+      return false;
+    }
+    written += n;
+  }
+  ::fsync(fd);
+  ::close(fd);
+  return true;
+}
+
+void dropCache(options const &opts, std::string const &path) {
+  if (!opts.cold)
+    return;
+  int fd = ::open(path.c_str(), O_RDONLY);
+  if (fd == -1)
+    return;
+  ::fdatasync(fd);
+  ::posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+  ::close(fd);
+}
+
+volatile size_t sink = 0;
+
+void benchReadline(options const &opts, char const *fs,
+                   std::string const &path, size_t size, size_t bufsize,
+                   size_t lineLength) {
+  result r{fs, "readline", "", size, bufsize, lineLength, 0, 0};
+
+  dropCache(opts, path);
+  r.impl = "streams";
+  r.ops = 0;
+  r.seconds = timed([&] {
+    ifstream in{array<char>(path.c_str())};
+    for (;;) {
+      auto line = in.readline();
+      if (line.second == 0)
+        break;
+      ++r.ops;
+    }
+  });
+  report(r);
+
+  dropCache(opts, path);
+  r.impl = "stdio";
+  r.ops = 0;
+  r.seconds = timed([&] {
+    FILE *f = fopen(path.c_str(), "r");
+    setvbuf(f, nullptr, _IOFBF, bufsize);
+    char *line = nullptr;
+    size_t cap = 0;
+    while (getline(&line, &cap, f) != -1)
+      ++r.ops;
+    free(line);
+    fclose(f);
+  });
+  report(r);
+
+  dropCache(opts, path);
+  r.impl = "iostream";
+  r.ops = 0;
+  r.seconds = timed([&] {
+    array<char> buf{bufsize};
+    std::ifstream in;
+    in.rdbuf()->pubsetbuf(buf.data(), static_cast<std::streamsize>(bufsize));
+    in.open(path);
+    std::string line;
+    while (std::getline(in, line))
+      ++r.ops;
+  });
+  report(r);
+
+  dropCache(opts, path);
+  r.impl = "syscall";
+  r.ops = 0;
+  r.seconds = timed([&] {
+    int fd = ::open(path.c_str(), O_RDONLY);
+    array<char> buf{bufsize};
+    ssize_t got;
+    while ((got = ::read(fd, buf.data(), bufsize)) > 0) {
+      char const *p = buf.data();
+      char const *end = p + got;
+      while ((p = static_cast<char const *>(memchr(p, '\n', end - p)))) {
+        ++r.ops;
+        ++p;
+      }
+    }
+    ::close(fd);
+  });
+  report(r);
+}
+
+void benchRead(options const &opts, char const *fs, std::string const &path,
+               size_t size, size_t bufsize) {
+  result r{fs, "read", "", size, bufsize, 0, 0, 0};
+
+  dropCache(opts, path);
+  r.impl = "streams";
+  r.ops = 0;
+  r.seconds = timed([&] {
+    ifstream in{array<char>(path.c_str())};
+    array<char> buf{bufsize};
+    while (in.read(buf, bufsize) != 0)
+      ++r.ops;
+  });
+  report(r);
+
+  dropCache(opts, path);
+  r.impl = "stdio";
+  r.ops = 0;
+  r.seconds = timed([&] {
+    FILE *f = fopen(path.c_str(), "r");
+    array<char> buf{bufsize};
+    while (fread(buf.data(), 1, bufsize, f) != 0)
+      ++r.ops;
+    fclose(f);
+  });
+  report(r);
+
+  dropCache(opts, path);
+  r.impl = "iostream";
+  r.ops = 0;
+  r.seconds = timed([&] {
+    std::ifstream in{path, std::ios::binary};
+    array<char> buf{bufsize};
+    while (in.read(buf.data(), static_cast<std::streamsize>(bufsize)) ||
+           in.gcount() != 0)
+      ++r.ops;
+  });
+  report(r);
+
+  dropCache(opts, path);
+  r.impl = "syscall";
+  r.ops = 0;
+  r.seconds = timed([&] {
+    int fd = ::open(path.c_str(), O_RDONLY);
+    array<char> buf{bufsize};
+    while (::read(fd, buf.data(), bufsize) > 0)
+      ++r.ops;
+    ::close(fd);
+  });
+  report(r);
+}
+
+// Writes `size` bytes in pieces of `piece` bytes through every backend.
+void benchWrite(char const *fs, char const *name, std::string const &path,
+                size_t size, size_t bufsize, size_t piece) {
+  result r{fs, name, "", size, bufsize, 0, size / piece, 0};
+  array<char> data{piece};
+  for (size_t i = 0; i < piece; ++i)
+    data[i] = static_cast<char>('a' + i % 26);
+
+  ::unlink(path.c_str());
+  r.impl = "streams";
+  r.seconds = timed([&] {
+    ofstream out{array<char>(path.c_str())};
+    for (size_t i = 0; i < r.ops; ++i)
+      out.write(data, piece);
+    out.flush();
+  });
+  report(r);
+
+  ::unlink(path.c_str());
+  r.impl = "stdio";
+  r.seconds = timed([&] {
+    FILE *f = fopen(path.c_str(), "w");
+    setvbuf(f, nullptr, _IOFBF, bufsize);
+    for (size_t i = 0; i < r.ops; ++i)
+      fwrite(data.data(), 1, piece, f);
+    fclose(f);
+  });
+  report(r);
+
+  ::unlink(path.c_str());
+  r.impl = "iostream";
+  r.seconds = timed([&] {
+    array<char> buf{bufsize};
+    std::ofstream out;
+    out.rdbuf()->pubsetbuf(buf.data(), static_cast<std::streamsize>(bufsize));
+    out.open(path, std::ios::binary);
+    for (size_t i = 0; i < r.ops; ++i)
+      out.write(data.data(), static_cast<std::streamsize>(piece));
+    out.close();
+  });
+  report(r);
+
+  ::unlink(path.c_str());
+  r.impl = "syscall";
+  r.seconds = timed([&] {
+    int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    array<char> buf{bufsize};
+    size_t used = 0;
+    for (size_t i = 0; i < r.ops; ++i) {
+      if (used + piece > bufsize) {
+        sink = sink + static_cast<size_t>(::write(fd, buf.data(), used));
+        used = 0;
+      }
+      if (piece >= bufsize) {
+        sink = sink + static_cast<size_t>(::write(fd, data.data(), piece));
+        continue;
+      }
+      memcpy(buf.data() + used, data.data(), piece);
+      used += piece;
+    }
+    if (used != 0)
+      sink = sink + static_cast<size_t>(::write(fd, buf.data(), used));
+    ::close(fd);
+  });
+  report(r);
+  ::unlink(path.c_str());
+}
+
+void benchSeek(options const &opts, char const *fs, std::string const &path,
+               size_t size, size_t bufsize) {
+  size_t constexpr probe = 64;
+  size_t const seeks = opts.quick ? 2000 : 20000;
+  result r{fs, "seek", "", size, bufsize, 0, seeks, 0};
+  auto offsets = array<size_t>{seeks};
+  uint64_t state = 0xD1B54A32D192ED03ull;
+  for (auto &offset : offsets)
+    offset = xorshift(state) % (size - probe);
+
+  dropCache(opts, path);
+  r.impl = "streams";
+  r.seconds = timed([&] {
+    ifstream in{array<char>(path.c_str())};
+    array<char> buf{probe};
+    for (auto offset : offsets) {
+      in.rseek(static_cast<ssize_t>(offset), IOPos::SET);
+      sink = sink + in.read(buf, probe);
+    }
+  });
+  report(r);
+
+  dropCache(opts, path);
+  r.impl = "stdio";
+  r.seconds = timed([&] {
+    FILE *f = fopen(path.c_str(), "r");
+    setvbuf(f, nullptr, _IOFBF, bufsize);
+    char buf[probe];
+    for (auto offset : offsets) {
+      fseek(f, static_cast<long>(offset), SEEK_SET);
+      sink = sink + fread(buf, 1, probe, f);
+    }
+    fclose(f);
+  });
+  report(r);
+
+  dropCache(opts, path);
+  r.impl = "iostream";
+  r.seconds = timed([&] {
+    std::ifstream in{path, std::ios::binary};
+    char buf[probe];
+    for (auto offset : offsets) {
+      in.seekg(static_cast<std::streamoff>(offset));
+      in.read(buf, probe);
+      sink = sink + static_cast<size_t>(in.gcount());
+    }
+  });
+  report(r);
+
+  dropCache(opts, path);
+  r.impl = "syscall";
+  r.seconds = timed([&] {
+    int fd = ::open(path.c_str(), O_RDONLY);
+    char buf[probe];
+    for (auto offset : offsets)
+      sink = sink + static_cast<size_t>(
+                        ::pread(fd, buf, probe, static_cast<off_t>(offset)));
+    ::close(fd);
+  });
+  report(r);
+}
+
+void runSuite(options const &opts, char const *fs, std::string const &dir) {
+  auto const input = dir + "/bench_input.txt";
+  auto const output = dir + "/bench_output.bin";
+  size_t const fileSizes[] = {1u << 20, 16u << 20};
+  size_t const bufferSizes[] = {4096, 65536};
+  size_t const lineLengths[] = {16, 128, 1024};
+  size_t const nsizes = opts.quick ? 1 : 2;
+
+  for (size_t s = 0; s < nsizes; ++s) {
+    auto const size = fileSizes[s];
+    for (auto lineLength : lineLengths) {
+      if (!generate(input, size, lineLength)) {
+        cerr.write("bench: cannot create input in ");
+        cerr.write(dir.c_str());
+        cerr.write("\n");
+        return;
+      }
+      for (auto bufsize : bufferSizes)
+        benchReadline(opts, fs, input, size, bufsize, lineLength);
+    }
+    for (auto bufsize : bufferSizes) {
+      benchRead(opts, fs, input, size, bufsize);
+      benchSeek(opts, fs, input, size, bufsize);
+      benchWrite(fs, "small_write", output, size, bufsize, 16);
+      benchWrite(fs, "large_write", output, size, bufsize, 1u << 20);
+    }
+  }
+  ::unlink(input.c_str());
+}
+
+} // namespace
+
+int main(int argc, char const *argv[]) {
+  options opts;
+  char const *out = nullptr;
+  for (int i = 1; i < argc; ++i) {
+    std::string const arg = argv[i];
+    if (arg == "--quick") {
+      opts.quick = true;
+    } else if (arg == "--cold") {
+      opts.cold = true;
+    } else if (arg == "--out" && i + 1 < argc) {
+      out = argv[++i];
+    } else if (arg == "--dir" && i + 1 < argc &&
+               opts.ndirs < options::MAX_DIRS) {
+      std::string const spec = argv[++i];
+      auto const eq = spec.find('=');
+      auto &dir = opts.dirs[opts.ndirs++];
+      dir.label = eq == std::string::npos ? spec : spec.substr(0, eq);
+      dir.path = eq == std::string::npos ? spec : spec.substr(eq + 1);
+    } else {
+      cerr.write("Usage: bench [--quick] [--cold] [--out FILE] "
+                 "[--dir LABEL=PATH]...\n");
+      return 1;
+    }
+  }
+  if (opts.ndirs == 0) {
+    opts.dirs[opts.ndirs++] = {"tmpfs", "/dev/shm"};
+    opts.dirs[opts.ndirs++] = {"disk", "."};
+  }
+
+  if (out != nullptr) {
+    ::unlink(out);
+    results = new ofstream{array<char>(out)};
+  } else {
+    results = &cout.get();
+  }
+  for (size_t i = 0; i < opts.ndirs; ++i)
+    runSuite(opts, opts.dirs[i].label.c_str(), opts.dirs[i].path);
+  results->flush();
+  if (results != &cout.get())
+    delete results;
+  return 0;
+}
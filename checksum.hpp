@@ -0,0 +1,270 @@
+#ifndef CHECKSUM_HPP
+#define CHECKSUM_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(_M_X64)
+#include <nmmintrin.h>
+#define CHECKSUM_HAS_CRC32 1
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+
+enum class ChecksumKind : int { NONE = 0, CRC32C = 1, XXH64 = 2 };
+
+namespace checksum {
+
+// CRC32C (Castagnoli), reflected, as used by iSCSI, ext4 and SSE4.2.
+inline constexpr uint32_t CRC32C_POLY = 0x82F63B78u;
+
+struct crc32c_tables {
+  uint32_t t[8][256];
+  constexpr crc32c_tables() : t{} {
+    for (uint32_t i = 0; i < 256; ++i) {
+      uint32_t crc = i;
+      for (int k = 0; k < 8; ++k)
+        crc = crc & 1 ? crc >> 1 ^ CRC32C_POLY : crc >> 1;
+      t[0][i] = crc;
+    }
+    for (uint32_t i = 0; i < 256; ++i)
+      for (int k = 1; k < 8; ++k)
+        t[k][i] = t[k - 1][i] >> 8 ^ t[0][t[k - 1][i] & 0xFF];
+  }
+};
+inline constexpr crc32c_tables crc32c_table{};
+
+// Slicing-by-8: eight table lookups per 8 bytes.
+inline uint32_t crc32c_soft(uint32_t crc, unsigned char const *p, size_t n) {
+  auto const &t = crc32c_table.t;
+  for (; n >= 8; p += 8, n -= 8) {
+    uint32_t lo, hi;
+    memcpy(&lo, p, 4);
+    memcpy(&hi, p + 4, 4);
+    lo ^= crc;
+    crc = t[7][lo & 0xFF] ^ t[6][lo >> 8 & 0xFF] ^ t[5][lo >> 16 & 0xFF] ^
+          t[4][lo >> 24] ^ t[3][hi & 0xFF] ^ t[2][hi >> 8 & 0xFF] ^
+          t[1][hi >> 16 & 0xFF] ^ t[0][hi >> 24];
+  }
+  for (; n != 0; ++p, --n)
+    crc = crc >> 8 ^ t[0][(crc ^ *p) & 0xFF];
+  return crc;
+}
+
+#ifdef CHECKSUM_HAS_CRC32
+#ifndef _MSC_VER
+__attribute__((target("sse4.2")))
+#endif
+inline uint32_t crc32c_hard(uint32_t crc, unsigned char const *p, size_t n) {
+  uint64_t crc64 = crc;
+  for (; n >= 8; p += 8, n -= 8) {
+    uint64_t word;
+    memcpy(&word, p, 8);
+    crc64 = _mm_crc32_u64(crc64, word);
+  }
+  auto crc32 = static_cast<uint32_t>(crc64);
+  for (; n != 0; ++p, --n)
+    crc32 = _mm_crc32_u8(crc32, *p);
+  return crc32;
+}
+
+inline bool has_sse42() {
+#ifdef _MSC_VER
+  int info[4];
+  __cpuid(info, 1);
+  return (info[2] & (1 << 20)) != 0;
+#else
+  return __builtin_cpu_supports("sse4.2");
+#endif
+}
+#endif
+
+// Continues a CRC32C over `n` more bytes; start from 0.
+inline uint32_t crc32c(uint32_t crc, void const *data, size_t n) {
+  auto const *p = static_cast<unsigned char const *>(data);
+  crc = ~crc;
+#ifdef CHECKSUM_HAS_CRC32
+  static bool const hard = has_sse42();
+  crc = hard ? crc32c_hard(crc, p, n) : crc32c_soft(crc, p, n);
+#else
+  crc = crc32c_soft(crc, p, n);
+#endif
+  return ~crc;
+}
+
+// Streaming XXH64: feeding the data in any number of pieces gives the same
+// digest as hashing it at once.
+class xxh64 {
+public:
+  explicit xxh64(uint64_t seed = 0) { reset(seed); }
+  void reset(uint64_t seed = 0) {
+    m_seed = seed;
+    m_v[0] = seed + P1 + P2;
+    m_v[1] = seed + P2;
+    m_v[2] = seed;
+    m_v[3] = seed - P1;
+    m_total = 0;
+    m_held = 0;
+  }
+  void update(void const *data, size_t n) {
+    auto const *p = static_cast<unsigned char const *>(data);
+    m_total += n;
+    if (m_held + n < 32) {
+      memcpy(m_memory + m_held, p, n);
+      m_held += n;
+      return;
+    }
+    if (m_held != 0) {
+      auto const fill = 32 - m_held;
+      memcpy(m_memory + m_held, p, fill);
+      stripe(m_memory);
+      p += fill;
+      n -= fill;
+      m_held = 0;
+    }
+    for (; n >= 32; p += 32, n -= 32)
+      stripe(p);
+    memcpy(m_memory, p, n);
+    m_held = n;
+  }
+  uint64_t digest() const {
+    uint64_t h;
+    if (m_total >= 32) {
+      h = rotl(m_v[0], 1) + rotl(m_v[1], 7) + rotl(m_v[2], 12) +
+          rotl(m_v[3], 18);
+      for (auto v : m_v)
+        h = (h ^ round(0, v)) * P1 + P4;
+    } else {
+      h = m_seed + P5;
+    }
+    h += m_total;
+    auto const *p = m_memory;
+    auto n = m_held;
+    for (; n >= 8; p += 8, n -= 8)
+      h = rotl(h ^ round(0, read64(p)), 27) * P1 + P4;
+    if (n >= 4) {
+      h = rotl(h ^ read32(p) * P1, 23) * P2 + P3;
+      p += 4;
+      n -= 4;
+    }
+    for (; n != 0; ++p, --n)
+      h = rotl(h ^ *p * P5, 11) * P1;
+    h ^= h >> 33;
+    h *= P2;
+    h ^= h >> 29;
+    h *= P3;
+    h ^= h >> 32;
+    return h;
+  }
+
+private:
+  static constexpr uint64_t P1 = 11400714785074694791ull;
+  static constexpr uint64_t P2 = 14029467366897019727ull;
+  static constexpr uint64_t P3 = 1609587929392839161ull;
+  static constexpr uint64_t P4 = 9650029242287828579ull;
+  static constexpr uint64_t P5 = 2870177450012600261ull;
+
+  static uint64_t rotl(uint64_t x, int r) { return x << r | x >> (64 - r); }
+  static uint64_t read64(unsigned char const *p) {
+    uint64_t value;
+    memcpy(&value, p, 8);
+    return value;
+  }
+  static uint64_t read32(unsigned char const *p) {
+    uint32_t value;
+    memcpy(&value, p, 4);
+    return value;
+  }
+  static uint64_t round(uint64_t acc, uint64_t input) {
+    return rotl(acc + input * P2, 31) * P1;
+  }
+  void stripe(unsigned char const *p) {
+    for (int i = 0; i < 4; ++i)
+      m_v[i] = round(m_v[i], read64(p + 8 * i));
+  }
+
+  uint64_t m_seed;
+  uint64_t m_v[4];
+  uint64_t m_total;
+  unsigned char m_memory[32];
+  size_t m_held;
+};
+
+// Trailer record appended after checksummed data (integers little endian):
+//   "STRMCSUM", u32 kind, u32 0, u64 data bytes, u64 checksum
+inline constexpr size_t TRAILER_SIZE = 32;
+
+inline void encode_trailer(char *out, ChecksumKind kind, uint64_t bytes,
+                           uint64_t value) {
+  memcpy(out, "STRMCSUM", 8);
+  memset(out + 8, 0, 8);
+  for (size_t i = 0; i < 8; ++i) {
+    if (i < 4)
+      out[8 + i] = static_cast<char>(static_cast<uint32_t>(kind) >> (8 * i));
+    out[16 + i] = static_cast<char>(bytes >> (8 * i));
+    out[24 + i] = static_cast<char>(value >> (8 * i));
+  }
+}
+inline bool decode_trailer(char const *in, ChecksumKind &kind, uint64_t &bytes,
+                           uint64_t &value) {
+  if (memcmp(in, "STRMCSUM", 8) != 0)
+    return false;
+  uint32_t rawKind = 0;
+  bytes = value = 0;
+  for (size_t i = 0; i < 8; ++i) {
+    if (i < 4)
+      rawKind |= uint32_t{static_cast<unsigned char>(in[8 + i])} << (8 * i);
+    bytes |= uint64_t{static_cast<unsigned char>(in[16 + i])} << (8 * i);
+    value |= uint64_t{static_cast<unsigned char>(in[24 + i])} << (8 * i);
+  }
+  if (rawKind != static_cast<uint32_t>(ChecksumKind::CRC32C) &&
+      rawKind != static_cast<uint32_t>(ChecksumKind::XXH64))
+    return false;
+  kind = static_cast<ChecksumKind>(rawKind);
+  return true;
+}
+
+} // namespace checksum
+
+// Running checksum of the bytes a stream has moved.
+class stream_checksum {
+public:
+  void reset(ChecksumKind kind) {
+    m_kind = kind;
+    m_crc = 0;
+    m_xxh.reset();
+    m_bytes = 0;
+  }
+  void update(void const *data, size_t size) {
+    if (m_kind == ChecksumKind::NONE || size == 0)
+      return;
+    if (m_kind == ChecksumKind::CRC32C)
+      m_crc = checksum::crc32c(m_crc, data, size);
+    else
+      m_xxh.update(data, size);
+    m_bytes += size;
+  }
+  ChecksumKind kind() const { return m_kind; }
+  uint64_t bytes() const { return m_bytes; }
+  uint64_t value() const {
+    switch (m_kind) {
+    case ChecksumKind::CRC32C:
+      return m_crc;
+    case ChecksumKind::XXH64:
+      return m_xxh.digest();
+    case ChecksumKind::NONE:
+      break;
+    }
+    return 0;
+  }
+
+private:
+  ChecksumKind m_kind = ChecksumKind::NONE;
+  uint32_t m_crc = 0;
+  checksum::xxh64 m_xxh;
+  uint64_t m_bytes = 0;
+};
+
+#endif // CHECKSUM_HPP
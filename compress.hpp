@@ -0,0 +1,634 @@
+#ifndef COMPRESS_HPP
+#define COMPRESS_HPP
+
+#include "streams.hpp"
+
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+// Block-compressed streams layered over ifstream/ofstream:
+//
+//   ofstream file{array<char>{"app.log.lz"}};
+//   lz_ofstream out{file};          // compresses on every core
+//   out.write("...");
+//   out.close();                    // writes the block index
+//
+//   ifstream file{array<char>{"app.log.lz"}};
+//   lz_ifstream in{file};
+//   in.rseek(1 << 30);              // jumps straight to the right block
+//   auto line = in.readline();
+//
+// Data is cut into BLOCK sized blocks, each compressed on its own with an
+// LZ4-style codec (literal runs and back references within 64 KiB), so
+// blocks compress in parallel and any block can be decoded without the ones
+// before it. A block that does not shrink is stored as is. Layout, all
+// integers little endian:
+//
+//   "LZB1" u32 block size
+//   per block: u32 stored size (high bit: not compressed), u32 raw size, data
+//   u32 0
+//   per block: u64 offset of its header, u64 raw offset   (the index)
+//   u64 block count, u64 offset of the index, "LZBX"
+//
+// Offsets are relative to the "LZB1" header. A stream without the index
+// (e.g. cut short) still reads sequentially; only rseek() needs it.
+namespace lz {
+
+inline constexpr size_t BLOCK = size_t{256} << 10;
+inline constexpr size_t MAX_BLOCK = size_t{64} << 20;
+inline constexpr uint32_t STORED = uint32_t{1} << 31;
+inline constexpr size_t HEADER = 8;
+inline constexpr size_t FOOTER = 20;
+
+inline void store_le(char *p, uint64_t value, size_t bytes) {
+  for (size_t i = 0; i < bytes; ++i)
+    p[i] = static_cast<char>(value >> (8 * i));
+}
+inline uint64_t load_le(char const *p, size_t bytes) {
+  uint64_t value = 0;
+  for (size_t i = 0; i < bytes; ++i)
+    value |= uint64_t{static_cast<unsigned char>(p[i])} << (8 * i);
+  return value;
+}
+
+// Worst case size of a block of `size` bytes stored as one literal run.
+inline size_t bound(size_t size) { return size + size / 255 + 16; }
+
+namespace detail {
+
+inline constexpr unsigned HASH_BITS = 14;
+// A match may not start in the last 12 bytes and always leaves the last 5
+// as literals, which keeps the decoder's copies simple.
+inline constexpr size_t LAST_MATCH = 12;
+inline constexpr size_t LAST_LITERALS = 5;
+
+inline uint32_t read32(char const *p) {
+  uint32_t value;
+  memcpy(&value, p, sizeof(value));
+  return value;
+}
+inline uint32_t hash(uint32_t value) {
+  return (value * 2654435761u) >> (32 - HASH_BITS);
+}
+inline bool put_length(char *dst, size_t cap, size_t &o, size_t length) {
+  for (; length >= 255; length -= 255) {
+    if (o == cap)
+      return false;
+    dst[o++] = static_cast<char>(255);
+  }
+  if (o == cap)
+    return false;
+  dst[o++] = static_cast<char>(length);
+  return true;
+}
+// Writes literals [from, from + count) followed by a match, unless `length`
+// is 0 for the final literal-only sequence.
+inline bool put_sequence(char *dst, size_t cap, size_t &o, char const *from,
+                         size_t count, size_t offset, size_t length) {
+  if (o == cap)
+    return false;
+  auto const match = length == 0 ? 0 : length - 4;
+  auto &token = dst[o++];
+  token = static_cast<char>((count < 15 ? count : 15) << 4 |
+                            (match < 15 ? match : 15));
+  if (count >= 15 && !put_length(dst, cap, o, count - 15))
+    return false;
+  if (cap - o < count)
+    return false;
+  memcpy(dst + o, from, count);
+  o += count;
+  if (length == 0)
+    return true;
+  if (cap - o < 2)
+    return false;
+  store_le(dst + o, offset, 2);
+  o += 2;
+  return match < 15 || put_length(dst, cap, o, match - 15);
+}
+inline bool get_length(char const *src, size_t n, size_t &i, size_t &length) {
+  for (;;) {
+    if (i == n)
+      return false;
+    auto const byte = static_cast<unsigned char>(src[i++]);
+    length += byte;
+    if (byte != 255)
+      return true;
+  }
+}
+
+} // namespace detail
+
+// Compresses [src, src + n) into at most `cap` bytes at `dst`. Returns the
+// compressed size, or 0 if it does not fit.
+inline size_t compress(char const *src, size_t n, char *dst, size_t cap) {
+  using namespace detail;
+  size_t o = 0, anchor = 0;
+  if (n > LAST_MATCH) {
+    array<uint32_t> table{size_t{1} << HASH_BITS};
+    memset(table.data(), 0, table.capacity() * sizeof(uint32_t));
+    auto const limit = n - LAST_MATCH;
+    size_t i = 1;
+    table[hash(read32(src))] = 0;
+    while (i < limit) {
+      auto const value = read32(src + i);
+      auto &slot = table[hash(value)];
+      size_t candidate = slot;
+      slot = static_cast<uint32_t>(i);
+      if (i - candidate > 0xFFFF || read32(src + candidate) != value) {
+        // Skip faster through data that does not compress.
+        i += 1 + ((i - anchor) >> 6);
+        continue;
+      }
+      while (i > anchor && candidate > 0 && src[i - 1] == src[candidate - 1]) {
+        --i;
+        --candidate;
+      }
+      size_t length = 4;
+      while (i + length < n - LAST_LITERALS &&
+             src[i + length] == src[candidate + length])
+        ++length;
+      if (!put_sequence(dst, cap, o, src + anchor, i - anchor, i - candidate,
+                        length))
+        return 0;
+      i += length;
+      anchor = i;
+      if (i < limit)
+        table[hash(read32(src + i - 2))] = static_cast<uint32_t>(i - 2);
+    }
+  }
+  if (!put_sequence(dst, cap, o, src + anchor, n - anchor, 0, 0))
+    return 0;
+  return o;
+}
+
+// Decompresses [src, src + n) into exactly `size` bytes at `dst`. Returns
+// false if the data is corrupt.
+inline bool decompress(char const *src, size_t n, char *dst, size_t size) {
+  using namespace detail;
+  size_t i = 0, o = 0;
+  while (i < n) {
+    auto const token = static_cast<unsigned char>(src[i++]);
+    size_t count = token >> 4;
+    if (count == 15 && !get_length(src, n, i, count))
+      return false;
+    if (n - i < count || size - o < count)
+      return false;
+    memcpy(dst + o, src + i, count);
+    i += count;
+    o += count;
+    if (i == n)
+      break;
+    if (n - i < 2)
+      return false;
+    auto const offset = static_cast<size_t>(load_le(src + i, 2));
+    i += 2;
+    size_t length = token & 15u;
+    if (length == 15 && !get_length(src, n, i, length))
+      return false;
+    length += 4;
+    if (offset == 0 || offset > o || size - o < length)
+      return false;
+    if (offset >= length) {
+      memcpy(dst + o, dst + o - offset, length);
+      o += length;
+    } else {
+      // Overlapping copy repeats the last `offset` bytes.
+      for (auto const end = o + length; o != end; ++o)
+        dst[o] = dst[o - offset];
+    }
+  }
+  return o == size;
+}
+
+} // namespace lz
+
+// Compresses everything written to it into `sink`, a file or an
+// omemstream, spreading blocks over `threads` threads (0 picks one per
+// core). Finished blocks are written in order as soon as they and every
+// block before them are ready.
+#ifdef __cpp_concepts
+template <output_stream Sink = ofstream>
+#else
+template <typename Sink = ofstream>
+#endif
+class lz_ofstream {
+public:
+  explicit lz_ofstream(Sink &sink, size_t threads = 0) : m_sink{sink} {
+    if (threads == 0)
+      threads = std::thread::hardware_concurrency();
+    if (threads == 0)
+      threads = 1;
+    m_jobs = array<job>{threads * 2};
+    for (auto &j : m_jobs)
+      j.raw = array<char>{lz::BLOCK};
+    array<char> header{lz::HEADER};
+    memcpy(header.data(), "LZB1", 4);
+    lz::store_le(header.data() + 4, lz::BLOCK, 4);
+    emit(header, lz::HEADER);
+    // The calling thread compresses too when it has to wait.
+    m_pool = array<helper>{threads - 1};
+    for (auto &h : m_pool)
+      h.thread = std::thread{[this] { work(); }};
+  }
+  lz_ofstream(lz_ofstream const &) = delete;
+  lz_ofstream &operator=(lz_ofstream const &) = delete;
+  ~lz_ofstream() {
+    close();
+    {
+      std::lock_guard<std::mutex> guard{m_lock};
+      m_stopping = true;
+    }
+    m_changed.notify_all();
+    for (auto &h : m_pool)
+      h.thread.join();
+  }
+
+  size_t write(char const *text) { return write(text, stringlen(text)); }
+  size_t write(array<char> const &buffer, size_t size) {
+    return write(buffer, 0, size);
+  }
+  size_t write(array<char> const &buffer, size_t start, size_t size) {
+    return write(buffer.data() + start, size);
+  }
+  size_t write(char const *data, size_t size) {
+    if (m_closed)
+      return 0;
+    for (size_t done = 0; done != size;) {
+      auto &j = m_jobs[m_submitted % m_jobs.capacity()];
+      auto const n = min(size - done, lz::BLOCK - m_filled);
+      memcpy(j.raw.data() + m_filled, data + done, n);
+      m_filled += n;
+      done += n;
+      m_rawSize += n;
+      if (m_filled == lz::BLOCK)
+        submit();
+    }
+    return size;
+  }
+  // Ends the current block early, writes out every block and flushes the
+  // sink.
+  void flush() {
+    if (m_closed)
+      return;
+    if (m_filled != 0)
+      submit();
+    while (m_written != m_submitted)
+      writeOldest();
+    m_sink.flush();
+  }
+  // Flushes and appends the block index. Writes after this are ignored.
+  void close() {
+    if (m_closed)
+      return;
+    flush();
+    m_closed = true;
+    auto const indexOffset = m_offset + 4;
+    array<char> tail{4 + m_index.size() * 16 + lz::FOOTER};
+    size_t o = 0;
+    lz::store_le(tail.data(), 0, 4);
+    o += 4;
+    for (auto const &entry : m_index) {
+      lz::store_le(tail.data() + o, entry.packed, 8);
+      lz::store_le(tail.data() + o + 8, entry.raw, 8);
+      o += 16;
+    }
+    lz::store_le(tail.data() + o, m_index.size(), 8);
+    lz::store_le(tail.data() + o + 8, indexOffset, 8);
+    memcpy(tail.data() + o + 16, "LZBX", 4);
+    emit(tail, tail.capacity());
+    m_sink.flush();
+  }
+  size_t rawSize() const { return m_rawSize; }
+  // Bytes written to the sink so far.
+  size_t compressedSize() const { return m_offset; }
+
+private:
+  struct job {
+    array<char> raw;
+    size_t size = 0;
+    array<char> packed;
+    size_t packedSize = 0;
+    bool ready = false;
+  };
+  struct helper {
+    std::thread thread;
+  };
+  struct index_entry {
+    uint64_t packed;
+    uint64_t raw;
+  };
+
+  static void compress(job &j) {
+    if (j.packed.capacity() < lz::HEADER + j.size)
+      j.packed = array<char>{lz::HEADER + j.size};
+    auto size = lz::compress(j.raw.data(), j.size,
+                             j.packed.data() + lz::HEADER, j.size);
+    uint32_t flags = 0;
+    if (size == 0) {
+      memcpy(j.packed.data() + lz::HEADER, j.raw.data(), j.size);
+      size = j.size;
+      flags = lz::STORED;
+    }
+    lz::store_le(j.packed.data(), flags | static_cast<uint32_t>(size), 4);
+    lz::store_le(j.packed.data() + 4, j.size, 4);
+    j.packedSize = lz::HEADER + size;
+  }
+  void work() {
+    for (;;) {
+      job *j;
+      {
+        std::unique_lock<std::mutex> guard{m_lock};
+        m_changed.wait(guard,
+                       [&] { return m_stopping || m_claimed != m_submitted; });
+        if (m_claimed == m_submitted)
+          return;
+        j = &m_jobs[m_claimed++ % m_jobs.capacity()];
+      }
+      compress(*j);
+      {
+        std::lock_guard<std::mutex> guard{m_lock};
+        j->ready = true;
+      }
+      m_changed.notify_all();
+    }
+  }
+  void submit() {
+    auto &j = m_jobs[m_submitted % m_jobs.capacity()];
+    j.size = m_filled;
+    j.ready = false;
+    m_filled = 0;
+    {
+      std::lock_guard<std::mutex> guard{m_lock};
+      ++m_submitted;
+    }
+    m_changed.notify_all();
+    // The next block reuses the oldest slot once it has been written out.
+    if (m_submitted - m_written == m_jobs.capacity())
+      writeOldest();
+  }
+  void writeOldest() {
+    auto &j = m_jobs[m_written % m_jobs.capacity()];
+    job *mine = nullptr;
+    {
+      // Rather than sit idle, compress the next unclaimed block (the oldest
+      // itself when there are no other threads).
+      std::lock_guard<std::mutex> guard{m_lock};
+      if (m_claimed != m_submitted && !j.ready)
+        mine = &m_jobs[m_claimed++ % m_jobs.capacity()];
+    }
+    if (mine != nullptr) {
+      compress(*mine);
+      {
+        std::lock_guard<std::mutex> guard{m_lock};
+        mine->ready = true;
+      }
+      m_changed.notify_all();
+    }
+    {
+      std::unique_lock<std::mutex> guard{m_lock};
+      m_changed.wait(guard, [&] { return j.ready; });
+    }
+    m_index.append(index_entry{m_offset, m_rawWritten});
+    m_rawWritten += j.size;
+    emit(j.packed, j.packedSize);
+    ++m_written;
+  }
+  void emit(array<char> const &data, size_t size) {
+    m_sink.write(data, 0, size);
+    m_offset += size;
+  }
+
+  Sink &m_sink;
+  array<job> m_jobs;
+  array<helper> m_pool;
+  std::mutex m_lock;
+  std::condition_variable m_changed;
+  // Blocks are numbered in write order: [m_written, m_claimed) are being
+  // compressed or done, [m_claimed, m_submitted) are waiting for a thread.
+  size_t m_submitted = 0;
+  size_t m_claimed = 0;
+  size_t m_written = 0;
+  bool m_stopping = false;
+  bool m_closed = false;
+  size_t m_filled = 0;
+  size_t m_rawSize = 0;
+  size_t m_rawWritten = 0;
+  size_t m_offset = 0;
+  vector<index_entry> m_index;
+};
+
+// Reads what lz_ofstream wrote. Blocks are decoded one at a time as they
+// are read; rseek() uses the block index to decode only the block holding
+// the target offset.
+#ifdef __cpp_concepts
+template <input_stream Source = ifstream>
+#else
+template <typename Source = ifstream>
+#endif
+class lz_ifstream {
+public:
+  explicit lz_ifstream(Source &source) : m_source{source} {
+    m_base = source.tellr();
+    array<char> header{lz::HEADER};
+    if (!readExactly(header, lz::HEADER) ||
+        memcmp(header.data(), "LZB1", 4) != 0) {
+      m_corrupt = true;
+      return;
+    }
+    auto const blockSize = static_cast<size_t>(lz::load_le(header.data() + 4, 4));
+    if (blockSize == 0 || blockSize > lz::MAX_BLOCK) {
+      m_corrupt = true;
+      return;
+    }
+    m_block = array<char>{blockSize};
+  }
+  lz_ifstream(lz_ifstream const &) = delete;
+  lz_ifstream &operator=(lz_ifstream const &) = delete;
+
+  // True once the header or a block turned out to be damaged. Reading stops
+  // there.
+  bool corrupt() const { return m_corrupt; }
+  bool eof() const { return m_ended && m_pos == m_size; }
+  size_t tellr() const { return m_blockOffset + m_pos; }
+
+  size_t read(array<char> &buffer, size_t size) { return read(buffer, 0, size); }
+  size_t read(array<char> &buffer, size_t start, size_t size) {
+    size_t done = 0;
+    while (done != size && fill()) {
+      auto const n = min(m_size - m_pos, size - done);
+      memcpy(buffer.data() + start + done, m_block.data() + m_pos, n);
+      m_pos += n;
+      done += n;
+    }
+    return done;
+  }
+  // Reads up to and including the next '\n', like ifstream::readline().
+  pair<array<char>, size_t> readline() {
+    array<char> line{64};
+    size_t size = 0;
+    while (fill()) {
+      auto const *data = m_block.data() + m_pos;
+      auto const *nl =
+          static_cast<char const *>(memchr(data, '\n', m_size - m_pos));
+      auto const n = nl == nullptr ? m_size - m_pos
+                                   : static_cast<size_t>(nl - data) + 1;
+      if (size + n > line.capacity()) {
+        auto capacity = line.capacity();
+        while (capacity < size + n)
+          capacity <<= 1;
+        array<char> grown{capacity};
+        memcpy(grown.data(), line.data(), size);
+        line = forward<array<char>>(grown);
+      }
+      memcpy(line.data() + size, data, n);
+      size += n;
+      m_pos += n;
+      if (nl != nullptr)
+        break;
+    }
+    return {line, size};
+  }
+  // Moves to uncompressed offset `offset` (clamped to the end). Returns
+  // false if the source cannot seek or the stream has no valid index.
+  bool rseek(size_t offset) {
+    if (m_corrupt || !loadIndex())
+      return false;
+    size_t lo = 0, hi = m_index.size();
+    while (hi - lo > 1) {
+      auto const mid = lo + (hi - lo) / 2;
+      (m_index[mid].raw <= offset ? lo : hi) = mid;
+    }
+    m_pos = m_size = 0;
+    m_ended = false;
+    if (m_index.size() == 0 || offset >= m_total) {
+      m_blockOffset = m_total;
+      m_ended = true;
+      return true;
+    }
+    auto const &entry = m_index[lo];
+    if (m_source.rseek(m_base + static_cast<ssize_t>(entry.packed),
+                       IOPos::SET) == -1)
+      return false;
+    m_blockOffset = static_cast<size_t>(entry.raw);
+    if (!nextBlock())
+      return false;
+    // An index entry that disagrees with the block it points at.
+    if (offset - m_blockOffset > m_size) {
+      m_size = 0;
+      return fail();
+    }
+    m_pos = offset - m_blockOffset;
+    return true;
+  }
+
+private:
+  struct index_entry {
+    uint64_t packed;
+    uint64_t raw;
+  };
+
+  bool readExactly(array<char> &buffer, size_t size) {
+    return m_source.read(buffer, 0, size) == size;
+  }
+  bool fill() {
+    while (m_pos == m_size) {
+      if (m_ended || m_corrupt)
+        return false;
+      m_blockOffset += m_size;
+      m_pos = m_size = 0;
+      if (!nextBlock())
+        return false;
+    }
+    return true;
+  }
+  bool nextBlock() {
+    array<char> header{lz::HEADER};
+    auto const got = m_source.read(header, 0, size_t{4});
+    // A stream cut short between blocks simply ends there.
+    if (got == 0 || (got == 4 && lz::load_le(header.data(), 4) == 0)) {
+      m_ended = true;
+      return false;
+    }
+    if (got != 4 || m_source.read(header, 4, size_t{4}) != 4)
+      return fail();
+    auto const stored = static_cast<uint32_t>(lz::load_le(header.data(), 4));
+    auto const packed = static_cast<size_t>(stored & ~lz::STORED);
+    auto const raw = static_cast<size_t>(lz::load_le(header.data() + 4, 4));
+    if (raw == 0 || raw > m_block.capacity() || packed > lz::bound(raw))
+      return fail();
+    if (stored & lz::STORED) {
+      if (packed != raw || !readExactly(m_block, raw))
+        return fail();
+    } else {
+      if (m_packed.capacity() < packed)
+        m_packed = array<char>{lz::bound(m_block.capacity())};
+      if (!readExactly(m_packed, packed) ||
+          !lz::decompress(m_packed.data(), packed, m_block.data(), raw))
+        return fail();
+    }
+    m_size = raw;
+    return true;
+  }
+  bool fail() {
+    m_corrupt = true;
+    return false;
+  }
+  bool loadIndex() {
+    if (m_indexLoaded)
+      return true;
+    auto const footer = m_source.read_last(lz::FOOTER);
+    if (footer.second != lz::FOOTER ||
+        memcmp(footer.first.data() + 16, "LZBX", 4) != 0)
+      return false;
+    auto const count = static_cast<size_t>(lz::load_le(footer.first.data(), 8));
+    auto const at = lz::load_le(footer.first.data() + 8, 8);
+    // The entries lie between `at` and the footer; a count that does not fit
+    // there is damage, not a reason to allocate.
+    auto const end = m_source.tellend();
+    if (end < m_base + static_cast<ssize_t>(lz::FOOTER))
+      return false;
+    auto const footerAt =
+        static_cast<uint64_t>(end - m_base) - uint64_t{lz::FOOTER};
+    if (at > footerAt || count > (footerAt - at) / 16 ||
+        m_source.rseek(m_base + static_cast<ssize_t>(at), IOPos::SET) == -1)
+      return false;
+    array<char> entries{count * 16};
+    if (!readExactly(entries, count * 16))
+      return false;
+    m_index.clear();
+    for (size_t i = 0; i < count; ++i) {
+      m_index.append(index_entry{lz::load_le(entries.data() + i * 16, 8),
+                                 lz::load_le(entries.data() + i * 16 + 8, 8)});
+      if (i != 0 && m_index[i].raw <= m_index[i - 1].raw)
+        return false;
+    }
+    // The raw size of the last block gives the total.
+    m_total = 0;
+    if (count != 0) {
+      auto const &last = m_index[count - 1];
+      if (m_source.rseek(m_base + static_cast<ssize_t>(last.packed + 4),
+                         IOPos::SET) == -1 ||
+          !readExactly(entries, 4))
+        return false;
+      m_total = static_cast<size_t>(last.raw + lz::load_le(entries.data(), 4));
+    }
+    m_indexLoaded = true;
+    return true;
+  }
+
+  Source &m_source;
+  ssize_t m_base = 0;
+  array<char> m_block;
+  array<char> m_packed;
+  size_t m_pos = 0, m_size = 0;
+  // Uncompressed offset of the start of the current block.
+  size_t m_blockOffset = 0;
+  bool m_ended = false;
+  bool m_corrupt = false;
+  bool m_indexLoaded = false;
+  vector<index_entry> m_index;
+  size_t m_total = 0;
+};
+
+#endif // COMPRESS_HPP
@@ -0,0 +1,535 @@
+#ifndef CORO_HPP
+#define CORO_HPP
+
+#ifdef __linux__
+
+#include "reactor.hpp"
+#include "streams.hpp"
+
+#include <atomic>
+#include <condition_variable>
+#include <coroutine>
+#include <exception>
+#include <mutex>
+#include <thread>
+
+// Awaitable stream operations on top of the epoll reactor:
+//
+//   task<void> echo(ifstream &in, ofstream &out) {
+//     for (;;) {
+//       auto line = co_await co_readline(in);
+//       if (line.second == 0)
+//         break;
+//       co_await co_write(out, line.first, line.second);
+//     }
+//     co_await co_flush(out);
+//   }
+//
+// Streams should be in non-blocking mode (reactor::makeNonBlocking) so that
+// a stalled stream suspends the coroutine instead of the executor thread.
+// Tasks are started with spawn() on a loop_executor (one thread) or a
+// pool_executor (work-stealing worker threads, one reactor each).
+
+class executor {
+public:
+  virtual void schedule(std::coroutine_handle<> handle) = 0;
+  // Reactor serving the calling thread, or null on a thread the executor
+  // does not run on; awaiters suspended there go through schedule() first.
+  virtual reactor *io() = 0;
+  virtual ~executor() = default;
+
+protected:
+  // Called when a spawned task has run to completion.
+  virtual void finished() = 0;
+  friend struct detached_task;
+};
+
+// Executor running on the calling thread, if any.
+inline thread_local executor *current_executor = nullptr;
+
+template <typename T> class task;
+
+namespace coro_detail {
+
+struct promise_base {
+  std::coroutine_handle<> continuation;
+  std::exception_ptr error;
+
+  struct final_awaiter {
+    bool await_ready() noexcept { return false; }
+    template <typename P>
+    std::coroutine_handle<>
+    await_suspend(std::coroutine_handle<P> self) noexcept {
+      auto next = self.promise().continuation;
+      return next ? next : std::noop_coroutine();
+    }
+    void await_resume() noexcept {}
+  };
+  std::suspend_always initial_suspend() noexcept { return {}; }
+  final_awaiter final_suspend() noexcept { return {}; }
+  void unhandled_exception() { error = std::current_exception(); }
+};
+
+// FIFO/LIFO queue of suspended coroutines.
+class handle_queue {
+public:
+  bool empty() const { return m_size == 0; }
+  size_t size() const { return m_size; }
+  void push_back(std::coroutine_handle<> handle) {
+    if (m_size == m_slots.capacity())
+      grow();
+    m_slots[(m_head + m_size++) % m_slots.capacity()] = handle.address();
+  }
+  std::coroutine_handle<> pop_back() {
+    --m_size;
+    return std::coroutine_handle<>::from_address(
+        m_slots[(m_head + m_size) % m_slots.capacity()]);
+  }
+  std::coroutine_handle<> pop_front() {
+    auto *address = m_slots[m_head];
+    m_head = (m_head + 1) % m_slots.capacity();
+    --m_size;
+    return std::coroutine_handle<>::from_address(address);
+  }
+
+private:
+  void grow() {
+    array<void *> grown{m_slots.capacity() == 0 ? 64 : m_slots.capacity() << 1};
+    for (size_t i = 0; i < m_size; ++i)
+      grown[i] = m_slots[(m_head + i) % m_slots.capacity()];
+    m_slots = forward<array<void *>>(grown);
+    m_head = 0;
+  }
+
+  array<void *> m_slots;
+  size_t m_head = 0;
+  size_t m_size = 0;
+};
+
+} // namespace coro_detail
+
+// Lazily started coroutine producing a T. Awaiting it starts it and resumes
+// the awaiter once it completes.
+template <typename T> class task {
+public:
+  struct promise_type : coro_detail::promise_base {
+    T value{};
+    task get_return_object() {
+      return task{std::coroutine_handle<promise_type>::from_promise(*this)};
+    }
+    void return_value(T result) { value = static_cast<T &&>(result); }
+  };
+
+  task(task &&move) noexcept : m_handle{move.m_handle} {
+    move.m_handle = nullptr;
+  }
+  task(task const &) = delete;
+  task &operator=(task const &) = delete;
+  ~task() {
+    if (m_handle)
+      m_handle.destroy();
+  }
+
+  bool await_ready() const noexcept { return false; }
+  std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiter) {
+    m_handle.promise().continuation = awaiter;
+    return m_handle;
+  }
+  T await_resume() {
+    if (m_handle.promise().error)
+      std::rethrow_exception(m_handle.promise().error);
+    return static_cast<T &&>(m_handle.promise().value);
+  }
+
+private:
+  explicit task(std::coroutine_handle<promise_type> handle) : m_handle{handle} {}
+  std::coroutine_handle<promise_type> m_handle;
+};
+
+template <> class task<void> {
+public:
+  struct promise_type : coro_detail::promise_base {
+    task get_return_object() {
+      return task{std::coroutine_handle<promise_type>::from_promise(*this)};
+    }
+    void return_void() {}
+  };
+
+  task(task &&move) noexcept : m_handle{move.m_handle} {
+    move.m_handle = nullptr;
+  }
+  task(task const &) = delete;
+  task &operator=(task const &) = delete;
+  ~task() {
+    if (m_handle)
+      m_handle.destroy();
+  }
+
+  bool await_ready() const noexcept { return false; }
+  std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiter) {
+    m_handle.promise().continuation = awaiter;
+    return m_handle;
+  }
+  void await_resume() {
+    if (m_handle.promise().error)
+      std::rethrow_exception(m_handle.promise().error);
+  }
+
+private:
+  explicit task(std::coroutine_handle<promise_type> handle) : m_handle{handle} {}
+  std::coroutine_handle<promise_type> m_handle;
+};
+
+// Top-level coroutine owning a spawned task; frees itself when done.
+struct detached_task {
+  struct promise_type {
+    executor *owner = nullptr;
+    detached_task get_return_object() {
+      return {std::coroutine_handle<promise_type>::from_promise(*this)};
+    }
+    std::suspend_always initial_suspend() noexcept { return {}; }
+    std::suspend_never final_suspend() noexcept {
+      owner->finished();
+      return {};
+    }
+    void return_void() {}
+    void unhandled_exception() { std::terminate(); }
+  };
+  std::coroutine_handle<promise_type> handle;
+};
+
+inline detached_task run_detached(task<void> body) { co_await body; }
+
+namespace coro_detail {
+
+// Scheduled in place of a coroutine that suspends on a thread its executor
+// does not run on: it arms the awaiter from one of the executor's own
+// threads, then frees itself.
+struct hop {
+  struct promise_type {
+    hop get_return_object() {
+      return {std::coroutine_handle<promise_type>::from_promise(*this)};
+    }
+    std::suspend_always initial_suspend() noexcept { return {}; }
+    std::suspend_never final_suspend() noexcept { return {}; }
+    void return_void() {}
+    void unhandled_exception() { std::terminate(); }
+  };
+  std::coroutine_handle<promise_type> handle;
+};
+
+template <typename A> hop arm_later(A *awaiter) {
+  awaiter->arm();
+  co_return;
+}
+
+} // namespace coro_detail
+
+// Suspends until `fd` is ready for `events` on the current executor. Several
+// coroutines may wait on one descriptor, e.g. a reader and a writer.
+struct wait_fd {
+  int fd;
+  uint32_t events;
+
+  wait_fd(int fd, uint32_t events) : fd{fd}, events{events} {}
+
+  bool await_ready() const noexcept { return current_executor == nullptr; }
+  bool await_suspend(std::coroutine_handle<> handle) {
+    m_handle = handle;
+    m_exec = current_executor;
+    if (m_exec->io() == nullptr) {
+      m_exec->schedule(coro_detail::arm_later(this).handle);
+      return true;
+    }
+    return watch();
+  }
+  void await_resume() const noexcept {}
+  // Waits from the executor's thread the hop landed on.
+  void arm() {
+    if (!watch())
+      m_exec->schedule(m_handle);
+  }
+
+private:
+  // Descriptors epoll cannot watch (regular files) are always ready, and
+  // leave the coroutine running.
+  bool watch() {
+    m_io = m_exec->io();
+    m_id = m_io->watch(fd, events, &ready, this);
+    return m_id != nullptr;
+  }
+  static void ready(void *self, uint32_t) {
+    auto *waiter = static_cast<wait_fd *>(self);
+    waiter->m_io->unwatch(waiter->m_id);
+    waiter->m_exec->schedule(waiter->m_handle);
+  }
+  std::coroutine_handle<> m_handle;
+  executor *m_exec = nullptr;
+  reactor *m_io = nullptr;
+  reactor::watch_id m_id = nullptr;
+};
+
+inline wait_fd wait_readable(int fd) { return {fd, EPOLLIN | EPOLLRDHUP}; }
+inline wait_fd wait_writable(int fd) { return {fd, EPOLLOUT}; }
+
+// Suspends for `milliseconds` using the current executor's timers.
+struct sleep_for {
+  uint64_t milliseconds;
+
+  explicit sleep_for(uint64_t milliseconds) : milliseconds{milliseconds} {}
+
+  bool await_ready() const noexcept { return current_executor == nullptr; }
+  void await_suspend(std::coroutine_handle<> handle) {
+    m_handle = handle;
+    m_exec = current_executor;
+    if (m_exec->io() == nullptr)
+      m_exec->schedule(coro_detail::arm_later(this).handle);
+    else
+      arm();
+  }
+  void await_resume() const noexcept {}
+  void arm() { m_exec->io()->addTimer(milliseconds, &ready, this); }
+
+private:
+  static void ready(void *self) {
+    auto *sleeper = static_cast<sleep_for *>(self);
+    sleeper->m_exec->schedule(sleeper->m_handle);
+  }
+  std::coroutine_handle<> m_handle;
+  executor *m_exec = nullptr;
+};
+
+template <typename T>
+task<pair<array<T>, size_t>> co_readline(basic_ifstream<T> &stream) {
+  array<T> line{64};
+  size_t size = 0;
+  for (;;) {
+    if (size == line.capacity()) {
+      array<T> grown{line.capacity() << 1};
+      memcpy(grown.data(), line.data(), size * sizeof(T));
+      line = forward<array<T>>(grown);
+    }
+    auto [got, found] = stream.readUntil(
+        line, size, line.capacity() - size, &basic_ifstream<T>::is_nl, false);
+    size += got;
+    if (found)
+      break;
+    if (size == line.capacity())
+      continue;
+    if (!stream.wouldBlock())
+      break;
+    co_await wait_readable(stream.getHandle());
+  }
+  co_return pair<array<T>, size_t>{forward<array<T>>(line), size};
+}
+
+// Reads `size` elements, fewer only at end of file.
+template <typename T>
+task<pair<array<T>, size_t>> co_read(basic_ifstream<T> &stream, size_t size) {
+  array<T> buffer{size};
+  size_t got = 0;
+  while (got != size) {
+    got += stream.read(buffer, got, size - got, false);
+    if (got == size || !stream.wouldBlock())
+      break;
+    co_await wait_readable(stream.getHandle());
+  }
+  co_return pair<array<T>, size_t>{forward<array<T>>(buffer), got};
+}
+
+// Hands `size` elements of `buffer` to the stream; `buffer` must stay alive
+// until the returned task completes.
+template <typename T>
+task<size_t> co_write(basic_ofstream<T> &stream, array<T> const &buffer,
+                      size_t size) {
+  size_t written = 0;
+  while (written != size) {
+    written += stream.write(buffer, written, size - written);
+    if (written == size || !stream.wouldBlock())
+      break;
+    co_await wait_writable(stream.getHandle());
+  }
+  co_return written;
+}
+
+template <typename T> task<size_t> co_flush(basic_ofstream<T> &stream) {
+  size_t flushed = 0;
+  while (stream.pending() != 0) {
+    flushed += stream.flush();
+    if (stream.pending() == 0 || !stream.wouldBlock())
+      break;
+    co_await wait_writable(stream.getHandle());
+  }
+  co_return flushed;
+}
+
+// Runs coroutines and their I/O on the calling thread.
+class loop_executor : public executor {
+public:
+  void schedule(std::coroutine_handle<> handle) override {
+    m_ready.push_back(handle);
+  }
+  reactor *io() override { return &m_io; }
+  void spawn(task<void> body) {
+    auto detached = run_detached(static_cast<task<void> &&>(body));
+    detached.handle.promise().owner = this;
+    ++m_outstanding;
+    schedule(detached.handle);
+  }
+  // Runs until every spawned task has finished.
+  void run() {
+    auto *previous = current_executor;
+    current_executor = this;
+    while (m_outstanding != 0) {
+      while (!m_ready.empty())
+        m_ready.pop_front().resume();
+      if (m_outstanding != 0)
+        m_io.runOnce(-1);
+    }
+    current_executor = previous;
+  }
+
+private:
+  void finished() override { --m_outstanding; }
+
+  reactor m_io;
+  coro_detail::handle_queue m_ready;
+  size_t m_outstanding = 0;
+};
+
+// Work-stealing pool: each worker owns a reactor and a deque of runnable
+// coroutines. Workers run their own deque newest-first, steal the oldest
+// entries of other deques when idle, and sleep in epoll_wait otherwise.
+class pool_executor : public executor {
+public:
+  explicit pool_executor(size_t threads = std::thread::hardware_concurrency())
+      : m_workers{threads == 0 ? 1 : threads} {
+    for (size_t i = 0; i < m_workers.capacity(); ++i)
+      m_workers[i].thread = std::thread{[this, i] { work(i); }};
+  }
+  pool_executor(pool_executor const &) = delete;
+  pool_executor &operator=(pool_executor const &) = delete;
+  ~pool_executor() {
+    join();
+    m_stopping.store(true, std::memory_order_release);
+    for (auto &w : m_workers)
+      w.io.wake();
+    for (auto &w : m_workers)
+      w.thread.join();
+  }
+
+  void schedule(std::coroutine_handle<> handle) override {
+    auto const self = t_worker.pool == this ? t_worker.index
+                                            : m_next++ % m_workers.capacity();
+    {
+      std::lock_guard<std::mutex> guard{m_workers[self].lock};
+      m_workers[self].queue.push_back(handle);
+    }
+    if (t_worker.pool != this)
+      wakeWorker(self);
+    else if (m_sleeping.load(std::memory_order_acquire) != 0)
+      wakeAny();
+  }
+  reactor *io() override {
+    return t_worker.pool == this ? &m_workers[t_worker.index].io : nullptr;
+  }
+  void spawn(task<void> body) {
+    auto detached = run_detached(static_cast<task<void> &&>(body));
+    detached.handle.promise().owner = this;
+    m_outstanding.fetch_add(1, std::memory_order_relaxed);
+    schedule(detached.handle);
+  }
+  // Blocks until every spawned task has finished.
+  void join() {
+    std::unique_lock<std::mutex> guard{m_doneLock};
+    m_done.wait(guard, [this] {
+      return m_outstanding.load(std::memory_order_acquire) == 0;
+    });
+  }
+
+private:
+  struct worker {
+    std::mutex lock;
+    coro_detail::handle_queue queue;
+    reactor io;
+    std::thread thread;
+    std::atomic<bool> sleeping{false};
+  };
+  // Zero-initialized per thread: threads outside the pool have no pool.
+  struct worker_id {
+    pool_executor *pool;
+    size_t index;
+  };
+  inline static thread_local worker_id t_worker;
+
+  std::coroutine_handle<> take(size_t index) {
+    auto &own = m_workers[index];
+    {
+      std::lock_guard<std::mutex> guard{own.lock};
+      if (!own.queue.empty())
+        return own.queue.pop_back();
+    }
+    for (size_t i = 1; i < m_workers.capacity(); ++i) {
+      auto &victim = m_workers[(index + i) % m_workers.capacity()];
+      std::lock_guard<std::mutex> guard{victim.lock};
+      if (!victim.queue.empty())
+        return victim.queue.pop_front();
+    }
+    return nullptr;
+  }
+  void wakeWorker(size_t index) {
+    if (m_workers[index].sleeping.exchange(false, std::memory_order_acq_rel))
+      m_workers[index].io.wake();
+  }
+  void wakeAny() {
+    for (size_t i = 0; i < m_workers.capacity(); ++i)
+      if (m_workers[i].sleeping.load(std::memory_order_acquire)) {
+        wakeWorker(i);
+        return;
+      }
+  }
+  void work(size_t index) {
+    t_worker = {this, index};
+    current_executor = this;
+    auto &self = m_workers[index];
+    while (!m_stopping.load(std::memory_order_acquire)) {
+      if (auto handle = take(index)) {
+        handle.resume();
+        continue;
+      }
+      // Pick up completed I/O and timers without blocking first.
+      if (self.io.runOnce(0) != 0)
+        continue;
+      self.sleeping.store(true, std::memory_order_release);
+      m_sleeping.fetch_add(1, std::memory_order_acq_rel);
+      if (auto handle = take(index)) {
+        m_sleeping.fetch_sub(1, std::memory_order_acq_rel);
+        self.sleeping.store(false, std::memory_order_release);
+        handle.resume();
+        continue;
+      }
+      self.io.runOnce(-1);
+      m_sleeping.fetch_sub(1, std::memory_order_acq_rel);
+      self.sleeping.store(false, std::memory_order_release);
+    }
+    current_executor = nullptr;
+  }
+  void finished() override {
+    if (m_outstanding.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+      std::lock_guard<std::mutex> guard{m_doneLock};
+      m_done.notify_all();
+    }
+  }
+
+  array<worker> m_workers;
+  std::atomic<size_t> m_next{0};
+  std::atomic<size_t> m_sleeping{0};
+  std::atomic<size_t> m_outstanding{0};
+  std::atomic<bool> m_stopping{false};
+  std::mutex m_doneLock;
+  std::condition_variable m_done;
+};
+
+#endif // __linux__
+
+#endif // CORO_HPP
@@ -0,0 +1,260 @@
+#ifndef FIXEDSTREAM_HPP
+#define FIXEDSTREAM_HPP
+
+#include "streams.hpp"
+
+// Streams whose buffer capacity is a template parameter and whose buffer is
+// stored inline, layered over a stream (an ofstream/ifstream by default, or
+// a memory stream) that only ever moves whole buffers:
+//
+//   ofstream file{array<char>{"ticks.bin"}};
+//   fixed_ofstream<4096> out{file};      // the 4 KiB buffer lives in `out`
+//   out.write_n<16>(tick);               // unrolled 16-byte copy
+//
+//   ifstream file{array<char>{"ticks.bin"}};
+//   fixed_ifstream<4096> in{file};
+//   char tick[16];
+//   while (in.read_n<16>(tick) == 16)
+//     ...
+//
+// With N at least a stream buffer, every refill and flush goes straight
+// between this buffer and the handle. Sizes known at compile time are
+// checked against N at compile time.
+namespace fixed_detail {
+
+// Copies BYTES bytes, a size known at compile time: sizes of one register
+// as a single move, other sizes up to 32 bytes as two overlapping moves of
+// the largest register size below them, longer ones with memcpy. Copies
+// sized at run time use memcpy directly; it is as fast for them and keeps
+// GCC's bounds checks able to follow the buffer.
+template <size_t BYTES> inline void copy_n(void *to, void const *from) {
+  auto *d = static_cast<char *>(to);
+  auto const *s = static_cast<char const *>(from);
+  if constexpr (BYTES == 1 || BYTES == 2 || BYTES == 4 || BYTES == 8 ||
+                BYTES == 16 || BYTES > 32) {
+    memcpy(d, s, BYTES);
+  } else {
+    constexpr size_t HALF = BYTES > 16 ? 16 : BYTES > 8 ? 8 : BYTES > 4 ? 4 : 2;
+    memcpy(d, s, HALF);
+    memcpy(d + BYTES - HALF, s + BYTES - HALF, HALF);
+  }
+}
+
+// Index of the first `ch` in [p, p + n), or n.
+template <typename T> inline size_t find(T const *p, size_t n, T ch) {
+  if constexpr (sizeof(T) == 1) {
+    auto const *hit = static_cast<T const *>(memchr(p, ch, n));
+    return hit == nullptr ? n : static_cast<size_t>(hit - p);
+  } else {
+    for (size_t i = 0; i < n; ++i)
+      if (p[i] == ch)
+        return i;
+    return n;
+  }
+}
+
+} // namespace fixed_detail
+
+template <character_type T, size_t N, output_stream Sink = basic_ofstream<T>>
+class basic_fixed_ofstream {
+  static_assert(N != 0 && N <= std::numeric_limits<size_t>::max() / sizeof(T),
+                "buffer capacity out of range");
+
+public:
+  static constexpr size_t capacity() { return N; }
+  static constexpr size_t bytes() { return N * sizeof(T); }
+
+  explicit basic_fixed_ofstream(Sink &sink) : m_sink{sink} {}
+  basic_fixed_ofstream(basic_fixed_ofstream const &) = delete;
+  basic_fixed_ofstream &operator=(basic_fixed_ofstream const &) = delete;
+  ~basic_fixed_ofstream() { flush(); }
+
+  size_t write(T const *data, size_t size) {
+    if (size <= room()) {
+      memcpy(m_buf + m_size, data, size * sizeof(T));
+      m_size += size;
+      return size;
+    }
+    return writeLong(data, size);
+  }
+  size_t write(T const *data) { return write(data, stringlen(data)); }
+  size_t write(array<T> const &buffer, size_t start, size_t size) {
+    return write(buffer.data() + start, size);
+  }
+  // Writes exactly M elements with a copy unrolled for M.
+  template <size_t M> size_t write_n(T const *data) {
+    static_assert(M <= N, "record larger than the buffer");
+    if (M > N - m_size) {
+      flush();
+      if (M > N - m_size)
+        return 0ul;
+    }
+    fixed_detail::copy_n<M * sizeof(T)>(m_buf + m_size, data);
+    m_size += M;
+    return M;
+  }
+  size_t put(T ch) {
+    if (m_size == N) {
+      flush();
+      if (m_size == N)
+        return 0ul;
+    }
+    m_buf[m_size++] = ch;
+    return 1ul;
+  }
+  // Hands the buffer to the sink and flushes it. Returns the elements the
+  // sink took; on a full non-blocking handle the rest stays buffered.
+  size_t flush() {
+    if (m_size == 0) {
+      m_sink.flush();
+      return 0ul;
+    }
+    auto const taken = m_sink.write(m_buf, m_size);
+    memmove(m_buf, m_buf + taken, (m_size - taken) * sizeof(T));
+    m_size -= taken;
+    m_sink.flush();
+    return taken;
+  }
+  ssize_t wseek(ssize_t offset, IOPos position) {
+    flush();
+    return m_size == 0 ? m_sink.wseek(offset, position) : -1l;
+  }
+  ssize_t tellw() const {
+    return m_sink.tellw() + static_cast<ssize_t>(m_size * sizeof(T));
+  }
+  size_t pending() const { return m_size; }
+
+private:
+  // Elements the buffer has left. m_size never exceeds N, but the compiler
+  // cannot see that once the buffer has been passed to the sink, and would
+  // warn about copies past it.
+  size_t room() const { return m_size < N ? N - m_size : 0ul; }
+  // Fills the buffer, flushes it and writes what is left, straight through
+  // the sink if it is a buffer or more.
+  size_t writeLong(T const *data, size_t size) {
+    auto const head = room();
+    memcpy(m_buf + m_size, data, head * sizeof(T));
+    m_size = N;
+    flush();
+    if (m_size != 0)
+      return head;
+    if (size - head >= N)
+      return head + m_sink.write(data + head, size - head);
+    return head + write(data + head, size - head);
+  }
+
+  Sink &m_sink;
+  size_t m_size = 0;
+  T m_buf[N];
+};
+
+template <character_type T, size_t N, input_stream Source = basic_ifstream<T>>
+class basic_fixed_ifstream {
+  static_assert(N != 0 && N <= std::numeric_limits<size_t>::max() / sizeof(T),
+                "buffer capacity out of range");
+
+public:
+  static constexpr size_t capacity() { return N; }
+  static constexpr size_t bytes() { return N * sizeof(T); }
+
+  explicit basic_fixed_ifstream(Source &source) : m_source{source} {}
+  basic_fixed_ifstream(basic_fixed_ifstream const &) = delete;
+  basic_fixed_ifstream &operator=(basic_fixed_ifstream const &) = delete;
+
+  size_t read(T *data, size_t size) {
+    size_t done = 0;
+    while (done != size) {
+      if (m_pos == m_size) {
+        // Reads of a buffer or more skip it.
+        if (size - done >= N) {
+          auto const got = m_source.readSome(data + done, size - done);
+          if (got == 0)
+            break;
+          done += got;
+          continue;
+        }
+        if (!refill())
+          break;
+      }
+      auto const count = min(m_size - m_pos, size - done);
+      memcpy(data + done, m_buf + m_pos, count * sizeof(T));
+      m_pos += count;
+      done += count;
+    }
+    return done;
+  }
+  // Reads exactly M elements with a copy unrolled for M; fewer only at the
+  // end of the stream. If the source would block first, reads nothing and
+  // keeps what has arrived for the next call.
+  template <size_t M> size_t read_n(T *data) {
+    static_assert(M <= N, "record larger than the buffer");
+    if (m_size - m_pos < M && !fill(M))
+      return m_source.wouldBlock() ? 0ul : read(data, m_size - m_pos);
+    fixed_detail::copy_n<M * sizeof(T)>(data, m_buf + m_pos);
+    m_pos += M;
+    return M;
+  }
+  // Next line with its newline, pointing into the buffer and valid until
+  // the next call. A line longer than the buffer comes in N element
+  // pieces, only the last of which ends in a newline. {nullptr, 0} at the
+  // end, or if the source would block before the line is complete; the
+  // part that has arrived is kept, and wouldBlock() tells the two apart.
+  pair<T const *, size_t> readline_view() {
+    size_t scanned = 0;
+    for (;;) {
+      auto const avail = m_size - m_pos;
+      auto const at =
+          fixed_detail::find(m_buf + m_pos + scanned, avail - scanned, T('\n'));
+      if (at != avail - scanned)
+        return take(scanned + at + 1);
+      scanned = avail;
+      if (avail == N)
+        return take(avail);
+      if (!fill(avail + 1))
+        return avail == 0 || m_source.wouldBlock()
+                   ? pair<T const *, size_t>{nullptr, 0ul}
+                   : take(avail);
+    }
+  }
+  bool eof() { return m_pos == m_size && !refill() && !wouldBlock(); }
+  // True if the last read stopped because the source would block.
+  bool wouldBlock() const { return m_source.wouldBlock(); }
+
+private:
+  pair<T const *, size_t> take(size_t count) {
+    auto const *start = m_buf + m_pos;
+    m_pos += count;
+    return {start, count};
+  }
+  bool refill() {
+    m_pos = m_size = 0;
+    m_size = m_source.readSome(m_buf, N);
+    return m_size != 0;
+  }
+  // Makes `count` elements available, moving the unread ones to the front.
+  bool fill(size_t count) {
+    auto const unread = m_size - m_pos;
+    memmove(m_buf, m_buf + m_pos, unread * sizeof(T));
+    m_pos = 0;
+    m_size = unread;
+    while (m_size < count) {
+      auto const got = m_source.readSome(m_buf + m_size, N - m_size);
+      if (got == 0)
+        return false;
+      m_size += got;
+    }
+    return true;
+  }
+
+  Source &m_source;
+  size_t m_pos = 0;
+  size_t m_size = 0;
+  T m_buf[N];
+};
+
+template <size_t N, output_stream Sink = ofstream>
+using fixed_ofstream = basic_fixed_ofstream<char, N, Sink>;
+template <size_t N, input_stream Source = ifstream>
+using fixed_ifstream = basic_fixed_ifstream<char, N, Source>;
+
+#endif // FIXEDSTREAM_HPP
@@ -0,0 +1,254 @@
+#ifndef FOLLOW_HPP
+#define FOLLOW_HPP
+
+#ifdef __linux__
+
+#include "streams.hpp"
+
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <atomic>
+
+// Follows a file by name the way `tail -F` does:
+//
+//   file_follower follower{"app.log"};
+//   follower.run([&](array<char> const &line, size_t size) { ... });
+//
+// The file stays open and only data appended to it is read. inotify wakes
+// the follower when the file changes; where it is unavailable the file is
+// polled instead. A truncated file is read again from its start; see
+// truncated() for how truncation is told apart from appends. A different
+// file appearing under the name is taken as rotation: the old file is read
+// to its end first, then the new one is read from its start.
+class file_follower {
+public:
+  // How often the file is checked when inotify is unavailable, and how
+  // often it is checked anyway when it is.
+  static constexpr int POLL_INTERVAL_MS = 250;
+  static constexpr int NOTIFY_INTERVAL_MS = 1000;
+
+  // Bytes just before the read position that are kept to notice the file
+  // being rewritten past it.
+  static constexpr size_t TAIL_SIZE = 64;
+
+  // Starts at the current end of the file, or at its start if `fromStart`.
+  // A file that does not exist yet is picked up once it is created.
+  explicit file_follower(char const *path, bool fromStart = false)
+      : m_path{path} {
+    m_notify = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (m_notify != -1) {
+      auto const dir = directoryOf(path);
+      if (inotify_add_watch(m_notify, dir.data(), IN_CREATE | IN_MOVED_TO) ==
+          -1)
+        stopNotify();
+    }
+    open(fromStart);
+  }
+  file_follower(file_follower const &) = delete;
+  file_follower &operator=(file_follower const &) = delete;
+  ~file_follower() { stopNotify(); }
+
+  bool usingNotify() const { return m_notify != -1; }
+  bool isOpen() const { return static_cast<bool>(m_stream); }
+  // Makes run() return. Safe to call from a signal handler.
+  void stop() { m_stopped.store(true, std::memory_order_relaxed); }
+  bool stopped() const { return m_stopped.load(std::memory_order_relaxed); }
+
+  // Waits up to `timeoutMs` for the file to change, then passes every line
+  // completed since the last call to `onLine(line, size)`, newline included.
+  template <typename F> void poll(int timeoutMs, F &&onLine) {
+    wait(timeoutMs);
+    update(onLine);
+  }
+  // Calls poll() until stop() is called. `afterPoll()` runs after each one,
+  // e.g. to flush what `onLine` wrote.
+  template <typename F, typename G> void run(F &&onLine, G &&afterPoll) {
+    update(onLine);
+    afterPoll();
+    while (!stopped()) {
+      poll(usingNotify() ? NOTIFY_INTERVAL_MS : POLL_INTERVAL_MS, onLine);
+      afterPoll();
+    }
+  }
+  template <typename F> void run(F &&onLine) {
+    run(onLine, [] {});
+  }
+
+private:
+  static array<char> directoryOf(char const *path) {
+    auto const length = stringlen(path);
+    size_t slash = length;
+    while (slash != 0 && path[slash - 1] != '/')
+      --slash;
+    if (slash == 0)
+      return array<char>{"."};
+    // Keeps the slash itself for "/name".
+    auto const size = slash == 1 ? 1 : slash - 1;
+    array<char> dir{size + 1};
+    memcpy(dir.data(), path, size);
+    dir[size] = '\0';
+    return dir;
+  }
+  void stopNotify() {
+    if (m_notify != -1)
+      ::close(m_notify);
+    m_notify = -1;
+    m_watch = -1;
+  }
+  // Opens the file currently at the path, failing quietly if there is none
+  // so that a rotated-away file can be waited for.
+  bool open(bool fromStart) {
+    auto const fd = ::open(m_path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1)
+      return false;
+    struct stat info;
+    if (fstat(fd, &info) == -1) {
+      ::close(fd);
+      return false;
+    }
+    m_device = info.st_dev;
+    m_inode = info.st_ino;
+    m_stream = make_uniq<ifstream>(fd, true);
+    m_size = 0;
+    m_tailAt = 0;
+    m_tailSize = 0;
+    if (!fromStart)
+      m_stream->rseek(0, IOPos::END);
+    remember(info);
+    if (m_notify != -1) {
+      if (m_watch != -1)
+        inotify_rm_watch(m_notify, m_watch);
+      m_watch = inotify_add_watch(m_notify, m_path,
+                                  IN_MODIFY | IN_ATTRIB | IN_MOVE_SELF |
+                                      IN_DELETE_SELF);
+    }
+    return true;
+  }
+  // Sleeps until an inotify event arrives or the timeout passes, and
+  // discards the events: they only say that something is worth checking.
+  void wait(int timeoutMs) {
+    if (m_notify == -1) {
+      ::poll(nullptr, 0, timeoutMs);
+      return;
+    }
+    pollfd pfd{m_notify, POLLIN, 0};
+    if (::poll(&pfd, 1, timeoutMs) <= 0)
+      return;
+    alignas(inotify_event) char events[4096];
+    while (::read(m_notify, events, sizeof(events)) > 0) {
+    }
+  }
+  // Reads lines until the end of the file. A trailing partial line is kept
+  // for the next call.
+  template <typename F> void drain(F &onLine) {
+    for (;;) {
+      if (m_size == m_line.capacity()) {
+        array<char> grown{m_line.capacity() << 1};
+        memcpy(grown.data(), m_line.data(), m_size);
+        m_line = forward<array<char>>(grown);
+      }
+      auto [got, found] =
+          m_stream->readUntil(m_line, m_size, m_line.capacity() - m_size,
+                              &ifstream::is_nl);
+      m_size += got;
+      if (found) {
+        onLine(static_cast<array<char> const &>(m_line), m_size);
+        m_size = 0;
+      } else if (m_size != m_line.capacity()) {
+        return;
+      }
+    }
+  }
+  // Records the state truncated() compares against: the size and mtime of
+  // the last fstat(), and the bytes just before the read position.
+  void remember(struct stat const &info) {
+    m_lastSize = info.st_size;
+    m_lastMtime = info.st_mtim;
+    auto const at = m_stream->tellr();
+    auto const size = static_cast<size_t>(min(at, ssize_t{TAIL_SIZE}));
+    if (at == m_tailAt + static_cast<ssize_t>(m_tailSize))
+      return;
+    auto const got = ::pread(m_stream->getHandle(), m_tail, size,
+                             static_cast<off_t>(at) - static_cast<off_t>(size));
+    m_tailSize = got == static_cast<ssize_t>(size) ? size : 0;
+    m_tailAt = at - static_cast<ssize_t>(m_tailSize);
+  }
+  static bool sameTime(timespec const &a, timespec const &b) {
+    return a.tv_sec == b.tv_sec && a.tv_nsec == b.tv_nsec;
+  }
+  // Truncation is the file shrinking below what was read or last seen, a
+  // change since the last check that did not make the file grow (truncated
+  // and rewritten to at most its old size), or different bytes just before
+  // the read position (truncated and rewritten past it, as with logrotate's
+  // copytruncate). Changes are told by the mtime rather than by IN_MODIFY,
+  // which may still be queued for writes already read; the ctime would
+  // also move on a chmod.
+  bool truncated(struct stat const &info) const {
+    if (info.st_size < m_stream->tellr() || info.st_size < m_lastSize)
+      return true;
+    if (sameTime(info.st_mtim, m_lastMtime))
+      return false;
+    if (info.st_size <= m_lastSize)
+      return true;
+    if (m_tailSize == 0)
+      return false;
+    char now[TAIL_SIZE];
+    auto const got = ::pread(m_stream->getHandle(), now, m_tailSize,
+                             static_cast<off_t>(m_tailAt));
+    return got != static_cast<ssize_t>(m_tailSize) ||
+           memcmp(now, m_tail, m_tailSize) != 0;
+  }
+  template <typename F> void update(F &onLine) {
+    if (!m_stream && !open(true))
+      return;
+    struct stat info;
+    bool const known = fstat(m_stream->getHandle(), &info) == 0;
+    if (known && truncated(info)) {
+      m_stream->rseek(0, IOPos::SET);
+      m_size = 0;
+      m_tailAt = 0;
+      m_tailSize = 0;
+    }
+    drain(onLine);
+    if (known)
+      remember(info);
+    // Until another file takes the name, the old one may still be written.
+    if (stat(m_path, &info) == -1 ||
+        (info.st_dev == m_device && info.st_ino == m_inode))
+      return;
+    // Rotated: the old file has just been read to its end, and whatever is
+    // left of it is its last, unterminated line.
+    if (m_size != 0)
+      onLine(static_cast<array<char> const &>(m_line), m_size);
+    m_size = 0;
+    m_stream.reset();
+    if (m_notify != -1 && m_watch != -1)
+      inotify_rm_watch(m_notify, m_watch);
+    m_watch = -1;
+    if (open(true))
+      drain(onLine);
+  }
+
+  char const *m_path;
+  int m_notify = -1;
+  int m_watch = -1;
+  dev_t m_device = 0;
+  ino_t m_inode = 0;
+  uniq_ptr<ifstream> m_stream;
+  off_t m_lastSize = 0;
+  timespec m_lastMtime{};
+  char m_tail[TAIL_SIZE];
+  ssize_t m_tailAt = 0;
+  size_t m_tailSize = 0;
+  array<char> m_line{256};
+  size_t m_size = 0;
+  std::atomic<bool> m_stopped{false};
+};
+
+#endif // __linux__
+
+#endif // FOLLOW_HPP
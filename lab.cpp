@@ -1,26 +1,75 @@
 #include "streams.hpp"
+#include "utf.hpp"
+#ifdef __linux__
+#include "follow.hpp"
+#include <csignal>
+#endif
 #include <iostream>
 #include <stdexcept>
 
+#ifdef __linux__
+static file_follower *following = nullptr;
+
+static void stopFollowing(int) {
+  if (following != nullptr)
+    following->stop();
+}
+
+// lab -f <n> <outfile> <infile>: keeps <infile> open and appends the last
+// <n> code points of every line written to it from now on to <outfile>, one
+// per line, until interrupted.
+static int follow(long long n, char const *outfile, char const *infile) {
+  // Whole lines only, so several followers can share one output file.
+  ofstream output{array<char>(outfile), IOMode::APPEND};
+  output.setRecordDelimiter('\n');
+  file_follower follower{infile};
+  following = &follower;
+  std::signal(SIGINT, &stopFollowing);
+  std::signal(SIGTERM, &stopFollowing);
+  follower.run(
+      [&](array<char> const &line, size_t size) {
+        auto const len = size - (line[size - 1] == '\n');
+        auto const start = utf::tail(line.data(), len, static_cast<size_t>(n));
+        output.write(line, start, len - start);
+        output.write("\n");
+      },
+      [&] { output.flush(); });
+  following = nullptr;
+  return 0;
+}
+#endif
+
 int main(int argc, char const *argv[]) {
-  if (argc != 3) {
+  bool const follows = argc > 1 && strcmp(argv[1], "-f") == 0;
+  if (argc != (follows ? 5 : 3)) {
     cerr.write("Invalid number of arguments!\n");
     return 1;
   }
+  if (follows)
+    ++argv;
   char *endp;
   auto n = std::strtoll(argv[1], &endp, 10);
-  if (endp != argv[1] + stringlen(argv[1])) {
+  if (endp != argv[1] + stringlen(argv[1]) || n < 0) {
     cerr.write("Invalid argument for number of symbols!\n");
     return 1;
   }
-  ofstream output{array<char>(argv[2])};
-  output.wseek(0, IOPos::END);
+  if (follows) {
+#ifdef __linux__
+    return follow(n, argv[2], argv[3]);
+#else
+    cerr.write("Follow mode is not supported on this platform!\n");
+    return 1;
+#endif
+  }
+  // One write at the end of the file, however many runs append at once.
+  ofstream output{array<char>(argv[2]), IOMode::APPEND};
+  output.setRecordDelimiter('\n');
   auto line = cin.readline();
-  ssize_t len = line.second;
-  ssize_t isLastLF = line.first[len - 1] == '\n';
-  size_t len2cpy = min(static_cast<long long>(len) - isLastLF, n);
-  array<char> text{len2cpy};
-  memcpy(text.data(), line.first.data() + len - len2cpy - isLastLF, len2cpy);
-  output.write(text, len2cpy);
+  size_t len = line.second;
+  if (len != 0 && line.first[len - 1] == '\n')
+    --len;
+  // Counts code points, so multi-byte UTF-8 sequences are never cut.
+  auto start = utf::tail(line.first.data(), len, static_cast<size_t>(n));
+  output.write(line.first, start, len - start);
   return 0;
 }
@@ -0,0 +1,212 @@
+#ifndef LINEBATCH_HPP
+#define LINEBATCH_HPP
+
+#include "simd.hpp"
+#include "streams.hpp"
+
+// Lines read many at a time into one contiguous block plus a table of where
+// each one starts, rather than one array per readline():
+//
+//   ifstream file{array<char>{"app.log"}};
+//   line_reader reader{file};
+//   line_batch batch;
+//   while (reader.readlines(batch) != 0)
+//     for (size_t i = 0; i < batch.size(); ++i) {
+//       auto [line, size] = batch[i];
+//       ...
+//     }
+//
+// Refills go straight into the batch's block, and each is scanned for
+// newlines once. The batch is reused from call to call, so once it has
+// grown a loop like the one above allocates nothing. A filled batch owns
+// its lines and can be handed to another thread while the reader fills the
+// next one.
+namespace batch_detail {
+
+// Index of the first newline in [p, p + n), or n.
+template <typename T> inline size_t find_nl(T const *p, size_t n) {
+  if constexpr (sizeof(T) == 1) {
+    auto const *hit = static_cast<T const *>(memchr(p, '\n', n));
+    return hit == nullptr ? n : static_cast<size_t>(hit - p);
+  } else {
+    for (size_t i = 0; i < n; ++i)
+      if (p[i] == static_cast<T>('\n'))
+        return i;
+    return n;
+  }
+}
+// Calls `found(i)` for the index of every newline in [p, p + n), in order.
+template <typename T, typename F>
+inline void for_each_nl(T const *p, size_t n, F &&found) {
+  if constexpr (sizeof(T) == 1) {
+    simd::for_each_byte(reinterpret_cast<char const *>(p), n, '\n', found);
+  } else {
+    for (size_t i = 0; i < n; ++i)
+      if (p[i] == static_cast<T>('\n'))
+        found(i);
+  }
+}
+// Makes room for `capacity` elements, keeping the first `keep`.
+template <typename V>
+void reserve(array<V> &buffer, size_t keep, size_t capacity) {
+  if (capacity <= buffer.capacity())
+    return;
+  array<V> grown{capacity};
+  if (keep != 0)
+    memcpy(grown.data(), buffer.data(), keep * sizeof(V));
+  buffer = forward<array<V>>(grown);
+}
+
+} // namespace batch_detail
+
+template <character_type T, input_stream Source = basic_ifstream<T>>
+class basic_line_reader;
+
+// Line i is block[offsets[i], offsets[i + 1]), with its newline as
+// readline() would return it; only the last line of a stream may have none.
+template <character_type T> class basic_line_batch {
+public:
+  basic_line_batch() : m_offsets{1} { m_offsets[0] = 0; }
+
+  size_t size() const { return m_lines; }
+  bool empty() const { return m_lines == 0; }
+  // The block holding the lines back to back, length() elements long.
+  T const *data() const { return m_block.data(); }
+  size_t length() const { return m_offsets[m_lines]; }
+  // size() + 1 entries: where every line starts, then where the last ends.
+  size_t const *offsets() const { return m_offsets.data(); }
+  pair<T const *, size_t> operator[](size_t i) const {
+    return {m_block.data() + m_offsets[i], m_offsets[i + 1] - m_offsets[i]};
+  }
+  // Drops the lines and keeps the storage.
+  void clear() { m_lines = 0; }
+
+private:
+  template <character_type, input_stream> friend class basic_line_reader;
+
+  array<T> m_block;
+  array<size_t> m_offsets;
+  size_t m_lines = 0;
+};
+
+// Fills line batches from an ifstream, or any source with readSome() and
+// wouldBlock() such as an imemstream. Whatever was read past the last line
+// a batch could take, usually the start of a line, is kept here and goes
+// into the next batch.
+template <character_type T, input_stream Source> class basic_line_reader {
+public:
+  static constexpr size_t MAX_LINES = 4096;
+  static constexpr size_t MAX_SIZE = size_t{256} << 10;
+  // Block size a batch starts with; it grows up to the size limit when a
+  // line does not fit.
+  static constexpr size_t READ_SIZE = size_t{64} << 10;
+
+  explicit basic_line_reader(Source &source) : m_source{source} {}
+  basic_line_reader(basic_line_reader const &) = delete;
+  basic_line_reader &operator=(basic_line_reader const &) = delete;
+
+  // Replaces the contents of `batch` with the next lines, at most
+  // `maxLines` of them and `maxSize` elements in all. A line longer than
+  // `maxSize` comes in `maxSize` element pieces, only the last of which ends
+  // in a newline. Returns the number of lines: 0 at the end of the stream
+  // or, for a source that would block, when no whole line has arrived.
+  size_t readlines(basic_line_batch<T> &batch, size_t maxLines = MAX_LINES,
+                   size_t maxSize = MAX_SIZE) {
+    batch.m_lines = 0;
+    if (maxLines == 0 || maxSize == 0)
+      return 0ul;
+    auto const pending = m_end - m_pos;
+    batch_detail::reserve(batch.m_block, 0,
+                          min(maxSize, max(pending, READ_SIZE)));
+    if (pending != 0 && !takePending(batch, maxLines, maxSize))
+      return batch.m_lines;
+    auto length = batch.length() + (m_end - m_pos);
+    if (m_end != m_pos) {
+      memcpy(batch.m_block.data() + batch.length(), m_pending.data() + m_pos,
+             (m_end - m_pos) * sizeof(T));
+      m_pos = m_end = 0;
+    }
+    while (batch.m_lines != maxLines) {
+      if (length == maxSize) {
+        if (batch.m_lines == 0)
+          addLine(batch, maxLines, maxSize);
+        break;
+      }
+      if (length == batch.m_block.capacity())
+        batch_detail::reserve(batch.m_block, length, min(maxSize, length * 2));
+      auto *block = batch.m_block.data();
+      auto const room = min(batch.m_block.capacity(), maxSize) - length;
+      auto const got = m_source.readSome(block + length, room);
+      if (got == 0) {
+        // The end of a stream also ends its last line.
+        if (batch.length() != length && !m_source.wouldBlock())
+          addLine(batch, maxLines, length);
+        break;
+      }
+      batch_detail::for_each_nl(block + length, got, [&](size_t at) {
+        if (batch.m_lines != maxLines)
+          addLine(batch, maxLines, length + at + 1);
+      });
+      length += got;
+    }
+    auto const end = batch.length();
+    stash(batch.m_block.data() + end, length - end);
+    return batch.m_lines;
+  }
+  // The same into a new batch.
+  basic_line_batch<T> readlines(size_t maxLines = MAX_LINES,
+                                size_t maxSize = MAX_SIZE) {
+    basic_line_batch<T> batch;
+    readlines(batch, maxLines, maxSize);
+    return batch;
+  }
+
+private:
+  // Moves the whole lines kept from the last call into the empty `batch`.
+  // Returns false if the batch is full, true if what is left of them is
+  // part of a line that needs more data.
+  bool takePending(basic_line_batch<T> &batch, size_t maxLines,
+                   size_t maxSize) {
+    auto const *data = m_pending.data() + m_pos;
+    auto const pending = m_end - m_pos;
+    auto const room = min(pending, maxSize);
+    size_t taken = 0;
+    while (batch.m_lines != maxLines) {
+      auto const at = batch_detail::find_nl(data + taken, room - taken);
+      if (at == room - taken)
+        break;
+      taken += at + 1;
+      addLine(batch, maxLines, taken);
+    }
+    if (batch.m_lines == 0 && room == maxSize)
+      addLine(batch, maxLines, taken = maxSize);
+    memcpy(batch.m_block.data(), data, taken * sizeof(T));
+    m_pos += taken;
+    return batch.m_lines != maxLines && room == pending && taken != maxSize;
+  }
+  void addLine(basic_line_batch<T> &batch, size_t maxLines, size_t end) {
+    auto &offsets = batch.m_offsets;
+    if (batch.m_lines + 1 == offsets.capacity())
+      batch_detail::reserve(offsets, batch.m_lines + 1,
+                            min(maxLines, max(batch.m_lines * 2, size_t{64})) +
+                                1);
+    offsets[++batch.m_lines] = end;
+  }
+  void stash(T const *data, size_t size) {
+    batch_detail::reserve(m_pending, 0, size);
+    if (size != 0)
+      memcpy(m_pending.data(), data, size * sizeof(T));
+    m_pos = 0;
+    m_end = size;
+  }
+
+  Source &m_source;
+  array<T> m_pending;
+  size_t m_pos = 0;
+  size_t m_end = 0;
+};
+
+using line_batch = basic_line_batch<char>;
+using line_reader = basic_line_reader<char>;
+
+#endif // LINEBATCH_HPP
@@ -0,0 +1,554 @@
+#ifndef LINEINDEX_HPP
+#define LINEINDEX_HPP
+
+#ifdef __linux__
+
+#include "simd.hpp"
+#include "streams.hpp"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <thread>
+
+// Monotone sequence of integers in [0, universe] stored in Elias-Fano form:
+// the low `lowBits` bits of every value are packed as is, the rest are
+// written in unary into a bit vector with one set bit per value. That comes
+// to about 2 + log2(universe / count) bits per value, and any value is
+// found with one select on the bit vector.
+//
+// The encoding is one contiguous run of 64-bit words, so it can be written
+// out as is and used in place from a mapped file.
+class elias_fano {
+public:
+  elias_fano() = default;
+  // `values` must be non-decreasing and no larger than `universe`.
+  template <typename V>
+  elias_fano(V const *values, size_t count, uint64_t universe) {
+    // An empty sequence is the header alone, whatever the universe.
+    if (count == 0) {
+      m_storage = array<uint64_t>{HEADER};
+      for (auto &word : m_storage)
+        word = 0;
+      attach(m_storage.data());
+      return;
+    }
+    unsigned lowBits = 0;
+    while (count != 0 && (universe / count) >> (lowBits + 1) != 0)
+      ++lowBits;
+    auto const lowWords = wordsFor(count * lowBits);
+    auto const highWords = wordsFor(count + (universe >> lowBits) + 1);
+    auto const sampleWords = samplesFor(count);
+    m_storage = array<uint64_t>{HEADER + lowWords + highWords + sampleWords};
+    for (auto &word : m_storage)
+      word = 0;
+    m_storage[0] = count;
+    m_storage[1] = lowBits;
+    m_storage[2] = lowWords;
+    m_storage[3] = highWords;
+    m_storage[4] = sampleWords;
+    attach(m_storage.data());
+    auto *high = m_storage.data() + HEADER + lowWords;
+    auto *samples = high + highWords;
+    uint64_t const lowMask = (uint64_t{1} << m_lowBits) - 1;
+    for (size_t i = 0; i < count; ++i) {
+      auto const value = static_cast<uint64_t>(values[i]);
+      setBits(i * m_lowBits, value & lowMask);
+      auto const bit = (value >> m_lowBits) + i;
+      high[bit / 64] |= uint64_t{1} << (bit % 64);
+      if (i % SAMPLE == 0)
+        samples[i / SAMPLE] = bit;
+    }
+  }
+  // Uses an encoding written out from serialize() without copying it; `data`
+  // must outlive the result. `size` is the number of words available at
+  // `data`. An empty sequence is returned if they do not hold a valid
+  // encoding.
+  static elias_fano view(uint64_t const *data, size_t size) {
+    elias_fano result;
+    if (size < HEADER || data[1] >= 64 || data[2] > size || data[3] > size ||
+        data[4] > size || HEADER + data[2] + data[3] + data[4] > size ||
+        data[2] < wordsFor(data[0] * data[1]) ||
+        data[4] != samplesFor(data[0]))
+      return result;
+    // select() relies on the bit vector and samples being consistent.
+    auto const *high = data + HEADER + data[2];
+    uint64_t ones = 0;
+    for (size_t i = 0; i < data[3]; ++i)
+      ones += simd::popcount64(high[i]);
+    for (size_t i = 0; i < data[4]; ++i)
+      if (high[data[3] + i] >= data[3] * 64)
+        return result;
+    if (ones != data[0])
+      return result;
+    result.attach(data);
+    return result;
+  }
+  elias_fano(elias_fano const &) = delete;
+  elias_fano &operator=(elias_fano const &) = delete;
+  elias_fano(elias_fano &&) = default;
+  elias_fano &operator=(elias_fano &&) = default;
+
+  size_t size() const { return m_count; }
+  uint64_t operator[](size_t i) const {
+    auto const high = select(i) - i;
+    return high << m_lowBits | getBits(i * m_lowBits);
+  }
+  // The encoding, words() 64-bit words long.
+  uint64_t const *serialize() const { return m_words; }
+  size_t words() const {
+    return m_words == nullptr
+               ? 0
+               : static_cast<size_t>(HEADER + m_words[2] + m_words[3] +
+                                     m_words[4]);
+  }
+  size_t bytes() const { return words() * sizeof(uint64_t); }
+
+private:
+  // count, lowBits and the sizes of the low, high and sample parts.
+  static constexpr size_t HEADER = 5;
+  // Every SAMPLE-th set bit's position is kept so select() scans at most a
+  // few words.
+  static constexpr size_t SAMPLE = 256;
+
+  static size_t wordsFor(uint64_t bits) {
+    return static_cast<size_t>((bits + 63) / 64);
+  }
+  static size_t samplesFor(uint64_t count) {
+    return count == 0 ? 0 : static_cast<size_t>(count / SAMPLE + 1);
+  }
+  void attach(uint64_t const *data) {
+    m_words = data;
+    m_count = static_cast<size_t>(data[0]);
+    m_lowBits = static_cast<unsigned>(data[1]);
+    m_low = data + HEADER;
+    m_high = m_low + data[2];
+    m_samples = m_high + data[3];
+  }
+  void setBits(uint64_t at, uint64_t value) {
+    if (m_lowBits == 0)
+      return;
+    auto *low = m_storage.data() + HEADER;
+    low[at / 64] |= value << (at % 64);
+    if (at % 64 + m_lowBits > 64)
+      low[at / 64 + 1] |= value >> (64 - at % 64);
+  }
+  uint64_t getBits(uint64_t at) const {
+    if (m_lowBits == 0)
+      return 0;
+    uint64_t value = m_low[at / 64] >> (at % 64);
+    if (at % 64 + m_lowBits > 64)
+      value |= m_low[at / 64 + 1] << (64 - at % 64);
+    return value & ((uint64_t{1} << m_lowBits) - 1);
+  }
+  // Position of the i-th set bit of the high bit vector.
+  uint64_t select(size_t i) const {
+    auto const from = m_samples[i / SAMPLE];
+    auto rank = i % SAMPLE;
+    auto word = static_cast<size_t>(from / 64);
+    uint64_t bits = m_high[word] & (~uint64_t{0} << (from % 64));
+    for (;;) {
+      auto const ones = simd::popcount64(bits);
+      if (rank < ones)
+        break;
+      rank -= ones;
+      bits = m_high[++word];
+    }
+    for (; rank != 0; --rank)
+      bits &= bits - 1;
+    return uint64_t{word} * 64 + simd::ctz64(bits);
+  }
+
+  // Owned encoding; empty when viewing words that live elsewhere.
+  array<uint64_t> m_storage;
+  uint64_t const *m_words = nullptr;
+  uint64_t const *m_low = nullptr;
+  uint64_t const *m_high = nullptr;
+  uint64_t const *m_samples = nullptr;
+  size_t m_count = 0;
+  unsigned m_lowBits = 0;
+};
+
+// Byte offset of the start of every line of a seekable file, built by
+// scanning fixed-size chunks of the file on several threads at once. Each
+// chunk keeps the line starts it contains Elias-Fano coded relative to the
+// chunk, so the whole index costs a few bits per line.
+//
+// An index can be kept in a sidecar file. The sidecar records the size and
+// mtime of the indexed prefix and a checksum of its first and last few KiB;
+// it is mapped rather than read when loaded, and only bytes appended since
+// it was written are scanned.
+class line_index {
+public:
+  static constexpr uint64_t CHUNK_SIZE = uint64_t{16} << 20;
+
+  line_index() = default;
+  // Indexes the file behind `stream` as it is now, using `threads` workers
+  // (0 picks one per core). The stream's own position is left alone.
+  explicit line_index(ifstream const &stream, size_t threads = 0) {
+    update(stream, threads);
+  }
+  // Loads the index of the file behind `stream` from `sidecar`, brings it up
+  // to date and writes it back if anything had to be scanned. A missing or
+  // stale sidecar just means a full build.
+  line_index(ifstream const &stream, char const *sidecar, size_t threads = 0) {
+    load(sidecar);
+    if (update(stream, threads) != 0 || m_map == nullptr)
+      save(sidecar);
+  }
+  line_index(line_index &&move) { *this = static_cast<line_index &&>(move); }
+  line_index &operator=(line_index &&move) {
+    if (this != &move) {
+      unmap();
+      m_chunks = static_cast<array<chunk> &&>(move.m_chunks);
+      m_lines = move.m_lines;
+      m_fileSize = move.m_fileSize;
+      m_mtime = move.m_mtime;
+      m_checksum = move.m_checksum;
+      m_scanned = move.m_scanned;
+      m_map = move.m_map;
+      m_mapSize = move.m_mapSize;
+      move.m_map = nullptr;
+      move.m_mapSize = 0;
+    }
+    return *this;
+  }
+  line_index(line_index const &) = delete;
+  line_index &operator=(line_index const &) = delete;
+  ~line_index() { unmap(); }
+
+  // Number of lines; a final line without a newline counts as well.
+  size_t lines() const { return m_lines; }
+  // Bytes of the file covered by the index.
+  uint64_t fileSize() const { return m_fileSize; }
+  // Bytes of the file read by the last build or update.
+  uint64_t scanned() const { return m_scanned; }
+  // Offset at which `line` starts, or the file size for `line >= lines()`.
+  uint64_t offset(size_t line) const {
+    if (line >= m_lines)
+      return m_fileSize;
+    if (line == 0)
+      return 0;
+    // Starts are numbered from line 1 on.
+    size_t const start = line - 1;
+    size_t lo = 0, hi = m_chunks.capacity();
+    while (hi - lo > 1) {
+      auto const mid = (lo + hi) / 2;
+      if (m_chunks[mid].first <= start)
+        lo = mid;
+      else
+        hi = mid;
+    }
+    auto const &chunk = m_chunks[lo];
+    return uint64_t{lo} * CHUNK_SIZE + chunk.starts[start - chunk.first];
+  }
+  // Moves the read position of `stream` to the start of `line`.
+  ssize_t seek_line(ifstream &stream, size_t line) const {
+    return stream.rseek(static_cast<ssize_t>(offset(line)), IOPos::SET);
+  }
+  // Reads lines [first, first + count) including their newlines.
+  pair<array<char>, size_t> read_lines(ifstream &stream, size_t first,
+                                       size_t count) const {
+    auto const begin = offset(first);
+    auto const end = offset(first + min(count, m_lines - min(first, m_lines)));
+    array<char> text{static_cast<size_t>(end - begin)};
+    if (seek_line(stream, first) == -1)
+      return {text, 0ul};
+    auto const got = stream.read(text, text.capacity());
+    return {text, got};
+  }
+  // Bytes taken by the index itself.
+  size_t bytes() const {
+    size_t total = m_chunks.capacity() * sizeof(chunk);
+    for (auto const &chunk : m_chunks)
+      total += chunk.starts.bytes();
+    return total;
+  }
+
+  // Catches up with the file behind `stream`: bytes appended since the last
+  // build are scanned. A file that was modified without growing, or whose
+  // indexed prefix no longer matches, is indexed from scratch. Returns the
+  // bytes scanned.
+  uint64_t update(ifstream const &stream, size_t threads = 0) {
+    int const handle = stream.getHandle();
+    m_scanned = 0;
+    struct stat info;
+    if (fstat(handle, &info) == -1) {
+      invoke(file_error_handler, __FILE__, __FUNCTION__);
+      return 0;
+    }
+    auto const size = static_cast<uint64_t>(info.st_size);
+    auto const mtime = mtimeOf(info);
+    if (size == m_fileSize && mtime == m_mtime)
+      return 0;
+    // The prefix checksum only samples the ends of the indexed bytes, so it
+    // is trusted for appends alone; anything else was rewritten in place.
+    uint64_t checksum;
+    if (size <= m_fileSize || !prefixChecksum(handle, m_fileSize, checksum) ||
+        checksum != m_checksum) {
+      m_chunks = array<chunk>{};
+      m_fileSize = 0;
+    }
+    if (!extend(handle, size, threads) ||
+        !prefixChecksum(handle, m_fileSize, m_checksum)) {
+      invoke(file_error_handler, __FILE__, __FUNCTION__);
+      m_chunks = array<chunk>{};
+      m_fileSize = 0;
+      m_lines = 0;
+      return 0;
+    }
+    m_mtime = mtime;
+    return m_scanned;
+  }
+  // Writes the index to `path`, replacing it atomically. The sidecar is only
+  // a cache, so failures are reported through the result alone.
+  // Each save writes a temporary file of its own next to `path`, so
+  // processes saving the same sidecar at once do not clobber each other.
+  bool save(char const *path) const {
+    auto const length = stringlen(path);
+    array<char> temporary{length + 8};
+    memcpy(temporary.data(), path, length);
+    memcpy(temporary.data() + length, ".XXXXXX", 8);
+    int fd = ::mkostemp(temporary.data(), O_CLOEXEC);
+    if (fd == -1)
+      return false;
+    if (::fchmod(fd, 0644) == -1) {
+      ::close(fd);
+      ::unlink(temporary.data());
+      return false;
+    }
+    sidecar_header const header{SIDECAR_MAGIC, SIDECAR_VERSION, CHUNK_SIZE,
+                                m_fileSize,    m_mtime,         m_checksum,
+                                m_lines,       m_chunks.capacity()};
+    bool ok = writeAll(fd, &header, sizeof(header));
+    for (size_t i = 0; ok && i < m_chunks.capacity(); ++i)
+      ok = writeAll(fd, m_chunks[i].starts.serialize(),
+                    m_chunks[i].starts.bytes());
+    ok = ::close(fd) == 0 && ok;
+    if (ok && ::rename(temporary.data(), path) == 0)
+      return true;
+    ::unlink(temporary.data());
+    return false;
+  }
+
+private:
+  struct chunk {
+    // Index of the chunk's first line start among all of them.
+    size_t first = 0;
+    // Offsets, relative to the chunk, of the bytes following its newlines.
+    elias_fano starts;
+  };
+  struct helper {
+    std::thread thread;
+  };
+  // Sidecar layout: this header, then the encoding of every chunk in order,
+  // all in native byte order.
+  struct sidecar_header {
+    uint64_t magic;
+    uint64_t version;
+    uint64_t chunkSize;
+    uint64_t fileSize;
+    int64_t mtime;
+    uint64_t checksum;
+    uint64_t lines;
+    uint64_t chunks;
+  };
+  static constexpr uint64_t SIDECAR_MAGIC = 0x5844494c454e494cull; // LINELIDX
+  static constexpr uint64_t SIDECAR_VERSION = 1;
+  static constexpr size_t READ_SIZE = size_t{1} << 20;
+  // Bytes at each end of the indexed prefix covered by the checksum.
+  static constexpr size_t CHECKSUM_SPAN = 4096;
+
+  static int64_t mtimeOf(struct stat const &info) {
+    return static_cast<int64_t>(info.st_mtim.tv_sec) * 1000000000 +
+           info.st_mtim.tv_nsec;
+  }
+  static bool readAt(int handle, char *data, size_t size, uint64_t offset) {
+    while (size != 0) {
+      auto const got = ::pread(handle, data, size, static_cast<off_t>(offset));
+      if (got == -1 && errno == EINTR)
+        continue;
+      if (got <= 0)
+        return false;
+      data += got;
+      size -= static_cast<size_t>(got);
+      offset += static_cast<uint64_t>(got);
+    }
+    return true;
+  }
+  static bool writeAll(int handle, void const *data, size_t size) {
+    auto const *p = static_cast<char const *>(data);
+    while (size != 0) {
+      auto const put = ::write(handle, p, size);
+      if (put == -1 && errno == EINTR)
+        continue;
+      if (put <= 0)
+        return false;
+      p += put;
+      size -= static_cast<size_t>(put);
+    }
+    return true;
+  }
+  // FNV-1a over the first and last CHECKSUM_SPAN bytes of [0, size): enough
+  // to notice a file that was replaced or rewritten rather than appended to,
+  // without reading all of it.
+  static bool prefixChecksum(int handle, uint64_t size, uint64_t &checksum) {
+    char data[2 * CHECKSUM_SPAN];
+    auto const head = static_cast<size_t>(min(uint64_t{CHECKSUM_SPAN}, size));
+    auto const tail =
+        static_cast<size_t>(min(uint64_t{CHECKSUM_SPAN}, size - head));
+    if (!readAt(handle, data, head, 0) ||
+        !readAt(handle, data + head, tail, size - tail))
+      return false;
+    checksum = 0xcbf29ce484222325ull ^ size;
+    for (size_t i = 0; i < head + tail; ++i)
+      checksum = (checksum ^ static_cast<unsigned char>(data[i])) *
+                 0x100000001b3ull;
+    return true;
+  }
+
+  void unmap() {
+    if (m_map != nullptr)
+      ::munmap(m_map, m_mapSize);
+    m_map = nullptr;
+    m_mapSize = 0;
+  }
+  // Maps a sidecar and uses the chunk encodings in place; leaves the index
+  // empty if the file is missing or malformed.
+  void load(char const *path) {
+    int fd = ::open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1)
+      return;
+    struct stat info;
+    if (fstat(fd, &info) == 0 &&
+        static_cast<size_t>(info.st_size) >= sizeof(sidecar_header)) {
+      m_mapSize = static_cast<size_t>(info.st_size);
+      m_map = ::mmap(nullptr, m_mapSize, PROT_READ, MAP_SHARED, fd, 0);
+      if (m_map == MAP_FAILED)
+        m_map = nullptr;
+    }
+    ::close(fd);
+    if (m_map == nullptr || !parse())
+      *this = line_index{};
+  }
+  bool parse() {
+    auto const *header = static_cast<sidecar_header const *>(m_map);
+    if (header->magic != SIDECAR_MAGIC ||
+        header->version != SIDECAR_VERSION ||
+        header->chunkSize != CHUNK_SIZE ||
+        header->chunks != (header->fileSize + CHUNK_SIZE - 1) / CHUNK_SIZE)
+      return false;
+    auto const *words = reinterpret_cast<uint64_t const *>(header + 1);
+    size_t left = (m_mapSize - sizeof(sidecar_header)) / sizeof(uint64_t);
+    if (header->chunks > left)
+      return false;
+    m_chunks = array<chunk>{static_cast<size_t>(header->chunks)};
+    for (auto &chunk : m_chunks) {
+      chunk.starts = elias_fano::view(words, left);
+      if (chunk.starts.words() == 0)
+        return false;
+      words += chunk.starts.words();
+      left -= chunk.starts.words();
+    }
+    m_fileSize = header->fileSize;
+    m_mtime = header->mtime;
+    m_checksum = header->checksum;
+    number();
+    return m_lines == header->lines && left == 0;
+  }
+  // Indexes [m_fileSize, size), rescanning the last chunk if it was partial.
+  bool extend(int handle, uint64_t size, size_t threads) {
+    auto const kept = static_cast<size_t>(m_fileSize / CHUNK_SIZE);
+    auto const chunks =
+        static_cast<size_t>((size + CHUNK_SIZE - 1) / CHUNK_SIZE);
+    array<chunk> grown{chunks};
+    for (size_t i = 0; i < kept; ++i)
+      grown[i] = static_cast<chunk &&>(m_chunks[i]);
+    m_chunks = static_cast<array<chunk> &&>(grown);
+    m_fileSize = size;
+    if (chunks > kept && !scan(handle, kept, threads))
+      return false;
+    m_scanned = size - uint64_t{kept} * CHUNK_SIZE;
+    number();
+    return true;
+  }
+  // Scans chunks [from, end) on up to `threads` threads.
+  bool scan(int handle, size_t from, size_t threads) {
+    auto const chunks = m_chunks.capacity();
+    if (threads == 0)
+      threads = std::thread::hardware_concurrency();
+    threads = min(threads == 0 ? size_t{1} : threads, chunks - from);
+    std::atomic<size_t> next{from};
+    std::atomic<bool> failed{false};
+    auto worker = [&] {
+      array<char> buffer{READ_SIZE};
+      vector<uint32_t> starts;
+      for (size_t i; (i = next.fetch_add(1, std::memory_order_relaxed)) <
+                         chunks && !failed.load(std::memory_order_relaxed);) {
+        if (!scanChunk(handle, i, buffer, starts))
+          failed.store(true, std::memory_order_relaxed);
+      }
+    };
+    array<helper> pool{threads - 1};
+    for (auto &h : pool)
+      h.thread = std::thread{worker};
+    worker();
+    for (auto &h : pool)
+      h.thread.join();
+    return !failed.load(std::memory_order_relaxed);
+  }
+  bool scanChunk(int handle, size_t index, array<char> &buffer,
+                 vector<uint32_t> &starts) {
+    auto const begin = uint64_t{index} * CHUNK_SIZE;
+    auto const length = min(CHUNK_SIZE, m_fileSize - begin);
+    starts.clear();
+    for (uint64_t done = 0; done != length;) {
+      auto const want =
+          static_cast<size_t>(min(uint64_t{READ_SIZE}, length - done));
+      if (!readAt(handle, buffer.data(), want, begin + done))
+        return false;
+      simd::for_each_byte(buffer.data(), want, '\n', [&](size_t at) {
+        starts.append(static_cast<uint32_t>(done + at + 1));
+      });
+      done += want;
+    }
+    m_chunks[index].starts = elias_fano{starts.data(), starts.size(), length};
+    return true;
+  }
+  // Recomputes the per-chunk line numbering and the line count.
+  void number() {
+    size_t starts = 0;
+    for (auto &chunk : m_chunks) {
+      chunk.first = starts;
+      starts += chunk.starts.size();
+    }
+    if (m_fileSize == 0) {
+      m_lines = 0;
+      return;
+    }
+    // A newline as the very last byte does not start another line.
+    auto const last = m_chunks.capacity() - 1;
+    auto const &tail = m_chunks[last].starts;
+    bool const trailing =
+        tail.size() != 0 &&
+        uint64_t{last} * CHUNK_SIZE + tail[tail.size() - 1] == m_fileSize;
+    m_lines = 1 + starts - trailing;
+  }
+
+  array<chunk> m_chunks;
+  size_t m_lines = 0;
+  uint64_t m_fileSize = 0;
+  int64_t m_mtime = 0;
+  uint64_t m_checksum = 0;
+  uint64_t m_scanned = 0;
+  // Sidecar mapping that unchanged chunks point into.
+  void *m_map = nullptr;
+  size_t m_mapSize = 0;
+};
+
+#endif // __linux__
+
+#endif // LINEINDEX_HPP
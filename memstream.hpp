@@ -0,0 +1,281 @@
+#ifndef MEMSTREAM_HPP
+#define MEMSTREAM_HPP
+
+#include "streams.hpp"
+
+// Streams over memory with the readline/readUntil/read/write/seek interface
+// of the file streams, for tests and for handing data between pipeline
+// stages without a syscall:
+//
+//   omemstream out;
+//   out.write("first\nsecond\n");
+//   imemstream in{static_cast<omemstream &&>(out)};  // takes the buffer over
+//   auto line = in.readline();
+//
+// The reader works on the caller's memory in place and the writer appends
+// straight into its own buffer; neither has a staging buffer in between.
+// As with the file streams, positions are in bytes. Both meet input_stream
+// and output_stream, so layers such as utf16_reader or lz_ofstream run over
+// memory as they do over files.
+
+template <character_type T> class basic_omemstream;
+
+template <character_type T> class basic_imemstream {
+public:
+  using char_type = T;
+
+  // Reads the `size` elements at `data`, which must outlive the stream.
+  basic_imemstream(T const *data, size_t size) : m_data{data}, m_size{size} {}
+  // Reads, and owns, the first `size` elements of `data`.
+  basic_imemstream(array<T> &&data, size_t size)
+      : m_owned{forward<array<T>>(data)}, m_data{m_owned.data()},
+        m_size{size} {}
+  // Reads what `written` wrote, taking its buffer over.
+  explicit basic_imemstream(basic_omemstream<T> &&written)
+      : basic_imemstream{written.release()} {}
+  basic_imemstream(basic_imemstream const &) = delete;
+  basic_imemstream &operator=(basic_imemstream const &) = delete;
+
+  ssize_t rseek(ssize_t offset, IOPos position) {
+    ssize_t base = 0;
+    if (position == IOPos::CUR)
+      base = tellr();
+    else if (position == IOPos::END)
+      base = tellend();
+    auto const target = base + offset;
+    if (target < 0)
+      return -1l;
+    m_pos = min(static_cast<size_t>(target) / sizeof(T), m_size);
+    return tellr();
+  }
+  ssize_t tellr() const { return static_cast<ssize_t>(m_pos * sizeof(T)); }
+  ssize_t tellend() const { return static_cast<ssize_t>(m_size * sizeof(T)); }
+  bool eof() const { return m_pos == m_size; }
+  // Memory never has to be waited for.
+  bool wouldBlock() const { return false; }
+  // Elements not read yet, in place.
+  T const *data() const { return m_data + m_pos; }
+  size_t remaining() const { return m_size - m_pos; }
+
+  static bool is_nl(T ch) { return ch == '\n'; }
+  // Next line with its newline, pointing into the stream's memory; valid
+  // while the memory is. {nullptr, 0} at the end.
+  pair<T const *, size_t> readline_view() {
+    if (eof())
+      return {nullptr, 0ul};
+    auto const n = scan(&is_nl, remaining()).first;
+    auto const *line = data();
+    m_pos += n;
+    return {line, n};
+  }
+  pair<array<T>, size_t> readline() { return readUntil(&is_nl); }
+  pair<array<T>, size_t> readUntil(bool (*predicate)(T)) {
+    auto const n = scan(predicate, remaining()).first;
+    array<T> result{data(), n};
+    m_pos += n;
+    return {result, n};
+  }
+  pair<size_t, bool> readUntil(array<T> &buffer, bool (*predicate)(T),
+                               bool firstReq = true) {
+    return readUntil(buffer, 0, buffer.capacity(), predicate, firstReq);
+  }
+  pair<size_t, bool> readUntil(array<T> &buffer, size_t start, size_t size,
+                               bool (*predicate)(T), bool = true) {
+    auto const found = scan(predicate, min(size, remaining()));
+    memcpy(buffer.data() + start, data(), found.first * sizeof(T));
+    m_pos += found.first;
+    return found;
+  }
+  // Up to and including the first occurrence of delimiter[0, length), in
+  // place; valid while the memory is. {nullptr, 0} at the end.
+  pair<T const *, size_t> readUntil_view(T const *delimiter, size_t length) {
+    if (eof())
+      return {nullptr, 0ul};
+    auto const n = scan(delimiter, length, remaining()).first;
+    auto const *run = data();
+    m_pos += n;
+    return {run, n};
+  }
+  pair<array<T>, size_t> readUntil(T const *delimiter, size_t length) {
+    auto const n = scan(delimiter, length, remaining()).first;
+    array<T> result{data(), n};
+    m_pos += n;
+    return {result, n};
+  }
+  pair<array<T>, size_t> readUntil(T const *delimiter) {
+    return readUntil(delimiter, stringlen(delimiter));
+  }
+  pair<size_t, bool> readUntil(array<T> &buffer, T const *delimiter,
+                               size_t length, bool firstReq = true) {
+    return readUntil(buffer, 0, buffer.capacity(), delimiter, length,
+                     firstReq);
+  }
+  // A buffer filled without a match stops short of a tail that could begin
+  // the delimiter, so the next call finds a delimiter straddling the two.
+  pair<size_t, bool> readUntil(array<T> &buffer, size_t start, size_t size,
+                               T const *delimiter, size_t length,
+                               bool = true) {
+    auto found = scan(delimiter, length, min(size, remaining()));
+    if (!found.second && found.first == size && size > 1)
+      found.first -= simd::partial_sequence(data() + 1, size - 1, delimiter,
+                                            length);
+    memcpy(buffer.data() + start, data(), found.first * sizeof(T));
+    m_pos += found.first;
+    return found;
+  }
+  size_t read(array<T> &buffer, size_t size, bool firstReq = true) {
+    return read(buffer, 0, size, firstReq);
+  }
+  size_t read(array<T> &buffer, size_t start, size_t size, bool = true) {
+    auto const n = min(size, remaining());
+    memcpy(buffer.data() + start, data(), n * sizeof(T));
+    m_pos += n;
+    return n;
+  }
+  // Like ifstream::readSome(): at most `size` elements into `data`.
+  size_t readSome(T *data, size_t size, bool = true) {
+    auto const n = min(size, remaining());
+    memcpy(data, this->data(), n * sizeof(T));
+    m_pos += n;
+    return n;
+  }
+  // The last `count` elements (all of them if there are fewer), whatever
+  // the read position.
+  pair<array<T>, size_t> read_last(size_t count) const {
+    count = min(count, m_size);
+    return {array<T>{m_data + m_size - count, count}, count};
+  }
+  // Writes everything not read yet to `sink`, straight from memory.
+  template <typename Sink> size_t copy_to(Sink &sink) {
+    auto const written = sink.write(data(), remaining());
+    m_pos += written;
+    return written;
+  }
+
+private:
+  basic_imemstream(pair<array<T>, size_t> &&released)
+      : basic_imemstream{forward<array<T>>(released.first), released.second} {}
+
+  // Length of the run up to and including the first element matching
+  // `predicate` within the next `limit`, and whether one was found.
+  pair<size_t, bool> scan(bool (*predicate)(T), size_t limit) const {
+    auto const *p = data();
+    if constexpr (sizeof(T) == 1) {
+      if (predicate == &is_nl) {
+        auto const *nl = static_cast<T const *>(memchr(p, '\n', limit));
+        return nl == nullptr ? pair<size_t, bool>{limit, false}
+                             : pair<size_t, bool>{
+                                   static_cast<size_t>(nl - p) + 1, true};
+      }
+    }
+    for (size_t i = 0; i < limit; ++i)
+      if (invoke(predicate, p[i]))
+        return {i + 1, true};
+    return {limit, false};
+  }
+  // The same for a delimiter sequence, which has to end within `limit`.
+  pair<size_t, bool> scan(T const *delimiter, size_t length,
+                          size_t limit) const {
+    auto const at = simd::find_sequence(data(), limit, delimiter, length);
+    return at == limit && length != 0
+               ? pair<size_t, bool>{limit, false}
+               : pair<size_t, bool>{at + length, true};
+  }
+
+  array<T> m_owned;
+  T const *m_data;
+  size_t m_size;
+  size_t m_pos = 0;
+};
+
+template <character_type T> class basic_omemstream {
+public:
+  using char_type = T;
+
+  basic_omemstream() = default;
+  explicit basic_omemstream(size_t capacity) : m_data{capacity} {}
+  basic_omemstream(basic_omemstream const &) = delete;
+  basic_omemstream &operator=(basic_omemstream const &) = delete;
+  basic_omemstream(basic_omemstream &&move)
+      : m_data{forward<array<T>>(move.m_data)}, m_size{move.m_size},
+        m_pos{move.m_pos} {
+    move.m_size = move.m_pos = 0;
+  }
+
+  ssize_t wseek(ssize_t offset, IOPos position) {
+    ssize_t base = 0;
+    if (position == IOPos::CUR)
+      base = tellw();
+    else if (position == IOPos::END)
+      base = static_cast<ssize_t>(m_size * sizeof(T));
+    auto const target = base + offset;
+    if (target < 0)
+      return -1l;
+    // Like a file, seeking past the end leaves a zero-filled gap once
+    // something is written there.
+    m_pos = static_cast<size_t>(target) / sizeof(T);
+    return tellw();
+  }
+  ssize_t tellw() const { return static_cast<ssize_t>(m_pos * sizeof(T)); }
+  // Nothing is ever buffered on the way to memory.
+  size_t pending() const { return 0ul; }
+  size_t flush() { return 0ul; }
+  // Like ofstream::tryWrite()/tryFlush(); memory never blocks or fails.
+  io_result tryWrite(T const *data, size_t size) {
+    return {write(data, size), IOStatus::OK, 0};
+  }
+  io_result tryFlush() { return {}; }
+
+  size_t write(T const *buffer) { return write(buffer, stringlen(buffer)); }
+  size_t write(array<T> const &buffer) {
+    return write(buffer, buffer.capacity());
+  }
+  size_t write(array<T> const &buffer, size_t size) {
+    return write(buffer, 0, size);
+  }
+  size_t write(array<T> const &buffer, size_t start, size_t size) {
+    return write(buffer.data() + start, size);
+  }
+  size_t write(T const *data, size_t size) {
+    reserve(m_pos + size);
+    if (m_pos > m_size)
+      memset(m_data.data() + m_size, 0, (m_pos - m_size) * sizeof(T));
+    memcpy(m_data.data() + m_pos, data, size * sizeof(T));
+    m_pos += size;
+    m_size = max(m_size, m_pos);
+    return size;
+  }
+  // Room for `size` elements, so that writes up to it do not reallocate.
+  void reserve(size_t size) {
+    if (size <= m_data.capacity())
+      return;
+    auto capacity = m_data.capacity() < 64 ? 64 : m_data.capacity();
+    while (capacity < size)
+      capacity <<= 1;
+    array<T> grown{capacity};
+    memcpy(grown.data(), m_data.data(), m_size * sizeof(T));
+    m_data = forward<array<T>>(grown);
+  }
+  T const *data() const { return m_data.data(); }
+  size_t size() const { return m_size; }
+  // Hands the buffer and the number of elements written over and starts
+  // empty.
+  pair<array<T>, size_t> release() {
+    pair<array<T>, size_t> result{forward<array<T>>(m_data), m_size};
+    m_size = m_pos = 0;
+    return result;
+  }
+  void clear() { m_size = m_pos = 0; }
+
+private:
+  array<T> m_data;
+  size_t m_size = 0;
+  size_t m_pos = 0;
+};
+
+using imemstream = basic_imemstream<char>;
+using omemstream = basic_omemstream<char>;
+using iwmemstream = basic_imemstream<short>;
+using owmemstream = basic_omemstream<short>;
+
+#endif // MEMSTREAM_HPP
@@ -0,0 +1,226 @@
+#ifndef MMAPSTREAM_HPP
+#define MMAPSTREAM_HPP
+
+#ifdef __linux__
+
+#include "streams.hpp"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Output stream that writes into a shared mapping of the file instead of
+// calling write() per buffer, for large sequential exports:
+//
+//   mmap_ofstream out{array<char>{"export.csv"}};
+//   while (...)
+//     out.write(row, size);
+//   out.close();                      // trims the file to what was written
+//
+// It has ofstream's write/wseek/tellw/flush, with offsets in bytes, so
+// callers written against those can switch over. Like ofstream it does not
+// truncate an existing file; data past what is written is kept.
+//
+// Disk space is reserved EXTENT bytes at a time with fallocate, so running
+// out of it shows up as a failed write rather than SIGBUS on a page fault
+// (file systems without fallocate fall back to a sparse file). The
+// reservation keeps the file's size; the size is raised with ftruncate
+// SIZE_STEP bytes ahead of the writes, so readers of the growing file, or
+// what is left of it after a crash, see at most that much zero padding.
+// Every
+// SYNC_CHUNK bytes written, writeback of them is started with
+// sync_file_range and the chunk before is waited for and dropped from the
+// mapping, which bounds both dirty page cache and resident memory.
+template <character_type T> class basic_mmap_ofstream {
+public:
+  static constexpr size_t EXTENT = size_t{64} << 20;
+  static constexpr size_t SYNC_CHUNK = size_t{8} << 20;
+  static constexpr size_t SIZE_STEP = size_t{1} << 20;
+
+  explicit basic_mmap_ofstream(array<T> const &filename) {
+    m_fd = ::open(filename.data(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (m_fd == -1) {
+      invoke(file_error_handler, __FILE__, __FUNCTION__);
+      return;
+    }
+    struct stat info;
+    if (fstat(m_fd, &info) == -1) {
+      invoke(file_error_handler, __FILE__, __FUNCTION__);
+      return;
+    }
+    m_size = m_fileSize = static_cast<size_t>(info.st_size);
+    if (m_size != 0)
+      map(m_size);
+  }
+  basic_mmap_ofstream(basic_mmap_ofstream const &) = delete;
+  basic_mmap_ofstream &operator=(basic_mmap_ofstream const &) = delete;
+  ~basic_mmap_ofstream() { close(); }
+
+  bool isOpen() const { return m_fd != -1; }
+
+  size_t write(array<T> const &buffer) {
+    return write(buffer.data(), buffer.capacity());
+  }
+  size_t write(array<T> const &buffer, size_t size) {
+    return write(buffer, 0, size);
+  }
+  size_t write(array<T> const &buffer, size_t start, size_t size) {
+    return write(buffer.data() + start, size);
+  }
+  size_t write(T const *data) { return write(data, stringlen(data)); }
+  // Copies `size` elements into the mapping, growing the file first if
+  // needed. Returns the elements written: `size`, or 0 if the file could not
+  // be grown.
+  size_t write(T const *data, size_t size) {
+    auto const bytes = size * sizeof(T);
+    if (bytes == 0 || !isOpen())
+      return 0ul;
+    auto const end = m_pos + bytes;
+    if ((end > m_capacity && !grow(end)) ||
+        (end > m_fileSize && !resize(end))) {
+      invoke(file_error_handler, __FILE__, __FUNCTION__);
+      return 0ul;
+    }
+    memcpy(m_data + m_pos, data, bytes);
+    m_pos += bytes;
+    m_size = max(m_size, m_pos);
+    if (m_pos >= m_started + SYNC_CHUNK)
+      writeback(m_pos);
+    return size;
+  }
+  // Byte offsets, as for ofstream. Seeking past the end leaves a zero-filled
+  // gap once something is written there.
+  ssize_t wseek(ssize_t offset, IOPos position) {
+    ssize_t base = 0;
+    if (position == IOPos::CUR)
+      base = tellw();
+    else if (position == IOPos::END)
+      base = static_cast<ssize_t>(m_size);
+    auto const target = base + offset;
+    if (target < 0 || !isOpen())
+      return -1l;
+    m_pos = static_cast<size_t>(target);
+    return tellw();
+  }
+  ssize_t tellw() const { return static_cast<ssize_t>(m_pos); }
+  // Starts writeback of everything written so far without waiting for it.
+  // Returns the elements handed to the kernel.
+  size_t flush() {
+    if (!isOpen() || m_size == m_started)
+      return 0ul;
+    auto const from = min(m_started, m_size);
+    ::sync_file_range(m_fd, static_cast<off_t>(from),
+                      static_cast<off_t>(m_size - from),
+                      SYNC_FILE_RANGE_WRITE);
+    m_started = m_size;
+    return (m_size - from) / sizeof(T);
+  }
+  // Writes everything out and waits until it is on disk.
+  bool sync() {
+    if (!isOpen())
+      return false;
+    if (m_data != nullptr && ::msync(m_data, m_capacity, MS_SYNC) == -1)
+      return false;
+    return ::fdatasync(m_fd) != -1;
+  }
+  // Unmaps the file and trims it, and the space reserved past it, to its
+  // size: the end of what was written, or the old size if that was larger.
+  // Returns false if the trim failed.
+  bool close() {
+    if (!isOpen())
+      return true;
+    bool ok = true;
+    if (m_data != nullptr)
+      ::munmap(m_data, m_capacity);
+    m_data = nullptr;
+    if (::ftruncate(m_fd, static_cast<off_t>(m_size)) == -1) {
+      invoke(file_error_handler, __FILE__, __FUNCTION__);
+      ok = false;
+    }
+    ::close(m_fd);
+    m_fd = -1;
+    return ok;
+  }
+
+private:
+  bool map(size_t capacity) {
+    auto *data = ::mmap(nullptr, capacity, PROT_READ | PROT_WRITE, MAP_SHARED,
+                        m_fd, 0);
+    if (data == MAP_FAILED) {
+      invoke(file_error_handler, __FILE__, __FUNCTION__);
+      return false;
+    }
+    m_data = static_cast<char *>(data);
+    m_capacity = capacity;
+    return true;
+  }
+  // Reserves disk space and extends the mapping to the next EXTENT boundary
+  // at or past `size` bytes, leaving the file's size as it is.
+  bool grow(size_t size) {
+    auto const capacity = (size + EXTENT - 1) / EXTENT * EXTENT;
+    if (::fallocate(m_fd, FALLOC_FL_KEEP_SIZE, static_cast<off_t>(m_capacity),
+                    static_cast<off_t>(capacity - m_capacity)) == -1 &&
+        errno != EOPNOTSUPP)
+      return false;
+    if (m_data == nullptr)
+      return map(capacity);
+    auto *data = ::mremap(m_data, m_capacity, capacity, MREMAP_MAYMOVE);
+    if (data == MAP_FAILED)
+      return false;
+    m_data = static_cast<char *>(data);
+    m_capacity = capacity;
+    return true;
+  }
+  // Raises the file's size to the next SIZE_STEP boundary at or past `size`
+  // bytes, within the mapping, so that the pages written are backed.
+  bool resize(size_t size) {
+    auto const fileSize =
+        min((size + SIZE_STEP - 1) / SIZE_STEP * SIZE_STEP, m_capacity);
+    if (::ftruncate(m_fd, static_cast<off_t>(fileSize)) == -1)
+      return false;
+    m_fileSize = fileSize;
+    return true;
+  }
+  // Starts writeback of [m_started, end), then waits for the chunk started
+  // before it and drops its pages from the mapping; they stay in the page
+  // cache, and are faulted back in if written again.
+  void writeback(size_t end) {
+    ::sync_file_range(m_fd, static_cast<off_t>(m_started),
+                      static_cast<off_t>(end - m_started),
+                      SYNC_FILE_RANGE_WRITE);
+    if (m_started > m_waited) {
+      ::sync_file_range(m_fd, static_cast<off_t>(m_waited),
+                        static_cast<off_t>(m_started - m_waited),
+                        SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE |
+                            SYNC_FILE_RANGE_WAIT_AFTER);
+      auto const page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+      auto const begin = (m_waited + page - 1) / page * page;
+      auto const stop = m_started / page * page;
+      if (stop > begin)
+        ::madvise(m_data + begin, stop - begin, MADV_DONTNEED);
+    }
+    m_waited = m_started;
+    m_started = end;
+  }
+
+  int m_fd = -1;
+  char *m_data = nullptr;
+  // Bytes mapped, the stream's size (the file's old size or the end of what
+  // was written, whichever is larger), the file's size for now and the write
+  // position.
+  size_t m_capacity = 0;
+  size_t m_size = 0;
+  size_t m_fileSize = 0;
+  size_t m_pos = 0;
+  // Writeback was started for [m_waited, m_started) and has completed
+  // below m_waited.
+  size_t m_started = 0;
+  size_t m_waited = 0;
+};
+
+using mmap_ofstream = basic_mmap_ofstream<char>;
+
+#endif // __linux__
+
+#endif // MMAPSTREAM_HPP
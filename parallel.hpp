@@ -0,0 +1,312 @@
+#ifndef PARALLEL_HPP
+#define PARALLEL_HPP
+
+#ifdef __linux__
+
+#include "streams.hpp"
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+// Runs a function over every line of a file on all cores:
+//
+//   std::atomic<size_t> errors{0};
+//   parallel_for_lines("app.log", [&](char const *line, size_t size) {
+//     if (size >= 5 && memcmp(line, "ERROR", 5) == 0)
+//       ++errors;
+//   });
+//
+// The file is mapped once and cut into byte ranges. A line belongs to the
+// range it starts in, so each range is realigned to the first line start at
+// or after its beginning and runs past its end to finish its last line.
+// Lines are passed with their newline, if they have one.
+
+// Output produced for one range, written out in input order by the ordered
+// form of parallel_for_lines.
+class line_output {
+public:
+  void write(char const *data, size_t size) {
+    if (m_size + size > m_buffer.capacity()) {
+      auto capacity = m_buffer.capacity() == 0 ? 4096 : m_buffer.capacity();
+      while (capacity < m_size + size)
+        capacity <<= 1;
+      array<char> grown{capacity};
+      memcpy(grown.data(), m_buffer.data(), m_size);
+      m_buffer = forward<array<char>>(grown);
+    }
+    memcpy(m_buffer.data() + m_size, data, size);
+    m_size += size;
+  }
+  void write(char const *text) { write(text, stringlen(text)); }
+  array<char> const &buffer() const { return m_buffer; }
+  size_t size() const { return m_size; }
+  // Releases the buffer.
+  void reset() {
+    m_buffer = array<char>{};
+    m_size = 0;
+  }
+
+private:
+  array<char> m_buffer;
+  size_t m_size = 0;
+};
+
+namespace parallel_detail {
+
+// Smallest and largest range handed to a worker at once.
+inline constexpr size_t MIN_RANGE = size_t{64} << 10;
+inline constexpr size_t MAX_RANGE = size_t{4} << 20;
+
+struct helper {
+  std::thread thread;
+};
+
+// Read-only mapping of a whole file, opened through ifstream.
+class mapped_file {
+public:
+  explicit mapped_file(char const *path) : m_stream{array<char>{path}} {
+    struct stat info;
+    if (fstat(m_stream.getHandle(), &info) == -1) {
+      invoke(file_error_handler, __FILE__, __FUNCTION__);
+      return;
+    }
+    m_size = static_cast<size_t>(info.st_size);
+    m_ok = true;
+    if (m_size == 0)
+      return;
+    auto *data = ::mmap(nullptr, m_size, PROT_READ, MAP_PRIVATE,
+                        m_stream.getHandle(), 0);
+    if (data == MAP_FAILED) {
+      invoke(file_error_handler, __FILE__, __FUNCTION__);
+      m_ok = false;
+      return;
+    }
+    ::madvise(data, m_size, MADV_SEQUENTIAL);
+    m_data = static_cast<char const *>(data);
+  }
+  mapped_file(mapped_file const &) = delete;
+  mapped_file &operator=(mapped_file const &) = delete;
+  ~mapped_file() {
+    if (m_data != nullptr)
+      ::munmap(const_cast<char *>(m_data), m_size);
+  }
+  bool ok() const { return m_ok; }
+  char const *data() const { return m_data; }
+  size_t size() const { return m_size; }
+
+private:
+  ifstream m_stream;
+  char const *m_data = nullptr;
+  size_t m_size = 0;
+  bool m_ok = false;
+};
+
+inline size_t worker_count(size_t threads) {
+  if (threads == 0)
+    threads = std::thread::hardware_concurrency();
+  return threads == 0 ? 1 : threads;
+}
+inline size_t range_size(size_t size, size_t workers) {
+  auto const even = size / (workers * 16);
+  return even < MIN_RANGE ? MIN_RANGE : even > MAX_RANGE ? MAX_RANGE : even;
+}
+
+// Calls `fn` for every line of data[0, size) that starts in [begin, end).
+// Only the range a line starts in reads past its end, so a line spanning
+// many ranges is scanned once rather than once per range.
+template <typename F>
+void for_lines_in(char const *data, size_t size, size_t begin, size_t end,
+                  F &fn) {
+  auto pos = begin;
+  if (begin != 0) {
+    // A line starts at p when data[p - 1] is a newline.
+    auto const *nl = static_cast<char const *>(
+        memchr(data + begin - 1, '\n', end - begin));
+    if (nl == nullptr)
+      return;
+    pos = static_cast<size_t>(nl - data) + 1;
+  }
+  while (pos < end) {
+    auto const *nl =
+        static_cast<char const *>(memchr(data + pos, '\n', size - pos));
+    auto const stop = nl == nullptr ? size : static_cast<size_t>(nl - data) + 1;
+    fn(data + pos, stop - pos);
+    pos = stop;
+  }
+}
+
+// Ranges [0, count) dealt out to workers in contiguous runs. A worker takes
+// ranges from the front of its own run; once that is empty it steals the
+// back half of another worker's run, so a worker stuck on long lines only
+// keeps what it is working on. Runs are packed as (begin << 32 | end) and
+// changed with compare-and-swap only.
+class range_deques {
+public:
+  range_deques(size_t workers, size_t count) : m_runs{workers} {
+    for (size_t i = 0; i < workers; ++i)
+      m_runs[i].bounds.store(pack(count * i / workers, count * (i + 1) / workers),
+                             std::memory_order_relaxed);
+  }
+  bool take(size_t worker, size_t &range) {
+    if (popFront(worker, range))
+      return true;
+    for (size_t i = 1; i < m_runs.capacity(); ++i)
+      if (steal((worker + i) % m_runs.capacity(), worker))
+        return popFront(worker, range) || take(worker, range);
+    return false;
+  }
+
+private:
+  struct run {
+    std::atomic<uint64_t> bounds{0};
+  };
+  static uint64_t pack(size_t begin, size_t end) {
+    return uint64_t{begin} << 32 | end;
+  }
+  static size_t begin(uint64_t bounds) {
+    return static_cast<size_t>(bounds >> 32);
+  }
+  static size_t end(uint64_t bounds) {
+    return static_cast<size_t>(bounds & 0xffffffffu);
+  }
+  bool popFront(size_t worker, size_t &range) {
+    auto &bounds = m_runs[worker].bounds;
+    auto current = bounds.load(std::memory_order_acquire);
+    while (begin(current) < end(current)) {
+      if (bounds.compare_exchange_weak(current,
+                                       pack(begin(current) + 1, end(current)),
+                                       std::memory_order_acq_rel)) {
+        range = begin(current);
+        return true;
+      }
+    }
+    return false;
+  }
+  bool steal(size_t victim, size_t thief) {
+    auto &bounds = m_runs[victim].bounds;
+    auto current = bounds.load(std::memory_order_acquire);
+    while (begin(current) < end(current)) {
+      auto const mid = begin(current) + (end(current) - begin(current)) / 2;
+      if (bounds.compare_exchange_weak(current, pack(begin(current), mid),
+                                       std::memory_order_acq_rel)) {
+        // Only its owner refills an empty run, so a plain store is safe.
+        m_runs[thief].bounds.store(pack(mid, end(current)),
+                                   std::memory_order_release);
+        return true;
+      }
+    }
+    return false;
+  }
+
+  array<run> m_runs;
+};
+
+} // namespace parallel_detail
+
+// Calls `fn(line, size)` for every line of the file at `path` from `threads`
+// threads (0 picks one per core), in no particular order. Returns false if
+// the file could not be opened or mapped.
+template <typename F>
+bool parallel_for_lines(char const *path, F &&fn, size_t threads = 0) {
+  using namespace parallel_detail;
+  mapped_file file{path};
+  if (!file.ok() || file.size() == 0)
+    return file.ok();
+  auto const workers = worker_count(threads);
+  auto const step = range_size(file.size(), workers);
+  auto const ranges = (file.size() + step - 1) / step;
+  range_deques deques{workers, ranges};
+  auto work = [&](size_t worker) {
+    for (size_t range; deques.take(worker, range);) {
+      auto const begin = range * step;
+      auto const end = min(begin + step, file.size());
+      for_lines_in(file.data(), file.size(), begin, end, fn);
+    }
+  };
+  array<helper> pool{workers - 1};
+  for (size_t i = 0; i < pool.capacity(); ++i)
+    pool[i].thread = std::thread{work, i + 1};
+  work(0);
+  for (auto &h : pool)
+    h.thread.join();
+  return true;
+}
+
+// Ordered form: `fn(line, size, output)` writes whatever it produces for a
+// line to `output`, and the output of every range is written to `out` in
+// input order from the calling thread. Only a few ranges per thread may run
+// ahead of the oldest unwritten one, which bounds the memory held.
+template <typename F>
+bool parallel_for_lines(char const *path, ofstream &out, F &&fn,
+                        size_t threads = 0) {
+  using namespace parallel_detail;
+  mapped_file file{path};
+  if (!file.ok() || file.size() == 0)
+    return file.ok();
+  auto const workers = worker_count(threads);
+  auto const step = range_size(file.size(), workers);
+  auto const ranges = (file.size() + step - 1) / step;
+  auto const window = workers * 4;
+  array<line_output> outputs{ranges};
+  array<bool> done{ranges};
+  for (auto &flag : done)
+    flag = false;
+  std::mutex lock;
+  std::condition_variable changed;
+  size_t next = 0;
+  size_t written = 0;
+  auto work = [&] {
+    for (;;) {
+      size_t range;
+      {
+        std::unique_lock<std::mutex> guard{lock};
+        changed.wait(guard,
+                     [&] { return next == ranges || next < written + window; });
+        if (next == ranges)
+          return;
+        range = next++;
+      }
+      auto &output = outputs[range];
+      auto emit = [&](char const *line, size_t size) { fn(line, size, output); };
+      auto const begin = range * step;
+      for_lines_in(file.data(), file.size(), begin,
+                   min(begin + step, file.size()), emit);
+      {
+        std::lock_guard<std::mutex> guard{lock};
+        done[range] = true;
+      }
+      changed.notify_all();
+    }
+  };
+  array<helper> pool{workers};
+  for (auto &h : pool)
+    h.thread = std::thread{work};
+  while (written != ranges) {
+    {
+      std::unique_lock<std::mutex> guard{lock};
+      changed.wait(guard, [&] { return done[written]; });
+    }
+    auto &output = outputs[written];
+    if (output.size() != 0)
+      out.write(output.buffer(), 0, output.size());
+    output.reset();
+    {
+      std::lock_guard<std::mutex> guard{lock};
+      ++written;
+    }
+    changed.notify_all();
+  }
+  for (auto &h : pool)
+    h.thread.join();
+  out.flush();
+  return true;
+}
+
+#endif // __linux__
+
+#endif // PARALLEL_HPP
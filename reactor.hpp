@@ -0,0 +1,457 @@
+#ifndef REACTOR_HPP
+#define REACTOR_HPP
+
+#ifdef __linux__
+
+#include "streams.hpp"
+
+#include <atomic>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <time.h>
+
+// Edge-triggered epoll event loop serving many non-blocking streams from one
+// thread. Run one reactor per thread to spread streams over a few cores; only
+// stop() and wake() may be called from other threads.
+//
+// Streams are switched to O_NONBLOCK when they are watched and must outlive
+// their registration. Callbacks may watch and unwatch freely, including the
+// registration that is currently being dispatched.
+//
+// A descriptor may be watched several times, e.g. by a reader and a writer
+// of one socket: epoll holds one entry per descriptor for everything its
+// registrations wait for, and each registration is called for its own
+// events. Descriptors epoll cannot watch, such as regular files, are always
+// ready; watching one returns null without reporting an error.
+class reactor {
+public:
+  using event_callback = void (*)(void *context, uint32_t events);
+  using timer_callback = void (*)(void *context);
+  template <typename T>
+  using line_callback = void (*)(void *context, basic_ifstream<T> &stream,
+                                 array<T> &line, size_t size);
+  template <typename T>
+  using eof_callback = void (*)(void *context, basic_ifstream<T> &stream);
+  template <typename T>
+  using drain_callback = void (*)(void *context, basic_ofstream<T> &stream);
+
+  struct registration;
+  struct handler {
+    virtual void onEvents(uint32_t events) = 0;
+    virtual ~handler() = default;
+
+    reactor *owner = nullptr;
+    int fd = -1;
+    uint32_t events = 0;
+    bool closed = false;
+    handler *prev = nullptr;
+    handler *next = nullptr;
+    // The descriptor's entry and the next handler on it.
+    registration *entry = nullptr;
+    handler *sibling = nullptr;
+  };
+  // What epoll knows about one descriptor: the union of the events its
+  // handlers wait for.
+  struct registration {
+    int fd = -1;
+    uint32_t events = 0;
+    handler *handlers = nullptr;
+    bool closed = false;
+  };
+  struct timer {
+    uint64_t deadline;
+    uint64_t interval;
+    timer_callback callback;
+    void *context;
+    bool cancelled = false;
+  };
+  using watch_id = handler *;
+  using timer_id = timer *;
+
+  reactor() {
+    m_epoll = epoll_create1(EPOLL_CLOEXEC);
+    if (m_epoll == -1) {
+      invoke(file_error_handler, __FILE__, __FUNCTION__);
+      return;
+    }
+    int efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (efd == -1) {
+      invoke(file_error_handler, __FILE__, __FUNCTION__);
+      return;
+    }
+    m_wakeup = attach(new wake_handler{}, efd, EPOLLIN);
+  }
+  reactor(reactor const &) = delete;
+  reactor &operator=(reactor const &) = delete;
+  ~reactor() {
+    int const wakefd = m_wakeup != nullptr ? m_wakeup->fd : -1;
+    while (m_live != nullptr)
+      unwatch(m_live);
+    collect();
+    if (wakefd != -1)
+      close(wakefd);
+    while (m_timers.size() != 0) {
+      delete m_timers.back();
+      m_timers.pop_back();
+    }
+    if (m_epoll != -1)
+      close(m_epoll);
+  }
+
+  // Calls `callback` with the epoll event mask every time `fd` becomes ready
+  // for `events` (EPOLLIN, EPOLLOUT, ...). The descriptor is not modified.
+  watch_id watch(int fd, uint32_t events, event_callback callback,
+                 void *context) {
+    return attach(new fd_handler{callback, context}, fd, events);
+  }
+  // Calls `onLine` for every complete line read from `stream`. A trailing
+  // line without a newline is delivered at end of file, followed by `onEof`
+  // (which may be null), after which the registration is removed.
+  template <typename T>
+  watch_id watchLines(basic_ifstream<T> &stream, line_callback<T> onLine,
+                      eof_callback<T> onEof, void *context) {
+    if (!makeNonBlocking(stream.getHandle()))
+      return nullptr;
+    return attach(new line_handler<T>{stream, onLine, onEof, context},
+                  stream.getHandle(), EPOLLIN | EPOLLRDHUP);
+  }
+  // Flushes `stream` whenever its handle becomes writable and calls `onDrain`
+  // once nothing is left pending in its buffer.
+  template <typename T>
+  watch_id watchDrain(basic_ofstream<T> &stream, drain_callback<T> onDrain,
+                      void *context) {
+    if (!makeNonBlocking(stream.getHandle()))
+      return nullptr;
+    return attach(new drain_handler<T>{stream, onDrain, context},
+                  stream.getHandle(), EPOLLOUT);
+  }
+  void unwatch(watch_id id) {
+    if (id == nullptr || id->closed)
+      return;
+    detach(id);
+    id->closed = true;
+    --m_watching;
+    if (id->prev != nullptr)
+      id->prev->next = id->next;
+    else
+      m_live = id->next;
+    if (id->next != nullptr)
+      id->next->prev = id->prev;
+    // Events for it may still be queued in the batch being dispatched.
+    m_graveyard.append(id);
+  }
+  // Registered streams and descriptors, not counting the internal wakeup.
+  size_t watching() const { return m_watching - (m_wakeup != nullptr); }
+
+  // Runs `callback` after `milliseconds`, and then every `milliseconds` if
+  // `repeat` is set, until cancelled. A one-shot timer's id is invalid once
+  // it has fired.
+  timer_id addTimer(uint64_t milliseconds, timer_callback callback,
+                    void *context, bool repeat = false) {
+    uint64_t const interval = milliseconds * 1000000u;
+    auto *t = new timer{now() + interval, repeat ? interval : 0, callback,
+                        context};
+    pushTimer(t);
+    return t;
+  }
+  void cancelTimer(timer_id id) {
+    if (id != nullptr)
+      id->cancelled = true;
+  }
+
+  // Waits up to `timeoutMs` (-1 = until something happens) and dispatches
+  // whatever became ready. Returns the number of callbacks invoked.
+  int runOnce(int timeoutMs = -1) {
+    int wait = timeoutMs;
+    if (auto *next = nextTimer()) {
+      auto const current = now();
+      auto const due =
+          next->deadline > current
+              ? static_cast<int>((next->deadline - current + 999999) / 1000000)
+              : 0;
+      if (wait < 0 || due < wait)
+        wait = due;
+    }
+    epoll_event events[MAX_EVENTS];
+    int ready = epoll_wait(m_epoll, events, MAX_EVENTS, wait);
+    if (ready == -1) {
+      if (errno != EINTR)
+        invoke(file_error_handler, __FILE__, __FUNCTION__);
+      ready = 0;
+    }
+    int dispatched = 0;
+    for (int i = 0; i < ready; ++i) {
+      auto *entry = static_cast<registration *>(events[i].data.ptr);
+      auto const happened = events[i].events;
+      // Handlers removed meanwhile keep their sibling link until collect().
+      for (auto *h = entry->closed ? nullptr : entry->handlers; h != nullptr;
+           h = h->sibling) {
+        if (h->closed || (happened & (h->events | EPOLLERR | EPOLLHUP)) == 0)
+          continue;
+        h->onEvents(happened);
+        ++dispatched;
+      }
+    }
+    dispatched += fireTimers();
+    collect();
+    return dispatched;
+  }
+  void run() {
+    m_stopped.store(false, std::memory_order_relaxed);
+    while (!m_stopped.load(std::memory_order_acquire))
+      runOnce(-1);
+  }
+  void stop() {
+    m_stopped.store(true, std::memory_order_release);
+    wake();
+  }
+  static bool makeNonBlocking(int fd) {
+    int flags = fcntl(fd, F_GETFL);
+    if (flags == -1 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) == -1) {
+      invoke(file_error_handler, __FILE__, __FUNCTION__);
+      return false;
+    }
+    return true;
+  }
+  // Interrupts a blocked runOnce() from any thread.
+  void wake() {
+    uint64_t const one = 1;
+    if (m_wakeup != nullptr &&
+        ::write(m_wakeup->fd, &one, sizeof(one)) == -1 && errno != EAGAIN)
+      invoke(file_error_handler, __FILE__, __FUNCTION__);
+  }
+
+private:
+  static constexpr int MAX_EVENTS = 256;
+
+  struct wake_handler : handler {
+    void onEvents(uint32_t) override {
+      uint64_t count;
+      while (::read(fd, &count, sizeof(count)) > 0)
+        ;
+    }
+  };
+  struct fd_handler : handler {
+    fd_handler(event_callback cb, void *ctx) : callback{cb}, context{ctx} {}
+    void onEvents(uint32_t events) override { invoke(callback, context, events); }
+    event_callback callback;
+    void *context;
+  };
+  template <typename T> struct line_handler : handler {
+    line_handler(basic_ifstream<T> &in, line_callback<T> cb, eof_callback<T> eof,
+                 void *ctx)
+        : stream{in}, onLine{cb}, onEof{eof}, context{ctx} {}
+    // Edge triggered: keep reading until the stream reports it would block.
+    void onEvents(uint32_t) override {
+      while (!closed) {
+        if (size == line.capacity()) {
+          array<T> grown{line.capacity() == 0 ? 64 : line.capacity() << 1};
+          memcpy(grown.data(), line.data(), size * sizeof(T));
+          line = forward<array<T>>(grown);
+        }
+        auto [got, found] = stream.readUntil(
+            line, size, line.capacity() - size, &basic_ifstream<T>::is_nl,
+            false);
+        size += got;
+        if (found) {
+          auto const complete = size;
+          size = 0;
+          invoke(onLine, context, stream, line, complete);
+          continue;
+        }
+        if (size == line.capacity())
+          continue;
+        if (stream.wouldBlock())
+          return;
+        if (size != 0) {
+          auto const complete = size;
+          size = 0;
+          invoke(onLine, context, stream, line, complete);
+        }
+        if (closed)
+          return;
+        owner->unwatch(this);
+        if (onEof != nullptr)
+          invoke(onEof, context, stream);
+        return;
+      }
+    }
+    basic_ifstream<T> &stream;
+    line_callback<T> onLine;
+    eof_callback<T> onEof;
+    void *context;
+    array<T> line{64};
+    size_t size = 0;
+  };
+  template <typename T> struct drain_handler : handler {
+    drain_handler(basic_ofstream<T> &out, drain_callback<T> cb, void *ctx)
+        : stream{out}, onDrain{cb}, context{ctx} {}
+    void onEvents(uint32_t) override {
+      if (stream.pending() != 0)
+        stream.flush();
+      if (stream.pending() == 0)
+        invoke(onDrain, context, stream);
+    }
+    basic_ofstream<T> &stream;
+    drain_callback<T> onDrain;
+    void *context;
+  };
+
+  static uint64_t now() {
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<uint64_t>(ts.tv_sec) * 1000000000u +
+           static_cast<uint64_t>(ts.tv_nsec);
+  }
+  handler *attach(handler *h, int fd, uint32_t events) {
+    h->owner = this;
+    h->fd = fd;
+    h->events = events;
+    auto *entry = fd >= 0 && static_cast<size_t>(fd) < m_entries.size()
+                      ? m_entries[static_cast<size_t>(fd)]
+                      : nullptr;
+    bool const added = entry == nullptr;
+    if (added)
+      entry = new registration{fd};
+    if (!control(added ? EPOLL_CTL_ADD : EPOLL_CTL_MOD, entry,
+                 entry->events | events)) {
+      // Regular files cannot be watched and are always ready.
+      if (errno != EPERM)
+        invoke(file_error_handler, __FILE__, __FUNCTION__);
+      if (added)
+        delete entry;
+      delete h;
+      return nullptr;
+    }
+    if (added) {
+      while (m_entries.size() <= static_cast<size_t>(fd))
+        m_entries.append(nullptr);
+      m_entries[static_cast<size_t>(fd)] = entry;
+    }
+    h->entry = entry;
+    h->sibling = entry->handlers;
+    entry->handlers = h;
+    h->next = m_live;
+    if (m_live != nullptr)
+      m_live->prev = h;
+    m_live = h;
+    ++m_watching;
+    return h;
+  }
+  bool control(int op, registration *entry, uint32_t events) {
+    epoll_event ev{};
+    ev.events = events | EPOLLET;
+    ev.data.ptr = entry;
+    if (epoll_ctl(m_epoll, op, entry->fd, &ev) == -1)
+      return false;
+    entry->events = events;
+    return true;
+  }
+  // Takes `h` off its descriptor, narrowing what epoll waits for to what the
+  // remaining handlers want, or dropping the descriptor with the last one.
+  void detach(handler *h) {
+    auto *entry = h->entry;
+    uint32_t events = 0;
+    handler **link = &entry->handlers;
+    while (*link != nullptr) {
+      if (*link == h)
+        *link = h->sibling;
+      else {
+        events |= (*link)->events;
+        link = &(*link)->sibling;
+      }
+    }
+    if (entry->handlers != nullptr) {
+      if (events != entry->events)
+        control(EPOLL_CTL_MOD, entry, events);
+      return;
+    }
+    epoll_ctl(m_epoll, EPOLL_CTL_DEL, entry->fd, nullptr);
+    m_entries[static_cast<size_t>(entry->fd)] = nullptr;
+    entry->closed = true;
+    m_closedEntries.append(entry);
+  }
+  void collect() {
+    while (m_graveyard.size() != 0) {
+      delete m_graveyard.back();
+      m_graveyard.pop_back();
+    }
+    while (m_closedEntries.size() != 0) {
+      delete m_closedEntries.back();
+      m_closedEntries.pop_back();
+    }
+  }
+
+  // Binary min-heap of timers ordered by deadline. Cancelled timers are
+  // dropped lazily when they reach the top.
+  static bool earlier(timer const *a, timer const *b) {
+    return a->deadline < b->deadline;
+  }
+  void pushTimer(timer *t) {
+    m_timers.append(t);
+    size_t i = m_timers.size() - 1;
+    while (i != 0 && earlier(m_timers[i], m_timers[(i - 1) / 2])) {
+      auto *tmp = m_timers[i];
+      m_timers[i] = m_timers[(i - 1) / 2];
+      m_timers[(i - 1) / 2] = tmp;
+      i = (i - 1) / 2;
+    }
+  }
+  timer *popTimer() {
+    auto *top = m_timers[0];
+    m_timers[0] = m_timers.back();
+    m_timers.pop_back();
+    size_t i = 0;
+    for (;;) {
+      size_t smallest = i;
+      for (size_t child = 2 * i + 1; child <= 2 * i + 2; ++child)
+        if (child < m_timers.size() &&
+            earlier(m_timers[child], m_timers[smallest]))
+          smallest = child;
+      if (smallest == i)
+        break;
+      auto *tmp = m_timers[i];
+      m_timers[i] = m_timers[smallest];
+      m_timers[smallest] = tmp;
+      i = smallest;
+    }
+    return top;
+  }
+  timer *nextTimer() {
+    while (m_timers.size() != 0 && m_timers[0]->cancelled)
+      delete popTimer();
+    return m_timers.size() != 0 ? m_timers[0] : nullptr;
+  }
+  int fireTimers() {
+    int fired = 0;
+    auto const current = now();
+    timer *t;
+    while ((t = nextTimer()) != nullptr && t->deadline <= current) {
+      popTimer();
+      invoke(t->callback, t->context);
+      ++fired;
+      if (t->interval != 0 && !t->cancelled) {
+        t->deadline = current + t->interval;
+        pushTimer(t);
+      } else {
+        delete t;
+      }
+    }
+    return fired;
+  }
+
+  int m_epoll = -1;
+  handler *m_wakeup = nullptr;
+  handler *m_live = nullptr;
+  size_t m_watching = 0;
+  vector<handler *> m_graveyard;
+  // Registrations by descriptor, and those dropped during dispatch.
+  vector<registration *> m_entries;
+  vector<registration *> m_closedEntries;
+  vector<timer *> m_timers;
+  std::atomic<bool> m_stopped{false};
+};
+
+#endif // __linux__
+
+#endif // REACTOR_HPP
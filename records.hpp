@@ -0,0 +1,294 @@
+#ifndef RECORDS_HPP
+#define RECORDS_HPP
+
+#include "streams.hpp"
+
+// Length-prefixed binary records over ifstream/ofstream or the memory
+// streams of memstream.hpp:
+//
+//   record_writer out{file, RecordPrefix::VARINT, true};   // with CRC32C
+//   out.write_record(event, size);                         // queued
+//   out.write_records(batch, count);    // queued ones and these, one write
+//
+//   record_reader in{source, RecordPrefix::VARINT, true};
+//   for (;;) {
+//     auto [record, status] = in.read_record();
+//     if (status != RecordStatus::OK)
+//       break;
+//     handle(record.data, record.size);
+//   }
+//
+// A record is its length (LEB128 varint or u32 little endian), the payload
+// and, if enabled, the CRC32C of the payload as u32 little endian. Both ends
+// must agree on the prefix and on the CRC.
+
+enum class RecordPrefix : int { VARINT = 0, FIXED32 = 1 };
+// TRUNCATED and CORRUPT are final; WOULD_BLOCK leaves the record unread so
+// the call can be repeated once the source is readable.
+enum class RecordStatus : int {
+  OK = 0,
+  END = 1,
+  WOULD_BLOCK = 2,
+  TRUNCATED = 3,
+  CORRUPT = 4
+};
+
+struct record_view {
+  char const *data = nullptr;
+  size_t size = 0;
+};
+
+namespace records {
+
+inline constexpr size_t MAX_VARINT = 10;
+inline constexpr size_t CRC_SIZE = 4;
+
+inline void store_u32(char *p, uint32_t value) {
+  for (size_t i = 0; i < 4; ++i)
+    p[i] = static_cast<char>(value >> (8 * i));
+}
+inline uint32_t load_u32(char const *p) {
+  uint32_t value = 0;
+  for (size_t i = 0; i < 4; ++i)
+    value |= uint32_t{static_cast<unsigned char>(p[i])} << (8 * i);
+  return value;
+}
+// Writes the length prefix of a `size` byte record and returns its length.
+inline size_t encode_prefix(char *p, RecordPrefix prefix, uint64_t size) {
+  if (prefix == RecordPrefix::FIXED32) {
+    store_u32(p, static_cast<uint32_t>(size));
+    return 4;
+  }
+  size_t count = 0;
+  for (; size >= 0x80; size >>= 7)
+    p[count++] = static_cast<char>(size | 0x80);
+  p[count++] = static_cast<char>(size);
+  return count;
+}
+
+} // namespace records
+
+// Frames records into one batch buffer so that many small records cost one
+// write. Queued records are written out by flush(), write_records(), once
+// BATCH bytes are queued, and on destruction. The sink needs tryWrite() and
+// tryFlush() besides the output_stream interface.
+#ifdef __cpp_concepts
+template <output_stream Sink = ofstream>
+#else
+template <typename Sink = ofstream>
+#endif
+class record_writer {
+public:
+  static constexpr size_t BATCH = size_t{64} << 10;
+
+  explicit record_writer(Sink &sink,
+                         RecordPrefix prefix = RecordPrefix::VARINT,
+                         bool crc = false)
+      : m_sink{sink}, m_prefix{prefix}, m_crc{crc} {}
+  record_writer(record_writer const &) = delete;
+  record_writer &operator=(record_writer const &) = delete;
+  ~record_writer() { flush(); }
+
+  // Queues one record. Returns false, queuing nothing, if the record is too
+  // long for the prefix.
+  bool write_record(char const *data, size_t size) {
+    if (!queue(data, size))
+      return false;
+    if (m_size >= BATCH)
+      flush();
+    return true;
+  }
+  // Queues `count` records and writes out everything queued with a single
+  // write and flush. A record too long for the prefix stops the batch before
+  // it with FAILED; the records before it are still written.
+  io_result write_records(record_view const *records, size_t count) {
+    size_t total = m_size;
+    size_t fit = 0;
+    for (; fit < count && fits(records[fit].size); ++fit)
+      total += framed(records[fit].size);
+    reserve(total);
+    for (size_t i = 0; i < fit; ++i)
+      queue(records[i].data, records[i].size);
+    auto const written = flush();
+    if (fit != count && written.ok())
+      return {written.count, IOStatus::FAILED, 0};
+    return written;
+  }
+  // Writes out the queued records and flushes the sink. On WOULD_BLOCK or
+  // FAILED whatever the sink did not take stays queued.
+  io_result flush() {
+    auto sent = m_sink.tryWrite(m_batch.data() + m_sent, m_size - m_sent);
+    m_sent += sent.count;
+    if (m_sent == m_size)
+      m_sent = m_size = 0;
+    if (!sent.ok())
+      return sent;
+    auto const flushed = m_sink.tryFlush();
+    return {sent.count, flushed.status, flushed.error};
+  }
+  // Bytes queued and not yet handed to the sink.
+  size_t pending() const { return m_size - m_sent; }
+
+private:
+  bool fits(size_t size) const {
+    return m_prefix == RecordPrefix::VARINT ||
+           uint64_t{size} <= uint64_t{0xffffffffu};
+  }
+  size_t framed(size_t size) const {
+    return records::MAX_VARINT + size + (m_crc ? records::CRC_SIZE : 0);
+  }
+  bool queue(char const *data, size_t size) {
+    if (!fits(size))
+      return false;
+    reserve(m_size + framed(size));
+    auto *out = m_batch.data() + m_size;
+    auto const header = records::encode_prefix(out, m_prefix, size);
+    if (size != 0)
+      memcpy(out + header, data, size);
+    if (m_crc)
+      records::store_u32(out + header + size, checksum::crc32c(0, data, size));
+    m_size += header + size + (m_crc ? records::CRC_SIZE : 0);
+    return true;
+  }
+  void reserve(size_t size) {
+    if (size <= m_batch.capacity())
+      return;
+    auto capacity = m_batch.capacity() == 0 ? size_t{4096} : m_batch.capacity();
+    while (capacity < size)
+      capacity <<= 1;
+    array<char> grown{capacity};
+    if (m_size != 0)
+      memcpy(grown.data(), m_batch.data(), m_size);
+    m_batch = forward<array<char>>(grown);
+  }
+
+  Sink &m_sink;
+  RecordPrefix m_prefix;
+  bool m_crc;
+  array<char> m_batch;
+  size_t m_size = 0;
+  size_t m_sent = 0;
+};
+
+// Reads records through a buffer of its own, filled straight from the
+// source with readSome(). A record is returned as a view into that buffer,
+// valid until the next read_record(); a record larger than the buffer grows
+// it. Lengths above `maxRecord` are taken as corruption rather than
+// allocated. The source needs readSome() and wouldBlock() besides the
+// input_stream interface.
+#ifdef __cpp_concepts
+template <input_stream Source = ifstream>
+#else
+template <typename Source = ifstream>
+#endif
+class record_reader {
+public:
+  static constexpr size_t BUFFER = size_t{64} << 10;
+  static constexpr size_t MAX_RECORD = size_t{64} << 20;
+
+  explicit record_reader(Source &source,
+                         RecordPrefix prefix = RecordPrefix::VARINT,
+                         bool crc = false, size_t maxRecord = MAX_RECORD)
+      : m_source{source}, m_prefix{prefix}, m_crc{crc},
+        m_maxRecord{maxRecord}, m_buffer{BUFFER} {}
+  record_reader(record_reader const &) = delete;
+  record_reader &operator=(record_reader const &) = delete;
+
+  pair<record_view, RecordStatus> read_record() {
+    if (m_status != RecordStatus::OK)
+      return {record_view{}, m_status};
+    uint64_t length = 0;
+    size_t header = 0;
+    auto const status = readPrefix(length, header);
+    if (status != RecordStatus::OK)
+      return {record_view{}, status};
+    if (length > m_maxRecord)
+      return {record_view{}, m_status = RecordStatus::CORRUPT};
+    auto const size = static_cast<size_t>(length);
+    auto const total = header + size + (m_crc ? records::CRC_SIZE : 0);
+    if (!fill(total))
+      return {record_view{}, stopped(true)};
+    auto const *payload = m_buffer.data() + m_pos + header;
+    if (m_crc && records::load_u32(payload + size) !=
+                     checksum::crc32c(0, payload, size))
+      return {record_view{}, m_status = RecordStatus::CORRUPT};
+    m_pos += total;
+    return {record_view{payload, size}, RecordStatus::OK};
+  }
+
+private:
+  RecordStatus readPrefix(uint64_t &length, size_t &header) {
+    if (m_prefix == RecordPrefix::FIXED32) {
+      if (!fill(4))
+        return stopped(m_end != m_pos);
+      length = records::load_u32(m_buffer.data() + m_pos);
+      header = 4;
+      return RecordStatus::OK;
+    }
+    for (size_t i = 0; i < records::MAX_VARINT; ++i) {
+      if (!fill(i + 1))
+        return stopped(i != 0);
+      auto const byte = static_cast<unsigned char>(m_buffer[m_pos + i]);
+      // The tenth byte only has the top bit of a 64-bit length to give.
+      if (i == records::MAX_VARINT - 1 && byte > 1)
+        break;
+      length |= uint64_t{byte & 0x7fu} << (7 * i);
+      if ((byte & 0x80) == 0) {
+        header = i + 1;
+        return RecordStatus::OK;
+      }
+    }
+    return m_status = RecordStatus::CORRUPT;
+  }
+  // Why fill() came up short: a source that would block, a clean end
+  // between records, or an end in the middle of one.
+  RecordStatus stopped(bool midRecord) {
+    if (m_source.wouldBlock())
+      return RecordStatus::WOULD_BLOCK;
+    return m_status =
+               midRecord ? RecordStatus::TRUNCATED : RecordStatus::END;
+  }
+  // Makes `size` bytes from m_pos available in the buffer.
+  bool fill(size_t size) {
+    if (m_pos == m_end)
+      m_pos = m_end = 0;
+    while (m_end - m_pos < size) {
+      if (m_pos + size > m_buffer.capacity())
+        makeRoom(size);
+      auto const got = m_source.readSome(m_buffer.data() + m_end,
+                                         m_buffer.capacity() - m_end);
+      if (got == 0)
+        return false;
+      m_end += got;
+    }
+    return true;
+  }
+  // Moves the unread bytes to the front, growing the buffer if `size`
+  // bytes would still not fit.
+  void makeRoom(size_t size) {
+    auto const unread = m_end - m_pos;
+    auto capacity = m_buffer.capacity();
+    while (capacity < size)
+      capacity <<= 1;
+    if (capacity == m_buffer.capacity()) {
+      memmove(m_buffer.data(), m_buffer.data() + m_pos, unread);
+    } else {
+      array<char> grown{capacity};
+      memcpy(grown.data(), m_buffer.data() + m_pos, unread);
+      m_buffer = forward<array<char>>(grown);
+    }
+    m_pos = 0;
+    m_end = unread;
+  }
+
+  Source &m_source;
+  RecordPrefix m_prefix;
+  bool m_crc;
+  size_t m_maxRecord;
+  array<char> m_buffer;
+  size_t m_pos = 0;
+  size_t m_end = 0;
+  RecordStatus m_status = RecordStatus::OK;
+};
+
+#endif // RECORDS_HPP
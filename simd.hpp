@@ -0,0 +1,378 @@
+#ifndef SIMD_HPP
+#define SIMD_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define SIMD_SSE2 1
+#endif
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__ ||   \
+    defined(_WIN32)
+#define SIMD_LITTLE_ENDIAN 1
+#endif
+
+namespace simd {
+
+inline unsigned ctz32(uint32_t x) {
+#ifdef _MSC_VER
+  unsigned long idx;
+  _BitScanForward(&idx, x);
+  return static_cast<unsigned>(idx);
+#else
+  return static_cast<unsigned>(__builtin_ctz(x));
+#endif
+}
+
+inline unsigned clz32(uint32_t x) {
+#ifdef _MSC_VER
+  unsigned long idx;
+  _BitScanReverse(&idx, x);
+  return 31u - static_cast<unsigned>(idx);
+#else
+  return static_cast<unsigned>(__builtin_clz(x));
+#endif
+}
+
+inline unsigned ctz64(uint64_t x) {
+#ifdef _MSC_VER
+  unsigned long idx;
+  _BitScanForward64(&idx, x);
+  return static_cast<unsigned>(idx);
+#else
+  return static_cast<unsigned>(__builtin_ctzll(x));
+#endif
+}
+
+inline unsigned popcount64(uint64_t x) {
+#ifdef _MSC_VER
+  return static_cast<unsigned>(__popcnt64(x));
+#else
+  return static_cast<unsigned>(__builtin_popcountll(x));
+#endif
+}
+
+template <typename T> inline bool is_digit(T ch) {
+  return ch >= static_cast<T>('0') && ch <= static_cast<T>('9');
+}
+
+// Number of leading decimal digits in [p, p + n).
+template <typename T> inline size_t digit_run(T const *p, size_t n) {
+  size_t i = 0;
+  while (i < n && is_digit(p[i]))
+    ++i;
+  return i;
+}
+
+#ifdef SIMD_SSE2
+template <> inline size_t digit_run<char>(char const *p, size_t n) {
+  size_t i = 0;
+  __m128i const zero = _mm_set1_epi8('0');
+  __m128i const nine = _mm_set1_epi8(9);
+  for (; i + 16 <= n; i += 16) {
+    __m128i v = _mm_sub_epi8(
+        _mm_loadu_si128(reinterpret_cast<__m128i const *>(p + i)), zero);
+    auto mask = static_cast<uint32_t>(
+        _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_min_epu8(v, nine), v)));
+    if (mask != 0xFFFF)
+      return i + ctz32(~mask);
+  }
+  while (i < n && is_digit(p[i]))
+    ++i;
+  return i;
+}
+#endif
+
+// Calls `found(i)` for the index of every `ch` in [p, p + n), in order.
+template <typename F>
+inline void for_each_byte(char const *p, size_t n, char ch, F &&found) {
+  size_t i = 0;
+#ifdef SIMD_SSE2
+  __m128i const needle = _mm_set1_epi8(ch);
+  auto const matches = [&](size_t at) {
+    auto const v = _mm_loadu_si128(reinterpret_cast<__m128i const *>(p + at));
+    return static_cast<uint64_t>(static_cast<uint32_t>(
+        _mm_movemask_epi8(_mm_cmpeq_epi8(v, needle))));
+  };
+  for (; i + 64 <= n; i += 64) {
+    uint64_t mask = matches(i) | matches(i + 16) << 16 |
+                    matches(i + 32) << 32 | matches(i + 48) << 48;
+    for (; mask != 0; mask &= mask - 1)
+      found(i + ctz64(mask));
+  }
+#endif
+  for (; i < n; ++i)
+    if (p[i] == ch)
+      found(i);
+}
+
+// Index of the last `ch` in [p, p + n), or n if there is none.
+template <typename T> inline size_t find_last(T const *p, size_t n, T ch) {
+  for (size_t i = n; i-- > 0;)
+    if (p[i] == ch)
+      return i;
+  return n;
+}
+
+#ifdef SIMD_SSE2
+// GCC cannot always tell that the vector loop is unreachable when a short
+// literal is inlined into a caller, and warns about loads past it.
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Warray-bounds"
+#endif
+template <> inline size_t find_last<char>(char const *p, size_t n, char ch) {
+  // Short runs, such as a one-element record, never reach a vector load.
+  if (n < 16) {
+    for (size_t i = n; i-- > 0;)
+      if (p[i] == ch)
+        return i;
+    return n;
+  }
+  __m128i const needle = _mm_set1_epi8(ch);
+  size_t i = n;
+  for (; i >= 16; i -= 16) {
+    auto const v =
+        _mm_loadu_si128(reinterpret_cast<__m128i const *>(p + i - 16));
+    auto const mask =
+        static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(v, needle)));
+    if (mask != 0)
+      return i - 16 + (31 - clz32(mask));
+  }
+  while (i-- > 0)
+    if (p[i] == ch)
+      return i;
+  return n;
+}
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic pop
+#endif
+#endif
+
+// Index of the first occurrence of needle[0, m) in [p, p + n), or n if there
+// is none. Positions whose first and last elements match the needle's are
+// verified with memcmp.
+template <typename T>
+inline size_t find_sequence(T const *p, size_t n, T const *needle, size_t m) {
+  if (m == 0)
+    return 0;
+  for (size_t i = 0; i + m <= n; ++i)
+    if (p[i] == needle[0] && p[i + m - 1] == needle[m - 1] &&
+        memcmp(p + i, needle, m * sizeof(T)) == 0)
+      return i;
+  return n;
+}
+
+#ifdef SIMD_SSE2
+// Tests 16 positions at once: a load at i is compared with the first byte
+// and a load at i + m - 1 with the last, so only positions matching both
+// are verified.
+template <>
+inline size_t find_sequence<char>(char const *p, size_t n, char const *needle,
+                                  size_t m) {
+  if (m == 0)
+    return 0;
+  if (m > n)
+    return n;
+  if (m == 1) {
+    auto const *hit = static_cast<char const *>(memchr(p, needle[0], n));
+    return hit == nullptr ? n : static_cast<size_t>(hit - p);
+  }
+  __m128i const first = _mm_set1_epi8(needle[0]);
+  __m128i const last = _mm_set1_epi8(needle[m - 1]);
+  size_t i = 0;
+  for (; i + m - 1 + 16 <= n; i += 16) {
+    auto const a = _mm_loadu_si128(reinterpret_cast<__m128i const *>(p + i));
+    auto const b =
+        _mm_loadu_si128(reinterpret_cast<__m128i const *>(p + i + m - 1));
+    auto mask = static_cast<uint32_t>(_mm_movemask_epi8(
+        _mm_and_si128(_mm_cmpeq_epi8(a, first), _mm_cmpeq_epi8(b, last))));
+    for (; mask != 0; mask &= mask - 1) {
+      auto const at = i + ctz32(mask);
+      if (memcmp(p + at + 1, needle + 1, m - 2) == 0)
+        return at;
+    }
+  }
+  for (; i + m <= n; ++i)
+    if (p[i] == needle[0] && p[i + m - 1] == needle[m - 1] &&
+        memcmp(p + i + 1, needle + 1, m - 2) == 0)
+      return i;
+  return n;
+}
+#endif
+
+// Length of the longest tail of [p, p + n), shorter than m, that needle[0, m)
+// starts with: the part of a match cut off by the end of the data.
+template <typename T>
+inline size_t partial_sequence(T const *p, size_t n, T const *needle,
+                               size_t m) {
+  for (auto k = m == 0 ? 0 : n < m ? n : m - 1; k != 0; --k)
+    if (memcmp(p + n - k, needle, k * sizeof(T)) == 0)
+      return k;
+  return 0;
+}
+
+// Number of leading ASCII bytes in [p, p + n).
+inline size_t ascii_run(char const *p, size_t n) {
+  size_t i = 0;
+#ifdef SIMD_SSE2
+  for (; i + 16 <= n; i += 16) {
+    auto const mask = static_cast<uint32_t>(_mm_movemask_epi8(
+        _mm_loadu_si128(reinterpret_cast<__m128i const *>(p + i))));
+    if (mask != 0)
+      return i + ctz32(mask);
+  }
+#endif
+  while (i < n && static_cast<unsigned char>(p[i]) < 0x80)
+    ++i;
+  return i;
+}
+
+// Number of bytes in [p, p + n) that are not UTF-8 continuation bytes
+// (10xxxxxx), i.e. the number of code points in valid UTF-8.
+inline size_t count_utf8_leads(char const *p, size_t n) {
+  size_t i = 0;
+  size_t count = 0;
+#ifdef SIMD_SSE2
+  // Continuation bytes are exactly the signed bytes below -64.
+  __m128i const limit = _mm_set1_epi8(-65);
+  auto const leads = [&](size_t at) {
+    auto const v = _mm_loadu_si128(reinterpret_cast<__m128i const *>(p + at));
+    return static_cast<uint64_t>(static_cast<uint32_t>(
+        _mm_movemask_epi8(_mm_cmpgt_epi8(v, limit))));
+  };
+  for (; i + 64 <= n; i += 64)
+    count += popcount64(leads(i) | leads(i + 16) << 16 | leads(i + 32) << 32 |
+                        leads(i + 48) << 48);
+#endif
+  for (; i < n; ++i)
+    count += (static_cast<unsigned char>(p[i]) & 0xC0) != 0x80;
+  return count;
+}
+
+// Copies the leading ASCII bytes of [p, p + n) to `out` as 16-bit units and
+// returns how many there were.
+inline size_t widen_ascii(char const *p, size_t n, short *out) {
+  size_t i = 0;
+#ifdef SIMD_SSE2
+  __m128i const zero = _mm_setzero_si128();
+  for (; i + 16 <= n; i += 16) {
+    auto const v = _mm_loadu_si128(reinterpret_cast<__m128i const *>(p + i));
+    if (_mm_movemask_epi8(v) != 0)
+      break;
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(out + i),
+                     _mm_unpacklo_epi8(v, zero));
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(out + i + 8),
+                     _mm_unpackhi_epi8(v, zero));
+  }
+#endif
+  for (; i < n && static_cast<unsigned char>(p[i]) < 0x80; ++i)
+    out[i] = static_cast<short>(p[i]);
+  return i;
+}
+
+// Copies the leading units of [p, p + n) below 0x80 to `out` as bytes and
+// returns how many there were.
+inline size_t narrow_ascii(short const *p, size_t n, char *out) {
+  size_t i = 0;
+#ifdef SIMD_SSE2
+  __m128i const high = _mm_set1_epi16(static_cast<short>(0xFF80));
+  __m128i const zero = _mm_setzero_si128();
+  for (; i + 8 <= n; i += 8) {
+    auto const v = _mm_loadu_si128(reinterpret_cast<__m128i const *>(p + i));
+    if (_mm_movemask_epi8(_mm_cmpeq_epi16(_mm_and_si128(v, high), zero)) !=
+        0xFFFF)
+      break;
+    _mm_storel_epi64(reinterpret_cast<__m128i *>(out + i),
+                     _mm_packus_epi16(v, v));
+  }
+#endif
+  for (; i < n && static_cast<unsigned short>(p[i]) < 0x80; ++i)
+    out[i] = static_cast<char>(p[i]);
+  return i;
+}
+
+// Converts exactly 8 ASCII digits to their value (SWAR, little endian).
+inline uint32_t parse_eight_digits(char const *p) {
+#ifdef SIMD_LITTLE_ENDIAN
+  uint64_t val;
+  memcpy(&val, p, sizeof(val));
+  uint64_t constexpr mask = 0x000000FF000000FF;
+  uint64_t constexpr mul1 = 0x000F424000000064; // 100 + (1000000 << 32)
+  uint64_t constexpr mul2 = 0x0000271000000001; // 1 + (10000 << 32)
+  val -= 0x3030303030303030;
+  val = (val * 10) + (val >> 8);
+  val = (((val & mask) * mul1) + (((val >> 16) & mask) * mul2)) >> 32;
+  return static_cast<uint32_t>(val);
+#else
+  uint32_t val = 0;
+  for (size_t i = 0; i < 8; ++i)
+    val = val * 10 + static_cast<uint32_t>(p[i] - '0');
+  return val;
+#endif
+}
+
+// Computes `acc * mul + add`, returning false if it does not fit in 64 bits.
+inline bool mul_add(uint64_t &acc, uint64_t mul, uint64_t add) {
+  uint64_t next;
+#ifdef _MSC_VER
+  if (acc != 0 && mul > UINT64_MAX / acc)
+    return false;
+  next = acc * mul;
+  if (next > UINT64_MAX - add)
+    return false;
+  next += add;
+#else
+  if (__builtin_mul_overflow(acc, mul, &next) ||
+      __builtin_add_overflow(next, add, &next))
+    return false;
+#endif
+  acc = next;
+  return true;
+}
+
+// Accumulates a run of decimal digits into a 64-bit value. Digits that would
+// overflow the value are counted in `dropped` instead of being folded in.
+struct digit_accumulator {
+  uint64_t value = 0;
+  size_t dropped = 0;
+
+  // Folds `n` digits (all known to be digits) starting at `p`.
+  // Returns the number of digits that were folded into `value`.
+  template <typename T> size_t accumulate(T const *p, size_t n) {
+    size_t folded = 0;
+    if constexpr (sizeof(T) == 1) {
+      if (dropped == 0) {
+        for (; folded + 16 <= n; folded += 16) {
+          uint64_t const chunk =
+              uint64_t{parse_eight_digits(p + folded)} * 100000000u +
+              parse_eight_digits(p + folded + 8);
+          if (!mul_add(value, 10000000000000000ull, chunk))
+            break;
+        }
+        for (; folded + 8 <= n; folded += 8) {
+          if (!mul_add(value, 100000000ull, parse_eight_digits(p + folded)))
+            break;
+        }
+      }
+    }
+    for (; folded < n && dropped == 0; ++folded) {
+      if (!mul_add(value, 10, static_cast<uint64_t>(p[folded] - '0')))
+        break;
+    }
+    dropped += n - folded;
+    return folded;
+  }
+};
+
+// Powers of ten that are exactly representable as a double.
+inline constexpr double exact_pow10[] = {
+    1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+
+} // namespace simd
+
+#endif // SIMD_HPP
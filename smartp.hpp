@@ -4,6 +4,7 @@
 #include "type_traits.hpp"
 #include <cstddef>
 #include <cstdint>
+#include <cstring>
 #ifdef _WIN32
 #include <windows.h>
 #if defined(_MSC_VER)
@@ -372,6 +373,10 @@ template <character_type T>
 template <typename T>
 #endif
 inline size_t stringlen(T const *str) {
+  // strlen() is folded for literals, so their length is known at compile
+  // time.
+  if constexpr (sizeof(T) == 1)
+    return strlen(reinterpret_cast<char const *>(str));
   T const *end = str;
   while (*end)
     ++end;
@@ -379,13 +384,23 @@ inline size_t stringlen(T const *str) {
 }
 
 template <typename T> class vector;
-#include <cstring>
 // extern "C" void* memcpy(void* __restrict, void const* __restrict, size_t)
 // __THROW __nonnull((1, 2));
 
+// Tag for array's constructor over storage the array does not own.
+struct borrowed_t {
+  explicit borrowed_t() = default;
+};
+inline constexpr borrowed_t borrowed{};
+
 template <typename T> class array {
 public:
   constexpr array() noexcept : m_capacity{0} {}
+  // Uses the caller's `capacity` elements at `storage`, e.g. a static
+  // buffer, without allocating or ever freeing them. Copies of it own their
+  // elements; moves pass the borrowed storage on.
+  array(borrowed_t, T *storage, size_t capacity) noexcept
+      : m_data{storage}, m_capacity{capacity}, m_borrowed{true} {}
   explicit array(size_t capacity) noexcept
       : m_data{make_uniq<T[]>(capacity)}, m_capacity{capacity} {}
   array(T const *copy, size_t capacity) noexcept
@@ -401,10 +416,14 @@ public:
   }
   array(array &&move)
       : m_data{forward<uniq_ptr<T[]>>(move.m_data)}, m_capacity{
-                                                         move.m_capacity} {
+                                                         move.m_capacity},
+        m_borrowed{move.m_borrowed} {
     move.m_capacity = 0;
+    move.m_borrowed = false;
   }
+  ~array() { forget(); }
   array &operator=(array const &copy) {
+    forget();
     m_data = make_uniq<T[]>(copy.capacity());
     m_capacity = 0;
     for (auto const &item : copy) {
@@ -413,9 +432,12 @@ public:
     return *this;
   }
   array &operator=(array &&move) {
+    forget();
     m_data = forward<decltype(move.m_data)>(move.m_data);
     m_capacity = move.m_capacity;
+    m_borrowed = move.m_borrowed;
     move.m_capacity = 0;
+    move.m_borrowed = false;
     return *this;
   }
   // template <character_type D>
@@ -505,8 +527,16 @@ public:
   iterator<true> rend() const { return iterator<true>{*this, -1}; }
 
 protected:
+  // Lets go of borrowed storage so that m_data does not free it.
+  void forget() {
+    if (m_borrowed)
+      m_data.release();
+    m_borrowed = false;
+  }
+
   uniq_ptr<T[]> m_data;
   size_t m_capacity;
+  bool m_borrowed = false;
 };
 
 template <typename T> class vector : public array<T> {
@@ -538,13 +568,22 @@ public:
       if (this->m_capacity == 0)
         this->m_capacity = 4;
       auto newdata = make_uniq<T[]>(this->m_capacity);
-      m_size = 0;
-      for (auto &&itemo : *this)
-        newdata[m_size++] = forward<T>(itemo);
+      for (size_t i = 0; i < m_size; ++i)
+        newdata[i] = static_cast<T &&>(this->m_data[i]);
       this->m_data = forward<decltype(newdata)>(newdata);
     }
     this->m_data[m_size++] = item;
   }
+  T &back() { return this->m_data[m_size - 1]; }
+  T const &back() const { return this->m_data[m_size - 1]; }
+  void pop_back() {
+    if (m_size != 0)
+      this->m_data[--m_size] = T{};
+  }
+  void clear() {
+    while (m_size != 0)
+      pop_back();
+  }
   // template <typename D>
   // requires is_character_v<D> vector<D>(D const* copy)
   // noexcept : array<T>(copy) { m_size = this->m_capacity - 1; }
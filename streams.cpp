@@ -1,6 +1,7 @@
 #include "streams.hpp"
 #include <climits>
 #include <cmath>
+#include <new>
 #ifdef _WIN32
 #include <winbase.h>
 #include <wtypesbase.h>
@@ -81,12 +82,103 @@ void default_file_error_handler(char const *FILE, char const *FUNCTION) {
 void (*file_error_handler)(char const *,
                            char const *) = &default_file_error_handler;
 
+stream_tracer *default_stream_tracer = nullptr;
+
+bool stream_stats_on_close = getenv("STREAMS_STATS") != nullptr;
+
+void dump_stream_stats(char const *name, stream_stats const &stats) {
+  char line[512];
+  auto len = snprintf(line, sizeof(line),
+                      "%s: syscalls=%llu read=%llu written=%llu refills=%llu "
+                      "flushes=%llu seeks=%llu straddles=%llu\n",
+                      name, static_cast<unsigned long long>(stats.syscalls),
+                      static_cast<unsigned long long>(stats.bytesRead),
+                      static_cast<unsigned long long>(stats.bytesWritten),
+                      static_cast<unsigned long long>(stats.refills),
+                      static_cast<unsigned long long>(stats.flushes),
+                      static_cast<unsigned long long>(stats.seeks),
+                      static_cast<unsigned long long>(stats.straddles));
+  if (len <= 0)
+    return;
+  // Written straight to the stderr handle: the global cerr reports its own
+  // stats after its final flush.
+  auto const size = min(static_cast<size_t>(len), sizeof(line) - 1);
+#ifdef __linux__
+  if (::write(STDERR_FILENO, line, size) == -1)
+    return;
+#elif _WIN32
+  DWORD written;
+  WriteFile(GetStdHandle(STD_ERROR_HANDLE), line, static_cast<DWORD>(size),
+            &written, nullptr);
+#endif
+}
+
+// cout and cerr are built in place on first use and never destroyed: a
+// function-local static would be destroyed in reverse order of
+// construction, leaving cerr gone while cout's destructor, or any later
+// one, reports an error through it. They are flushed at exit instead.
+// All three buffer through static arrays rather than the heap.
+namespace {
+alignas(ofstream) unsigned char error_storage[sizeof(ofstream)];
+alignas(ofstream) unsigned char output_storage[sizeof(ofstream)];
+char error_buffer[ofstream::BUFFER_SIZE];
+char output_buffer[ofstream::BUFFER_SIZE];
+char input_buffer[ifstream::BUFFER_SIZE];
+
+array<char> borrow(char *buffer) {
+  return array<char>{borrowed, buffer, ofstream::BUFFER_SIZE};
+}
+
+void finish(ofstream &stream) {
+  stream.flush();
+  if (stream_stats_on_close && stream.stats().syscalls != 0)
+    dump_stream_stats(stream.getFileName(), stream.stats());
+}
+} // namespace
+
+static ofstream &standard_error() {
+  static ofstream *const stream = [] {
 #ifdef __linux__
-ofstream cerr{STDERR_FILENO, false};
-ofstream cout{STDOUT_FILENO, false};
-ifstream cin{STDIN_FILENO, false};
+    auto *built = new (error_storage)
+        ofstream{STDERR_FILENO, false, borrow(error_buffer)};
 #elif _WIN32
-ofstream cerr{GetStdHandle(STD_ERROR_HANDLE), false};
-ofstream cout{GetStdHandle(STD_OUTPUT_HANDLE), false};
-ifstream cin{GetStdHandle(STD_INPUT_HANDLE), false};
-#endif
\ No newline at end of file
+    auto *built = new (error_storage) ofstream{
+        GetStdHandle(STD_ERROR_HANDLE), false, borrow(error_buffer)};
+#endif
+    atexit([] { finish(standard_error()); });
+    return built;
+  }();
+  return *stream;
+}
+static ofstream &standard_output() {
+  static ofstream *const stream = [] {
+#ifdef __linux__
+    auto *built = new (output_storage)
+        ofstream{STDOUT_FILENO, false, borrow(output_buffer)};
+#elif _WIN32
+    auto *built = new (output_storage) ofstream{
+        GetStdHandle(STD_OUTPUT_HANDLE), false, borrow(output_buffer)};
+#endif
+    // cerr's handler is registered first, so it runs after cout's and
+    // writes out an error flushing cout reported.
+    standard_error();
+    atexit([] { finish(standard_output()); });
+    return built;
+  }();
+  return *stream;
+}
+// cin reports nothing through the others and its destructor puts back the
+// flags a timeout changed, so it stays an ordinary static.
+static ifstream &standard_input() {
+#ifdef __linux__
+  static ifstream stream{STDIN_FILENO, false, borrow(input_buffer)};
+#elif _WIN32
+  static ifstream stream{GetStdHandle(STD_INPUT_HANDLE), false,
+                         borrow(input_buffer)};
+#endif
+  return stream;
+}
+
+constinit standard_stream<ofstream> const cerr{&standard_error};
+constinit standard_stream<ofstream> const cout{&standard_output};
+constinit standard_stream<ifstream> const cin{&standard_input};
\ No newline at end of file
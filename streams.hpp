@@ -1,12 +1,63 @@
+#ifndef STREAMS_HPP
+#define STREAMS_HPP
+
 #include <sys/types.h>
 
+#include <atomic>
+#include <cerrno>
 #include <cstddef>
 #include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <limits>
 
+#include "checksum.hpp"
+#include "simd.hpp"
 #include "smartp.hpp"
+#include "trace.hpp"
 
-enum class IOMode : int { READ = 1, WRITE = 2, READWRITE = 3 };
+// APPEND writes at the end of the file whatever else appends to it
+// (O_APPEND, FILE_APPEND_DATA on Windows).
+enum class IOMode : int { READ = 1, WRITE = 2, READWRITE = 3, APPEND = 6 };
 enum class IOPos : int { SET = 0, CUR = 1, END = 2 };
+enum class ParseStatus : int {
+  OK = 0,
+  NO_DIGITS = 1,
+  OUT_OF_RANGE = 2,
+  INVALID = 3,
+  END_OF_STREAM = 4
+};
+enum class IOStatus : int { OK = 0, WOULD_BLOCK = 1, FAILED = 2 };
+// Result of a write or flush that reports failure instead of calling
+// file_error_handler: how many elements got through and why it stopped.
+struct io_result {
+  size_t count = 0;
+  IOStatus status = IOStatus::OK;
+  // errno (GetLastError() on Windows) when the status is FAILED.
+  int error = 0;
+  bool ok() const { return status == IOStatus::OK; }
+};
+// Outcome of checking data read against a checksum trailer.
+enum class ChecksumCheck : int { NONE = 0, PENDING = 1, OK = 2, MISMATCH = 3 };
+
+// Snapshot of the I/O a stream has performed so far.
+struct stream_stats {
+  uint64_t syscalls = 0;
+  uint64_t bytesRead = 0;
+  uint64_t bytesWritten = 0;
+  uint64_t refills = 0;
+  uint64_t flushes = 0;
+  uint64_t seeks = 0;
+  // Refills a readUntil() call needed after it had already taken part of a
+  // record.
+  uint64_t straddles = 0;
+};
+
+// Dumps the stats of every file stream that did any I/O to stderr when it is
+// closed. Enabled by setting STREAMS_STATS in the environment.
+extern bool stream_stats_on_close;
+void dump_stream_stats(char const *name, stream_stats const &stats);
+
 #ifdef __cpp_concepts
 
 template <character_type T>
@@ -15,24 +66,101 @@ template <typename T>
 #endif
 class basic_stream_traits {
 public:
+  using char_type = T;
+  static constexpr size_t BUFFER_SIZE = 80;
+
+  basic_stream_traits() = default;
   virtual ~basic_stream_traits() = default;
 
+  stream_stats stats() const {
+    stream_stats result;
+#ifndef STREAMS_NO_STATS
+    result.syscalls = m_stats.syscalls.load(std::memory_order_relaxed);
+    result.bytesRead = m_stats.bytesRead.load(std::memory_order_relaxed);
+    result.bytesWritten = m_stats.bytesWritten.load(std::memory_order_relaxed);
+    result.refills = m_stats.refills.load(std::memory_order_relaxed);
+    result.flushes = m_stats.flushes.load(std::memory_order_relaxed);
+    result.seeks = m_stats.seeks.load(std::memory_order_relaxed);
+    result.straddles = m_stats.straddles.load(std::memory_order_relaxed);
+#endif
+    return result;
+  }
+  stream_tracer *getTracer() const { return m_tracer; }
+  void setTracer(stream_tracer *tracer) { m_tracer = tracer; }
+  // Starts a running checksum of the data moved from now on, in the order
+  // it is moved: what each refill reads or what each flush writes, while it
+  // is still in cache. NONE turns it off.
+  void setChecksum(ChecksumKind kind) { m_checksum.reset(kind); }
+  ChecksumKind checksumKind() const { return m_checksum.kind(); }
+  uint64_t checksum() const { return m_checksum.value(); }
+
 protected:
-  static constexpr size_t BUFFER_SIZE = 80;
+  // Reads and writes through `rbuf` and `wbuf`, which may borrow static
+  // storage, instead of allocating BUFFER_SIZE elements for each.
+  basic_stream_traits(array<T> &&rbuf, array<T> &&wbuf)
+      : m_rbuffer{forward<array<T>>(rbuf)},
+        m_wbuffer{forward<array<T>>(wbuf)} {}
+
+  stream_tracer *m_tracer = default_stream_tracer;
+  stream_checksum m_checksum;
+#ifndef STREAMS_NO_STATS
+  // Only the owning thread updates the counters, so a relaxed load/store pair
+  // is enough and avoids a locked instruction; other threads may still read
+  // them through stats().
+  static void count(std::atomic<uint64_t> &counter, uint64_t amount) {
+    counter.store(counter.load(std::memory_order_relaxed) + amount,
+                  std::memory_order_relaxed);
+  }
+  struct {
+    std::atomic<uint64_t> syscalls{0};
+    std::atomic<uint64_t> bytesRead{0};
+    std::atomic<uint64_t> bytesWritten{0};
+    std::atomic<uint64_t> refills{0};
+    std::atomic<uint64_t> flushes{0};
+    std::atomic<uint64_t> seeks{0};
+    std::atomic<uint64_t> straddles{0};
+  } m_stats;
+#endif
+
   struct {
     array<T> buf{BUFFER_SIZE};
     size_t pos = 0;
     size_t size = 0;
+    // Set once a read returned end of file.
+    bool eof = false;
+    // Set when the last refill returned nothing because no data was ready.
+    bool blocked = false;
   } m_rbuffer;
   struct {
     array<T> buf{BUFFER_SIZE};
     size_t size = 0;
+    // Set when the last flush could not write because the handle was full.
+    bool blocked = false;
   } m_wbuffer;
   ssize_t m_roffset = 0;
   ssize_t m_woffset = 0;
   array<T> m_fn;
 };
 #define fold(x) (__builtin_constant_p(x) ? (x) : (x))
+#ifndef STREAMS_NO_STATS
+#define STREAM_STAT(counter, amount)                                           \
+  this->count(this->m_stats.counter, static_cast<uint64_t>(amount))
+#else
+#define STREAM_STAT(counter, amount) static_cast<void>(0)
+#endif
+#ifndef STREAMS_NO_TRACE
+#define STREAM_TRACE_START()                                                   \
+  (this->m_tracer != nullptr ? trace_clock::now() : uint64_t{0})
+#define STREAM_TRACE(op, result, start)                                        \
+  do {                                                                         \
+    if (this->m_tracer != nullptr)                                             \
+      this->m_tracer->record(op, static_cast<int64_t>(result),                 \
+                             trace_clock::now() - (start));                    \
+  } while (false)
+#else
+#define STREAM_TRACE_START() uint64_t{0}
+#define STREAM_TRACE(op, result, start) static_cast<void>(start)
+#endif
 
 #ifdef __cpp_concepts
 template <character_type T, typename HANDLE_T>
@@ -41,6 +169,7 @@ template <typename T, typename HANDLE_T>
 #endif
 class basic_fstream_traits : public basic_stream_traits<T> {
 public:
+  using basic_stream_traits<T>::basic_stream_traits;
   void openstream() {
     for (auto it = m_open_actions.begin(); it != m_open_actions.end(); ++it) {
       invoke(*it, this);
@@ -49,6 +178,11 @@ public:
   IOMode getOpenMode() const { return m_mode; }
   HANDLE_T getHandle() const { return m_handle; }
   void setSeekable(bool val) { m_isSeekable = val; }
+  // Milliseconds to wait for data before giving up: -1 blocks (the default),
+  // 0 never waits. For an ofstream it bounds each wait of the destructor for
+  // a full O_NONBLOCK handle to drain. Linux only; Windows always blocks.
+  int getTimeout() const { return m_timeout; }
+  void setTimeout(int milliseconds) { m_timeout = milliseconds; }
   void setHandle(HANDLE_T handle) {
     m_handle = handle;
     this->m_roffset = 0;
@@ -56,6 +190,8 @@ public:
     this->m_wbuffer.size = 0;
     this->m_rbuffer.pos = 0;
     this->m_rbuffer.size = 0;
+    this->m_rbuffer.eof = false;
+    this->m_rbuffer.blocked = false;
   }
   T const *getFileName() const { return m_fn.data(); }
   void setFileName(T const *filename) {
@@ -64,9 +200,19 @@ public:
   virtual ~basic_fstream_traits() = default;
 
 protected:
+  void dumpStats() const {
+    if (!stream_stats_on_close || this->stats().syscalls == 0)
+      return;
+    if constexpr (is_same_v<T, char>)
+      dump_stream_stats(getFileName(), this->stats());
+    else
+      dump_stream_stats("(wide stream)", this->stats());
+  }
+
   inline static HANDLE_T INVALID_HANDLE = reinterpret_cast<HANDLE_T>(-1);
   vector<void (*)(basic_fstream_traits *)> m_open_actions;
   bool m_isSeekable = true;
+  int m_timeout = -1;
 
   array<T> m_fn;
   IOMode m_mode = IOMode::READ;
@@ -77,18 +223,25 @@ extern void (*file_error_handler)(char const *FILE, char const *FUNCTION);
 void default_file_error_handler(char const *FILE, char const *FUNCTION);
 
 #ifdef __linux__
-#include <asm-generic/ioctls.h>
 #include <fcntl.h>
+#include <poll.h>
 #include <string.h>
-#include <sys/ioctl.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
 #include <unistd.h>
 
 template <character_type T>
 class basic_fstream_unix : public basic_fstream_traits<T, int> {
 public:
   basic_fstream_unix() { this->m_open_actions.append(&open_unix); }
+  basic_fstream_unix(array<T> &&rbuf, array<T> &&wbuf)
+      : basic_fstream_traits<T, int>{forward<array<T>>(rbuf),
+                                     forward<array<T>>(wbuf)} {
+    this->m_open_actions.append(&open_unix);
+  }
 
   ~basic_fstream_unix() {
+    this->dumpStats();
     if (close(this->getHandle()) == -1) {
       invoke(file_error_handler, __FILE__, __FUNCTION__);
     }
@@ -97,11 +250,54 @@ public:
   }
 
 protected:
+  off_t sysSeek(off_t offset, int whence) {
+    STREAM_STAT(syscalls, 1);
+    STREAM_STAT(seeks, 1);
+    auto const start = STREAM_TRACE_START();
+    auto cur = ::lseek(this->m_handle, offset, whence);
+    STREAM_TRACE(TraceOp::SEEK, cur, start);
+    return cur;
+  }
+  ssize_t sysRead(void *data, size_t size) {
+    STREAM_STAT(syscalls, 1);
+    auto const start = STREAM_TRACE_START();
+    auto rsize = ::read(this->m_handle, data, size);
+    STREAM_TRACE(TraceOp::READ, rsize, start);
+    if (rsize > 0)
+      STREAM_STAT(bytesRead, rsize);
+    return rsize;
+  }
+  ssize_t sysWrite(void const *data, size_t size) {
+    STREAM_STAT(syscalls, 1);
+    auto const start = STREAM_TRACE_START();
+    auto wsize = ::write(this->m_handle, data, size);
+    STREAM_TRACE(TraceOp::WRITE, wsize, start);
+    if (wsize > 0)
+      STREAM_STAT(bytesWritten, wsize);
+    return wsize;
+  }
+  // Runs one in-kernel copy (copy_file_range, sendfile or splice) issued by
+  // this stream. Only the WRITE leg of a transfer counts the bytes it moved.
+  template <typename F> ssize_t sysTransfer(TraceOp op, F const &call) {
+    STREAM_STAT(syscalls, 1);
+    auto const start = STREAM_TRACE_START();
+    ssize_t moved = call();
+    STREAM_TRACE(op, moved, start);
+    if (moved > 0 && op == TraceOp::WRITE)
+      STREAM_STAT(bytesWritten, moved);
+    return moved;
+  }
+  // Accounts for bytes another stream moved out of this one in the kernel.
+  void countTransferred(ssize_t bytes) { STREAM_STAT(bytesRead, bytes); }
+
   static void open_unix(basic_fstream_traits<T, int> *self) {
     int flags = O_RDONLY;
     if (self->getOpenMode() == IOMode::WRITE) {
       flags = O_WRONLY | O_CREAT;
     }
+    if (self->getOpenMode() == IOMode::APPEND) {
+      flags = O_WRONLY | O_CREAT | O_APPEND;
+    }
     if (static_cast<IOMode>(static_cast<int>(self->getOpenMode()) &
                             static_cast<int>(IOMode::READWRITE)) ==
         IOMode::READWRITE) {
@@ -116,6 +312,8 @@ protected:
   }
 };
 
+template <character_type T> class basic_ofstream;
+
 template <character_type T>
 class basic_ifstream : public basic_fstream_unix<T> {
 public:
@@ -130,24 +328,41 @@ public:
     this->m_mode = IOMode::READ;
     this->setHandle(handle);
   }
+  // Reads `handle` through `buffer`, e.g. static storage borrowed with
+  // array<T>{borrowed, storage, size}, instead of allocating one.
+  basic_ifstream(int handle, bool isSeekable, array<T> &&buffer)
+      : basic_fstream_unix<T>{forward<array<T>>(buffer), array<T>{}} {
+    this->setSeekable(isSeekable);
+    this->setFileName("(opened by handle)");
+    this->m_mode = IOMode::READ;
+    this->setHandle(handle);
+  }
+  ~basic_ifstream() {
+    if (m_ownNonBlock)
+      fcntl(this->m_handle, F_SETFL,
+            fcntl(this->m_handle, F_GETFL) & ~O_NONBLOCK);
+  }
 
   virtual ssize_t rseek(ssize_t offset, IOPos position) {
     if (!this->m_isSeekable)
       return -1l;
-    if (lseek(this->m_handle,
-              this->m_roffset + static_cast<ssize_t>(this->m_rbuffer.pos) -
-                  static_cast<ssize_t>(this->m_rbuffer.size),
-              SEEK_SET) == -1) {
+    if (this->sysSeek(this->m_roffset +
+                          static_cast<ssize_t>(this->m_rbuffer.pos) -
+                          static_cast<ssize_t>(this->m_rbuffer.size),
+                      SEEK_SET) == -1) {
       invoke(file_error_handler, __FILE__, __FUNCTION__);
       return -1l;
     }
-    auto cur = lseek(this->m_handle, offset, static_cast<int>(position));
+    auto cur = this->sysSeek(offset, static_cast<int>(position));
     if (cur == -1) {
       invoke(file_error_handler, __FILE__, __FUNCTION__);
       return -1l;
     }
     this->m_rbuffer.size = 0;
     this->m_rbuffer.pos = 0;
+    this->m_rbuffer.eof = false;
+    m_reverse.end = -1;
+    restartCheck(cur);
     return this->m_roffset = cur;
   }
   virtual ssize_t tellr() const {
@@ -155,23 +370,119 @@ public:
            static_cast<ssize_t>(this->m_rbuffer.size);
   }
   ssize_t tellend() {
+    if (m_limit >= 0)
+      return m_limit;
     if (this->m_isSeekable)
-      return ::lseek(this->m_handle, 0, SEEK_END);
+      return this->sysSeek(0, SEEK_END);
     return 0l;
   }
+  // Pipes and sockets only know they are at end of file once a read has
+  // returned 0, so this stays false until the writer has closed its end and
+  // the buffered data has been consumed.
   bool eof() {
     if (this->m_isSeekable)
       return tellend() == tellr();
-    int n;
-
-    auto res = ioctl(0, FIONREAD, &n);
-    if (res == -1) {
-      invoke(file_error_handler, __FILE__, __FUNCTION__);
-      return true;
+    return this->m_rbuffer.eof && this->m_rbuffer.size == 0;
+  }
+  // True if the last refill gave up because no data arrived within the
+  // timeout (or at once, for a zero timeout or an O_NONBLOCK handle). Data
+  // consumed before that point has already been returned to the caller.
+  bool wouldBlock() const { return this->m_rbuffer.blocked; }
+  // Forgets a previously seen end of file, e.g. to pick up appended data.
+  void clearEof() { this->m_rbuffer.eof = false; }
+  // Looks for the trailer basic_ofstream::writeChecksum() appends and hides
+  // it: reads end where the data does, a checksum of the same kind starts,
+  // and once reads reach the end checksumCheck() tells whether the data
+  // matched. Verifying needs one pass from the start; rseek() back to 0
+  // starts it over, seeking anywhere else gives it up. Returns false, and
+  // changes nothing, if the file has no trailer.
+  bool expectChecksum() {
+    if (!this->m_isSeekable || m_limit >= 0)
+      return false;
+    auto const end = this->sysSeek(0, SEEK_END);
+    auto constexpr size = checksum::TRAILER_SIZE;
+    if (end < static_cast<ssize_t>(size))
+      return false;
+    array<T> trailer{size / sizeof(T)};
+    auto const at = static_cast<size_t>(end) - size;
+    if (at % sizeof(T) != 0 ||
+        readBlock(trailer.data(), at / sizeof(T), size / sizeof(T)) !=
+            size / sizeof(T))
+      return false;
+    ChecksumKind kind;
+    if (!checksum::decode_trailer(reinterpret_cast<char const *>(trailer.data()),
+                                  kind, m_expectedBytes, m_expected))
+      return false;
+    m_limit = static_cast<ssize_t>(at);
+    this->m_checksum.reset(kind);
+    m_check = tellr() == 0 ? ChecksumCheck::PENDING : ChecksumCheck::NONE;
+    return true;
+  }
+  ChecksumCheck checksumCheck() const { return m_check; }
+  // Returns the lines of the file last to first, one per call, each with its
+  // newline as readline() would; {.., 0} once the start has been reached.
+  // This walk starts at the end of the file and is independent of the
+  // forward read position; rseek() starts it over. The file is read
+  // backward in REVERSE_BLOCK sized blocks, so only the blocks holding the
+  // returned lines are ever read.
+  pair<array<T>, size_t> readline_reverse() {
+    auto &r = m_reverse;
+    if (!this->m_isSeekable)
+      return {array<T>{}, 0ul};
+    if (r.end < 0) {
+      auto const end = tellend();
+      if (end < 0)
+        return {array<T>{}, 0ul};
+      r.end = r.base = end / static_cast<ssize_t>(sizeof(T));
+      r.size = 0;
+    }
+    if (r.end == 0)
+      return {array<T>{}, 0ul};
+    // The element just before `end` belongs to the line even if it is a
+    // newline, so the search for the previous newline starts below it.
+    auto unscanned = static_cast<size_t>(max(r.end - 1 - r.base, ssize_t{0}));
+    ssize_t start;
+    for (;;) {
+      auto const at =
+          simd::find_last(r.buf.data(), unscanned, static_cast<T>('\n'));
+      if (at != unscanned) {
+        start = r.base + static_cast<ssize_t>(at) + 1;
+        break;
+      }
+      if (r.base == 0) {
+        start = 0;
+        break;
+      }
+      auto const oldBase = r.base;
+      if (!extendBackward())
+        return {array<T>{}, 0ul};
+      unscanned = static_cast<size_t>(min(oldBase, r.end - 1) - r.base);
     }
-    if (n == 0)
-      return true;
-    return false;
+    auto const length = static_cast<size_t>(r.end - start);
+    array<T> line{length};
+    memcpy(line.data(), r.buf.data() + (start - r.base), length * sizeof(T));
+    r.end = start;
+    return {line, length};
+  }
+  // Reads the last `count` elements of the file (all of it if it is
+  // shorter) with a single seek, whatever the file's size.
+  pair<array<T>, size_t> read_last(size_t count) {
+    if (!this->m_isSeekable)
+      return {array<T>{}, 0ul};
+    auto const end = tellend();
+    if (end < 0)
+      return {array<T>{}, 0ul};
+    auto const total = static_cast<size_t>(end) / sizeof(T);
+    count = min(count, total);
+    array<T> result{count};
+    auto const got = readBlock(result.data(), total - count, count);
+    return {result, got};
+  }
+  // Moves up to `size` elements (all of them by default) to `sink`; see
+  // basic_ofstream::transfer_from.
+  size_t copy_to(basic_ofstream<T> &sink,
+                 size_t size = std::numeric_limits<size_t>::max()) {
+    return sink.transfer_from(*this, size);
   }
   static bool is_nl(T ch) { return ch == '\n'; }
   virtual pair<array<T>, size_t> readline() { return readUntil(&is_nl); }
@@ -207,6 +518,8 @@ public:
     bool found = false;
     while (actualRead != size) {
       if (checkNeedsFill()) {
+        if (actualRead != 0)
+          STREAM_STAT(straddles, 1);
         auto filled = fillBuffer(firstReq);
         firstReq = false;
         if (filled == 0)
@@ -222,44 +535,416 @@ public:
     }
     return {actualRead, found};
   }
+  // Reads up to and including the first occurrence of delimiter[0, length),
+  // e.g. "\r\n", found even when it spans refills. Without a match the
+  // result holds everything up to the end of the stream.
+  pair<array<T>, size_t> readUntil(T const *delimiter, size_t length) {
+    array<T> result{max(length, size_t{16})};
+    size_t totalRead = 0;
+    bool firstReq = true;
+    for (;;) {
+      auto [readsize, found] =
+          readUntilSequence(result, 0, totalRead, result.capacity() - totalRead,
+                            delimiter, length, firstReq);
+      firstReq = false;
+      totalRead += readsize;
+      if (found || totalRead != result.capacity())
+        break;
+      array<T> grown{result.capacity() << 1};
+      memcpy(grown.data(), result.data(), totalRead * sizeof(T));
+      result = forward<array<T>>(grown);
+    }
+    return {result, totalRead};
+  }
+  pair<array<T>, size_t> readUntil(T const *delimiter) {
+    return readUntil(delimiter, stringlen(delimiter));
+  }
+  pair<size_t, bool> readUntil(array<T> &buffer, T const *delimiter,
+                               size_t length, bool firstReq = true) {
+    return readUntil(buffer, 0, buffer.capacity(), delimiter, length,
+                     firstReq);
+  }
+  // Fills buffer[start, start + size) without growing it. When it fills up
+  // without a match, a tail that could begin the delimiter is left unread,
+  // so a delimiter straddling two calls is found by the second.
+  pair<size_t, bool> readUntil(array<T> &buffer, size_t start, size_t size,
+                               T const *delimiter, size_t length,
+                               bool firstReq = true) {
+    auto result = readUntilSequence(buffer, start, start, size, delimiter,
+                                    length, firstReq);
+    if (!result.second && result.first == size && size > 1) {
+      auto const kept = simd::partial_sequence(buffer.data() + start + 1,
+                                               size - 1, delimiter, length);
+      unread(buffer.data() + start + size - kept, kept);
+      result.first -= kept;
+    }
+    return result;
+  }
   virtual size_t read(array<T> &buffer, size_t size, bool firstReq = true) {
+    return read(buffer, 0, size, firstReq);
+  }
+  virtual size_t read(array<T> &buffer, size_t start, size_t size,
+                      bool firstReq = true) {
     size_t actualRead = 0;
     while (actualRead != size) {
       if (checkNeedsFill()) {
-        auto filled = fillBuffer(firstReq);
+        auto filled = readSome(buffer.data() + start + actualRead,
+                               size - actualRead, firstReq);
         firstReq = false;
         if (filled == 0)
           break;
+        actualRead += filled;
+        continue;
       }
-      actualRead += consumeBuffer(buffer, actualRead, size - actualRead);
+      actualRead +=
+          consumeBuffer(buffer, start + actualRead, size - actualRead);
     }
     return actualRead;
   }
+  // Reads at most `size` elements with at most one read of the handle:
+  // whatever is buffered, else straight into `data` for reads of at least a
+  // buffer, else through the buffer. Returns 0 at end of stream or if the
+  // read would block.
+  size_t readSome(T *data, size_t size, bool firstReq = true) {
+    if (size == 0)
+      return 0;
+    if (checkNeedsFill()) {
+      if (size >= this->m_rbuffer.buf.capacity())
+        return readHandle(data, size);
+      if (fillBuffer(firstReq) == 0)
+        return 0;
+    }
+    auto const count = min(this->m_rbuffer.size - this->m_rbuffer.pos, size);
+    memcpy(data, cursor(), count * sizeof(T));
+    advance(count);
+    return count;
+  }
+  template <integer_type V> pair<V, ParseStatus> read_int() {
+    bool firstReq = true;
+    if (!skipSpaces(firstReq))
+      return {V{}, ParseStatus::END_OF_STREAM};
+    bool negative = false;
+    if (available(firstReq) != 0 &&
+        (*cursor() == static_cast<T>('-') || *cursor() == static_cast<T>('+'))) {
+      negative = *cursor() == static_cast<T>('-');
+      advance(1);
+    }
+    simd::digit_accumulator acc;
+    if (consumeDigits(acc, firstReq) == 0)
+      return {V{}, ParseStatus::NO_DIGITS};
+    using limits = std::numeric_limits<V>;
+    uint64_t const limit =
+        negative ? (limits::is_signed ? static_cast<uint64_t>(limits::max()) + 1
+                                      : 0)
+                 : static_cast<uint64_t>(limits::max());
+    if (acc.dropped != 0 || acc.value > limit)
+      return {negative ? limits::min() : limits::max(),
+              ParseStatus::OUT_OF_RANGE};
+    return {negative ? static_cast<V>(0 - acc.value) : static_cast<V>(acc.value),
+            ParseStatus::OK};
+  }
+  // Mantissas longer than 19-20 significant digits are truncated before
+  // rounding, so the result may be off by one ulp for such inputs.
+  pair<double, ParseStatus> read_double() {
+    bool firstReq = true;
+    if (!skipSpaces(firstReq))
+      return {0.0, ParseStatus::END_OF_STREAM};
+    bool negative = false;
+    if (available(firstReq) != 0 &&
+        (*cursor() == static_cast<T>('-') || *cursor() == static_cast<T>('+'))) {
+      negative = *cursor() == static_cast<T>('-');
+      advance(1);
+    }
+    simd::digit_accumulator acc;
+    auto digits = consumeDigits(acc, firstReq);
+    int64_t exponent = static_cast<int64_t>(acc.dropped);
+    if (available(firstReq) != 0 && *cursor() == static_cast<T>('.')) {
+      advance(1);
+      size_t folded = 0;
+      digits += consumeDigits(acc, firstReq, &folded);
+      exponent -= static_cast<int64_t>(folded);
+    }
+    if (digits == 0)
+      return {0.0, ParseStatus::NO_DIGITS};
+    if (available(firstReq) != 0 &&
+        (*cursor() == static_cast<T>('e') || *cursor() == static_cast<T>('E'))) {
+      advance(1);
+      bool negexp = false;
+      if (available(firstReq) != 0 && (*cursor() == static_cast<T>('-') ||
+                                       *cursor() == static_cast<T>('+'))) {
+        negexp = *cursor() == static_cast<T>('-');
+        advance(1);
+      }
+      simd::digit_accumulator exp;
+      if (consumeDigits(exp, firstReq) == 0)
+        return {0.0, ParseStatus::INVALID};
+      int64_t constexpr maxexp = 1 << 20;
+      auto const e = exp.dropped != 0 || exp.value > maxexp
+                         ? maxexp
+                         : static_cast<int64_t>(exp.value);
+      exponent += negexp ? -e : e;
+    }
+    double const sign = negative ? -1.0 : 1.0;
+    if (acc.value == 0)
+      return {sign * 0.0, ParseStatus::OK};
+    if (acc.dropped == 0 && acc.value <= (uint64_t{1} << 53) &&
+        exponent >= -22 && exponent <= 22) {
+      auto value = static_cast<double>(acc.value);
+      value = exponent < 0 ? value / simd::exact_pow10[-exponent]
+                           : value * simd::exact_pow10[exponent];
+      return {sign * value, ParseStatus::OK};
+    }
+    if (exponent > 400)
+      return {sign * std::numeric_limits<double>::infinity(),
+              ParseStatus::OUT_OF_RANGE};
+    if (exponent < -400)
+      return {sign * 0.0, ParseStatus::OUT_OF_RANGE};
+    char text[48];
+    snprintf(text, sizeof(text), "%llue%lld",
+             static_cast<unsigned long long>(acc.value),
+             static_cast<long long>(exponent));
+    errno = 0;
+    auto value = strtod(text, nullptr);
+    // ERANGE is also reported for subnormal results, which are still valid.
+    auto status = errno == ERANGE && (value == 0.0 || value > 1.0)
+                      ? ParseStatus::OUT_OF_RANGE
+                      : ParseStatus::OK;
+    errno = 0;
+    return {sign * value, status};
+  }
 
 protected:
+  friend class basic_ofstream<T>;
+
+  static constexpr size_t REVERSE_BLOCK = size_t{64} << 10;
+  // End of the data in bytes when a checksum trailer follows it, else -1.
+  ssize_t m_limit = -1;
+  uint64_t m_expected = 0;
+  uint64_t m_expectedBytes = 0;
+  ChecksumCheck m_check = ChecksumCheck::NONE;
+  // Set once makeNonBlocking() looked at the handle, and if it switched it.
+  bool m_flagsChecked = false;
+  bool m_ownNonBlock = false;
+  void restartCheck(ssize_t offset) {
+    if (m_limit < 0)
+      return;
+    this->m_checksum.reset(this->m_checksum.kind());
+    m_check = offset == 0 ? ChecksumCheck::PENDING : ChecksumCheck::NONE;
+  }
+  void finishCheck() {
+    if (m_check != ChecksumCheck::PENDING)
+      return;
+    m_check = this->m_checksum.bytes() == m_expectedBytes &&
+                      this->checksum() == m_expected
+                  ? ChecksumCheck::OK
+                  : ChecksumCheck::MISMATCH;
+  }
+  // Window of the file held by readline_reverse(): elements [base, base +
+  // size) of the file, of which those from `end` on were already returned.
+  // `end` is -1 until the first call.
+  struct {
+    array<T> buf;
+    ssize_t base = 0;
+    size_t size = 0;
+    ssize_t end = -1;
+  } m_reverse;
+
+  // Reads `count` elements at element offset `at`, bypassing the read
+  // buffer. Returns fewer only at end of file or on an error.
+  size_t readBlock(T *data, size_t at, size_t count) {
+    if (this->sysSeek(static_cast<off_t>(at * sizeof(T)), SEEK_SET) == -1) {
+      invoke(file_error_handler, __FILE__, __FUNCTION__);
+      return 0ul;
+    }
+    auto *bytes = reinterpret_cast<char *>(data);
+    size_t const total = count * sizeof(T);
+    size_t done = 0;
+    while (done != total) {
+      auto rsize = this->sysRead(bytes + done, total - done);
+      if (rsize == -1 && errno == EINTR)
+        continue;
+      if (rsize == -1)
+        invoke(file_error_handler, __FILE__, __FUNCTION__);
+      if (rsize <= 0)
+        break;
+      done += static_cast<size_t>(rsize);
+    }
+    return done / sizeof(T);
+  }
+  // Prepends the block before the reverse window, dropping what
+  // readline_reverse() already returned.
+  bool extendBackward() {
+    auto &r = m_reverse;
+    auto const block = static_cast<size_t>(
+        min(r.base, static_cast<ssize_t>(REVERSE_BLOCK)));
+    auto const keep = static_cast<size_t>(r.end - r.base);
+    if (r.buf.capacity() < block + keep) {
+      array<T> grown{max(block + keep, REVERSE_BLOCK)};
+      memcpy(grown.data() + block, r.buf.data(), keep * sizeof(T));
+      r.buf = forward<array<T>>(grown);
+    } else {
+      memmove(r.buf.data() + block, r.buf.data(), keep * sizeof(T));
+    }
+    auto const at = static_cast<size_t>(r.base) - block;
+    if (readBlock(r.buf.data(), at, block) != block) {
+      r.end = -1;
+      return false;
+    }
+    r.base -= static_cast<ssize_t>(block);
+    r.size = block + keep;
+    return true;
+  }
+
   bool checkNeedsFill() const { return this->m_rbuffer.size == 0; }
-  virtual size_t fillBuffer(bool firstRequest = true) {
+  // Switches the handle to O_NONBLOCK for timed reads, once; the destructor
+  // switches it back. This changes the flags of the open file description,
+  // which other holders of it share.
+  void makeNonBlocking() {
+    m_flagsChecked = true;
+    auto const flags = fcntl(this->m_handle, F_GETFL);
+    if (flags == -1 || (flags & O_NONBLOCK) != 0)
+      return;
+    m_ownNonBlock = fcntl(this->m_handle, F_SETFL, flags | O_NONBLOCK) != -1;
+  }
+  bool waitReadable() {
+    pollfd pfd{this->m_handle, POLLIN, 0};
+    int ready;
+    do {
+      STREAM_STAT(syscalls, 1);
+      ready = ::poll(&pfd, 1, this->m_timeout);
+    } while (ready == -1 && errno == EINTR);
+    // Errors and hangups are left for the following read to report.
+    return ready != 0;
+  }
+  static bool is_space(T ch) {
+    return ch == ' ' || ch == '\t' || ch == '\n' || ch == '\r' ||
+           ch == '\v' || ch == '\f';
+  }
+  // Elements left in the read buffer, refilling it once if it is empty.
+  size_t available(bool &firstReq) {
+    if (checkNeedsFill()) {
+      fillBuffer(firstReq);
+      firstReq = false;
+    }
+    return this->m_rbuffer.size - this->m_rbuffer.pos;
+  }
+  T const *cursor() const {
+    return this->m_rbuffer.buf.data() + this->m_rbuffer.pos;
+  }
+  void advance(size_t count) {
+    this->m_rbuffer.pos += count;
+    if (this->m_rbuffer.pos == this->m_rbuffer.size) {
+      this->m_rbuffer.pos = 0;
+      this->m_rbuffer.size = 0;
+    }
+  }
+  // Puts back the `count` elements just taken, which may have come from an
+  // earlier refill; they were already counted and checksummed.
+  void unread(T const *data, size_t count) {
+    if (this->m_rbuffer.pos >= count) {
+      this->m_rbuffer.pos -= count;
+      return;
+    }
+    auto const left = this->m_rbuffer.size - this->m_rbuffer.pos;
+    if (left + count > this->m_rbuffer.buf.capacity()) {
+      array<T> grown{left + count};
+      memcpy(grown.data() + count, cursor(), left * sizeof(T));
+      this->m_rbuffer.buf = forward<array<T>>(grown);
+    } else {
+      memmove(this->m_rbuffer.buf.data() + count, cursor(), left * sizeof(T));
+    }
+    memcpy(this->m_rbuffer.buf.data(), data, count * sizeof(T));
+    this->m_rbuffer.pos = 0;
+    this->m_rbuffer.size = left + count;
+  }
+  bool skipSpaces(bool &firstReq) {
+    for (;;) {
+      auto const avail = available(firstReq);
+      if (avail == 0)
+        return false;
+      auto const *p = cursor();
+      size_t skipped = 0;
+      while (skipped < avail && is_space(p[skipped]))
+        ++skipped;
+      advance(skipped);
+      if (skipped != avail)
+        return true;
+    }
+  }
+  // Consumes a run of digits straddling any number of refills.
+  size_t consumeDigits(simd::digit_accumulator &acc, bool &firstReq,
+                       size_t *folded = nullptr) {
+    size_t total = 0;
+    for (;;) {
+      auto const avail = available(firstReq);
+      if (avail == 0)
+        break;
+      auto const run = simd::digit_run(cursor(), avail);
+      auto const f = acc.accumulate(cursor(), run);
+      if (folded != nullptr)
+        *folded += f;
+      advance(run);
+      total += run;
+      if (run != avail)
+        break;
+    }
+    return total;
+  }
+  virtual size_t fillBuffer(bool /*firstRequest*/ = true) {
+    auto const filled =
+        readHandle(this->m_rbuffer.buf.data() + this->m_rbuffer.size,
+                   this->m_rbuffer.buf.capacity() - this->m_rbuffer.size);
+    this->m_rbuffer.size += filled;
+    return filled;
+  }
+  // One read of the handle into `into`, at most `room` elements, with the
+  // same limit, timeout and checksum handling as a refill.
+  size_t readHandle(T *into, size_t room) {
+    this->m_rbuffer.blocked = false;
+    if (!this->m_isSeekable && this->m_rbuffer.eof)
+      return 0ul;
     if (this->m_isSeekable &&
-        lseek(this->m_handle, this->m_roffset, SEEK_SET) == -1) {
+        this->sysSeek(this->m_roffset, SEEK_SET) == -1) {
       invoke(file_error_handler, __FILE__, __FUNCTION__);
       return 0ul;
     }
-    if (!firstRequest && !this->m_isSeekable && eof())
-      return 0l;
-    errno = 0;
-    auto rsize = ::read(
-        this->m_handle, this->m_rbuffer.buf.data() + this->m_rbuffer.size,
-        (this->m_rbuffer.buf.capacity() - this->m_rbuffer.size) * sizeof(T));
+    auto bytes = room * sizeof(T);
+    if (m_limit >= 0) {
+      auto const left = max(m_limit - this->m_roffset, ssize_t{0});
+      if (left == 0) {
+        finishCheck();
+        return 0ul;
+      }
+      bytes = min(bytes, static_cast<size_t>(left));
+    }
+    // A timed read of a pipe or socket tries the read first and only polls
+    // when nothing is there; regular files never block.
+    if (this->m_timeout >= 0 && !this->m_isSeekable && !m_flagsChecked)
+      makeNonBlocking();
+    STREAM_STAT(refills, 1);
+    ssize_t rsize;
+    for (;;) {
+      do {
+        rsize = this->sysRead(into, bytes);
+      } while (rsize == -1l && errno == EINTR);
+      if (rsize != -1l || (errno != EAGAIN && errno != EWOULDBLOCK))
+        break;
+      // A handle the caller made non-blocking reports it at once.
+      if (!m_ownNonBlock || this->m_timeout == 0 || !waitReadable()) {
+        this->m_rbuffer.blocked = true;
+        return 0ul;
+      }
+    }
     if (rsize == -1l) {
       invoke(file_error_handler, __FILE__, __FUNCTION__);
       return 0ul;
     }
-    if (errno != 0) {
-      invoke(file_error_handler, __FILE__, __FUNCTION__);
+    if (rsize == 0) {
+      this->m_rbuffer.eof = true;
       return 0ul;
     }
+    this->m_checksum.update(into, static_cast<size_t>(rsize));
     auto actualSize = rsize / sizeof(T);
-    this->m_rbuffer.size += actualSize;
     this->m_roffset += rsize;
     return static_cast<size_t>(actualSize);
   }
@@ -275,6 +960,45 @@ protected:
     }
     return consumed;
   }
+  // readUntil() for a delimiter sequence, reading into buffer[start, start +
+  // size). A match may begin anywhere from buffer[origin], so one that
+  // straddles two refills, or two calls appending to the same buffer, is
+  // still found; each chunk copied is searched together with the last
+  // length - 1 elements before it.
+  pair<size_t, bool> readUntilSequence(array<T> &buffer, size_t origin,
+                                       size_t start, size_t size,
+                                       T const *delimiter, size_t length,
+                                       bool firstReq) {
+    if (length == 0)
+      return {0ul, true};
+    size_t actualRead = 0;
+    while (actualRead != size) {
+      if (checkNeedsFill()) {
+        if (actualRead != 0)
+          STREAM_STAT(straddles, 1);
+        auto filled = fillBuffer(firstReq);
+        firstReq = false;
+        if (filled == 0)
+          break;
+      }
+      auto const end = start + actualRead;
+      auto const chunk =
+          min(this->m_rbuffer.size - this->m_rbuffer.pos, size - actualRead);
+      memcpy(buffer.data() + end, cursor(), chunk * sizeof(T));
+      auto const from = end - min(end - origin, length - 1);
+      auto const span = end + chunk - from;
+      auto const at =
+          simd::find_sequence(buffer.data() + from, span, delimiter, length);
+      if (at != span) {
+        auto const taken = from + at + length - end;
+        advance(taken);
+        return {actualRead + taken, true};
+      }
+      advance(chunk);
+      actualRead += chunk;
+    }
+    return {actualRead, false};
+  }
   virtual pair<size_t, bool> consumeUntil(array<T> &buffer, size_t start,
                                           size_t size, bool (*predicate)(T)) {
     size_t consumed = this->m_rbuffer.pos;
@@ -304,9 +1028,15 @@ protected:
 template <character_type T>
 class basic_ofstream : public basic_fstream_unix<T> {
 public:
-  basic_ofstream(array<T> const &filename) {
+  // IOMode::APPEND makes every flush a single write at the current end of
+  // the file, so processes appending to the same file never overwrite each
+  // other. The stream then never seeks: wseek() fails and tellw() counts the
+  // elements this stream wrote.
+  basic_ofstream(array<T> const &filename, IOMode mode = IOMode::WRITE) {
     this->m_fn = filename;
-    this->m_mode = IOMode::WRITE;
+    this->m_mode = mode;
+    if (mode == IOMode::APPEND)
+      this->setSeekable(false);
     this->openstream();
   }
   basic_ofstream(int handle, bool isSeekable = true) {
@@ -315,16 +1045,25 @@ public:
     this->m_mode = IOMode::WRITE;
     this->setHandle(handle);
   }
+  // Writes to `handle` through `buffer`, e.g. static storage borrowed with
+  // array<T>{borrowed, storage, size}, instead of allocating one.
+  basic_ofstream(int handle, bool isSeekable, array<T> &&buffer)
+      : basic_fstream_unix<T>{array<T>{}, forward<array<T>>(buffer)} {
+    this->setSeekable(isSeekable);
+    this->setFileName("(opened by handle)");
+    this->m_mode = IOMode::WRITE;
+    this->setHandle(handle);
+  }
 
   virtual ssize_t wseek(ssize_t offset, IOPos position) {
     if (!this->m_isSeekable)
       return -1l;
     flush();
-    if (lseek(this->m_handle, this->m_woffset, SEEK_SET) == -1) {
+    if (this->sysSeek(this->m_woffset, SEEK_SET) == -1) {
       invoke(file_error_handler, __FILE__, __FUNCTION__);
       return -1l;
     }
-    auto cur = lseek(this->m_handle, offset, static_cast<int>(position));
+    auto cur = this->sysSeek(offset, static_cast<int>(position));
     if (cur == -1) {
       invoke(file_error_handler, __FILE__, __FUNCTION__);
       return -1l;
@@ -334,56 +1073,411 @@ public:
   virtual ssize_t tellw() const {
     return this->m_woffset + static_cast<ssize_t>(this->m_wbuffer.size);
   }
+  // Elements buffered but not yet handed to the OS.
+  size_t pending() const { return this->m_wbuffer.size; }
+  // True if the last flush found an O_NONBLOCK handle full. The buffered
+  // data is kept and goes out with the next flush.
+  bool wouldBlock() const { return this->m_wbuffer.blocked; }
   virtual size_t write(T const *buffer) {
-    array<T> arr{buffer, stringlen(buffer)};
-    return write(arr);
+    return write(buffer, stringlen(buffer));
   }
   virtual size_t write(array<T> const &buffer) {
     return write(buffer, buffer.capacity());
   }
   virtual size_t write(array<T> const &buffer, size_t size) {
+    return write(buffer, 0, size);
+  }
+  virtual size_t write(array<T> const &buffer, size_t start, size_t size) {
+    return write(buffer.data() + start, size);
+  }
+  // Writes `size` elements straight from the caller's memory. Returns the
+  // elements taken, whether written or buffered; see tryWrite().
+  virtual size_t write(T const *data, size_t size) {
+    return reported(tryWrite(data, size), __FUNCTION__);
+  }
+  // write() that returns errors instead of calling file_error_handler. It
+  // stops early with WOULD_BLOCK once an O_NONBLOCK handle and the buffer
+  // are both full, or with FAILED when a write fails; either way what it
+  // took stays buffered for the next flush.
+  io_result tryWrite(T const *data, size_t size) {
     size_t actualWritten = 0;
     while (actualWritten != size) {
-      auto filled = fillBuffer(buffer, actualWritten, size - actualWritten);
-      actualWritten += filled;
+      // Anything that would fill the buffer by itself skips it once the
+      // buffer is empty.
+      if (this->m_wbuffer.size == 0) {
+        auto const through =
+            recordEnd(data + actualWritten, size - actualWritten);
+        if (through >= this->m_wbuffer.buf.capacity()) {
+          auto const direct = tryWriteThrough(data + actualWritten, through);
+          actualWritten += direct.count;
+          if (!direct.ok())
+            return {actualWritten, direct.status, direct.error};
+          continue;
+        }
+      }
+      actualWritten += fillBuffer(data + actualWritten, size - actualWritten);
       if (this->m_wbuffer.size == this->m_wbuffer.buf.capacity()) {
-        if (flush() == 0)
-          return actualWritten - filled;
+        auto const flushed = tryFlush();
+        if (flushed.status == IOStatus::FAILED ||
+            (!flushed.ok() &&
+             this->m_wbuffer.size == this->m_wbuffer.buf.capacity()))
+          return {actualWritten, flushed.status, flushed.error};
       }
     }
-    return actualWritten;
+    return {actualWritten};
   }
-  virtual size_t flush() {
+  // Returns the elements written; see tryFlush().
+  virtual size_t flush() { return reported(tryFlush(), __FUNCTION__); }
+  // Writes the buffer out, continuing after partial writes and EINTR. It
+  // returns errors instead of calling file_error_handler, and WOULD_BLOCK
+  // when an O_NONBLOCK handle fills up; the unsent tail stays buffered.
+  io_result tryFlush() {
     if (this->m_wbuffer.size == 0)
-      return 0ul;
+      return {};
+    auto const end =
+        recordEnd(this->m_wbuffer.buf.data(), this->m_wbuffer.size);
+    if (end == 0) {
+      // One unfinished record fills the buffer: make room for the rest.
+      if (this->m_wbuffer.size == this->m_wbuffer.buf.capacity())
+        growBuffer();
+      return {};
+    }
     if (this->m_isSeekable &&
-        lseek(this->m_handle, this->m_woffset, SEEK_SET) == -1) {
-      invoke(file_error_handler, __FILE__, __FUNCTION__);
+        this->sysSeek(this->m_woffset, SEEK_SET) == -1)
+      return {0ul, IOStatus::FAILED, errno};
+    STREAM_STAT(flushes, 1);
+    auto const sent = sendAll(this->m_wbuffer.buf.data(), end);
+    auto const left = this->m_wbuffer.size - sent.count;
+    memmove(this->m_wbuffer.buf.data(),
+            this->m_wbuffer.buf.data() + sent.count, left * sizeof(T));
+    this->m_wbuffer.size = left;
+    return sent;
+  }
+  // Moves up to `size` elements (all of them by default) from `source`.
+  // Whatever the two streams have buffered is written out first; the rest
+  // is copied by the kernel without passing through user space:
+  // copy_file_range between regular files, sendfile from a regular file,
+  // splice if either side is a pipe and splice through a private pipe
+  // otherwise, with plain buffered reads and writes as the last resort.
+  // Stops early at end of file or when a non-blocking handle would block
+  // (see wouldBlock() on both streams). Returns the elements moved.
+  size_t transfer_from(basic_ifstream<T> &source,
+                       size_t size = std::numeric_limits<size_t>::max()) {
+    // Records have to pass through the buffer to be aligned.
+    if (m_aligned)
+      return bufferedTransfer(source, size);
+    flush();
+    if (this->m_wbuffer.size != 0)
       return 0ul;
+    auto moved =
+        write(source.m_rbuffer.buf, source.m_rbuffer.pos,
+              min(source.m_rbuffer.size - source.m_rbuffer.pos, size));
+    source.advance(moved);
+    flush();
+    if (moved == size || this->m_wbuffer.size != 0)
+      return moved;
+    // Checksums and trailers need the data to pass through user space, and
+    // copy_file_range refuses O_APPEND descriptors.
+    bool const inKernel = this->m_mode != IOMode::APPEND &&
+                          this->checksumKind() == ChecksumKind::NONE &&
+                          source.checksumKind() == ChecksumKind::NONE &&
+                          source.m_limit < 0;
+    if constexpr (sizeof(T) == 1) {
+      if (inKernel) {
+        auto [copied, done] = kernelTransfer(source, size - moved);
+        moved += copied;
+        if (done)
+          return moved;
+      }
     }
-    auto wsize = ::write(this->m_handle, this->m_wbuffer.buf.data(),
-                         this->m_wbuffer.size * sizeof(T));
-    if (wsize != static_cast<ssize_t>(this->m_wbuffer.size * sizeof(T))) {
-      invoke(file_error_handler, __FILE__, __FUNCTION__);
+    return moved + bufferedTransfer(source, size - moved);
+  }
+
+  // Makes flushes end right after `delimiter`: the buffer only goes out up
+  // to its last delimiter, and grows to hold a record longer than itself.
+  // With APPEND this keeps concurrent appenders from interleaving inside a
+  // record. flush() keeps an unfinished record back; the destructor writes
+  // it out.
+  void setRecordDelimiter(T delimiter) {
+    m_delimiter = delimiter;
+    m_aligned = true;
+  }
+  void clearRecordDelimiter() { m_aligned = false; }
+
+  // Appends a trailer with the checksum of everything written since
+  // setChecksum(), for basic_ifstream::expectChecksum(). Returns the
+  // elements written, 0 if no checksum is running.
+  size_t writeChecksum() {
+    flush();
+    if (this->checksumKind() == ChecksumKind::NONE ||
+        this->m_wbuffer.size != 0)
       return 0ul;
-    }
-    auto actualSize = wsize / sizeof(T);
-    this->m_wbuffer.size = 0;
-    this->m_woffset += wsize;
-    return static_cast<size_t>(actualSize);
-  };
+    array<T> trailer{checksum::TRAILER_SIZE / sizeof(T)};
+    checksum::encode_trailer(reinterpret_cast<char *>(trailer.data()),
+                             this->checksumKind(), this->m_checksum.bytes(),
+                             this->checksum());
+    // The trailer is not part of the data it checks.
+    auto const running = this->m_checksum;
+    auto const written = writeThrough(trailer.data(), trailer.capacity());
+    this->m_checksum = running;
+    return written;
+  }
 
-  ~basic_ofstream() { flush(); }
+  ~basic_ofstream() {
+    // Waits out a full O_NONBLOCK handle rather than drop the tail, which
+    // includes an unfinished record, unless setTimeout() limits the wait; a
+    // tail dropped then is reported as ETIMEDOUT.
+    m_aligned = false;
+    io_result result;
+    while ((result = tryFlush()).status == IOStatus::WOULD_BLOCK) {
+      pollfd pfd{this->m_handle, POLLOUT, 0};
+      if (::poll(&pfd, 1, this->m_timeout) == 0) {
+        result = {0ul, IOStatus::FAILED, ETIMEDOUT};
+        break;
+      }
+    }
+    reported(result, __FUNCTION__);
+  }
 
 protected:
+  enum class Transfer { COPY_RANGE, SENDFILE, SPLICE, PIPE, BUFFERED };
+  // Largest single request; keeps the counts within ssize_t.
+  static constexpr size_t MAX_TRANSFER = size_t{1} << 30;
+
+  static Transfer chooseTransfer(struct stat const &in, struct stat const &out) {
+    if (S_ISFIFO(in.st_mode) || S_ISFIFO(out.st_mode))
+      return Transfer::SPLICE;
+    if (S_ISREG(in.st_mode))
+      return S_ISREG(out.st_mode) ? Transfer::COPY_RANGE : Transfer::SENDFILE;
+    return Transfer::PIPE;
+  }
+  // Copies bytes until `size`, end of file, a blocked handle or an error.
+  // The second member is false if the kernel could not handle these
+  // descriptors and the buffered path has to take over.
+  pair<size_t, bool> kernelTransfer(basic_ifstream<T> &source, size_t size) {
+    int const from = source.getHandle();
+    int const to = this->getHandle();
+    struct stat in, out;
+    if (fstat(from, &in) == -1 || fstat(to, &out) == -1)
+      return {0ul, false};
+    auto how = chooseTransfer(in, out);
+    // Offsets are passed explicitly for seekable regular files, so neither
+    // descriptor's file position is disturbed.
+    off_t roff = source.m_roffset;
+    off_t woff = this->m_woffset;
+    off_t *rpos = source.m_isSeekable && !S_ISFIFO(in.st_mode) ? &roff : nullptr;
+    off_t *wpos =
+        this->m_isSeekable && !S_ISFIFO(out.st_mode) ? &woff : nullptr;
+    int through[2] = {-1, -1};
+    size_t moved = 0;
+    while (moved != size && how != Transfer::BUFFERED) {
+      auto const chunk = min(size - moved, MAX_TRANSFER);
+      ssize_t n = -1;
+      switch (how) {
+      case Transfer::COPY_RANGE:
+        n = this->sysTransfer(TraceOp::WRITE, [&] {
+          return copy_file_range(from, rpos, to, wpos, chunk, 0);
+        });
+        if (n == -1 && (errno == EXDEV || errno == EINVAL ||
+                        errno == ENOSYS || errno == EOPNOTSUPP)) {
+          how = Transfer::SENDFILE;
+          continue;
+        }
+        break;
+      case Transfer::SENDFILE:
+        if (wpos != nullptr && this->sysSeek(woff, SEEK_SET) == -1) {
+          how = Transfer::BUFFERED;
+          continue;
+        }
+        n = this->sysTransfer(TraceOp::WRITE,
+                              [&] { return sendfile(to, from, rpos, chunk); });
+        if (n > 0)
+          woff += n;
+        if (n == -1 && (errno == EINVAL || errno == ENOSYS)) {
+          how = Transfer::BUFFERED;
+          continue;
+        }
+        break;
+      case Transfer::SPLICE:
+        n = this->sysTransfer(TraceOp::WRITE, [&] {
+          return splice(from, rpos, to, wpos, chunk, SPLICE_F_MOVE);
+        });
+        if (n == -1 && errno == EINVAL) {
+          how = Transfer::BUFFERED;
+          continue;
+        }
+        break;
+      case Transfer::PIPE:
+        if (through[0] == -1 && pipe2(through, O_CLOEXEC) == -1) {
+          how = Transfer::BUFFERED;
+          continue;
+        }
+        n = this->sysTransfer(TraceOp::READ, [&] {
+          return splice(from, rpos, through[1], nullptr, chunk, SPLICE_F_MOVE);
+        });
+        if (n == -1 && errno == EINVAL) {
+          how = Transfer::BUFFERED;
+          continue;
+        }
+        // Bytes already pulled into the pipe must reach the sink, even if
+        // that means waiting for it.
+        if (n > 0 && !drainPipe(through[0], wpos, static_cast<size_t>(n)))
+          n = -1;
+        break;
+      case Transfer::BUFFERED:
+        break;
+      }
+      if (n == -1 && errno == EINTR)
+        continue;
+      if (n == -1) {
+        if (errno == EAGAIN || errno == EWOULDBLOCK)
+          markBlocked(source);
+        else
+          invoke(file_error_handler, __FILE__, __FUNCTION__);
+        break;
+      }
+      if (n == 0) {
+        source.m_rbuffer.eof = true;
+        break;
+      }
+      source.countTransferred(n);
+      source.m_roffset += n;
+      this->m_woffset += n;
+      moved += static_cast<size_t>(n);
+    }
+    if (through[0] != -1) {
+      close(through[0]);
+      close(through[1]);
+    }
+    return {moved, how != Transfer::BUFFERED};
+  }
+  bool drainPipe(int pipe, off_t *wpos, size_t size) {
+    while (size != 0) {
+      auto n = this->sysTransfer(TraceOp::WRITE, [&] {
+        return splice(pipe, nullptr, this->getHandle(), wpos, size,
+                      SPLICE_F_MOVE);
+      });
+      if (n == -1 && errno == EAGAIN) {
+        pollfd pfd{this->getHandle(), POLLOUT, 0};
+        ::poll(&pfd, 1, -1);
+        continue;
+      }
+      if (n == -1 && errno == EINTR)
+        continue;
+      if (n <= 0)
+        return false;
+      size -= static_cast<size_t>(n);
+    }
+    return true;
+  }
+  // After EAGAIN, works out which side of a transfer has to be waited for.
+  void markBlocked(basic_ifstream<T> &source) {
+    pollfd fds[2] = {{source.getHandle(), POLLIN, 0},
+                     {this->getHandle(), POLLOUT, 0}};
+    ::poll(fds, 2, 0);
+    source.m_rbuffer.blocked = (fds[0].revents & (POLLIN | POLLHUP)) == 0;
+    this->m_wbuffer.blocked =
+        !source.m_rbuffer.blocked || (fds[1].revents & POLLOUT) == 0;
+  }
+  // Moves data through the two streams' buffers.
+  size_t bufferedTransfer(basic_ifstream<T> &source, size_t size) {
+    size_t moved = 0;
+    while (moved != size) {
+      if (source.checkNeedsFill() && source.fillBuffer(false) == 0)
+        break;
+      auto const chunk =
+          min(source.m_rbuffer.size - source.m_rbuffer.pos, size - moved);
+      auto const written =
+          write(source.m_rbuffer.buf, source.m_rbuffer.pos, chunk);
+      source.advance(written);
+      moved += written;
+      if (written != chunk)
+        break;
+    }
+    flush();
+    return moved;
+  }
+  // Writes straight from the caller's memory; see sendAll().
+  size_t writeThrough(T const *data, size_t size) {
+    return reported(tryWriteThrough(data, size), __FUNCTION__);
+  }
+  io_result tryWriteThrough(T const *data, size_t size) {
+    if (this->m_isSeekable &&
+        this->sysSeek(this->m_woffset, SEEK_SET) == -1)
+      return {0ul, IOStatus::FAILED, errno};
+    return sendAll(data, size);
+  }
+  // Writes at the handle's position until everything is written, an
+  // O_NONBLOCK handle is full (only ever on an element boundary) or a write
+  // fails, and advances m_woffset past the elements written.
+  io_result sendAll(T const *data, size_t size) {
+    this->m_wbuffer.blocked = false;
+    auto const *bytes = reinterpret_cast<char const *>(data);
+    size_t const total = size * sizeof(T);
+    size_t done = 0;
+    io_result result;
+    while (done != total) {
+      auto wsize = this->sysWrite(bytes + done, total - done);
+      if (wsize == -1 && errno == EINTR)
+        continue;
+      if (wsize == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+        if (done % sizeof(T) == 0) {
+          this->m_wbuffer.blocked = true;
+          result.status = IOStatus::WOULD_BLOCK;
+          break;
+        }
+        pollfd pfd{this->m_handle, POLLOUT, 0};
+        ::poll(&pfd, 1, -1);
+        continue;
+      }
+      if (wsize <= 0) {
+        result.status = IOStatus::FAILED;
+        result.error = wsize == 0 ? EIO : errno;
+        break;
+      }
+      this->m_checksum.update(bytes + done, static_cast<size_t>(wsize));
+      done += static_cast<size_t>(wsize);
+    }
+    result.count = done / sizeof(T);
+    this->m_woffset += static_cast<ssize_t>(result.count * sizeof(T));
+    return result;
+  }
+  // Hands a failure to file_error_handler and returns the count.
+  size_t reported(io_result const &result, char const *function) {
+    if (result.status == IOStatus::FAILED) {
+      errno = result.error;
+      invoke(file_error_handler, __FILE__, function);
+    }
+    return result.count;
+  }
   virtual size_t fillBuffer(array<T> const &buffer, size_t start, size_t size) {
+    return fillBuffer(buffer.data() + start, size);
+  }
+  size_t fillBuffer(T const *data, size_t size) {
     size_t toFill =
         min(size, this->m_wbuffer.buf.capacity() - this->m_wbuffer.size);
-    memcpy(this->m_wbuffer.buf.data() + this->m_wbuffer.size,
-           buffer.data() + start, toFill * sizeof(T));
+    memcpy(this->m_wbuffer.buf.data() + this->m_wbuffer.size, data,
+           toFill * sizeof(T));
     this->m_wbuffer.size += toFill;
     return toFill;
   }
+  // Elements of data[0, size) up to and including the last record
+  // delimiter; all of them unless flushes are record aligned.
+  size_t recordEnd(T const *data, size_t size) const {
+    if (!m_aligned)
+      return size;
+    auto const last = simd::find_last(data, size, m_delimiter);
+    return last == size ? 0ul : last + 1;
+  }
+  void growBuffer() {
+    array<T> grown{this->m_wbuffer.buf.capacity() * 2};
+    memcpy(grown.data(), this->m_wbuffer.buf.data(),
+           this->m_wbuffer.size * sizeof(T));
+    this->m_wbuffer.buf = forward<array<T>>(grown);
+  }
+
+  T m_delimiter{};
+  bool m_aligned = false;
 };
 
 #elif _WIN32
@@ -397,8 +1491,14 @@ template <typename T>
 class basic_fstream_windows : public basic_fstream_traits<T, HANDLE> {
 public:
   basic_fstream_windows() { this->m_open_actions.append(&open_windows); }
+  basic_fstream_windows(array<T> &&rbuf, array<T> &&wbuf)
+      : basic_fstream_traits<T, HANDLE>{forward<array<T>>(rbuf),
+                                        forward<array<T>>(wbuf)} {
+    this->m_open_actions.append(&open_windows);
+  }
 
   ~basic_fstream_windows() {
+    this->dumpStats();
     if (CloseHandle(this->getHandle()) == -1) {
       invoke(file_error_handler, __FILE__, __FUNCTION__);
     }
@@ -407,6 +1507,33 @@ public:
   }
 
 protected:
+  DWORD sysSeek(LONG offset, DWORD method) {
+    STREAM_STAT(syscalls, 1);
+    STREAM_STAT(seeks, 1);
+    auto const start = STREAM_TRACE_START();
+    auto cur = SetFilePointer(this->m_handle, offset, nullptr, method);
+    STREAM_TRACE(TraceOp::SEEK, cur, start);
+    return cur;
+  }
+  BOOL sysRead(void *data, DWORD size, DWORD *rsize) {
+    STREAM_STAT(syscalls, 1);
+    auto const start = STREAM_TRACE_START();
+    auto ok = ReadFile(this->m_handle, data, size, rsize, nullptr);
+    STREAM_TRACE(TraceOp::READ, ok ? *rsize : -1, start);
+    if (ok)
+      STREAM_STAT(bytesRead, *rsize);
+    return ok;
+  }
+  BOOL sysWrite(void const *data, DWORD size, DWORD *wsize) {
+    STREAM_STAT(syscalls, 1);
+    auto const start = STREAM_TRACE_START();
+    auto ok = WriteFile(this->m_handle, data, size, wsize, nullptr);
+    STREAM_TRACE(TraceOp::WRITE, ok ? *wsize : -1, start);
+    if (ok)
+      STREAM_STAT(bytesWritten, *wsize);
+    return ok;
+  }
+
   static void open_windows(basic_fstream_traits<T, HANDLE> *self) {
     DWORD creationDisposition = OPEN_EXISTING;
     DWORD desiredAccess = 0;
@@ -414,6 +1541,10 @@ protected:
       desiredAccess |= GENERIC_WRITE;
       creationDisposition = OPEN_ALWAYS;
     }
+    if (self->getOpenMode() == IOMode::APPEND) {
+      desiredAccess |= FILE_APPEND_DATA;
+      creationDisposition = OPEN_ALWAYS;
+    }
     if (self->getOpenMode() == IOMode::READ) {
       desiredAccess |= GENERIC_READ;
     }
@@ -427,6 +1558,13 @@ protected:
     }
   }
 };
+#ifdef __cpp_concepts
+template <character_type T>
+#else
+template <typename T>
+#endif
+class basic_ofstream;
+
 #ifdef __cpp_concepts
 template <character_type T>
 #else
@@ -445,26 +1583,37 @@ public:
     this->m_mode = IOMode::READ;
     this->setHandle(handle);
   }
+  // Reads `handle` through `buffer`, e.g. static storage borrowed with
+  // array<T>{borrowed, storage, size}, instead of allocating one.
+  basic_ifstream(HANDLE handle, bool isSeekable, array<T> &&buffer)
+      : basic_fstream_windows<T>{forward<array<T>>(buffer), array<T>{}} {
+    this->setSeekable(isSeekable);
+    this->setFileName("(opened by handle)");
+    this->m_mode = IOMode::READ;
+    this->setHandle(handle);
+  }
 
   virtual ssize_t rseek(ssize_t offset, IOPos position) {
     if (!this->m_isSeekable)
       return -1l;
-    if (SetFilePointer(this->m_handle,
-                       static_cast<LONG>(this->m_roffset) +
-                           static_cast<LONG>(this->m_rbuffer.pos) -
-                           static_cast<LONG>(this->m_rbuffer.size),
-                       nullptr, FILE_BEGIN) == INVALID_SET_FILE_POINTER) {
+    if (this->sysSeek(static_cast<LONG>(this->m_roffset) +
+                          static_cast<LONG>(this->m_rbuffer.pos) -
+                          static_cast<LONG>(this->m_rbuffer.size),
+                      FILE_BEGIN) == INVALID_SET_FILE_POINTER) {
       invoke(file_error_handler, __FILE__, __FUNCTION__);
       return -1l;
     }
-    auto cur = SetFilePointer(this->m_handle, static_cast<LONG>(offset),
-                              nullptr, static_cast<int>(position));
+    auto cur = this->sysSeek(static_cast<LONG>(offset),
+                             static_cast<DWORD>(position));
     if (cur == INVALID_SET_FILE_POINTER) {
       invoke(file_error_handler, __FILE__, __FUNCTION__);
       return -1l;
     }
     this->m_rbuffer.size = 0;
     this->m_rbuffer.pos = 0;
+    this->m_rbuffer.eof = false;
+    m_reverse.end = -1;
+    restartCheck(static_cast<ssize_t>(cur));
     return this->m_roffset = cur;
   }
   virtual ssize_t tellr() const {
@@ -472,8 +1621,10 @@ public:
            static_cast<ssize_t>(this->m_rbuffer.size);
   }
   ssize_t tellend() {
+    if (m_limit >= 0)
+      return m_limit;
     if (this->m_isSeekable)
-      return SetFilePointer(this->m_handle, 0, nullptr, FILE_END);
+      return this->sysSeek(0, FILE_END);
     return 0l;
   }
   bool eof() {
@@ -488,8 +1639,111 @@ public:
     // }
     // if (n == 0)
     //   return true;
+    if (!this->m_isSeekable)
+      return this->m_rbuffer.eof && this->m_rbuffer.size == 0;
+    if (m_limit >= 0)
+      return m_limit == tellr();
     return GetFileSize(this->m_handle, NULL) == tellr();
   }
+  // Kept for the same interface as on Linux; reads here wait for data, so
+  // this stays false.
+  bool wouldBlock() const { return this->m_rbuffer.blocked; }
+  // Forgets a previously seen end of file, e.g. to pick up appended data.
+  void clearEof() { this->m_rbuffer.eof = false; }
+  // Looks for the trailer basic_ofstream::writeChecksum() appends and hides
+  // it: reads end where the data does, a checksum of the same kind starts,
+  // and once reads reach the end checksumCheck() tells whether the data
+  // matched. Verifying needs one pass from the start; rseek() back to 0
+  // starts it over, seeking anywhere else gives it up. Returns false, and
+  // changes nothing, if the file has no trailer.
+  bool expectChecksum() {
+    if (!this->m_isSeekable || m_limit >= 0)
+      return false;
+    auto const end = this->sysSeek(0, FILE_END);
+    auto constexpr size = checksum::TRAILER_SIZE;
+    if (end == INVALID_SET_FILE_POINTER || end < size)
+      return false;
+    array<T> trailer{size / sizeof(T)};
+    auto const at = static_cast<size_t>(end) - size;
+    if (at % sizeof(T) != 0 ||
+        readBlock(trailer.data(), at / sizeof(T), size / sizeof(T)) !=
+            size / sizeof(T))
+      return false;
+    ChecksumKind kind;
+    if (!checksum::decode_trailer(reinterpret_cast<char const *>(trailer.data()),
+                                  kind, m_expectedBytes, m_expected))
+      return false;
+    m_limit = static_cast<ssize_t>(at);
+    this->m_checksum.reset(kind);
+    m_check = tellr() == 0 ? ChecksumCheck::PENDING : ChecksumCheck::NONE;
+    return true;
+  }
+  ChecksumCheck checksumCheck() const { return m_check; }
+  // Returns the lines of the file last to first, one per call, each with its
+  // newline as readline() would; {.., 0} once the start has been reached.
+  // This walk starts at the end of the file and is independent of the
+  // forward read position; rseek() starts it over. The file is read
+  // backward in REVERSE_BLOCK sized blocks, so only the blocks holding the
+  // returned lines are ever read.
+  pair<array<T>, size_t> readline_reverse() {
+    auto &r = m_reverse;
+    if (!this->m_isSeekable)
+      return {array<T>{}, 0ul};
+    if (r.end < 0) {
+      auto const end = tellend();
+      if (static_cast<DWORD>(end) == INVALID_SET_FILE_POINTER)
+        return {array<T>{}, 0ul};
+      r.end = r.base = end / static_cast<ssize_t>(sizeof(T));
+      r.size = 0;
+    }
+    if (r.end == 0)
+      return {array<T>{}, 0ul};
+    // The element just before `end` belongs to the line even if it is a
+    // newline, so the search for the previous newline starts below it.
+    auto unscanned = static_cast<size_t>(max(r.end - 1 - r.base, ssize_t{0}));
+    ssize_t start;
+    for (;;) {
+      auto const at =
+          simd::find_last(r.buf.data(), unscanned, static_cast<T>('\n'));
+      if (at != unscanned) {
+        start = r.base + static_cast<ssize_t>(at) + 1;
+        break;
+      }
+      if (r.base == 0) {
+        start = 0;
+        break;
+      }
+      auto const oldBase = r.base;
+      if (!extendBackward())
+        return {array<T>{}, 0ul};
+      unscanned = static_cast<size_t>(min(oldBase, r.end - 1) - r.base);
+    }
+    auto const length = static_cast<size_t>(r.end - start);
+    array<T> line{length};
+    memcpy(line.data(), r.buf.data() + (start - r.base), length * sizeof(T));
+    r.end = start;
+    return {line, length};
+  }
+  // Reads the last `count` elements of the file (all of it if it is
+  // shorter) with a single seek, whatever the file's size.
+  pair<array<T>, size_t> read_last(size_t count) {
+    if (!this->m_isSeekable)
+      return {array<T>{}, 0ul};
+    auto const end = tellend();
+    if (static_cast<DWORD>(end) == INVALID_SET_FILE_POINTER)
+      return {array<T>{}, 0ul};
+    auto const total = static_cast<size_t>(end) / sizeof(T);
+    count = min(count, total);
+    array<T> result{count};
+    auto const got = readBlock(result.data(), total - count, count);
+    return {result, got};
+  }
+  // Moves up to `size` elements (all of them by default) to `sink`; see
+  // basic_ofstream::transfer_from.
+  size_t copy_to(basic_ofstream<T> &sink,
+                 size_t size = std::numeric_limits<size_t>::max()) {
+    return sink.transfer_from(*this, size);
+  }
   static bool is_nl(T ch) { return ch == '\n'; }
   virtual pair<array<T>, size_t> readline() {
     auto result = readUntil(&is_nl);
@@ -531,6 +1785,8 @@ public:
     bool found = false;
     while (actualRead != size) {
       if (checkNeedsFill()) {
+        if (actualRead != 0)
+          STREAM_STAT(straddles, 1);
         auto filled = fillBuffer(firstReq);
         firstReq = false;
         if (filled == 0)
@@ -546,48 +1802,384 @@ public:
     }
     return {actualRead, found};
   }
+  // Reads up to and including the first occurrence of delimiter[0, length),
+  // e.g. "\r\n", found even when it spans refills. Without a match the
+  // result holds everything up to the end of the stream.
+  pair<array<T>, size_t> readUntil(T const *delimiter, size_t length) {
+    array<T> result{max(length, size_t{16})};
+    size_t totalRead = 0;
+    bool firstReq = true;
+    for (;;) {
+      auto [readsize, found] =
+          readUntilSequence(result, 0, totalRead, result.capacity() - totalRead,
+                            delimiter, length, firstReq);
+      firstReq = false;
+      totalRead += readsize;
+      if (found || totalRead != result.capacity())
+        break;
+      array<T> grown{result.capacity() << 1};
+      memcpy(grown.data(), result.data(), totalRead * sizeof(T));
+      result = forward<array<T>>(grown);
+    }
+    return {result, totalRead};
+  }
+  pair<array<T>, size_t> readUntil(T const *delimiter) {
+    return readUntil(delimiter, stringlen(delimiter));
+  }
+  pair<size_t, bool> readUntil(array<T> &buffer, T const *delimiter,
+                               size_t length, bool firstReq = true) {
+    return readUntil(buffer, 0, buffer.capacity(), delimiter, length,
+                     firstReq);
+  }
+  // Fills buffer[start, start + size) without growing it. When it fills up
+  // without a match, a tail that could begin the delimiter is left unread,
+  // so a delimiter straddling two calls is found by the second.
+  pair<size_t, bool> readUntil(array<T> &buffer, size_t start, size_t size,
+                               T const *delimiter, size_t length,
+                               bool firstReq = true) {
+    auto result = readUntilSequence(buffer, start, start, size, delimiter,
+                                    length, firstReq);
+    if (!result.second && result.first == size && size > 1) {
+      auto const kept = simd::partial_sequence(buffer.data() + start + 1,
+                                               size - 1, delimiter, length);
+      unread(buffer.data() + start + size - kept, kept);
+      result.first -= kept;
+    }
+    return result;
+  }
   virtual size_t read(array<T> &buffer, size_t size, bool firstReq = true) {
+    return read(buffer, 0, size, firstReq);
+  }
+  virtual size_t read(array<T> &buffer, size_t start, size_t size,
+                      bool firstReq = true) {
     size_t actualRead = 0;
     while (actualRead != size) {
       if (checkNeedsFill()) {
-        auto filled = fillBuffer(firstReq);
+        auto filled = readSome(buffer.data() + start + actualRead,
+                               size - actualRead, firstReq);
         firstReq = false;
         if (filled == 0)
           break;
+        actualRead += filled;
+        continue;
       }
-      actualRead += consumeBuffer(buffer, actualRead, size - actualRead);
+      actualRead +=
+          consumeBuffer(buffer, start + actualRead, size - actualRead);
     }
     return actualRead;
   }
+  // Reads at most `size` elements with at most one read of the handle:
+  // whatever is buffered, else straight into `data` for reads of at least a
+  // buffer, else through the buffer. Returns 0 at end of stream or if the
+  // read would block.
+  size_t readSome(T *data, size_t size, bool firstReq = true) {
+    if (size == 0)
+      return 0;
+    if (checkNeedsFill()) {
+      if (size >= this->m_rbuffer.buf.capacity())
+        return readHandle(data, size);
+      if (fillBuffer(firstReq) == 0)
+        return 0;
+    }
+    auto const count = min(this->m_rbuffer.size - this->m_rbuffer.pos, size);
+    memcpy(data, cursor(), count * sizeof(T));
+    advance(count);
+    return count;
+  }
+  template <integer_type V> pair<V, ParseStatus> read_int() {
+    bool firstReq = true;
+    if (!skipSpaces(firstReq))
+      return {V{}, ParseStatus::END_OF_STREAM};
+    bool negative = false;
+    if (available(firstReq) != 0 &&
+        (*cursor() == static_cast<T>('-') || *cursor() == static_cast<T>('+'))) {
+      negative = *cursor() == static_cast<T>('-');
+      advance(1);
+    }
+    simd::digit_accumulator acc;
+    if (consumeDigits(acc, firstReq) == 0)
+      return {V{}, ParseStatus::NO_DIGITS};
+    using limits = std::numeric_limits<V>;
+    uint64_t const limit =
+        negative ? (limits::is_signed ? static_cast<uint64_t>(limits::max()) + 1
+                                      : 0)
+                 : static_cast<uint64_t>(limits::max());
+    if (acc.dropped != 0 || acc.value > limit)
+      return {negative ? limits::min() : limits::max(),
+              ParseStatus::OUT_OF_RANGE};
+    return {negative ? static_cast<V>(0 - acc.value) : static_cast<V>(acc.value),
+            ParseStatus::OK};
+  }
+  // Mantissas longer than 19-20 significant digits are truncated before
+  // rounding, so the result may be off by one ulp for such inputs.
+  pair<double, ParseStatus> read_double() {
+    bool firstReq = true;
+    if (!skipSpaces(firstReq))
+      return {0.0, ParseStatus::END_OF_STREAM};
+    bool negative = false;
+    if (available(firstReq) != 0 &&
+        (*cursor() == static_cast<T>('-') || *cursor() == static_cast<T>('+'))) {
+      negative = *cursor() == static_cast<T>('-');
+      advance(1);
+    }
+    simd::digit_accumulator acc;
+    auto digits = consumeDigits(acc, firstReq);
+    int64_t exponent = static_cast<int64_t>(acc.dropped);
+    if (available(firstReq) != 0 && *cursor() == static_cast<T>('.')) {
+      advance(1);
+      size_t folded = 0;
+      digits += consumeDigits(acc, firstReq, &folded);
+      exponent -= static_cast<int64_t>(folded);
+    }
+    if (digits == 0)
+      return {0.0, ParseStatus::NO_DIGITS};
+    if (available(firstReq) != 0 &&
+        (*cursor() == static_cast<T>('e') || *cursor() == static_cast<T>('E'))) {
+      advance(1);
+      bool negexp = false;
+      if (available(firstReq) != 0 && (*cursor() == static_cast<T>('-') ||
+                                       *cursor() == static_cast<T>('+'))) {
+        negexp = *cursor() == static_cast<T>('-');
+        advance(1);
+      }
+      simd::digit_accumulator exp;
+      if (consumeDigits(exp, firstReq) == 0)
+        return {0.0, ParseStatus::INVALID};
+      int64_t constexpr maxexp = 1 << 20;
+      auto const e = exp.dropped != 0 || exp.value > maxexp
+                         ? maxexp
+                         : static_cast<int64_t>(exp.value);
+      exponent += negexp ? -e : e;
+    }
+    double const sign = negative ? -1.0 : 1.0;
+    if (acc.value == 0)
+      return {sign * 0.0, ParseStatus::OK};
+    if (acc.dropped == 0 && acc.value <= (uint64_t{1} << 53) &&
+        exponent >= -22 && exponent <= 22) {
+      auto value = static_cast<double>(acc.value);
+      value = exponent < 0 ? value / simd::exact_pow10[-exponent]
+                           : value * simd::exact_pow10[exponent];
+      return {sign * value, ParseStatus::OK};
+    }
+    if (exponent > 400)
+      return {sign * std::numeric_limits<double>::infinity(),
+              ParseStatus::OUT_OF_RANGE};
+    if (exponent < -400)
+      return {sign * 0.0, ParseStatus::OUT_OF_RANGE};
+    char text[48];
+    snprintf(text, sizeof(text), "%llue%lld",
+             static_cast<unsigned long long>(acc.value),
+             static_cast<long long>(exponent));
+    errno = 0;
+    auto value = strtod(text, nullptr);
+    // ERANGE is also reported for subnormal results, which are still valid.
+    auto status = errno == ERANGE && (value == 0.0 || value > 1.0)
+                      ? ParseStatus::OUT_OF_RANGE
+                      : ParseStatus::OK;
+    errno = 0;
+    return {sign * value, status};
+  }
 
 protected:
+  friend class basic_ofstream<T>;
+
+  static constexpr size_t REVERSE_BLOCK = size_t{64} << 10;
+  // End of the data in bytes when a checksum trailer follows it, else -1.
+  ssize_t m_limit = -1;
+  uint64_t m_expected = 0;
+  uint64_t m_expectedBytes = 0;
+  ChecksumCheck m_check = ChecksumCheck::NONE;
+  void restartCheck(ssize_t offset) {
+    if (m_limit < 0)
+      return;
+    this->m_checksum.reset(this->m_checksum.kind());
+    m_check = offset == 0 ? ChecksumCheck::PENDING : ChecksumCheck::NONE;
+  }
+  void finishCheck() {
+    if (m_check != ChecksumCheck::PENDING)
+      return;
+    m_check = this->m_checksum.bytes() == m_expectedBytes &&
+                      this->checksum() == m_expected
+                  ? ChecksumCheck::OK
+                  : ChecksumCheck::MISMATCH;
+  }
+  // Window of the file held by readline_reverse(): elements [base, base +
+  // size) of the file, of which those from `end` on were already returned.
+  // `end` is -1 until the first call.
+  struct {
+    array<T> buf;
+    ssize_t base = 0;
+    size_t size = 0;
+    ssize_t end = -1;
+  } m_reverse;
+
+  // Reads `count` elements at element offset `at`, bypassing the read
+  // buffer. Returns fewer only at end of file or on an error.
+  size_t readBlock(T *data, size_t at, size_t count) {
+    if (this->sysSeek(static_cast<LONG>(at * sizeof(T)), FILE_BEGIN) ==
+        INVALID_SET_FILE_POINTER) {
+      invoke(file_error_handler, __FILE__, __FUNCTION__);
+      return 0ul;
+    }
+    auto *bytes = reinterpret_cast<char *>(data);
+    size_t const total = count * sizeof(T);
+    size_t done = 0;
+    while (done != total) {
+      DWORD rsize;
+      if (!this->sysRead(bytes + done, static_cast<DWORD>(total - done),
+                         &rsize)) {
+        invoke(file_error_handler, __FILE__, __FUNCTION__);
+        break;
+      }
+      if (rsize == 0)
+        break;
+      done += rsize;
+    }
+    return done / sizeof(T);
+  }
+  // Prepends the block before the reverse window, dropping what
+  // readline_reverse() already returned.
+  bool extendBackward() {
+    auto &r = m_reverse;
+    auto const block = static_cast<size_t>(
+        min(r.base, static_cast<ssize_t>(REVERSE_BLOCK)));
+    auto const keep = static_cast<size_t>(r.end - r.base);
+    if (r.buf.capacity() < block + keep) {
+      array<T> grown{max(block + keep, REVERSE_BLOCK)};
+      memcpy(grown.data() + block, r.buf.data(), keep * sizeof(T));
+      r.buf = forward<array<T>>(grown);
+    } else {
+      memmove(r.buf.data() + block, r.buf.data(), keep * sizeof(T));
+    }
+    auto const at = static_cast<size_t>(r.base) - block;
+    if (readBlock(r.buf.data(), at, block) != block) {
+      r.end = -1;
+      return false;
+    }
+    r.base -= static_cast<ssize_t>(block);
+    r.size = block + keep;
+    return true;
+  }
+
   bool checkNeedsFill() const { return this->m_rbuffer.size == 0; }
-  virtual size_t fillBuffer(bool firstRequest = true) {
+  static bool is_space(T ch) {
+    return ch == ' ' || ch == '\t' || ch == '\n' || ch == '\r' ||
+           ch == '\v' || ch == '\f';
+  }
+  // Elements left in the read buffer, refilling it once if it is empty.
+  size_t available(bool &firstReq) {
+    if (checkNeedsFill()) {
+      fillBuffer(firstReq);
+      firstReq = false;
+    }
+    return this->m_rbuffer.size - this->m_rbuffer.pos;
+  }
+  T const *cursor() const {
+    return this->m_rbuffer.buf.data() + this->m_rbuffer.pos;
+  }
+  void advance(size_t count) {
+    this->m_rbuffer.pos += count;
+    if (this->m_rbuffer.pos == this->m_rbuffer.size) {
+      this->m_rbuffer.pos = 0;
+      this->m_rbuffer.size = 0;
+    }
+  }
+  // Puts back the `count` elements just taken, which may have come from an
+  // earlier refill; they were already counted and checksummed.
+  void unread(T const *data, size_t count) {
+    if (this->m_rbuffer.pos >= count) {
+      this->m_rbuffer.pos -= count;
+      return;
+    }
+    auto const left = this->m_rbuffer.size - this->m_rbuffer.pos;
+    if (left + count > this->m_rbuffer.buf.capacity()) {
+      array<T> grown{left + count};
+      memcpy(grown.data() + count, cursor(), left * sizeof(T));
+      this->m_rbuffer.buf = forward<array<T>>(grown);
+    } else {
+      memmove(this->m_rbuffer.buf.data() + count, cursor(), left * sizeof(T));
+    }
+    memcpy(this->m_rbuffer.buf.data(), data, count * sizeof(T));
+    this->m_rbuffer.pos = 0;
+    this->m_rbuffer.size = left + count;
+  }
+  bool skipSpaces(bool &firstReq) {
+    for (;;) {
+      auto const avail = available(firstReq);
+      if (avail == 0)
+        return false;
+      auto const *p = cursor();
+      size_t skipped = 0;
+      while (skipped < avail && is_space(p[skipped]))
+        ++skipped;
+      advance(skipped);
+      if (skipped != avail)
+        return true;
+    }
+  }
+  // Consumes a run of digits straddling any number of refills.
+  size_t consumeDigits(simd::digit_accumulator &acc, bool &firstReq,
+                       size_t *folded = nullptr) {
+    size_t total = 0;
+    for (;;) {
+      auto const avail = available(firstReq);
+      if (avail == 0)
+        break;
+      auto const run = simd::digit_run(cursor(), avail);
+      auto const f = acc.accumulate(cursor(), run);
+      if (folded != nullptr)
+        *folded += f;
+      advance(run);
+      total += run;
+      if (run != avail)
+        break;
+    }
+    return total;
+  }
+  virtual size_t fillBuffer(bool /*firstRequest*/ = true) {
+    auto const filled =
+        readHandle(this->m_rbuffer.buf.data() + this->m_rbuffer.size,
+                   this->m_rbuffer.buf.capacity() - this->m_rbuffer.size);
+    this->m_rbuffer.size += filled;
+    return filled;
+  }
+  // One read of the handle into `into`, at most `room` elements, with the
+  // same limit, timeout and checksum handling as a refill.
+  size_t readHandle(T *into, size_t room) {
+    if (!this->m_isSeekable && this->m_rbuffer.eof)
+      return 0ul;
     if (this->m_isSeekable &&
-        SetFilePointer(this->m_handle, static_cast<LONG>(this->m_roffset),
-                       nullptr, FILE_BEGIN) == INVALID_SET_FILE_POINTER) {
+        this->sysSeek(static_cast<LONG>(this->m_roffset), FILE_BEGIN) ==
+            INVALID_SET_FILE_POINTER) {
       invoke(file_error_handler, __FILE__, __FUNCTION__);
       return 0ul;
     }
-    if (!firstRequest && !this->m_isSeekable && eof())
-      return 0l;
-    errno = 0;
+    auto bytes = room * sizeof(T);
+    if (m_limit >= 0) {
+      auto const left = max(m_limit - this->m_roffset, ssize_t{0});
+      if (left == 0) {
+        finishCheck();
+        return 0ul;
+      }
+      bytes = min(bytes, static_cast<size_t>(left));
+    }
     DWORD rsize;
-    if (!ReadFile(this->m_handle,
-                  this->m_rbuffer.buf.data() + this->m_rbuffer.size,
-                  static_cast<DWORD>(
-                      (this->m_rbuffer.buf.capacity() - this->m_rbuffer.size) *
-                      sizeof(T)),
-                  &rsize, nullptr)) {
+    STREAM_STAT(refills, 1);
+    if (!this->sysRead(into, static_cast<DWORD>(bytes), &rsize)) {
+      // The write end of an anonymous pipe was closed.
+      if (GetLastError() == ERROR_BROKEN_PIPE) {
+        this->m_rbuffer.eof = true;
+        return 0ul;
+      }
       invoke(file_error_handler, __FILE__, __FUNCTION__);
       return 0ul;
     }
-    if (errno != 0) {
-      invoke(file_error_handler, __FILE__, __FUNCTION__);
+    if (rsize == 0) {
+      this->m_rbuffer.eof = true;
       return 0ul;
     }
+    this->m_checksum.update(into, rsize);
     auto actualSize = rsize / sizeof(T);
-    this->m_rbuffer.size += actualSize;
     this->m_roffset += rsize;
     return static_cast<size_t>(actualSize);
   }
@@ -603,6 +2195,45 @@ protected:
     }
     return consumed;
   }
+  // readUntil() for a delimiter sequence, reading into buffer[start, start +
+  // size). A match may begin anywhere from buffer[origin], so one that
+  // straddles two refills, or two calls appending to the same buffer, is
+  // still found; each chunk copied is searched together with the last
+  // length - 1 elements before it.
+  pair<size_t, bool> readUntilSequence(array<T> &buffer, size_t origin,
+                                       size_t start, size_t size,
+                                       T const *delimiter, size_t length,
+                                       bool firstReq) {
+    if (length == 0)
+      return {0ul, true};
+    size_t actualRead = 0;
+    while (actualRead != size) {
+      if (checkNeedsFill()) {
+        if (actualRead != 0)
+          STREAM_STAT(straddles, 1);
+        auto filled = fillBuffer(firstReq);
+        firstReq = false;
+        if (filled == 0)
+          break;
+      }
+      auto const end = start + actualRead;
+      auto const chunk =
+          min(this->m_rbuffer.size - this->m_rbuffer.pos, size - actualRead);
+      memcpy(buffer.data() + end, cursor(), chunk * sizeof(T));
+      auto const from = end - min(end - origin, length - 1);
+      auto const span = end + chunk - from;
+      auto const at =
+          simd::find_sequence(buffer.data() + from, span, delimiter, length);
+      if (at != span) {
+        auto const taken = from + at + length - end;
+        advance(taken);
+        return {actualRead + taken, true};
+      }
+      advance(chunk);
+      actualRead += chunk;
+    }
+    return {actualRead, false};
+  }
   virtual pair<size_t, bool> consumeUntil(array<T> &buffer, size_t start,
                                           size_t size, bool (*predicate)(T)) {
     size_t consumed = this->m_rbuffer.pos;
@@ -635,9 +2266,15 @@ template <typename T>
 #endif
 class basic_ofstream : public basic_fstream_windows<T> {
 public:
-  basic_ofstream(array<T> const &filename) {
+  // IOMode::APPEND makes every flush a single write at the current end of
+  // the file, so processes appending to the same file never overwrite each
+  // other. The stream then never seeks: wseek() fails and tellw() counts the
+  // elements this stream wrote.
+  basic_ofstream(array<T> const &filename, IOMode mode = IOMode::WRITE) {
     this->m_fn = filename;
-    this->m_mode = IOMode::WRITE;
+    this->m_mode = mode;
+    if (mode == IOMode::APPEND)
+      this->setSeekable(false);
     this->openstream();
   }
   basic_ofstream(HANDLE handle, bool isSeekable = true) {
@@ -646,18 +2283,27 @@ public:
     this->m_mode = IOMode::WRITE;
     this->setHandle(handle);
   }
+  // Writes to `handle` through `buffer`, e.g. static storage borrowed with
+  // array<T>{borrowed, storage, size}, instead of allocating one.
+  basic_ofstream(HANDLE handle, bool isSeekable, array<T> &&buffer)
+      : basic_fstream_windows<T>{array<T>{}, forward<array<T>>(buffer)} {
+    this->setSeekable(isSeekable);
+    this->setFileName("(opened by handle)");
+    this->m_mode = IOMode::WRITE;
+    this->setHandle(handle);
+  }
 
   virtual ssize_t wseek(ssize_t offset, IOPos position) {
     if (!this->m_isSeekable)
       return -1l;
     flush();
-    if (SetFilePointer(this->m_handle, static_cast<LONG>(this->m_woffset),
-                       nullptr, FILE_BEGIN) == INVALID_SET_FILE_POINTER) {
+    if (this->sysSeek(static_cast<LONG>(this->m_woffset), FILE_BEGIN) ==
+        INVALID_SET_FILE_POINTER) {
       invoke(file_error_handler, __FILE__, __FUNCTION__);
       return -1l;
     }
-    auto cur = SetFilePointer(this->m_handle, static_cast<LONG>(offset),
-                              nullptr, static_cast<int>(position));
+    auto cur = this->sysSeek(static_cast<LONG>(offset),
+                             static_cast<DWORD>(position));
     if (cur == INVALID_SET_FILE_POINTER) {
       invoke(file_error_handler, __FILE__, __FUNCTION__);
       return -1l;
@@ -668,58 +2314,219 @@ public:
     return this->m_woffset + static_cast<ssize_t>(this->m_wbuffer.size);
   }
   virtual size_t write(T const *buffer) {
-    array<T> arr{buffer, stringlen(buffer)};
-    return this->write(arr);
+    return write(buffer, stringlen(buffer));
   }
   virtual size_t write(array<T> const &buffer) {
     return this->write(buffer, buffer.capacity());
   }
   virtual size_t write(array<T> const &buffer, size_t size) {
+    return write(buffer, 0, size);
+  }
+  virtual size_t write(array<T> const &buffer, size_t start, size_t size) {
+    return write(buffer.data() + start, size);
+  }
+  // Writes `size` elements straight from the caller's memory. Returns the
+  // elements taken, whether written or buffered; see tryWrite().
+  virtual size_t write(T const *data, size_t size) {
+    return reported(tryWrite(data, size), __FUNCTION__);
+  }
+  // write() that returns errors instead of calling file_error_handler. It
+  // stops early with FAILED when a write fails; what it took stays
+  // buffered for the next flush.
+  io_result tryWrite(T const *data, size_t size) {
     size_t actualWritten = 0;
     while (actualWritten != size) {
-      auto filled = fillBuffer(buffer, actualWritten, size - actualWritten);
-      actualWritten += filled;
+      // Anything that would fill the buffer by itself skips it once the
+      // buffer is empty.
+      if (this->m_wbuffer.size == 0) {
+        auto const through =
+            recordEnd(data + actualWritten, size - actualWritten);
+        if (through >= this->m_wbuffer.buf.capacity()) {
+          auto const direct = tryWriteThrough(data + actualWritten, through);
+          actualWritten += direct.count;
+          if (!direct.ok())
+            return {actualWritten, direct.status, direct.error};
+          continue;
+        }
+      }
+      actualWritten += fillBuffer(data + actualWritten, size - actualWritten);
       if (this->m_wbuffer.size == this->m_wbuffer.buf.capacity()) {
-        if (flush() == 0)
-          return actualWritten - filled;
+        auto const flushed = tryFlush();
+        if (flushed.status == IOStatus::FAILED ||
+            (!flushed.ok() &&
+             this->m_wbuffer.size == this->m_wbuffer.buf.capacity()))
+          return {actualWritten, flushed.status, flushed.error};
       }
     }
-    return actualWritten;
+    return {actualWritten};
   }
-  virtual size_t flush() {
+  // Returns the elements written; see tryFlush().
+  virtual size_t flush() { return reported(tryFlush(), __FUNCTION__); }
+  // Writes the buffer out, continuing after partial writes. It returns
+  // errors instead of calling file_error_handler; the unsent tail stays
+  // buffered.
+  io_result tryFlush() {
     if (this->m_wbuffer.size == 0)
-      return 0ul;
+      return {};
+    auto const end =
+        recordEnd(this->m_wbuffer.buf.data(), this->m_wbuffer.size);
+    if (end == 0) {
+      // One unfinished record fills the buffer: make room for the rest.
+      if (this->m_wbuffer.size == this->m_wbuffer.buf.capacity())
+        growBuffer();
+      return {};
+    }
     if (this->m_isSeekable &&
-        SetFilePointer(this->m_handle, static_cast<LONG>(this->m_woffset),
-                       nullptr, FILE_BEGIN) == INVALID_SET_FILE_POINTER) {
-      invoke(file_error_handler, __FILE__, __FUNCTION__);
+        this->sysSeek(static_cast<LONG>(this->m_woffset), FILE_BEGIN) ==
+            INVALID_SET_FILE_POINTER)
+      return {0ul, IOStatus::FAILED, static_cast<int>(GetLastError())};
+    STREAM_STAT(flushes, 1);
+    auto const sent = sendAll(this->m_wbuffer.buf.data(), end);
+    auto const left = this->m_wbuffer.size - sent.count;
+    memmove(this->m_wbuffer.buf.data(),
+            this->m_wbuffer.buf.data() + sent.count, left * sizeof(T));
+    this->m_wbuffer.size = left;
+    return sent;
+  }
+  // Moves up to `size` elements (all of them by default) from `source`
+  // through the two streams' buffers. Stops early at end of file. Returns
+  // the elements moved.
+  size_t transfer_from(basic_ifstream<T> &source,
+                       size_t size = std::numeric_limits<size_t>::max()) {
+    // Records have to pass through the buffer to be aligned.
+    if (m_aligned)
+      return bufferedTransfer(source, size);
+    flush();
+    if (this->m_wbuffer.size != 0)
       return 0ul;
-    }
-    DWORD wsize;
-    if (!WriteFile(this->m_handle, this->m_wbuffer.buf.data(),
-                   static_cast<DWORD>(this->m_wbuffer.size * sizeof(T)), &wsize,
-                   nullptr) ||
-        wsize != static_cast<DWORD>(this->m_wbuffer.size * sizeof(T))) {
-      invoke(file_error_handler, __FILE__, __FUNCTION__);
+    return bufferedTransfer(source, size);
+  }
+
+  // Makes flushes end right after `delimiter`: the buffer only goes out up
+  // to its last delimiter, and grows to hold a record longer than itself.
+  // With APPEND this keeps concurrent appenders from interleaving inside a
+  // record. flush() keeps an unfinished record back; the destructor writes
+  // it out.
+  void setRecordDelimiter(T delimiter) {
+    m_delimiter = delimiter;
+    m_aligned = true;
+  }
+  void clearRecordDelimiter() { m_aligned = false; }
+
+  // Appends a trailer with the checksum of everything written since
+  // setChecksum(), for basic_ifstream::expectChecksum(). Returns the
+  // elements written, 0 if no checksum is running.
+  size_t writeChecksum() {
+    flush();
+    if (this->checksumKind() == ChecksumKind::NONE ||
+        this->m_wbuffer.size != 0)
       return 0ul;
-    }
-    auto actualSize = wsize / sizeof(T);
-    this->m_wbuffer.size = 0;
-    this->m_woffset += wsize;
-    return static_cast<size_t>(actualSize);
-  };
+    array<T> trailer{checksum::TRAILER_SIZE / sizeof(T)};
+    checksum::encode_trailer(reinterpret_cast<char *>(trailer.data()),
+                             this->checksumKind(), this->m_checksum.bytes(),
+                             this->checksum());
+    // The trailer is not part of the data it checks.
+    auto const running = this->m_checksum;
+    auto const written = writeThrough(trailer.data(), trailer.capacity());
+    this->m_checksum = running;
+    return written;
+  }
 
-  ~basic_ofstream() { flush(); }
+  ~basic_ofstream() {
+    // Includes an unfinished record.
+    m_aligned = false;
+    flush();
+  }
 
 protected:
+  // Moves data through the two streams' buffers.
+  size_t bufferedTransfer(basic_ifstream<T> &source, size_t size) {
+    size_t moved = 0;
+    while (moved != size) {
+      if (source.checkNeedsFill() && source.fillBuffer(false) == 0)
+        break;
+      auto const chunk =
+          min(source.m_rbuffer.size - source.m_rbuffer.pos, size - moved);
+      auto const written =
+          write(source.m_rbuffer.buf, source.m_rbuffer.pos, chunk);
+      source.advance(written);
+      moved += written;
+      if (written != chunk)
+        break;
+    }
+    flush();
+    return moved;
+  }
+  // Writes straight from the caller's memory; see sendAll().
+  size_t writeThrough(T const *data, size_t size) {
+    return reported(tryWriteThrough(data, size), __FUNCTION__);
+  }
+  io_result tryWriteThrough(T const *data, size_t size) {
+    if (this->m_isSeekable &&
+        this->sysSeek(static_cast<LONG>(this->m_woffset), FILE_BEGIN) ==
+            INVALID_SET_FILE_POINTER)
+      return {0ul, IOStatus::FAILED, static_cast<int>(GetLastError())};
+    return sendAll(data, size);
+  }
+  // Writes at the handle's position until everything is written or a write
+  // fails, and advances m_woffset past the elements written.
+  io_result sendAll(T const *data, size_t size) {
+    auto const *bytes = reinterpret_cast<char const *>(data);
+    size_t const total = size * sizeof(T);
+    size_t done = 0;
+    io_result result;
+    while (done != total) {
+      DWORD wsize;
+      if (!this->sysWrite(bytes + done, static_cast<DWORD>(total - done),
+                          &wsize) ||
+          wsize == 0) {
+        result.status = IOStatus::FAILED;
+        result.error = static_cast<int>(GetLastError());
+        break;
+      }
+      this->m_checksum.update(bytes + done, wsize);
+      done += wsize;
+    }
+    result.count = done / sizeof(T);
+    this->m_woffset += static_cast<ssize_t>(result.count * sizeof(T));
+    return result;
+  }
+  // Hands a failure to file_error_handler and returns the count.
+  size_t reported(io_result const &result, char const *function) {
+    if (result.status == IOStatus::FAILED) {
+      SetLastError(static_cast<DWORD>(result.error));
+      invoke(file_error_handler, __FILE__, function);
+    }
+    return result.count;
+  }
   virtual size_t fillBuffer(array<T> const &buffer, size_t start, size_t size) {
+    return fillBuffer(buffer.data() + start, size);
+  }
+  size_t fillBuffer(T const *data, size_t size) {
     size_t toFill =
         min(size, this->m_wbuffer.buf.capacity() - this->m_wbuffer.size);
-    memcpy(this->m_wbuffer.buf.data() + this->m_wbuffer.size,
-           buffer.data() + start, toFill * sizeof(T));
+    memcpy(this->m_wbuffer.buf.data() + this->m_wbuffer.size, data,
+           toFill * sizeof(T));
     this->m_wbuffer.size += toFill;
     return toFill;
   }
+  // Elements of data[0, size) up to and including the last record
+  // delimiter; all of them unless flushes are record aligned.
+  size_t recordEnd(T const *data, size_t size) const {
+    if (!m_aligned)
+      return size;
+    auto const last = simd::find_last(data, size, m_delimiter);
+    return last == size ? 0ul : last + 1;
+  }
+  void growBuffer() {
+    array<T> grown{this->m_wbuffer.buf.capacity() * 2};
+    memcpy(grown.data(), this->m_wbuffer.buf.data(),
+           this->m_wbuffer.size * sizeof(T));
+    this->m_wbuffer.buf = forward<array<T>>(grown);
+  }
+
+  T m_delimiter{};
+  bool m_aligned = false;
 };
 
 #endif
@@ -729,6 +2536,62 @@ using ofstream = basic_ofstream<char>;
 using iwfstream = basic_ifstream<short>;
 using owfstream = basic_ofstream<short>;
 
-extern ofstream cerr;
-extern ifstream cin;
-extern ofstream cout;
+// What layers built on top of a stream (utf16_reader, lz_ifstream, ...)
+// use of it. The file streams and the memory streams of memstream.hpp both
+// qualify, so a layer can run over either.
+#ifdef __cpp_concepts
+template <typename S>
+concept input_stream =
+    requires(S &s, array<typename S::char_type> &buffer, size_t n) {
+      { s.read(buffer, n, n) } -> same_as<size_t>;
+      { s.rseek(ssize_t{}, IOPos::SET) } -> same_as<ssize_t>;
+      { s.tellr() } -> same_as<ssize_t>;
+      { s.tellend() } -> same_as<ssize_t>;
+      { s.read_last(n) } -> same_as<pair<array<typename S::char_type>, size_t>>;
+      { s.eof() } -> same_as<bool>;
+    };
+template <typename S>
+concept output_stream =
+    requires(S &s, array<typename S::char_type> const &buffer, size_t n) {
+      { s.write(buffer, n, n) } -> same_as<size_t>;
+      { s.write(buffer.data(), n) } -> same_as<size_t>;
+      { s.flush() } -> same_as<size_t>;
+      { s.tellw() } -> same_as<ssize_t>;
+    };
+#endif
+
+// A standard stream, built on first use: the object itself is constant
+// initialized, so a program pays for cin, cout and cerr (buffers, name,
+// open actions) only once it touches them. Use it through -> or pass it
+// where a stream reference is expected; the common calls also work
+// directly, as cout.write(...) did on the stream itself.
+//
+// cout and cerr are never destroyed, so that destructors running at exit
+// can still report through cerr; whatever they hold is flushed by an
+// atexit() handler registered when they are built.
+template <typename S> class standard_stream {
+public:
+  constexpr explicit standard_stream(S &(*open)()) noexcept : m_open{open} {}
+  S &get() const { return m_open(); }
+  S *operator->() const { return &m_open(); }
+  S &operator*() const { return m_open(); }
+  operator S &() const { return m_open(); }
+
+  template <typename... Args> auto write(Args &&...args) const {
+    return m_open().write(forward<Args>(args)...);
+  }
+  auto flush() const { return m_open().flush(); }
+  template <typename... Args> auto read(Args &&...args) const {
+    return m_open().read(forward<Args>(args)...);
+  }
+  auto readline() const { return m_open().readline(); }
+
+private:
+  S &(*m_open)();
+};
+
+extern standard_stream<ofstream> const cerr;
+extern standard_stream<ifstream> const cin;
+extern standard_stream<ofstream> const cout;
+
+#endif // STREAMS_HPP
@@ -0,0 +1,109 @@
+#include "check.hpp"
+#include "streams.hpp"
+
+#include <cstdlib>
+#include <sys/wait.h>
+#include <unistd.h>
+
+namespace {
+
+constexpr int WRITERS = 16;
+constexpr int LINES = 200;
+
+// Line `n` of writer `id`: "<id> <n> " padded with the writer's letter to
+// a length between 20 and 219, longer than the stream's buffer for most.
+size_t make_line(char *line, int id, int n) {
+  auto const length = static_cast<size_t>(20 + (id * 37 + n * 11) % 200);
+  auto at = static_cast<size_t>(snprintf(line, 32, "%d %d ", id, n));
+  for (; at + 1 < length; ++at)
+    line[at] = static_cast<char>('a' + id);
+  line[at++] = '\n';
+  return at;
+}
+
+// Appends this writer's lines in random 1-100 byte pieces, so that flushes
+// would fall inside lines if they were not record-aligned.
+void writer(char const *path, int id) {
+  srand(static_cast<unsigned>(id + 1));
+  ofstream out{array<char>{path}, IOMode::APPEND};
+  out.setRecordDelimiter('\n');
+  char line[256];
+  for (int n = 0; n < LINES; ++n) {
+    auto const size = make_line(line, id, n);
+    for (size_t at = 0; at < size;) {
+      auto const piece =
+          min(size - at, static_cast<size_t>(1 + rand() % 100));
+      out.write(line + at, piece);
+      at += piece;
+    }
+  }
+}
+
+// Concurrent APPEND writers never overwrite or split each other's lines.
+void concurrent(char const *path) {
+  unlink(path);
+  pid_t children[WRITERS];
+  for (int id = 0; id < WRITERS; ++id) {
+    children[id] = fork();
+    if (children[id] == 0) {
+      writer(path, id);
+      _exit(0);
+    }
+  }
+  for (auto child : children) {
+    int status = 0;
+    CHECK(waitpid(child, &status, 0) == child);
+    CHECK(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+  }
+
+  ifstream in{array<char>{path}};
+  int next[WRITERS] = {};
+  size_t lines = 0;
+  bool intact = true;
+  char expected[256];
+  for (;;) {
+    auto [line, size] = in.readline();
+    if (size == 0)
+      break;
+    ++lines;
+    int id = -1, n = -1;
+    if (sscanf(line.data(), "%d %d ", &id, &n) != 2 || id < 0 ||
+        id >= WRITERS || n != next[id]) {
+      intact = false;
+      continue;
+    }
+    ++next[id];
+    intact = intact && make_line(expected, id, n) == size &&
+             memcmp(expected, line.data(), size) == 0;
+  }
+  CHECK(intact);
+  CHECK(lines == size_t{WRITERS} * LINES);
+  unlink(path);
+}
+
+// APPEND never seeks: wseek() fails and tellw() counts this stream's writes.
+void no_seek(char const *path) {
+  unlink(path);
+  {
+    ofstream out{array<char>{path}};
+    out.write("existing\n");
+  }
+  ofstream out{array<char>{path}, IOMode::APPEND};
+  CHECK(out.wseek(0, IOPos::SET) == -1);
+  out.write("more\n");
+  CHECK(out.tellw() == 5);
+  out.flush();
+  ifstream in{array<char>{path}};
+  CHECK(in.tellend() == 14);
+  unlink(path);
+}
+
+} // namespace
+
+int main() {
+  char path[] = "/tmp/append_testXXXXXX";
+  close(mkstemp(path));
+  concurrent(path);
+  no_seek(path);
+  return check_failures() != 0;
+}
@@ -0,0 +1,21 @@
+#ifndef CHECK_HPP
+#define CHECK_HPP
+
+#include <cstdio>
+
+// Minimal assertions for the test executables: a failed CHECK reports where
+// it failed and the test keeps going; main() returns check_failures().
+inline int &check_failures() {
+  static int failures = 0;
+  return failures;
+}
+
+#define CHECK(cond)                                                            \
+  do {                                                                         \
+    if (!(cond)) {                                                             \
+      fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond); \
+      ++check_failures();                                                      \
+    }                                                                          \
+  } while (0)
+
+#endif // CHECK_HPP
@@ -0,0 +1,154 @@
+#include "check.hpp"
+#include "streams.hpp"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace {
+
+char path[] = "/tmp/checksum_testXXXXXX";
+
+// Test vectors from RFC 3720 (iSCSI) and the common "123456789" check.
+void crc32c_vectors() {
+  unsigned char zeros[32] = {};
+  unsigned char ones[32];
+  unsigned char ascending[32];
+  for (int i = 0; i < 32; ++i) {
+    ones[i] = 0xFF;
+    ascending[i] = static_cast<unsigned char>(i);
+  }
+  CHECK(checksum::crc32c(0, "", 0) == 0);
+  CHECK(checksum::crc32c(0, "123456789", 9) == 0xE3069283u);
+  CHECK(checksum::crc32c(0, zeros, 32) == 0x8A9136AAu);
+  CHECK(checksum::crc32c(0, ones, 32) == 0x62A8AB43u);
+  CHECK(checksum::crc32c(0, ascending, 32) == 0x46DD794Eu);
+  // Continuing a CRC over pieces gives the CRC of the whole.
+  CHECK(checksum::crc32c(checksum::crc32c(0, "12345", 5), "6789", 4) ==
+        0xE3069283u);
+  // The table and instruction paths agree.
+  auto const *digits = reinterpret_cast<unsigned char const *>("123456789");
+  CHECK(~checksum::crc32c_soft(~0u, digits, 9) == 0xE3069283u);
+#ifdef CHECKSUM_HAS_CRC32
+  if (checksum::has_sse42())
+    CHECK(~checksum::crc32c_hard(~0u, digits, 9) == 0xE3069283u);
+#endif
+}
+
+uint64_t xxh64_of(char const *text, size_t size) {
+  checksum::xxh64 hash;
+  hash.update(text, size);
+  return hash.digest();
+}
+
+// Reference values of XXH64 with seed 0.
+void xxh64_vectors() {
+  char const nobody[] = "Nobody inspects the spammish repetition";
+  CHECK(xxh64_of("", 0) == 0xEF46DB3751D8E999ull);
+  CHECK(xxh64_of("a", 1) == 0xD24EC4F1A98C6E5Bull);
+  CHECK(xxh64_of("abc", 3) == 0x44BC2CF5AD770999ull);
+  CHECK(xxh64_of(nobody, sizeof(nobody) - 1) == 0xFBCEA83C8A378BF1ull);
+  // Any split of the input gives the same digest.
+  bool same = true;
+  for (size_t cut = 0; cut < sizeof(nobody); ++cut) {
+    checksum::xxh64 hash;
+    hash.update(nobody, cut);
+    hash.update(nobody + cut, sizeof(nobody) - 1 - cut);
+    same = same && hash.digest() == 0xFBCEA83C8A378BF1ull;
+  }
+  CHECK(same);
+}
+
+void trailer_encoding() {
+  char trailer[checksum::TRAILER_SIZE];
+  checksum::encode_trailer(trailer, ChecksumKind::XXH64, 1234,
+                           0x0102030405060708ull);
+  ChecksumKind kind;
+  uint64_t bytes, value;
+  CHECK(checksum::decode_trailer(trailer, kind, bytes, value));
+  CHECK(kind == ChecksumKind::XXH64 && bytes == 1234 &&
+        value == 0x0102030405060708ull);
+  trailer[8] = 7;
+  CHECK(!checksum::decode_trailer(trailer, kind, bytes, value));
+}
+
+constexpr size_t LINES = 300;
+
+void write_file(ChecksumKind kind) {
+  unlink(path);
+  ofstream out{array<char>{path}};
+  out.setChecksum(kind);
+  char line[32];
+  for (size_t i = 0; i < LINES; ++i) {
+    snprintf(line, sizeof(line), "line %03zu\n", i);
+    out.write(line);
+  }
+  CHECK(out.writeChecksum() == checksum::TRAILER_SIZE);
+}
+
+ChecksumCheck read_file(size_t &lines) {
+  ifstream in{array<char>{path}};
+  CHECK(in.expectChecksum());
+  CHECK(in.checksumCheck() == ChecksumCheck::PENDING);
+  lines = 0;
+  while (in.readline().second != 0)
+    ++lines;
+  CHECK(in.eof());
+  return in.checksumCheck();
+}
+
+void stream_round_trip(ChecksumKind kind) {
+  write_file(kind);
+  size_t lines;
+  // The trailer is hidden from reads.
+  CHECK(read_file(lines) == ChecksumCheck::OK);
+  CHECK(lines == LINES);
+
+  // One flipped data byte is a mismatch.
+  auto const fd = ::open(path, O_WRONLY | O_CLOEXEC);
+  CHECK(::pwrite(fd, "X", 1, 100) == 1);
+  close(fd);
+  CHECK(read_file(lines) == ChecksumCheck::MISMATCH);
+  CHECK(lines == LINES);
+}
+
+void without_trailer() {
+  unlink(path);
+  {
+    ofstream out{array<char>{path}};
+    out.write("plain\n");
+  }
+  ifstream in{array<char>{path}};
+  CHECK(!in.expectChecksum());
+  CHECK(in.checksumCheck() == ChecksumCheck::NONE);
+  CHECK(in.readline().second == 6);
+}
+
+// A pass that does not start at the beginning cannot be checked.
+void seek_gives_up() {
+  write_file(ChecksumKind::CRC32C);
+  ifstream in{array<char>{path}};
+  CHECK(in.expectChecksum());
+  CHECK(in.rseek(9, IOPos::SET) == 9);
+  while (in.readline().second != 0) {
+  }
+  CHECK(in.checksumCheck() == ChecksumCheck::NONE);
+  CHECK(in.rseek(0, IOPos::SET) == 0);
+  while (in.readline().second != 0) {
+  }
+  CHECK(in.checksumCheck() == ChecksumCheck::OK);
+}
+
+} // namespace
+
+int main() {
+  close(mkstemp(path));
+  crc32c_vectors();
+  xxh64_vectors();
+  trailer_encoding();
+  stream_round_trip(ChecksumKind::CRC32C);
+  stream_round_trip(ChecksumKind::XXH64);
+  without_trailer();
+  seek_gives_up();
+  unlink(path);
+  return check_failures() != 0;
+}
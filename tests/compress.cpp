@@ -0,0 +1,105 @@
+#include "check.hpp"
+#include "compress.hpp"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace {
+
+// Three and a bit blocks of numbered lines.
+size_t write_stream(char const *path) {
+  unlink(path);
+  ofstream file{array<char>{path}};
+  lz_ofstream out{file, 2};
+  char line[32];
+  size_t size = 0;
+  for (size_t i = 0; size < 3 * lz::BLOCK + 1000; ++i) {
+    auto const len = snprintf(line, sizeof(line), "line %zu\n", i);
+    out.write(array<char>{line, static_cast<size_t>(len)},
+              static_cast<size_t>(len));
+    size += static_cast<size_t>(len);
+  }
+  out.close();
+  return size;
+}
+
+uint64_t load(int fd, off_t at) {
+  char bytes[8];
+  CHECK(pread(fd, bytes, 8, at) == 8);
+  return lz::load_le(bytes, 8);
+}
+void store(int fd, off_t at, uint64_t value) {
+  char bytes[8];
+  lz::store_le(bytes, value, 8);
+  CHECK(pwrite(fd, bytes, 8, at) == 8);
+}
+
+void seeks(char const *path, size_t size) {
+  ifstream file{array<char>{path}};
+  lz_ifstream in{file};
+  CHECK(in.rseek(lz::BLOCK + 5));
+  CHECK(in.tellr() == lz::BLOCK + 5);
+  array<char> buffer{16};
+  CHECK(in.read(buffer, 16) == 16);
+  CHECK(in.rseek(size + 10));
+  CHECK(in.eof());
+}
+
+// An entry claiming its block starts later than it does sends offsets past
+// the decoded block.
+void entry_past_block(char const *path) {
+  int fd = ::open(path, O_RDWR | O_CLOEXEC);
+  auto const end = lseek(fd, 0, SEEK_END);
+  auto const index = static_cast<off_t>(load(fd, end - 12));
+  auto const second = index + 16 + 8;
+  store(fd, second, 1);
+  close(fd);
+  {
+    ifstream file{array<char>{path}};
+    lz_ifstream in{file};
+    CHECK(!in.rseek(lz::BLOCK + 100));
+    CHECK(in.corrupt());
+    array<char> buffer{16};
+    CHECK(in.read(buffer, 16) == 0);
+  }
+  fd = ::open(path, O_RDWR | O_CLOEXEC);
+  store(fd, second, lz::BLOCK);
+  close(fd);
+}
+
+// A block count that cannot fit before the footer is refused without
+// allocating for it.
+void oversized_count(char const *path) {
+  int fd = ::open(path, O_RDWR | O_CLOEXEC);
+  auto const end = lseek(fd, 0, SEEK_END);
+  auto const count = load(fd, end - 20);
+  store(fd, end - 20, uint64_t{1} << 39);
+  {
+    ifstream file{array<char>{path}};
+    lz_ifstream in{file};
+    CHECK(!in.rseek(10));
+  }
+  store(fd, end - 20, count + 1);
+  {
+    ifstream file{array<char>{path}};
+    lz_ifstream in{file};
+    CHECK(!in.rseek(10));
+  }
+  store(fd, end - 20, count);
+  close(fd);
+}
+
+} // namespace
+
+int main() {
+  char path[] = "/tmp/compress_testXXXXXX";
+  close(mkstemp(path));
+  auto const size = write_stream(path);
+  seeks(path, size);
+  entry_past_block(path);
+  seeks(path, size);
+  oversized_count(path);
+  seeks(path, size);
+  unlink(path);
+  return check_failures() != 0;
+}
@@ -0,0 +1,118 @@
+#include "check.hpp"
+#include "coro.hpp"
+
+#include <sys/socket.h>
+#include <unistd.h>
+
+namespace {
+
+constexpr size_t PAYLOAD = size_t{4} << 20;
+
+// Sends PAYLOAD bytes through `fd`, waiting whenever the socket is full.
+task<void> sender(int fd, size_t *sent) {
+  char chunk[4096];
+  memset(chunk, 's', sizeof(chunk));
+  while (*sent != PAYLOAD) {
+    auto const n = ::write(fd, chunk, min(sizeof(chunk), PAYLOAD - *sent));
+    if (n > 0)
+      *sent += static_cast<size_t>(n);
+    else if (errno == EAGAIN)
+      co_await wait_writable(fd);
+    else
+      break;
+  }
+}
+// Reads from the same descriptor until PAYLOAD bytes came back.
+task<void> receiver(int fd, size_t *received) {
+  char chunk[4096];
+  while (*received != PAYLOAD) {
+    auto const n = ::read(fd, chunk, sizeof(chunk));
+    if (n > 0)
+      *received += static_cast<size_t>(n);
+    else if (n == -1 && errno == EAGAIN)
+      co_await wait_readable(fd);
+    else
+      break;
+  }
+}
+// Echoes everything back from the other end of the socket pair.
+void echo(int fd) {
+  char chunk[65536];
+  ssize_t n;
+  while ((n = ::read(fd, chunk, sizeof(chunk))) > 0)
+    for (ssize_t done = 0; done < n;) {
+      auto const w = ::write(fd, chunk + done, static_cast<size_t>(n - done));
+      if (w <= 0)
+        return;
+      done += w;
+    }
+}
+
+// A reader and a writer wait on one socket at the same time.
+template <typename E> void same_descriptor(E &exec) {
+  int fds[2];
+  CHECK(socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds) == 0);
+  CHECK(reactor::makeNonBlocking(fds[0]));
+  std::thread peer{echo, fds[1]};
+  size_t sent = 0;
+  size_t received = 0;
+  exec.spawn(sender(fds[0], &sent));
+  exec.spawn(receiver(fds[0], &received));
+  if constexpr (requires { exec.run(); })
+    exec.run();
+  else
+    exec.join();
+  CHECK(sent == PAYLOAD);
+  CHECK(received == PAYLOAD);
+  shutdown(fds[0], SHUT_RDWR);
+  peer.join();
+  close(fds[0]);
+  close(fds[1]);
+}
+
+// Regular files cannot be watched by epoll; waiting on one does not suspend.
+task<void> wait_on_file(int fd, bool *done) {
+  co_await wait_readable(fd);
+  co_await wait_writable(fd);
+  *done = true;
+}
+
+void regular_file() {
+  char path[] = "/tmp/coro_testXXXXXX";
+  int fd = mkstemp(path);
+  CHECK(fd != -1);
+  unlink(path);
+  loop_executor loop;
+  bool done = false;
+  loop.spawn(wait_on_file(fd, &done));
+  loop.run();
+  CHECK(done);
+  close(fd);
+}
+
+task<void> nap(std::atomic<int> *woken) {
+  co_await sleep_for(5);
+  woken->fetch_add(1);
+}
+
+void pool() {
+  pool_executor exec{4};
+  // The calling thread is not one of the pool's.
+  CHECK(exec.io() == nullptr);
+  std::atomic<int> woken{0};
+  for (int i = 0; i < 32; ++i)
+    exec.spawn(nap(&woken));
+  exec.join();
+  CHECK(woken.load() == 32);
+  same_descriptor(exec);
+}
+
+} // namespace
+
+int main() {
+  loop_executor loop;
+  same_descriptor(loop);
+  regular_file();
+  pool();
+  return check_failures() != 0;
+}
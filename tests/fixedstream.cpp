@@ -0,0 +1,116 @@
+#include "check.hpp"
+#include "fixedstream.hpp"
+#include "memstream.hpp"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace {
+
+// Literals shorter and longer than the buffer, then lines read back through
+// the same capacity. Built at every optimisation level the tree is.
+template <size_t N> void round_trip(char const *path) {
+  unlink(path);
+  {
+    ofstream file{array<char>{path}};
+    fixed_ofstream<N> out{file};
+    for (int i = 0; i < 20; ++i) {
+      out.write("line-abc\n");
+      out.write("0123456789abcdefghijklmnopqrstuvwxyz0123456789\n");
+      out.template write_n<4>("tick");
+      out.write("\n");
+    }
+  }
+  ifstream file{array<char>{path}};
+  fixed_ifstream<N> in{file};
+  bool same = true;
+  size_t lines = 0;
+  array<char> line{64};
+  size_t size = 0;
+  for (auto piece = in.readline_view(); piece.first != nullptr;
+       piece = in.readline_view()) {
+    memcpy(line.data() + size, piece.first, piece.second);
+    size += piece.second;
+    if (line[size - 1] != '\n')
+      continue;
+    char const *expected = lines % 3 == 0   ? "line-abc\n"
+                           : lines % 3 == 1 ? "0123456789abcdefghijklmnopqrstu"
+                                              "vwxyz0123456789\n"
+                                            : "tick\n";
+    same = same && size == stringlen(expected) &&
+           memcmp(line.data(), expected, size) == 0;
+    ++lines;
+    size = 0;
+  }
+  CHECK(same);
+  CHECK(lines == 60);
+  unlink(path);
+}
+
+// write_n/read_n for every copy kernel: single moves, overlapping pairs
+// and memcpy, through memory streams.
+template <size_t M> void records() {
+  char record[M];
+  for (size_t i = 0; i < M; ++i)
+    record[i] = static_cast<char>('a' + i % 26);
+  omemstream memory;
+  {
+    fixed_ofstream<64, omemstream> out{memory};
+    for (int i = 0; i < 10; ++i)
+      CHECK(out.template write_n<M>(record) == M);
+  }
+  CHECK(memory.size() == 10 * M);
+  imemstream source{static_cast<omemstream &&>(memory)};
+  fixed_ifstream<64, imemstream> in{source};
+  bool same = true;
+  char back[M];
+  for (int i = 0; i < 10; ++i) {
+    CHECK(in.template read_n<M>(back) == M);
+    same = same && memcmp(back, record, M) == 0;
+  }
+  CHECK(same);
+  CHECK(in.template read_n<M>(back) == 0);
+  CHECK(in.eof());
+}
+
+// A line cut short by a source that would block is not returned as if the
+// stream had ended; it comes whole once the rest arrives.
+void would_block() {
+  int fds[2];
+  CHECK(pipe2(fds, O_CLOEXEC | O_NONBLOCK) == 0);
+  ifstream file{fds[0], false};
+  fixed_ifstream<64> in{file};
+  CHECK(::write(fds[1], "first\nsec", 9) == 9);
+  auto line = in.readline_view();
+  CHECK(line.second == 6 && memcmp(line.first, "first\n", 6) == 0);
+  line = in.readline_view();
+  CHECK(line.first == nullptr && line.second == 0);
+  CHECK(in.wouldBlock());
+  CHECK(!in.eof());
+  char tick[4];
+  CHECK(in.read_n<4>(tick) == 0);
+  CHECK(::write(fds[1], "ond\n", 4) == 4);
+  line = in.readline_view();
+  CHECK(line.second == 7 && memcmp(line.first, "second\n", 7) == 0);
+  ::close(fds[1]);
+  CHECK(in.readline_view().first == nullptr);
+  CHECK(!in.wouldBlock());
+  CHECK(in.eof());
+}
+
+} // namespace
+
+int main() {
+  char path[] = "/tmp/fixedstream_testXXXXXX";
+  close(mkstemp(path));
+  round_trip<16>(path);
+  round_trip<32>(path);
+  records<1>();
+  records<3>();
+  records<8>();
+  records<12>();
+  records<24>();
+  records<40>();
+  would_block();
+  return check_failures() != 0;
+}
@@ -0,0 +1,135 @@
+#include "check.hpp"
+#include "follow.hpp"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <cstdlib>
+
+namespace {
+
+char dir[] = "/tmp/follow_testXXXXXX";
+char path[64];
+char rotated[64];
+
+// Everything the follower passed on since the last take(), concatenated.
+char seen[4096];
+size_t seenSize = 0;
+size_t seenLines = 0;
+
+void collect(array<char> const &line, size_t size) {
+  memcpy(seen + seenSize, line.data(), size);
+  seenSize += size;
+  ++seenLines;
+}
+bool took(char const *expected, size_t lines) {
+  auto const size = strlen(expected);
+  bool const same = seenSize == size && seenLines == lines &&
+                    memcmp(seen, expected, size) == 0;
+  if (!same)
+    fprintf(stderr, "got %zu lines: \"%.*s\"\n", seenLines,
+            static_cast<int>(seenSize), seen);
+  seenSize = 0;
+  seenLines = 0;
+  return same;
+}
+
+void append(char const *name, char const *text) {
+  auto const fd = ::open(name, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+  auto const size = strlen(text);
+  CHECK(::write(fd, text, size) == static_cast<ssize_t>(size));
+  close(fd);
+}
+// Truncates the file in place and writes `text` into it, as copytruncate
+// followed by a writer using O_APPEND does.
+void rewrite(char const *text) {
+  // Lets the mtime move past the last check even with coarse timestamps.
+  usleep(20000);
+  auto const fd = ::open(path, O_WRONLY | O_TRUNC | O_CLOEXEC);
+  auto const size = strlen(text);
+  CHECK(::write(fd, text, size) == static_cast<ssize_t>(size));
+  close(fd);
+}
+
+void follow() {
+  append(path, "before\n");
+  file_follower follower{path};
+  CHECK(follower.isOpen());
+  follower.poll(0, collect);
+  CHECK(took("", 0));
+
+  append(path, "a\nb\n");
+  follower.poll(1000, collect);
+  CHECK(took("a\nb\n", 2));
+
+  // A partial line waits for its newline.
+  append(path, "par");
+  follower.poll(1000, collect);
+  CHECK(took("", 0));
+  append(path, "tial\n");
+  follower.poll(1000, collect);
+  CHECK(took("partial\n", 1));
+
+  // Truncated to less than was read.
+  rewrite("t\n");
+  follower.poll(1000, collect);
+  CHECK(took("t\n", 1));
+
+  // Truncated and rewritten to the same size.
+  rewrite("u\n");
+  follower.poll(1000, collect);
+  CHECK(took("u\n", 1));
+
+  // Truncated and rewritten past the read position before the follower got
+  // to look.
+  append(path, "0123456789\n");
+  follower.poll(1000, collect);
+  CHECK(took("0123456789\n", 1));
+  rewrite("first\nsecond line\nthird line\n");
+  follower.poll(1000, collect);
+  CHECK(took("first\nsecond line\nthird line\n", 3));
+
+  // Appends after a rewrite are not mistaken for another one.
+  append(path, "more\n");
+  follower.poll(1000, collect);
+  CHECK(took("more\n", 1));
+  follower.poll(0, collect);
+  CHECK(took("", 0));
+
+  // Rotation: the old file is drained, including its unterminated last
+  // line, and the new one is read from its start.
+  append(path, "last of old\nunterminated");
+  CHECK(rename(path, rotated) == 0);
+  append(path, "new\n");
+  follower.poll(1000, collect);
+  CHECK(took("last of old\nunterminatednew\n", 3));
+  append(path, "next\n");
+  follower.poll(1000, collect);
+  CHECK(took("next\n", 1));
+}
+
+// A file that does not exist yet is read from its start once it appears.
+void created_later() {
+  unlink(path);
+  file_follower follower{path};
+  CHECK(!follower.isOpen());
+  follower.poll(0, collect);
+  append(path, "hello\n");
+  follower.poll(1000, collect);
+  CHECK(follower.isOpen());
+  CHECK(took("hello\n", 1));
+}
+
+} // namespace
+
+int main() {
+  CHECK(mkdtemp(dir) != nullptr);
+  snprintf(path, sizeof(path), "%s/log", dir);
+  snprintf(rotated, sizeof(rotated), "%s/log.1", dir);
+  follow();
+  created_later();
+  unlink(path);
+  unlink(rotated);
+  rmdir(dir);
+  return check_failures() != 0;
+}
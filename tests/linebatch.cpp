@@ -0,0 +1,112 @@
+#include "check.hpp"
+#include "linebatch.hpp"
+#include "memstream.hpp"
+
+#include <unistd.h>
+
+namespace {
+
+using memory_line_reader = basic_line_reader<char, imemstream>;
+
+bool line_is(line_batch const &batch, size_t i, char const *expected) {
+  auto const [line, size] = batch[i];
+  return size == stringlen(expected) && memcmp(line, expected, size) == 0;
+}
+
+// No batch takes more than maxLines lines; the rest come in later batches
+// in order.
+void line_limit() {
+  char const text[] = "a\nbb\nccc\ndddd\neeeee\n";
+  imemstream in{text, sizeof(text) - 1};
+  memory_line_reader reader{in};
+  line_batch batch;
+  CHECK(reader.readlines(batch, 2) == 2);
+  CHECK(line_is(batch, 0, "a\n") && line_is(batch, 1, "bb\n"));
+  CHECK(batch.length() == 5);
+  CHECK(batch.offsets()[2] == 5);
+  CHECK(reader.readlines(batch, 2) == 2);
+  CHECK(line_is(batch, 0, "ccc\n") && line_is(batch, 1, "dddd\n"));
+  CHECK(reader.readlines(batch, 2) == 1);
+  CHECK(line_is(batch, 0, "eeeee\n"));
+  CHECK(reader.readlines(batch, 2) == 0);
+  CHECK(batch.empty());
+}
+
+// No batch holds more than maxSize elements; a line longer than that
+// comes in maxSize pieces, only the last ending in a newline.
+void size_limit() {
+  char const text[] = "12\n0123456789abcdef\nxy\nlast";
+  imemstream in{text, sizeof(text) - 1};
+  memory_line_reader reader{in};
+  line_batch batch;
+  CHECK(reader.readlines(batch, 100, 8) == 1);
+  CHECK(line_is(batch, 0, "12\n"));
+  CHECK(reader.readlines(batch, 100, 8) == 1);
+  CHECK(line_is(batch, 0, "01234567"));
+  CHECK(reader.readlines(batch, 100, 8) == 1);
+  CHECK(line_is(batch, 0, "89abcdef"));
+  CHECK(reader.readlines(batch, 100, 8) == 2);
+  CHECK(line_is(batch, 0, "\n") && line_is(batch, 1, "xy\n"));
+  CHECK(batch.length() <= 8);
+  // The last line has no newline; the end of the stream ends it.
+  CHECK(reader.readlines(batch, 100, 8) == 1);
+  CHECK(line_is(batch, 0, "last"));
+  CHECK(reader.readlines(batch, 100, 8) == 0);
+  CHECK(reader.readlines(batch, 0, 8) == 0);
+  CHECK(reader.readlines(batch, 8, 0) == 0);
+}
+
+// Batched reading of a file gives the lines readline() does, across
+// refills and batches, at the default limits and small ones.
+void matches_readline(char const *path) {
+  unlink(path);
+  size_t count = 0;
+  {
+    ofstream out{array<char>{path}};
+    char line[300];
+    for (size_t i = 0; i < 20000; ++i, ++count) {
+      auto const len = static_cast<size_t>(snprintf(line, 32, "%zu ", i));
+      auto const size = len + (i * 7919) % 250;
+      memset(line + len, 'a' + static_cast<char>(i % 26), size - len);
+      line[size] = '\n';
+      out.write(line, size + 1);
+    }
+  }
+  size_t const limits[][2] = {{line_reader::MAX_LINES, line_reader::MAX_SIZE},
+                              {7, 1000},
+                              {1000, 300}};
+  for (auto const &limit : limits) {
+    ifstream batched{array<char>{path}};
+    ifstream single{array<char>{path}};
+    line_reader reader{batched};
+    line_batch batch;
+    size_t lines = 0;
+    bool same = true;
+    bool bounded = true;
+    while (reader.readlines(batch, limit[0], limit[1]) != 0) {
+      bounded = bounded && batch.size() <= limit[0] &&
+                batch.length() <= limit[1];
+      for (size_t i = 0; i < batch.size(); ++i, ++lines) {
+        auto [expected, size] = single.readline();
+        auto const [line, length] = batch[i];
+        same = same && size == length &&
+               memcmp(expected.data(), line, size) == 0;
+      }
+    }
+    CHECK(same);
+    CHECK(bounded);
+    CHECK(lines == count);
+  }
+  unlink(path);
+}
+
+} // namespace
+
+int main() {
+  char path[] = "/tmp/linebatch_testXXXXXX";
+  close(mkstemp(path));
+  line_limit();
+  size_limit();
+  matches_readline(path);
+  return check_failures() != 0;
+}
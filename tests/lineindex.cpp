@@ -0,0 +1,164 @@
+#include "check.hpp"
+#include "lineindex.hpp"
+
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+namespace {
+
+void elias_fano_values() {
+  uint32_t values[1000];
+  for (uint32_t i = 0; i < 1000; ++i)
+    values[i] = i * i;
+  elias_fano coded{values, 1000, uint64_t{999} * 999};
+  CHECK(coded.size() == 1000);
+  bool same = true;
+  for (size_t i = 0; i < 1000; ++i)
+    same = same && coded[i] == values[i];
+  CHECK(same);
+  auto view = elias_fano::view(coded.serialize(), coded.words());
+  CHECK(view.size() == 1000 && view[999] == values[999]);
+}
+
+// No values costs the header alone, however large the universe.
+void elias_fano_empty() {
+  elias_fano empty{static_cast<uint32_t const *>(nullptr), 0, uint64_t{1} << 24};
+  CHECK(empty.size() == 0);
+  CHECK(empty.words() == 5);
+  auto view = elias_fano::view(empty.serialize(), empty.words());
+  CHECK(view.words() == 5 && view.size() == 0);
+}
+
+void write_file(char const *path, char const *data, size_t size) {
+  unlink(path);
+  int fd = ::open(path, O_WRONLY | O_CREAT | O_CLOEXEC, 0644);
+  CHECK(fd != -1);
+  CHECK(::write(fd, data, size) == static_cast<ssize_t>(size));
+  close(fd);
+}
+
+// Chunks without a newline keep the index small.
+void newline_free_chunks() {
+  char path[] = "/tmp/lineindex_testXXXXXX";
+  close(mkstemp(path));
+  auto const size = static_cast<size_t>(line_index::CHUNK_SIZE * 3);
+  array<char> text{size};
+  memset(text.data(), 'x', size);
+  text[10] = '\n';
+  text[size - 1] = '\n';
+  write_file(path, text.data(), size);
+  ifstream stream{array<char>{path}};
+  line_index index{stream, 2};
+  CHECK(index.lines() == 2);
+  CHECK(index.offset(1) == 11);
+  CHECK(index.bytes() < 4096);
+  unlink(path);
+}
+
+void set_mtime(char const *path, time_t seconds) {
+  timespec const times[2] = {{seconds, 0}, {seconds, 0}};
+  CHECK(utimensat(AT_FDCWD, path, times, 0) == 0);
+}
+
+// Appends are scanned incrementally; a rewrite of the middle that keeps the
+// size is caught by the mtime and indexed again.
+void updates() {
+  char path[] = "/tmp/lineindex_testXXXXXX";
+  close(mkstemp(path));
+  // A whole chunk and then some: only the partial last chunk is rescanned
+  // on an append.
+  auto const size = static_cast<size_t>(line_index::CHUNK_SIZE) + 65536;
+  array<char> text{size};
+  for (size_t i = 0; i < size; ++i)
+    text[i] = i % 64 == 63 ? '\n' : 'a';
+  write_file(path, text.data(), size);
+  set_mtime(path, 1000);
+  ifstream stream{array<char>{path}};
+  line_index index{stream, 1};
+  CHECK(index.lines() == size / 64);
+
+  int fd = ::open(path, O_WRONLY | O_APPEND | O_CLOEXEC);
+  CHECK(::write(fd, "tail\n", 5) == 5);
+  close(fd);
+  set_mtime(path, 2000);
+  CHECK(index.update(stream, 1) == 65536 + 5);
+  CHECK(index.lines() == size / 64 + 1);
+
+  // Same size, the newlines in the middle of the first chunk moved.
+  fd = ::open(path, O_WRONLY | O_CLOEXEC);
+  char middle[4096];
+  memset(middle, 'b', sizeof(middle));
+  middle[100] = '\n';
+  CHECK(pwrite(fd, middle, sizeof(middle), 1 << 20) ==
+        static_cast<ssize_t>(sizeof(middle)));
+  close(fd);
+  set_mtime(path, 3000);
+  CHECK(index.update(stream, 1) == size + 5);
+  line_index fresh{stream, 1};
+  CHECK(fresh.lines() == size / 64 + 1 - 64 + 1);
+  CHECK(index.lines() == fresh.lines());
+  bool same = true;
+  for (size_t i = 0; i < fresh.lines(); ++i)
+    same = same && index.offset(i) == fresh.offset(i);
+  CHECK(same);
+  unlink(path);
+}
+
+// Processes saving one sidecar at once each leave a complete file behind,
+// and no temporaries.
+void concurrent_saves() {
+  char dir[] = "/tmp/lineindex_dirXXXXXX";
+  CHECK(mkdtemp(dir) != nullptr);
+  char path[64];
+  char sidecar[64];
+  snprintf(path, sizeof(path), "%s/data", dir);
+  snprintf(sidecar, sizeof(sidecar), "%s/data.idx", dir);
+  array<char> text{size_t{1} << 20};
+  for (size_t i = 0; i < text.capacity(); ++i)
+    text[i] = i % 100 == 99 ? '\n' : 'c';
+  write_file(path, text.data(), text.capacity());
+  pid_t children[8];
+  for (auto &child : children) {
+    child = fork();
+    if (child == 0) {
+      ifstream stream{array<char>{path}};
+      line_index index{stream, 1};
+      for (int i = 0; i < 20; ++i)
+        if (!index.save(sidecar))
+          _exit(1);
+      _exit(0);
+    }
+  }
+  for (auto child : children) {
+    int status = 0;
+    waitpid(child, &status, 0);
+    CHECK(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+  }
+  ifstream stream{array<char>{path}};
+  line_index loaded{stream, sidecar, 1};
+  CHECK(loaded.lines() == (text.capacity() + 99) / 100);
+  CHECK(loaded.scanned() == 0);
+  size_t entries = 0;
+  if (auto *listing = opendir(dir)) {
+    while (auto *entry = readdir(listing))
+      entries += entry->d_name[0] != '.';
+    closedir(listing);
+  }
+  CHECK(entries == 2);
+  unlink(sidecar);
+  unlink(path);
+  rmdir(dir);
+}
+
+} // namespace
+
+int main() {
+  elias_fano_values();
+  elias_fano_empty();
+  newline_free_chunks();
+  updates();
+  concurrent_saves();
+  return check_failures() != 0;
+}
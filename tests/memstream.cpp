@@ -0,0 +1,107 @@
+#include "check.hpp"
+#include "compress.hpp"
+#include "memstream.hpp"
+#include "utf.hpp"
+
+namespace {
+
+void lines() {
+  omemstream out;
+  CHECK(out.write("first\nsecond\nlast") == 17);
+  CHECK(out.tellw() == 17);
+  imemstream in{static_cast<omemstream &&>(out)};
+  CHECK(out.size() == 0);
+  CHECK(in.tellend() == 17);
+  auto [first, n] = in.readline();
+  CHECK(n == 6 && memcmp(first.data(), "first\n", 6) == 0);
+  auto [view, m] = in.readline_view();
+  CHECK(m == 7 && memcmp(view, "second\n", 7) == 0);
+  auto [last, k] = in.readline();
+  CHECK(k == 4 && memcmp(last.data(), "last", 4) == 0);
+  CHECK(in.eof());
+  CHECK(in.readline_view().second == 0);
+  auto [tail, t] = in.read_last(5);
+  CHECK(t == 5 && memcmp(tail.data(), "\nlast", 5) == 0);
+  CHECK(in.rseek(-4, IOPos::END) == 13);
+  omemstream copy;
+  CHECK(in.copy_to(copy) == 4);
+  CHECK(copy.size() == 4 && memcmp(copy.data(), "last", 4) == 0);
+}
+
+void gap() {
+  omemstream out;
+  out.write("ab");
+  CHECK(out.wseek(4, IOPos::SET) == 4);
+  out.write("c");
+  CHECK(out.size() == 5);
+  CHECK(memcmp(out.data(), "ab\0\0c", 5) == 0);
+}
+
+// The UTF-16 layers run over memory exactly as over files.
+void utf16_over_memory() {
+  char const text[] = "na\xc3\xafve \xf0\x9f\x98\x80\nline two\n";
+  imemstream in{text, sizeof(text) - 1};
+  utf16_reader reader{in};
+  auto [first, n] = reader.readline();
+  // "naïve " plus a surrogate pair and the newline.
+  CHECK(n == 9);
+  CHECK(first[2] == 0xEF);
+  CHECK(first[6] == static_cast<short>(0xD83D));
+  auto [second, m] = reader.readline();
+  CHECK(m == 9);
+  CHECK(reader.readline().second == 0);
+
+  omemstream out;
+  {
+    utf16_writer writer{out};
+    writer.write(first, 0, n);
+    writer.write(second, 0, m);
+    CHECK(writer.errors() == 0);
+  }
+  CHECK(out.size() == sizeof(text) - 1);
+  CHECK(memcmp(out.data(), text, out.size()) == 0);
+}
+
+// Compressing into an omemstream and reading it back from an imemstream,
+// including a seek through the block index.
+void lz_over_memory() {
+  omemstream packed;
+  size_t size = 0;
+  {
+    lz_ofstream out{packed, 2};
+    char line[32];
+    for (size_t i = 0; size < 2 * lz::BLOCK + 500; ++i) {
+      auto const len = snprintf(line, sizeof(line), "line %zu\n", i);
+      out.write(array<char>{line, static_cast<size_t>(len)},
+                static_cast<size_t>(len));
+      size += static_cast<size_t>(len);
+    }
+  }
+  CHECK(packed.size() < size);
+
+  imemstream source{static_cast<omemstream &&>(packed)};
+  lz_ifstream in{source};
+  CHECK(!in.corrupt());
+  array<char> buffer{5};
+  CHECK(in.read(buffer, 5) == 5);
+  CHECK(memcmp(buffer.data(), "line ", 5) == 0);
+  CHECK(in.rseek(lz::BLOCK + 3));
+  CHECK(in.tellr() == lz::BLOCK + 3);
+  size_t rest = 0;
+  array<char> chunk{4096};
+  for (size_t got; (got = in.read(chunk, chunk.capacity())) != 0;)
+    rest += got;
+  CHECK(rest == size - lz::BLOCK - 3);
+  CHECK(in.eof());
+  CHECK(!in.corrupt());
+}
+
+} // namespace
+
+int main() {
+  lines();
+  gap();
+  utf16_over_memory();
+  lz_over_memory();
+  return check_failures() != 0;
+}
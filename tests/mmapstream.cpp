@@ -0,0 +1,88 @@
+#include "check.hpp"
+#include "mmapstream.hpp"
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+#ifdef __linux__
+namespace {
+
+ssize_t size_of(char const *path) {
+  struct stat info;
+  if (stat(path, &info) == -1)
+    return -1;
+  return static_cast<ssize_t>(info.st_size);
+}
+
+// While writing, the file is at most SIZE_STEP past what was written; after
+// close() it is exactly what was written.
+void sizes(char const *path) {
+  unlink(path);
+  array<char> chunk{100000};
+  for (size_t i = 0; i < chunk.capacity(); ++i)
+    chunk[i] = static_cast<char>('a' + i % 26);
+  size_t written = 0;
+  {
+    mmap_ofstream out{array<char>{path}};
+    CHECK(out.isOpen());
+    CHECK(out.write("header\n") == 7);
+    written += 7;
+    CHECK(size_of(path) == static_cast<ssize_t>(mmap_ofstream::SIZE_STEP));
+    for (size_t i = 0; i < 25; ++i)
+      written += out.write(chunk);
+    CHECK(out.tellw() == static_cast<ssize_t>(written));
+    auto const during = size_of(path);
+    CHECK(during >= static_cast<ssize_t>(written));
+    CHECK(during - static_cast<ssize_t>(written) <
+          static_cast<ssize_t>(mmap_ofstream::SIZE_STEP));
+    CHECK(out.close());
+  }
+  CHECK(size_of(path) == static_cast<ssize_t>(written));
+
+  auto const fd = ::open(path, O_RDONLY | O_CLOEXEC);
+  array<char> back{written};
+  CHECK(::read(fd, back.data(), written) == static_cast<ssize_t>(written));
+  ::close(fd);
+  CHECK(memcmp(back.data(), "header\n", 7) == 0);
+  CHECK(memcmp(back.data() + 7 + 24 * chunk.capacity(), chunk.data(),
+               chunk.capacity()) == 0);
+}
+
+// Like ofstream, an existing file is not truncated: writing over its start
+// keeps its size, and seeking past its end leaves a zero-filled gap.
+void existing(char const *path) {
+  auto const before = size_of(path);
+  {
+    mmap_ofstream out{array<char>{path}};
+    CHECK(out.write("HEADER") == 6);
+  }
+  CHECK(size_of(path) == before);
+  {
+    mmap_ofstream out{array<char>{path}};
+    CHECK(out.wseek(10, IOPos::END) == before + 10);
+    CHECK(out.write("end") == 3);
+  }
+  CHECK(size_of(path) == before + 13);
+  auto const fd = ::open(path, O_RDONLY | O_CLOEXEC);
+  char tail[13];
+  CHECK(::pread(fd, tail, 13, before) == 13);
+  char head[7];
+  CHECK(::pread(fd, head, 7, 0) == 7);
+  ::close(fd);
+  CHECK(memcmp(tail, "\0\0\0\0\0\0\0\0\0\0end", 13) == 0);
+  CHECK(memcmp(head, "HEADER\n", 7) == 0);
+}
+
+} // namespace
+#endif
+
+int main() {
+#ifdef __linux__
+  char path[] = "/tmp/mmapstream_testXXXXXX";
+  close(mkstemp(path));
+  sizes(path);
+  existing(path);
+  unlink(path);
+#endif
+  return check_failures() != 0;
+}
@@ -0,0 +1,33 @@
+#include "check.hpp"
+#include "streams.hpp"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#ifndef STREAMS_NO_STATS
+#error "tests/nostats.cpp must be built with STREAMS_NO_STATS"
+#endif
+
+// With the counters compiled out the streams still work and stats() stays
+// empty.
+int main() {
+  char path[] = "/tmp/nostats_testXXXXXX";
+  close(mkstemp(path));
+  unlink(path);
+  {
+    ofstream out{array<char>{path}};
+    CHECK(out.write("hello\nworld\n") == 12);
+    CHECK(out.flush() == 12);
+    CHECK(out.stats().syscalls == 0);
+    CHECK(out.stats().bytesWritten == 0);
+    CHECK(out.stats().flushes == 0);
+  }
+  ifstream in{array<char>{path}};
+  CHECK(in.readline().second == 6);
+  CHECK(in.readline().second == 6);
+  auto const stats = in.stats();
+  CHECK(stats.syscalls == 0 && stats.bytesRead == 0 && stats.refills == 0 &&
+        stats.straddles == 0);
+  unlink(path);
+  return check_failures() != 0;
+}
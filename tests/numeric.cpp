@@ -0,0 +1,129 @@
+#include "check.hpp"
+#include "streams.hpp"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <cmath>
+
+namespace {
+
+char path[] = "/tmp/numeric_testXXXXXX";
+
+void put(char const *text) {
+  auto const fd = ::open(path, O_WRONLY | O_TRUNC | O_CLOEXEC);
+  auto const size = strlen(text);
+  CHECK(::write(fd, text, size) == static_cast<ssize_t>(size));
+  close(fd);
+}
+
+template <typename V> bool is_int(ifstream &in, V value, ParseStatus status) {
+  auto const result = in.template read_int<V>();
+  return result.first == value && result.second == status;
+}
+bool is_double(ifstream &in, double value, ParseStatus status) {
+  auto const result = in.read_double();
+  return result.first == value && result.second == status &&
+         std::signbit(result.first) == std::signbit(value);
+}
+
+void integers() {
+  put(" 123\n-45\t+7 9223372036854775807 -9223372036854775808 "
+      "9223372036854775808 -9223372036854775809 127 128 -1");
+  ifstream in{array<char>{path}};
+  CHECK(is_int<int>(in, 123, ParseStatus::OK));
+  CHECK(is_int<int>(in, -45, ParseStatus::OK));
+  CHECK(is_int<int>(in, 7, ParseStatus::OK));
+  CHECK(is_int<int64_t>(in, INT64_MAX, ParseStatus::OK));
+  CHECK(is_int<int64_t>(in, INT64_MIN, ParseStatus::OK));
+  CHECK(is_int<int64_t>(in, INT64_MAX, ParseStatus::OUT_OF_RANGE));
+  CHECK(is_int<int64_t>(in, INT64_MIN, ParseStatus::OUT_OF_RANGE));
+  CHECK(is_int<int8_t>(in, int8_t{127}, ParseStatus::OK));
+  CHECK(is_int<int8_t>(in, int8_t{127}, ParseStatus::OUT_OF_RANGE));
+  CHECK(is_int<unsigned>(in, 0u, ParseStatus::OUT_OF_RANGE));
+  CHECK(is_int<int>(in, 0, ParseStatus::END_OF_STREAM));
+}
+
+// Far more digits than fit in 64 bits is still only out of range.
+void long_digits() {
+  char text[200];
+  memset(text, '9', 150);
+  text[150] = '\0';
+  put(text);
+  ifstream in{array<char>{path}};
+  CHECK(is_int<uint64_t>(in, UINT64_MAX, ParseStatus::OUT_OF_RANGE));
+}
+
+void no_digits() {
+  put("abc");
+  ifstream in{array<char>{path}};
+  CHECK(is_int<int>(in, 0, ParseStatus::NO_DIGITS));
+  put("-x");
+  ifstream sign{array<char>{path}};
+  CHECK(is_int<int>(sign, 0, ParseStatus::NO_DIGITS));
+  put("inf");
+  ifstream inf{array<char>{path}};
+  CHECK(is_double(inf, 0.0, ParseStatus::NO_DIGITS));
+  put(".e5");
+  ifstream dot{array<char>{path}};
+  CHECK(is_double(dot, 0.0, ParseStatus::NO_DIGITS));
+  put("1e+");
+  ifstream exp{array<char>{path}};
+  CHECK(is_double(exp, 0.0, ParseStatus::INVALID));
+}
+
+void doubles() {
+  put("3.25 -0.5 1e3 -0 12345678901234567890123 1e999 -1e999 1e-400 "
+      "4.9406564584124654e-324 2.2250738585072014e-308 0.1");
+  ifstream in{array<char>{path}};
+  CHECK(is_double(in, 3.25, ParseStatus::OK));
+  CHECK(is_double(in, -0.5, ParseStatus::OK));
+  CHECK(is_double(in, 1000.0, ParseStatus::OK));
+  CHECK(is_double(in, -0.0, ParseStatus::OK));
+  CHECK(is_double(in, 12345678901234567890123.0, ParseStatus::OK));
+  CHECK(is_double(in, HUGE_VAL, ParseStatus::OUT_OF_RANGE));
+  CHECK(is_double(in, -HUGE_VAL, ParseStatus::OUT_OF_RANGE));
+  CHECK(is_double(in, 0.0, ParseStatus::OUT_OF_RANGE));
+  // Subnormal results are valid, even though strtod reports ERANGE.
+  CHECK(is_double(in, std::numeric_limits<double>::denorm_min(),
+                  ParseStatus::OK));
+  CHECK(is_double(in, std::numeric_limits<double>::min(), ParseStatus::OK));
+  CHECK(is_double(in, 0.1, ParseStatus::OK));
+  CHECK(is_double(in, 0.0, ParseStatus::END_OF_STREAM));
+}
+
+// Numbers straddling refills of the 80 byte buffer.
+void across_refills() {
+  char text[16384];
+  size_t size = 0;
+  int64_t expected = 0;
+  for (int i = 0; i < 1000; ++i) {
+    auto const value = (i % 2 == 0 ? 1 : -1) * int64_t{i} * 1000003;
+    expected += value;
+    size += static_cast<size_t>(snprintf(text + size, sizeof(text) - size,
+                                         "%lld ", static_cast<long long>(value)));
+  }
+  put(text);
+  ifstream in{array<char>{path}};
+  int64_t sum = 0;
+  bool ok = true;
+  for (int i = 0; i < 1000; ++i) {
+    auto const result = in.read_int<int64_t>();
+    ok = ok && result.second == ParseStatus::OK;
+    sum += result.first;
+  }
+  CHECK(ok && sum == expected);
+}
+
+} // namespace
+
+int main() {
+  close(mkstemp(path));
+  integers();
+  long_digits();
+  no_digits();
+  doubles();
+  across_refills();
+  unlink(path);
+  return check_failures() != 0;
+}
@@ -0,0 +1,178 @@
+#include "check.hpp"
+#include "streams.hpp"
+
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+namespace {
+
+bool file_is(char const *path, char const *expected, size_t size) {
+  static char contents[8192];
+  auto const fd = ::open(path, O_RDONLY | O_CLOEXEC);
+  auto const got = ::read(fd, contents, sizeof(contents));
+  close(fd);
+  return got == static_cast<ssize_t>(size) &&
+         memcmp(contents, expected, size) == 0;
+}
+
+// A large write tops up the partly filled buffer, flushes it and writes
+// the rest straight from the caller's memory.
+void write_through_after_partial_buffer(char const *path) {
+  static char expected[600];
+  array<char> big{500};
+  for (size_t i = 0; i < big.capacity(); ++i)
+    big[i] = static_cast<char>('a' + i % 26);
+  unlink(path);
+  {
+    ofstream out{array<char>{path}};
+    CHECK(out.write("abc") == 3);
+    CHECK(out.pending() == 3);
+    CHECK(out.write(big) == 500);
+    CHECK(out.pending() == 0);
+    CHECK(out.stats().flushes == 1);
+    CHECK(out.stats().bytesWritten == 503);
+    CHECK(out.tellw() == 503);
+    // Small writes after it are buffered again.
+    CHECK(out.write("tail") == 4);
+    CHECK(out.pending() == 4);
+  }
+  memcpy(expected, "abc", 3);
+  memcpy(expected + 3, big.data(), 500);
+  memcpy(expected + 503, "tail", 4);
+  CHECK(file_is(path, expected, 507));
+}
+
+// A full non-blocking handle stops the direct write with wouldBlock() set;
+// nothing is left buffered, and the caller resumes from the count returned.
+void write_through_would_block() {
+  int fds[2];
+  CHECK(socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds) == 0);
+  fcntl(fds[0], F_SETFL, fcntl(fds[0], F_GETFL) | O_NONBLOCK);
+  constexpr size_t SIZE = size_t{4} << 20;
+  array<char> data{SIZE};
+  for (size_t i = 0; i < SIZE; ++i)
+    data[i] = static_cast<char>(i * 7);
+  ofstream out{fds[0], false};
+  CHECK(out.write("xy") == 2);
+  auto accepted = out.write(data);
+  CHECK(accepted < SIZE);
+  CHECK(out.wouldBlock());
+  CHECK(out.pending() == 0);
+
+  array<char> sink{65536};
+  size_t received = 0;
+  bool same = true;
+  auto const drain = [&] {
+    ssize_t got;
+    while ((got = ::recv(fds[1], sink.data(), sink.capacity(),
+                         MSG_DONTWAIT)) > 0) {
+      for (ssize_t i = 0; i < got; ++i, ++received) {
+        auto const expected =
+            received < 2 ? "xy"[received] : data[received - 2];
+        same = same && sink[static_cast<size_t>(i)] == expected;
+      }
+    }
+  };
+  while (accepted != SIZE) {
+    drain();
+    auto const rest = array<char>{data.data() + accepted, SIZE - accepted};
+    accepted += out.write(rest);
+  }
+  CHECK(!out.wouldBlock());
+  drain();
+  CHECK(received == SIZE + 2);
+  CHECK(same);
+  close(fds[1]);
+}
+
+int reported_errno = 0;
+void record_error(char const *, char const *) { reported_errno = errno; }
+
+// A flush that fails after sending part of the buffer ends tryWrite() at
+// once, instead of refilling the freed space and failing again.
+void failed_flush_stops_write(char const *path) {
+  unlink(path);
+  auto const child = fork();
+  if (child == 0) {
+    signal(SIGXFSZ, SIG_IGN);
+    rlimit limit{100, 100};
+    setrlimit(RLIMIT_FSIZE, &limit);
+    ofstream out{array<char>{path}};
+    char chunk[70];
+    memset(chunk, 'x', sizeof(chunk));
+    bool ok = out.tryWrite(chunk, 70).ok() && out.tryWrite(chunk, 70).ok();
+    auto const failed = out.tryWrite(chunk, 70);
+    ok = ok && failed.status == IOStatus::FAILED && failed.error == EFBIG &&
+         failed.count == 20;
+    file_error_handler = &record_error;
+    _exit(ok ? 0 : 1);
+  }
+  int status = 0;
+  CHECK(waitpid(child, &status, 0) == child);
+  CHECK(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+  unlink(path);
+}
+
+// The destructor waits for a full non-blocking handle no longer than the
+// stream's timeout, and reports the tail it drops.
+void bounded_close() {
+  int fds[2];
+  CHECK(socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds) == 0);
+  fcntl(fds[0], F_SETFL, fcntl(fds[0], F_GETFL) | O_NONBLOCK);
+  char chunk[4096];
+  memset(chunk, 'x', sizeof(chunk));
+  while (::write(fds[0], chunk, sizeof(chunk)) > 0) {
+  }
+  auto *previous = file_error_handler;
+  file_error_handler = &record_error;
+  reported_errno = 0;
+  {
+    ofstream out{fds[0], false};
+    out.setTimeout(50);
+    CHECK(out.tryWrite(chunk, 10).ok());
+  }
+  file_error_handler = previous;
+  CHECK(reported_errno == ETIMEDOUT);
+  close(fds[1]);
+}
+
+// Record-aligned writes of literals shorter than a vector load, the pattern
+// the Release build has to compile without array-bounds warnings.
+void aligned_short_writes(char const *path) {
+  unlink(path);
+  {
+    ofstream out{array<char>{path}};
+    out.setRecordDelimiter('\n');
+    for (int i = 0; i < 40; ++i) {
+      out.write("ab");
+      out.write("\n");
+    }
+    out.write("tail");
+  }
+  ifstream in{array<char>{path}};
+  array<char> buffer{256};
+  auto const got = in.read(buffer, buffer.capacity());
+  CHECK(got == 40 * 3 + 4);
+  bool same = true;
+  for (size_t i = 0; i < 40 * 3; i += 3)
+    same = same && memcmp(buffer.data() + i, "ab\n", 3) == 0;
+  CHECK(same && memcmp(buffer.data() + 120, "tail", 4) == 0);
+  unlink(path);
+}
+
+} // namespace
+
+int main() {
+  char path[] = "/tmp/ofstream_testXXXXXX";
+  close(mkstemp(path));
+  write_through_after_partial_buffer(path);
+  write_through_would_block();
+  failed_flush_stops_write(path);
+  bounded_close();
+  aligned_short_writes(path);
+  return check_failures() != 0;
+}
@@ -0,0 +1,105 @@
+#include "check.hpp"
+#include "parallel.hpp"
+
+#include <unistd.h>
+
+namespace {
+
+// Short lines around one line that spans many ranges; each line holds its
+// own number so every one can be accounted for.
+size_t make_file(char const *path, size_t longLine) {
+  unlink(path);
+  int fd = ::open(path, O_WRONLY | O_CREAT | O_CLOEXEC, 0644);
+  CHECK(fd != -1);
+  char line[32];
+  size_t lines = 0;
+  auto put = [&](size_t count) {
+    for (size_t i = 0; i < count; ++i, ++lines) {
+      auto const len = snprintf(line, sizeof(line), "%zu\n", lines);
+      CHECK(::write(fd, line, static_cast<size_t>(len)) == len);
+    }
+  };
+  put(100000);
+  array<char> big{longLine};
+  memset(big.data(), 'x', longLine);
+  auto const len = snprintf(big.data(), longLine, "%zu", lines++);
+  big[static_cast<size_t>(len)] = 'x';
+  big[longLine - 1] = '\n';
+  CHECK(::write(fd, big.data(), longLine) == static_cast<ssize_t>(longLine));
+  put(100000);
+  // The last line has no newline.
+  auto const tail = snprintf(line, sizeof(line), "%zu", lines++);
+  CHECK(::write(fd, line, static_cast<size_t>(tail)) == tail);
+  close(fd);
+  return lines;
+}
+
+// Lines 0..lines-1 each seen once: the count, the sum and the sum of
+// squares of the numbers all match.
+void every_line_once(char const *path, size_t lines) {
+  std::atomic<size_t> calls{0};
+  std::atomic<size_t> sum{0};
+  std::atomic<size_t> squares{0};
+  CHECK(parallel_for_lines(
+      path,
+      [&](char const *line, size_t size) {
+        size_t number = 0;
+        for (size_t i = 0; i < size && line[i] >= '0' && line[i] <= '9'; ++i)
+          number = number * 10 + static_cast<size_t>(line[i] - '0');
+        ++calls;
+        sum += number;
+        squares += number * number;
+      },
+      4));
+  size_t expectedSum = 0;
+  size_t expectedSquares = 0;
+  for (size_t i = 0; i < lines; ++i) {
+    expectedSum += i;
+    expectedSquares += i * i;
+  }
+  CHECK(calls.load() == lines);
+  CHECK(sum.load() == expectedSum);
+  CHECK(squares.load() == expectedSquares);
+}
+
+void ordered_copy(char const *path, char const *copy) {
+  unlink(copy);
+  {
+    ofstream out{array<char>{copy}};
+    CHECK(parallel_for_lines(
+        path, out,
+        [](char const *line, size_t size, line_output &output) {
+          output.write(line, size);
+        },
+        4));
+  }
+  ifstream a{array<char>{path}};
+  ifstream b{array<char>{copy}};
+  array<char> left{size_t{1} << 16};
+  array<char> right{size_t{1} << 16};
+  bool same = true;
+  for (;;) {
+    auto const n = a.read(left, left.capacity());
+    auto const m = b.read(right, right.capacity());
+    same = same && n == m && memcmp(left.data(), right.data(), n) == 0;
+    if (n == 0 || !same)
+      break;
+  }
+  CHECK(same);
+  unlink(copy);
+}
+
+} // namespace
+
+int main() {
+  char path[] = "/tmp/parallel_testXXXXXX";
+  close(mkstemp(path));
+  // 48 MiB: hundreds of the smallest ranges.
+  auto const lines = make_file(path, size_t{48} << 20);
+  every_line_once(path, lines);
+  char copy[64];
+  snprintf(copy, sizeof(copy), "%s.copy", path);
+  ordered_copy(path, copy);
+  unlink(path);
+  return check_failures() != 0;
+}
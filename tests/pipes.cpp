@@ -0,0 +1,108 @@
+#include "check.hpp"
+#include "streams.hpp"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <chrono>
+
+namespace {
+
+using clock_type = std::chrono::steady_clock;
+
+long elapsed_ms(clock_type::time_point since) {
+  return static_cast<long>(std::chrono::duration_cast<std::chrono::milliseconds>(
+                               clock_type::now() - since)
+                               .count());
+}
+
+bool put(int fd, char const *text) {
+  auto const size = strlen(text);
+  return ::write(fd, text, size) == static_cast<ssize_t>(size);
+}
+
+// End of file is only known once read() returned 0 after the writer closed.
+void end_of_file() {
+  int fds[2];
+  CHECK(pipe(fds) == 0);
+  CHECK(put(fds[1], "a\nb"));
+  ifstream in{fds[0], false};
+  CHECK(!in.eof());
+  CHECK(in.readline().second == 2);
+  CHECK(!in.eof());
+  close(fds[1]);
+  auto [last, size] = in.readline();
+  CHECK(size == 1 && last[0] == 'b');
+  CHECK(in.eof());
+  CHECK(!in.wouldBlock());
+  CHECK(in.readline().second == 0);
+  CHECK(in.stats().refills == 2);
+}
+
+void timeout() {
+  int fds[2];
+  CHECK(pipe(fds) == 0);
+  auto const probe = dup(fds[0]);
+  {
+    ifstream in{fds[0], false};
+    in.setTimeout(50);
+    auto const start = clock_type::now();
+    CHECK(in.readline().second == 0);
+    CHECK(elapsed_ms(start) >= 40);
+    CHECK(in.wouldBlock());
+    CHECK(!in.eof());
+    // The stream switched the pipe to O_NONBLOCK for the timed read.
+    CHECK((fcntl(probe, F_GETFL) & O_NONBLOCK) != 0);
+
+    // Data that arrives before the timeout is returned; a line cut short by
+    // the timeout is handed back with wouldBlock() set.
+    CHECK(put(fds[1], "xy\npar"));
+    CHECK(in.readline().second == 3);
+    CHECK(!in.wouldBlock());
+    auto [partial, size] = in.readline();
+    CHECK(size == 3 && partial[0] == 'p');
+    CHECK(in.wouldBlock());
+
+    in.setTimeout(0);
+    auto const immediate = clock_type::now();
+    CHECK(in.readline().second == 0);
+    CHECK(in.wouldBlock());
+    CHECK(elapsed_ms(immediate) < 40);
+
+    close(fds[1]);
+    CHECK(in.readline().second == 0);
+    CHECK(!in.wouldBlock());
+    CHECK(in.eof());
+  }
+  // The destructor put the original flags back.
+  CHECK((fcntl(probe, F_GETFL) & O_NONBLOCK) == 0);
+  close(probe);
+}
+
+// A handle the caller made non-blocking never waits, whatever the timeout.
+void caller_non_blocking() {
+  int fds[2];
+  CHECK(pipe(fds) == 0);
+  CHECK(fcntl(fds[0], F_SETFL, fcntl(fds[0], F_GETFL) | O_NONBLOCK) == 0);
+  ifstream in{fds[0], false};
+  in.setTimeout(1000);
+  auto const start = clock_type::now();
+  CHECK(in.readline().second == 0);
+  CHECK(in.wouldBlock());
+  CHECK(elapsed_ms(start) < 500);
+  CHECK(put(fds[1], "ok\n"));
+  CHECK(in.readline().second == 3);
+  close(fds[1]);
+  CHECK(in.readline().second == 0);
+  CHECK(in.eof());
+  CHECK((fcntl(fds[0], F_GETFL) & O_NONBLOCK) != 0);
+}
+
+} // namespace
+
+int main() {
+  end_of_file();
+  timeout();
+  caller_non_blocking();
+  return check_failures() != 0;
+}
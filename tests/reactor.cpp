@@ -0,0 +1,270 @@
+#include "check.hpp"
+#include "reactor.hpp"
+
+#include <sys/socket.h>
+#include <unistd.h>
+
+namespace {
+
+struct pipe_fds {
+  pipe_fds() {
+    int fds[2];
+    CHECK(pipe2(fds, O_CLOEXEC) == 0);
+    read = fds[0];
+    write = fds[1];
+  }
+  int read;
+  int write;
+};
+
+void readiness() {
+  pipe_fds p;
+  reactor r;
+  int calls = 0;
+  uint32_t seen = 0;
+  struct context {
+    int *calls;
+    uint32_t *seen;
+  } ctx{&calls, &seen};
+  auto id = r.watch(
+      p.read, EPOLLIN,
+      [](void *c, uint32_t events) {
+        auto *ctx = static_cast<context *>(c);
+        ++*ctx->calls;
+        *ctx->seen |= events;
+      },
+      &ctx);
+  CHECK(id != nullptr);
+  CHECK(r.watching() == 1);
+  CHECK(r.runOnce(0) == 0);
+  CHECK(::write(p.write, "x", 1) == 1);
+  CHECK(r.runOnce(1000) == 1);
+  CHECK(calls == 1 && (seen & EPOLLIN) != 0);
+  // Edge triggered: unread data does not report the descriptor again.
+  CHECK(r.runOnce(0) == 0);
+  r.unwatch(id);
+  close(p.read);
+  close(p.write);
+}
+
+struct lines {
+  size_t count = 0;
+  size_t bytes = 0;
+  bool eof = false;
+  bool ordered = true;
+};
+
+void draining() {
+  pipe_fds p;
+  ifstream in{p.read, false};
+  reactor r;
+  lines seen;
+  r.watchLines<char>(
+      in,
+      [](void *c, ifstream &, array<char> &line, size_t size) {
+        auto *seen = static_cast<lines *>(c);
+        char expect[16];
+        auto const len = snprintf(expect, sizeof(expect), "line %zu\n",
+                                  seen->count);
+        if (seen->count < 2000 &&
+            (size != static_cast<size_t>(len) ||
+             memcmp(line.data(), expect, size) != 0))
+          seen->ordered = false;
+        ++seen->count;
+        seen->bytes += size;
+      },
+      [](void *c, ifstream &) { static_cast<lines *>(c)->eof = true; },
+      &seen);
+  // Far more than the stream buffer in one edge: every line is delivered
+  // from a single readiness event.
+  array<char> text{2000 * 16};
+  size_t size = 0;
+  for (size_t i = 0; i < 2000; ++i)
+    size += static_cast<size_t>(
+        snprintf(text.data() + size, text.capacity() - size, "line %zu\n", i));
+  CHECK(::write(p.write, text.data(), size) == static_cast<ssize_t>(size));
+  CHECK(::write(p.write, "tail", 4) == 4);
+  CHECK(r.runOnce(1000) == 1);
+  CHECK(seen.count == 2000 && seen.ordered);
+  CHECK(!seen.eof);
+  // The unterminated line comes out at end of file, then the registration
+  // goes away.
+  close(p.write);
+  CHECK(r.runOnce(1000) == 1);
+  CHECK(seen.count == 2001 && seen.bytes == size + 4);
+  CHECK(seen.eof);
+  CHECK(r.watching() == 0);
+}
+
+void socket_drain() {
+  int fds[2];
+  CHECK(socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds) == 0);
+  ofstream out{fds[0], false};
+  reactor r;
+  int drained = 0;
+  r.watchDrain<char>(
+      out, [](void *c, ofstream &) { ++*static_cast<int *>(c); }, &drained);
+  // Fill the socket until the stream has to keep data buffered.
+  array<char> chunk{50};
+  memset(chunk.data(), 'z', chunk.capacity());
+  size_t accepted = 0;
+  while (!out.wouldBlock())
+    accepted += out.write(chunk);
+  CHECK(out.pending() != 0);
+  drained = 0;
+  size_t received = 0;
+  char sink[65536];
+  for (int i = 0; i < 1000 && drained == 0; ++i) {
+    ssize_t got;
+    while ((got = ::recv(fds[1], sink, sizeof(sink), MSG_DONTWAIT)) > 0)
+      received += static_cast<size_t>(got);
+    r.runOnce(100);
+  }
+  CHECK(drained != 0);
+  CHECK(out.pending() == 0);
+  ssize_t got;
+  while ((got = ::recv(fds[1], sink, sizeof(sink), MSG_DONTWAIT)) > 0)
+    received += static_cast<size_t>(got);
+  CHECK(received == accepted);
+  close(fds[1]);
+}
+
+void timers() {
+  reactor r;
+  // More timers than the heap starts with, added out of order.
+  struct fired {
+    int order[16];
+    int count = 0;
+  } log;
+  struct slot {
+    fired *log;
+    int id;
+  } slots[12];
+  int const delays[12] = {60, 10, 110, 30, 90, 20, 100, 50, 80, 40, 70, 120};
+  for (int i = 0; i < 12; ++i) {
+    slots[i] = {&log, i};
+    r.addTimer(
+        static_cast<uint64_t>(delays[i]),
+        [](void *c) {
+          auto *s = static_cast<slot *>(c);
+          s->log->order[s->log->count++] = s->id;
+        },
+        &slots[i]);
+  }
+  auto cancelled = r.addTimer(
+      30, [](void *c) { static_cast<slot *>(c)->log->count += 100; },
+      &slots[0]);
+  r.cancelTimer(cancelled);
+  int ticks = 0;
+  auto repeating = r.addTimer(
+      15, [](void *c) { ++*static_cast<int *>(c); }, &ticks, true);
+  for (int i = 0; i < 100 && log.count < 12; ++i)
+    r.runOnce(200);
+  r.cancelTimer(repeating);
+  CHECK(log.count == 12);
+  for (int i = 1; i < log.count && i < 12; ++i)
+    CHECK(delays[log.order[i - 1]] < delays[log.order[i]]);
+  CHECK(ticks >= 4);
+  auto const after = ticks;
+  r.addTimer(40, [](void *) {}, nullptr);
+  r.runOnce(200);
+  CHECK(ticks == after);
+}
+
+void unwatching() {
+  pipe_fds a;
+  pipe_fds b;
+  reactor r;
+  int calls = 0;
+  struct context {
+    reactor *r;
+    int *calls;
+    reactor::watch_id other;
+  } toA{&r, &calls, nullptr}, toB{&r, &calls, nullptr};
+  // Each callback removes the other registration, which is ready in the
+  // same batch; only one of them runs.
+  auto callback = [](void *c, uint32_t) {
+    auto *ctx = static_cast<context *>(c);
+    ++*ctx->calls;
+    ctx->r->unwatch(ctx->other);
+  };
+  auto first = r.watch(a.read, EPOLLIN, callback, &toB);
+  auto second = r.watch(b.read, EPOLLIN, callback, &toA);
+  toB.other = second;
+  toA.other = first;
+  CHECK(::write(a.write, "x", 1) == 1);
+  CHECK(::write(b.write, "x", 1) == 1);
+  r.runOnce(1000);
+  CHECK(calls == 1);
+  CHECK(r.watching() == 1);
+  r.unwatch(first);
+  r.unwatch(second);
+  r.unwatch(first);
+  CHECK(r.watching() == 0);
+  CHECK(::write(a.write, "x", 1) == 1);
+  CHECK(r.runOnce(0) == 0);
+  // Many retired handlers are all released.
+  for (int i = 0; i < 20; ++i)
+    r.unwatch(r.watch(a.read, EPOLLIN, callback, &toA));
+  CHECK(r.watching() == 0);
+  for (int fd : {a.read, a.write, b.read, b.write})
+    close(fd);
+}
+
+// A reader and a writer of one socket each get their own events.
+void shared_descriptor() {
+  int fds[2];
+  CHECK(socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds) == 0);
+  reactor r;
+  int reads = 0;
+  int writes = 0;
+  auto count = [](void *c, uint32_t) { ++*static_cast<int *>(c); };
+  auto reader = r.watch(fds[0], EPOLLIN, count, &reads);
+  auto writer = r.watch(fds[0], EPOLLOUT, count, &writes);
+  CHECK(reader != nullptr && writer != nullptr);
+  CHECK(r.watching() == 2);
+  // Writable at once, nothing to read yet.
+  r.runOnce(1000);
+  CHECK(writes == 1 && reads == 0);
+  CHECK(::write(fds[1], "x", 1) == 1);
+  r.runOnce(1000);
+  CHECK(reads == 1);
+  // Without the writer the descriptor is still watched for input.
+  r.unwatch(writer);
+  CHECK(::write(fds[1], "y", 1) == 1);
+  r.runOnce(1000);
+  CHECK(reads == 2 && writes <= 2);
+  r.unwatch(reader);
+  CHECK(r.watching() == 0);
+  // The descriptor can be watched again from scratch.
+  reader = r.watch(fds[0], EPOLLIN, count, &reads);
+  CHECK(reader != nullptr);
+  r.unwatch(reader);
+  close(fds[0]);
+  close(fds[1]);
+}
+
+// Regular files are always ready: watching one is refused quietly.
+void regular_file() {
+  char path[] = "/tmp/reactor_testXXXXXX";
+  int fd = mkstemp(path);
+  CHECK(fd != -1);
+  unlink(path);
+  reactor r;
+  CHECK(r.watch(fd, EPOLLIN, [](void *, uint32_t) {}, nullptr) == nullptr);
+  CHECK(r.watching() == 0);
+  close(fd);
+}
+
+} // namespace
+
+int main() {
+  readiness();
+  draining();
+  socket_drain();
+  timers();
+  unwatching();
+  shared_descriptor();
+  regular_file();
+  return check_failures() != 0;
+}
@@ -0,0 +1,74 @@
+#include "check.hpp"
+#include "memstream.hpp"
+#include "streams.hpp"
+
+#include <sys/socket.h>
+#include <unistd.h>
+
+namespace {
+
+template <typename S>
+bool next(S &in, array<char> &buffer, char const *expected, bool found) {
+  auto const result = in.readUntil(buffer, "\r\n", 2);
+  auto const length = stringlen(expected);
+  return result.first == length && result.second == found &&
+         memcmp(buffer.data(), expected, length) == 0;
+}
+
+// A delimiter cut in two by the end of a full buffer is found by the next
+// call rather than lost.
+void file_straddle(char const *path) {
+  unlink(path);
+  {
+    ofstream out{array<char>{path}};
+    out.write("abcdefghi\r\nxyz\r\n");
+  }
+  ifstream in{array<char>{path}};
+  array<char> buffer{10};
+  CHECK(next(in, buffer, "abcdefghi", false));
+  CHECK(next(in, buffer, "\r\n", true));
+  CHECK(next(in, buffer, "xyz\r\n", true));
+  CHECK(in.readUntil(buffer, "\r\n", 2).first == 0);
+  unlink(path);
+}
+
+void memory_straddle() {
+  char const text[] = "abcdefghi\r\nxyz\r\n";
+  imemstream in{text, sizeof(text) - 1};
+  array<char> buffer{10};
+  CHECK(next(in, buffer, "abcdefghi", false));
+  CHECK(next(in, buffer, "\r\n", true));
+  CHECK(next(in, buffer, "xyz\r\n", true));
+  CHECK(in.eof());
+}
+
+// The part of the delimiter put back came from two refills; each packet is
+// one refill.
+void refill_straddle() {
+  int fds[2];
+  CHECK(socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, fds) == 0);
+  CHECK(::write(fds[1], "12345678A", 9) == 9);
+  CHECK(::write(fds[1], "BC12", 4) == 4);
+  close(fds[1]);
+  ifstream in{fds[0], false};
+  array<char> buffer{10};
+  auto result = in.readUntil(buffer, "ABC", 3);
+  CHECK(result.first == 8 && !result.second);
+  result = in.readUntil(buffer, "ABC", 3);
+  CHECK(result.first == 3 && result.second &&
+        memcmp(buffer.data(), "ABC", 3) == 0);
+  result = in.readUntil(buffer, "ABC", 3);
+  CHECK(result.first == 2 && !result.second &&
+        memcmp(buffer.data(), "12", 2) == 0);
+}
+
+} // namespace
+
+int main() {
+  char path[] = "/tmp/readuntil_testXXXXXX";
+  close(mkstemp(path));
+  file_straddle(path);
+  memory_straddle();
+  refill_straddle();
+  return check_failures() != 0;
+}
@@ -0,0 +1,136 @@
+#include "check.hpp"
+#include "memstream.hpp"
+#include "records.hpp"
+
+#include <unistd.h>
+
+namespace {
+
+// Record i is i bytes of (char)i, except one larger than the reader's
+// buffer so that it has to grow.
+constexpr size_t COUNT = 300;
+constexpr size_t LARGE = 100;
+size_t size_of(size_t i) {
+  return i == LARGE ? record_reader<>::BUFFER + 1000 : i;
+}
+
+void fill(array<char> &data, size_t i) {
+  memset(data.data(), static_cast<char>(i), size_of(i));
+}
+
+template <typename Source>
+void read_all(Source &source, RecordPrefix prefix, bool crc) {
+  record_reader reader{source, prefix, crc};
+  for (size_t i = 0; i < COUNT; ++i) {
+    auto [record, status] = reader.read_record();
+    CHECK(status == RecordStatus::OK);
+    if (status != RecordStatus::OK)
+      return;
+    CHECK(record.size == size_of(i));
+    bool same = true;
+    for (size_t j = 0; j < record.size; ++j)
+      same = same && record.data[j] == static_cast<char>(i);
+    CHECK(same);
+  }
+  CHECK(reader.read_record().second == RecordStatus::END);
+  // END is final.
+  CHECK(reader.read_record().second == RecordStatus::END);
+}
+
+void file_round_trip(char const *path) {
+  array<char> data{size_of(LARGE)};
+  unlink(path);
+  {
+    ofstream file{array<char>{path}};
+    record_writer writer{file, RecordPrefix::VARINT, true};
+    for (size_t i = 0; i < COUNT; ++i) {
+      fill(data, i);
+      CHECK(writer.write_record(data.data(), size_of(i)));
+    }
+  }
+  ifstream file{array<char>{path}};
+  read_all(file, RecordPrefix::VARINT, true);
+}
+
+// FIXED32 framing through memory, written as one batch.
+void memory_round_trip() {
+  array<array<char>> payloads{COUNT};
+  array<record_view> views{COUNT};
+  for (size_t i = 0; i < COUNT; ++i) {
+    payloads[i] = array<char>{size_of(i) + 1};
+    fill(payloads[i], i);
+    views[i] = record_view{payloads[i].data(), size_of(i)};
+  }
+  omemstream out;
+  {
+    record_writer writer{out, RecordPrefix::FIXED32, false};
+    auto const written = writer.write_records(views.data(), COUNT);
+    CHECK(written.ok());
+    CHECK(writer.pending() == 0);
+  }
+  imemstream in{static_cast<omemstream &&>(out)};
+  read_all(in, RecordPrefix::FIXED32, false);
+}
+
+void framed(omemstream &out) {
+  record_writer writer{out, RecordPrefix::VARINT, true};
+  writer.write_record("first", 5);
+  writer.write_record("second", 6);
+  writer.write_record("third", 5);
+}
+
+// A flipped payload byte fails the CRC; the records before it still read.
+void corrupted_crc() {
+  omemstream out;
+  framed(out);
+  auto [bytes, size] = out.release();
+  // Prefix, "first" and its CRC, prefix, then "second".
+  bytes[1 + 5 + 4 + 1 + 2] ^= 0x20;
+  imemstream in{forward<array<char>>(bytes), size};
+  record_reader reader{in, RecordPrefix::VARINT, true};
+  auto [first, status] = reader.read_record();
+  CHECK(status == RecordStatus::OK);
+  CHECK(first.size == 5 && memcmp(first.data, "first", 5) == 0);
+  CHECK(reader.read_record().second == RecordStatus::CORRUPT);
+  // CORRUPT is final.
+  CHECK(reader.read_record().second == RecordStatus::CORRUPT);
+}
+
+// Cutting the last record short is TRUNCATED, not END.
+void truncated() {
+  omemstream out;
+  framed(out);
+  imemstream in{out.data(), out.size() - 3};
+  record_reader reader{in, RecordPrefix::VARINT, true};
+  CHECK(reader.read_record().second == RecordStatus::OK);
+  CHECK(reader.read_record().second == RecordStatus::OK);
+  CHECK(reader.read_record().second == RecordStatus::TRUNCATED);
+}
+
+// A length above the reader's limit is corruption, not an allocation.
+void oversized_length() {
+  omemstream out;
+  {
+    record_writer writer{out};
+    array<char> big{2000};
+    memset(big.data(), 'x', big.capacity());
+    writer.write_record(big.data(), big.capacity());
+  }
+  imemstream in{out.data(), out.size()};
+  record_reader reader{in, RecordPrefix::VARINT, false, 1000};
+  CHECK(reader.read_record().second == RecordStatus::CORRUPT);
+}
+
+} // namespace
+
+int main() {
+  char path[] = "/tmp/records_testXXXXXX";
+  close(mkstemp(path));
+  file_round_trip(path);
+  unlink(path);
+  memory_round_trip();
+  corrupted_crc();
+  truncated();
+  oversized_length();
+  return check_failures() != 0;
+}
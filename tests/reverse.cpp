@@ -0,0 +1,117 @@
+#include "check.hpp"
+#include "streams.hpp"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace {
+
+char path[] = "/tmp/reverse_testXXXXXX";
+
+void put(char const *data, size_t size) {
+  auto const fd = ::open(path, O_WRONLY | O_TRUNC | O_CLOEXEC);
+  CHECK(::write(fd, data, size) == static_cast<ssize_t>(size));
+  close(fd);
+}
+
+bool is_line(pair<array<char>, size_t> const &line, char const *expected) {
+  auto const size = strlen(expected);
+  return line.second == size && memcmp(line.first.data(), expected, size) == 0;
+}
+
+void short_lines() {
+  put("one\n\nthree\nlast", 15);
+  ifstream in{array<char>{path}};
+  CHECK(in.readline().second == 4);
+  CHECK(is_line(in.readline_reverse(), "last"));
+  CHECK(is_line(in.readline_reverse(), "three\n"));
+  CHECK(is_line(in.readline_reverse(), "\n"));
+  CHECK(is_line(in.readline_reverse(), "one\n"));
+  CHECK(in.readline_reverse().second == 0);
+  CHECK(in.readline_reverse().second == 0);
+  // The forward position is untouched, and rseek() starts the walk over.
+  CHECK(in.readline().second == 1);
+  CHECK(in.rseek(0, IOPos::SET) == 0);
+  CHECK(is_line(in.readline_reverse(), "last"));
+}
+
+// Lines longer than a block and lines straddling block boundaries come back
+// whole, in reverse order.
+void long_lines() {
+  size_t const lengths[] = {70000, 3, 65535, 1, 65536, 200000, 10, 65537};
+  size_t total = 0;
+  for (auto length : lengths)
+    total += length;
+  array<char> text{total};
+  size_t at = 0;
+  for (size_t i = 0; i < sizeof(lengths) / sizeof(*lengths); ++i) {
+    memset(text.data() + at, static_cast<char>('a' + i), lengths[i] - 1);
+    at += lengths[i];
+    text[at - 1] = '\n';
+  }
+  put(text.data(), total);
+  ifstream in{array<char>{path}};
+  bool same = true;
+  at = total;
+  for (size_t i = sizeof(lengths) / sizeof(*lengths); i-- != 0;) {
+    auto const line = in.readline_reverse();
+    at -= lengths[i];
+    same = same && line.second == lengths[i] &&
+           memcmp(line.first.data(), text.data() + at, lengths[i]) == 0;
+  }
+  CHECK(same);
+  CHECK(in.readline_reverse().second == 0);
+  // Only the blocks holding returned lines were read, each once.
+  CHECK(in.stats().bytesRead == total);
+
+  auto const last = in.read_last(100);
+  CHECK(last.second == 100);
+  CHECK(memcmp(last.first.data(), text.data() + total - 100, 100) == 0);
+  auto const all = in.read_last(total + 5);
+  CHECK(all.second == total);
+  CHECK(memcmp(all.first.data(), text.data(), total) == 0);
+}
+
+void empty_file() {
+  put("", 0);
+  ifstream in{array<char>{path}};
+  CHECK(in.readline_reverse().second == 0);
+  CHECK(in.read_last(10).second == 0);
+}
+
+void not_seekable() {
+  int fds[2];
+  CHECK(pipe(fds) == 0);
+  CHECK(::write(fds[1], "a\nb\n", 4) == 4);
+  close(fds[1]);
+  ifstream in{fds[0], false};
+  CHECK(in.readline_reverse().second == 0);
+  CHECK(in.read_last(2).second == 0);
+  CHECK(in.readline().second == 2);
+}
+
+void find_last() {
+  char text[100];
+  memset(text, 'x', sizeof(text));
+  for (size_t n = 0; n <= sizeof(text); ++n)
+    CHECK(simd::find_last(text, n, '\n') == n);
+  text[3] = '\n';
+  text[70] = '\n';
+  CHECK(simd::find_last(text, 4, '\n') == 3);
+  CHECK(simd::find_last(text, 70, '\n') == 3);
+  CHECK(simd::find_last(text, 71, '\n') == 70);
+  CHECK(simd::find_last(text, 100, '\n') == 70);
+}
+
+} // namespace
+
+int main() {
+  close(mkstemp(path));
+  short_lines();
+  long_lines();
+  empty_file();
+  not_seekable();
+  find_last();
+  unlink(path);
+  return check_failures() != 0;
+}
@@ -0,0 +1,87 @@
+#include "check.hpp"
+#include "streams.hpp"
+
+#include <fcntl.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+namespace {
+
+void report(char const *, char const *function) {
+  cerr.write("failed: ");
+  cerr.write(function);
+  cerr.write("\n");
+}
+
+// cout is built before cerr, the order in which a function-local cerr would
+// be destroyed first. Flushing cout at exit fails, as stdout is open only
+// for reading, and the report of it still has to come out of cerr.
+void late_error() {
+  int err[2];
+  CHECK(pipe(err) == 0);
+  auto const child = fork();
+  if (child == 0) {
+    auto const readOnly = ::open("/dev/null", O_RDONLY | O_CLOEXEC);
+    close(err[0]);
+    dup2(readOnly, STDOUT_FILENO);
+    dup2(err[1], STDERR_FILENO);
+    close(readOnly);
+    close(err[1]);
+    cout.write("lost\n");
+    cerr.write("first\n");
+    file_error_handler = &report;
+    exit(0);
+  }
+  close(err[1]);
+  char text[256];
+  size_t size = 0;
+  for (ssize_t got; (got = ::read(err[0], text + size,
+                                   sizeof(text) - 1 - size)) > 0;)
+    size += static_cast<size_t>(got);
+  text[size] = '\0';
+  close(err[0]);
+  int status = 0;
+  CHECK(waitpid(child, &status, 0) == child);
+  CHECK(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+  CHECK(strncmp(text, "first\nfailed: ", 14) == 0);
+}
+
+// A stream over borrowed storage buffers in it, and lets go of it when a
+// record longer than the buffer makes it grow.
+void borrowed_buffer() {
+  static char storage[ofstream::BUFFER_SIZE];
+  int fds[2];
+  CHECK(pipe(fds) == 0);
+  {
+    ofstream out{fds[1], false,
+                 array<char>{borrowed, storage, ofstream::BUFFER_SIZE}};
+    out.write("abc");
+    CHECK(memcmp(storage, "abc", 3) == 0);
+    out.flush();
+    out.setRecordDelimiter('\n');
+    array<char> record{3 * ofstream::BUFFER_SIZE};
+    memset(record.data(), 'x', record.capacity());
+    record[record.capacity() - 1] = '\n';
+    // Written in pieces so that the record has to be gathered.
+    for (size_t at = 0; at < record.capacity(); at += 10)
+      out.write(record, at, 10);
+  }
+  char text[4 + 3 * ofstream::BUFFER_SIZE];
+  size_t size = 0;
+  for (ssize_t got;
+       (got = ::read(fds[0], text + size, sizeof(text) - size)) > 0;)
+    size += static_cast<size_t>(got);
+  close(fds[0]);
+  CHECK(size == 3 + 3 * ofstream::BUFFER_SIZE);
+  CHECK(memcmp(text, "abcxxx", 6) == 0 && text[size - 1] == '\n');
+  // The storage is still usable once the stream is gone.
+  memset(storage, 0, sizeof(storage));
+}
+
+} // namespace
+
+int main() {
+  late_error();
+  borrowed_buffer();
+  return check_failures() != 0;
+}
@@ -0,0 +1,80 @@
+#include "check.hpp"
+#include "streams.hpp"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace {
+
+char path[] = "/tmp/stats_testXXXXXX";
+
+void writes() {
+  unlink(path);
+  ofstream out{array<char>{path}};
+  array<char> chunk{20};
+  memset(chunk.data(), 'x', chunk.capacity());
+  for (int i = 0; i < 10; ++i)
+    CHECK(out.write(chunk) == 20);
+  // Two full buffers went out; the last 40 bytes are still buffered.
+  auto before = out.stats();
+  CHECK(before.bytesWritten == 160);
+  CHECK(before.flushes == 2);
+  CHECK(out.flush() == 40);
+  auto after = out.stats();
+  CHECK(after.bytesWritten == 200);
+  CHECK(after.flushes == 3);
+  CHECK(after.bytesRead == 0);
+  CHECK(after.refills == 0);
+  // Each flush of a seekable stream is one lseek and one write.
+  CHECK(after.seeks == 3);
+  CHECK(after.syscalls >= after.seeks + after.flushes);
+  CHECK(out.flush() == 0);
+  CHECK(out.stats().flushes == 3);
+}
+
+void reads() {
+  char text[300];
+  memset(text, 'y', 200);
+  memcpy(text + 200, "\nab\n", 4);
+  auto const fd = ::open(path, O_WRONLY | O_TRUNC | O_CLOEXEC);
+  CHECK(::write(fd, text, 204) == 204);
+  close(fd);
+
+  ifstream in{array<char>{path}};
+  CHECK(in.stats().syscalls == 0);
+  auto [line, size] = in.readline();
+  CHECK(size == 201);
+  auto stats = in.stats();
+  CHECK(stats.refills == 3);
+  CHECK(stats.bytesRead == 204);
+  // The 201 byte line crossed both refills after the first.
+  CHECK(stats.straddles == 2);
+  CHECK(in.readline().second == 3);
+  CHECK(in.stats().straddles == 2);
+
+  CHECK(in.rseek(0, IOPos::SET) == 0);
+  CHECK(in.stats().seeks > stats.seeks);
+}
+
+void short_lines() {
+  auto const fd = ::open(path, O_WRONLY | O_TRUNC | O_CLOEXEC);
+  CHECK(::write(fd, "a\nb\nc\n", 6) == 6);
+  close(fd);
+  ifstream in{array<char>{path}};
+  for (int i = 0; i < 3; ++i)
+    CHECK(in.readline().second == 2);
+  CHECK(in.stats().refills == 1);
+  CHECK(in.stats().straddles == 0);
+  CHECK(in.stats().bytesRead == 6);
+}
+
+} // namespace
+
+int main() {
+  close(mkstemp(path));
+  writes();
+  reads();
+  short_lines();
+  unlink(path);
+  return check_failures() != 0;
+}
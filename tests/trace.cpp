@@ -0,0 +1,119 @@
+#include "check.hpp"
+#include "streams.hpp"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace {
+
+char path[] = "/tmp/trace_testXXXXXX";
+
+struct call {
+  TraceOp op;
+  int64_t result;
+};
+
+// Remembers every hook call in order.
+class recording_tracer : public stream_tracer {
+public:
+  void record(TraceOp op, int64_t result, uint64_t) override {
+    if (m_count < 64)
+      m_calls[m_count] = {op, result};
+    ++m_count;
+  }
+  size_t count() const { return m_count; }
+  call const &operator[](size_t i) const { return m_calls[i]; }
+
+private:
+  call m_calls[64];
+  size_t m_count = 0;
+};
+
+void hooks() {
+  recording_tracer tracer;
+  unlink(path);
+  {
+    ofstream out{array<char>{path}};
+    CHECK(out.getTracer() == nullptr);
+    out.setTracer(&tracer);
+    CHECK(out.write("0123456789") == 10);
+    CHECK(tracer.count() == 0);
+    CHECK(out.flush() == 10);
+    // A seekable flush is an lseek to the write offset and one write.
+    CHECK(tracer.count() == 2);
+    CHECK(tracer[0].op == TraceOp::SEEK && tracer[0].result == 0);
+    CHECK(tracer[1].op == TraceOp::WRITE && tracer[1].result == 10);
+    out.setTracer(nullptr);
+    CHECK(out.write("abc") == 3);
+  }
+  CHECK(tracer.count() == 2);
+
+  // Streams constructed while a default tracer is set pick it up.
+  default_stream_tracer = &tracer;
+  ifstream in{array<char>{path}};
+  default_stream_tracer = nullptr;
+  CHECK(in.getTracer() == &tracer);
+  CHECK(in.readline().second == 13);
+  bool sawRead = false;
+  bool sawEof = false;
+  for (size_t i = 2; i < tracer.count(); ++i) {
+    if (tracer[i].op == TraceOp::READ && tracer[i].result == 13)
+      sawRead = true;
+    if (tracer[i].op == TraceOp::READ && tracer[i].result == 0)
+      sawEof = true;
+  }
+  CHECK(sawRead);
+  CHECK(sawEof);
+}
+
+void histogram() {
+  // Small values map to themselves; larger ones keep 4 significant bits.
+  for (uint64_t v = 0; v < 16; ++v)
+    CHECK(latency_histogram::lowerBound(latency_histogram::bucketOf(v)) == v);
+  CHECK(latency_histogram::bucketOf(16) == 16);
+  CHECK(latency_histogram::lowerBound(latency_histogram::bucketOf(1000)) ==
+        992);
+  CHECK(latency_histogram::bucketOf(UINT64_MAX) ==
+        latency_histogram::BUCKETS - 1);
+  bool monotonic = true;
+  for (size_t b = 1; b < latency_histogram::BUCKETS; ++b)
+    monotonic = monotonic && latency_histogram::lowerBound(b - 1) <
+                                 latency_histogram::lowerBound(b);
+  CHECK(monotonic);
+
+  static latency_histogram h;
+  CHECK(h.count() == 0 && h.quantile(0.5) == 0);
+  for (uint64_t v = 1; v <= 100; ++v)
+    h.record(v);
+  CHECK(h.count() == 100);
+  CHECK(h.max() == 100);
+  CHECK(h.mean() == 50.5);
+  CHECK(h.quantile(0.0) == 1);
+  CHECK(h.quantile(0.5) == 50);
+  CHECK(h.quantile(1.0) == 100);
+  // Quantiles report the bucket's lower bound, max() the exact value.
+  h.record(101);
+  CHECK(h.quantile(1.0) == 100);
+  CHECK(h.max() == 101);
+  h.reset();
+  CHECK(h.count() == 0 && h.max() == 0);
+
+  static histogram_tracer tracer;
+  tracer.record(TraceOp::WRITE, 10, 5);
+  tracer.record(TraceOp::WRITE, 10, 7);
+  CHECK(tracer.histogram(TraceOp::WRITE).count() == 2);
+  CHECK(tracer.histogram(TraceOp::READ).count() == 0);
+  char line[256];
+  CHECK(tracer.summary(TraceOp::WRITE, line, sizeof(line)) > 0);
+  CHECK(strncmp(line, "write: n=2 ", 11) == 0);
+}
+
+} // namespace
+
+int main() {
+  close(mkstemp(path));
+  hooks();
+  histogram();
+  unlink(path);
+  return check_failures() != 0;
+}
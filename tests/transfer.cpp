@@ -0,0 +1,152 @@
+#include "check.hpp"
+#include "streams.hpp"
+
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+namespace {
+
+char src[] = "/tmp/transfer_srcXXXXXX";
+char dst[] = "/tmp/transfer_dstXXXXXX";
+constexpr size_t SIZE = 20000;
+char data[SIZE];
+
+void make_source() {
+  for (size_t i = 0; i < SIZE; ++i)
+    data[i] = i % 100 == 99 ? '\n' : static_cast<char>('a' + i % 26);
+  auto const fd = ::open(src, O_WRONLY | O_TRUNC | O_CLOEXEC);
+  CHECK(::write(fd, data, SIZE) == static_cast<ssize_t>(SIZE));
+  close(fd);
+}
+
+// Reads a whole file or the rest of a pipe into `into`.
+size_t slurp(int fd, char *into, size_t capacity) {
+  size_t total = 0;
+  ssize_t n;
+  while (total != capacity &&
+         (n = ::read(fd, into + total, capacity - total)) > 0)
+    total += static_cast<size_t>(n);
+  return total;
+}
+bool matches_file(char const *path, char const *expected, size_t size) {
+  static char contents[2 * SIZE];
+  auto const fd = ::open(path, O_RDONLY | O_CLOEXEC);
+  auto const got = slurp(fd, contents, sizeof(contents));
+  close(fd);
+  return got == size && memcmp(contents, expected, size) == 0;
+}
+
+void file_to_file() {
+  unlink(dst);
+  {
+    ifstream in{array<char>{src}};
+    ofstream out{array<char>{dst}};
+    CHECK(out.transfer_from(in) == SIZE);
+    CHECK(in.tellr() == static_cast<ssize_t>(SIZE));
+    CHECK(out.tellw() == static_cast<ssize_t>(SIZE));
+    CHECK(in.stats().bytesRead == SIZE);
+    CHECK(out.stats().bytesWritten == SIZE);
+    CHECK(out.transfer_from(in) == 0);
+    CHECK(in.eof());
+  }
+  CHECK(matches_file(dst, data, SIZE));
+
+  // A bounded copy stops where asked and leaves the rest readable.
+  unlink(dst);
+  {
+    ifstream in{array<char>{src}};
+    ofstream out{array<char>{dst}};
+    CHECK(in.copy_to(out, 150) == 150);
+    CHECK(in.tellr() == 150);
+    auto [line, size] = in.readline();
+    CHECK(size == 50 && line[0] == data[150]);
+  }
+  CHECK(matches_file(dst, data, 150));
+}
+
+// Buffered data on both sides goes out first, in order.
+void after_buffered_readline() {
+  unlink(dst);
+  {
+    ifstream in{array<char>{src}};
+    CHECK(in.readline().second == 100);
+    ofstream out{array<char>{dst}};
+    CHECK(out.write("head:") == 5);
+    CHECK(out.transfer_from(in) == SIZE - 100);
+    CHECK(out.tellw() == static_cast<ssize_t>(SIZE - 95));
+    CHECK(out.write(":tail") == 5);
+  }
+  static char expected[SIZE + 10];
+  memcpy(expected, "head:", 5);
+  memcpy(expected + 5, data + 100, SIZE - 100);
+  memcpy(expected + 5 + SIZE - 100, ":tail", 5);
+  CHECK(matches_file(dst, expected, SIZE - 90));
+}
+
+void file_to_pipe() {
+  int fds[2];
+  CHECK(pipe(fds) == 0);
+  {
+    ifstream in{array<char>{src}};
+    CHECK(in.readline().second == 100);
+    ofstream out{fds[1], false};
+    CHECK(out.transfer_from(in) == SIZE - 100);
+  }
+  static char got[SIZE];
+  CHECK(slurp(fds[0], got, sizeof(got)) == SIZE - 100);
+  CHECK(memcmp(got, data + 100, SIZE - 100) == 0);
+  close(fds[0]);
+}
+
+void pipe_to_file() {
+  int fds[2];
+  CHECK(pipe(fds) == 0);
+  CHECK(::write(fds[1], data, 5000) == 5000);
+  close(fds[1]);
+  unlink(dst);
+  {
+    ifstream in{fds[0], false};
+    ofstream out{array<char>{dst}};
+    CHECK(out.transfer_from(in) == 5000);
+    CHECK(in.eof());
+  }
+  CHECK(matches_file(dst, data, 5000));
+}
+
+// Neither side is a pipe or a regular file, so the data goes through a
+// private pipe.
+void socket_to_socket() {
+  int fds[2];
+  CHECK(socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds) == 0);
+  int sink[2];
+  CHECK(socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sink) == 0);
+  CHECK(::write(fds[1], data, 3000) == 3000);
+  shutdown(fds[1], SHUT_WR);
+  {
+    ifstream in{fds[0], false};
+    ofstream out{sink[0], false};
+    CHECK(out.transfer_from(in) == 3000);
+  }
+  static char got[SIZE];
+  CHECK(slurp(sink[1], got, sizeof(got)) == 3000);
+  CHECK(memcmp(got, data, 3000) == 0);
+  close(fds[1]);
+  close(sink[1]);
+}
+
+} // namespace
+
+int main() {
+  close(mkstemp(src));
+  close(mkstemp(dst));
+  make_source();
+  file_to_file();
+  after_buffered_readline();
+  file_to_pipe();
+  pipe_to_file();
+  socket_to_socket();
+  unlink(src);
+  unlink(dst);
+  return check_failures() != 0;
+}
@@ -0,0 +1,201 @@
+#include "check.hpp"
+#include "utf.hpp"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace {
+
+char path[] = "/tmp/utf_testXXXXXX";
+
+// "a", "é", "€", "😀": one code point of each UTF-8 length.
+char const mixed[] = "a\xC3\xA9\xE2\x82\xAC\xF0\x9F\x98\x80";
+constexpr size_t MIXED = sizeof(mixed) - 1;
+
+void decode_encode() {
+  uint32_t const points[] = {0x61, 0xE9, 0x20AC, 0x1F600};
+  int const lengths[] = {1, 2, 3, 4};
+  size_t at = 0;
+  for (int i = 0; i < 4; ++i) {
+    uint32_t cp = 0;
+    CHECK(utf::decode(mixed + at, MIXED - at, cp) == lengths[i]);
+    CHECK(cp == points[i]);
+    char out[4];
+    CHECK(utf::encode(cp, out) == static_cast<size_t>(lengths[i]));
+    CHECK(memcmp(out, mixed + at, static_cast<size_t>(lengths[i])) == 0);
+    at += static_cast<size_t>(lengths[i]);
+  }
+  uint32_t cp;
+  // Overlong forms, surrogates and code points past U+10FFFF.
+  CHECK(utf::decode("\xC0\x80", 2, cp) <= 0);
+  CHECK(utf::decode("\xE0\x80\x80", 3, cp) <= 0);
+  CHECK(utf::decode("\xED\xA0\x80", 3, cp) <= 0);
+  CHECK(utf::decode("\xF4\x90\x80\x80", 4, cp) <= 0);
+  CHECK(utf::decode("\x80", 1, cp) <= 0);
+  // A sequence cut off by the end of input is not valid either.
+  CHECK(utf::decode(mixed + 6, 3, cp) <= 0);
+}
+
+void validate_and_count() {
+  CHECK(utf::validate(mixed, MIXED) == MIXED);
+  CHECK(utf::validate(mixed, MIXED - 1) == 6);
+  CHECK(utf::count(mixed, MIXED) == 4);
+  char text[100];
+  memset(text, 'x', sizeof(text));
+  memcpy(text + 70, "\xE2\x82\xAC", 3);
+  CHECK(utf::validate(text, sizeof(text)) == sizeof(text));
+  CHECK(utf::count(text, sizeof(text)) == 98);
+  text[40] = static_cast<char>(0xFF);
+  CHECK(utf::validate(text, sizeof(text)) == 40);
+}
+
+void tail_and_substring() {
+  CHECK(utf::tail(mixed, MIXED, 0) == MIXED);
+  CHECK(utf::tail(mixed, MIXED, 1) == 6);
+  CHECK(utf::tail(mixed, MIXED, 2) == 3);
+  CHECK(utf::tail(mixed, MIXED, 4) == 0);
+  CHECK(utf::tail(mixed, MIXED, 10) == 0);
+  // Invalid bytes count as one code point each, and a cut never splits a
+  // valid sequence.
+  char const broken[] = "\xC3\xA9\x80\xE2\x82";
+  CHECK(utf::tail(broken, 5, 1) == 4);
+  CHECK(utf::tail(broken, 5, 2) == 3);
+  CHECK(utf::tail(broken, 5, 3) == 2);
+  CHECK(utf::tail(broken, 5, 4) == 0);
+
+  auto const middle = utf::substring(mixed, MIXED, 1, 2);
+  CHECK(middle.first == 1 && middle.second == 5);
+  auto const clamped = utf::substring(mixed, MIXED, 3, 5);
+  CHECK(clamped.first == 6 && clamped.second == 4);
+  auto const past = utf::substring(mixed, MIXED, 9, 1);
+  CHECK(past.first == MIXED && past.second == 0);
+}
+
+void transcode() {
+  // Long ASCII runs go through the vector paths.
+  char text[200];
+  size_t n = 0;
+  for (int i = 0; i < 5; ++i) {
+    memset(text + n, 'a' + i, 25);
+    n += 25;
+    memcpy(text + n, mixed, MIXED);
+    n += MIXED;
+  }
+  short units[200];
+  auto const wide = utf::to_utf16(text, n, units);
+  CHECK(wide.read == n);
+  CHECK(wide.written == 5 * (25 + 5));
+  CHECK(units[25] == 'a' && units[26] == static_cast<short>(0xE9));
+  CHECK(static_cast<unsigned short>(units[28]) == 0xD83D);
+  CHECK(static_cast<unsigned short>(units[29]) == 0xDE00);
+  char back[600];
+  auto const narrow = utf::to_utf8(units, wide.written, back);
+  CHECK(narrow.read == wide.written && narrow.written == n);
+  CHECK(memcmp(back, text, n) == 0);
+
+  // Both directions stop at the first thing they cannot convert.
+  CHECK(utf::to_utf16("ab\xFF" "c", 4, units).read == 2);
+  short const lone[] = {'x', static_cast<short>(0xDC00), 'y'};
+  CHECK(utf::to_utf8(lone, 3, back).read == 1);
+  short const cut[] = {'x', static_cast<short>(0xD83D)};
+  CHECK(utf::to_utf8(cut, 2, back).read == 1);
+}
+
+void put(char const *data, size_t size) {
+  unlink(path);
+  auto const fd = ::open(path, O_WRONLY | O_CREAT | O_CLOEXEC, 0644);
+  CHECK(::write(fd, data, size) == static_cast<ssize_t>(size));
+  close(fd);
+}
+
+// UTF-8 -> UTF-16 -> UTF-8 through the streams, with sequences and pairs
+// straddling the readers' blocks and the writers' calls.
+void stream_round_trip() {
+  constexpr size_t SIZE = 3 * utf16_reader<>::BLOCK + 123;
+  array<char> text{SIZE};
+  size_t n = 0;
+  for (size_t line = 0; n + 64 < SIZE; ++line) {
+    for (size_t i = 0; i < line % 7; ++i, n += MIXED)
+      memcpy(text.data() + n, mixed, MIXED);
+    n += static_cast<size_t>(snprintf(text.data() + n, 32, "line %zu\n", line));
+  }
+  put(text.data(), n);
+
+  array<short> units{2 * SIZE};
+  size_t count = 0;
+  {
+    ifstream in{array<char>{path}};
+    utf16_reader reader{in};
+    for (;;) {
+      auto [line, size] = reader.readline();
+      if (size == 0)
+        break;
+      memcpy(units.data() + count, line.data(), size * sizeof(short));
+      count += size;
+    }
+    CHECK(reader.errors() == 0);
+  }
+  CHECK(units[count - 1] == '\n');
+
+  unlink(path);
+  {
+    ofstream out{array<char>{path}};
+    utf16_writer writer{out};
+    // Odd-sized writes split surrogate pairs between calls.
+    for (size_t at = 0; at < count; at += 7)
+      CHECK(writer.write(units, at, min(size_t{7}, count - at)) ==
+            min(size_t{7}, count - at));
+    CHECK(writer.errors() == 0);
+  }
+  ifstream check{array<char>{path}};
+  array<char> back{SIZE};
+  CHECK(check.read(back, SIZE) == n);
+  CHECK(memcmp(back.data(), text.data(), n) == 0);
+}
+
+// Invalid input becomes U+FFFD on the way in and on the way out.
+void replacements() {
+  put("a\xFF" "b\xE2\x82", 5);
+  {
+    ifstream in{array<char>{path}};
+    utf16_reader reader{in};
+    array<short> units{8};
+    CHECK(reader.read(units, 8) == 4);
+    CHECK(units[0] == 'a' && units[2] == 'b');
+    CHECK(static_cast<unsigned short>(units[1]) == utf::REPLACEMENT);
+    CHECK(static_cast<unsigned short>(units[3]) == utf::REPLACEMENT);
+    CHECK(reader.errors() == 2);
+  }
+  unlink(path);
+  {
+    ofstream out{array<char>{path}};
+    utf16_writer writer{out};
+    array<short> units{3};
+    units[0] = static_cast<short>(0xDC00);
+    units[1] = 'z';
+    units[2] = static_cast<short>(0xD800);
+    writer.write(units, 3);
+    // The trailing high surrogate is held until finish().
+    CHECK(writer.errors() == 1);
+    writer.finish();
+    CHECK(writer.errors() == 2);
+  }
+  ifstream in{array<char>{path}};
+  auto [line, size] = in.readline();
+  CHECK(size == 7);
+  CHECK(memcmp(line.data(), "\xEF\xBF\xBDz\xEF\xBF\xBD", 7) == 0);
+}
+
+} // namespace
+
+int main() {
+  close(mkstemp(path));
+  decode_encode();
+  validate_and_count();
+  tail_and_substring();
+  transcode();
+  stream_round_trip();
+  replacements();
+  unlink(path);
+  return check_failures() != 0;
+}
@@ -0,0 +1,185 @@
+#ifndef TRACE_HPP
+#define TRACE_HPP
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define TRACE_HAS_TSC 1
+#elif defined(_M_X64) || defined(_M_IX86)
+#include <intrin.h>
+#define TRACE_HAS_TSC 1
+#endif
+
+enum class TraceOp : int { READ = 0, WRITE = 1, SEEK = 2 };
+inline constexpr size_t TRACE_OPS = 3;
+
+inline char const *trace_op_name(TraceOp op) {
+  switch (op) {
+  case TraceOp::READ:
+    return "read";
+  case TraceOp::WRITE:
+    return "write";
+  case TraceOp::SEEK:
+    return "seek";
+  }
+  return "unknown";
+}
+
+// Cheapest monotonic tick source available: the TSC on x86, the steady clock
+// elsewhere. Ticks are converted to nanoseconds only when reporting.
+struct trace_clock {
+  static uint64_t now() {
+#ifdef TRACE_HAS_TSC
+    return __rdtsc();
+#else
+    return static_cast<uint64_t>(
+        std::chrono::steady_clock::now().time_since_epoch().count());
+#endif
+  }
+  static double ticks_per_ns() {
+#ifdef TRACE_HAS_TSC
+    static double const ratio = [] {
+      auto const start = std::chrono::steady_clock::now();
+      auto const ticks = __rdtsc();
+      while (std::chrono::steady_clock::now() - start <
+             std::chrono::milliseconds(5)) {
+      }
+      auto const ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                          std::chrono::steady_clock::now() - start)
+                          .count();
+      return static_cast<double>(__rdtsc() - ticks) / static_cast<double>(ns);
+    }();
+    return ratio;
+#else
+    using period = std::chrono::steady_clock::period;
+    return static_cast<double>(period::den) / (1e9 * period::num);
+#endif
+  }
+};
+
+// Receives one call per OS-level read, write or seek issued by a stream.
+// `result` is the raw return value of the call, `ticks` its trace_clock
+// duration.
+class stream_tracer {
+public:
+  virtual void record(TraceOp op, int64_t result, uint64_t ticks) = 0;
+  virtual ~stream_tracer() = default;
+};
+
+// Streams pick this tracer up when they are constructed.
+extern stream_tracer *default_stream_tracer;
+
+// Log-linear histogram in the spirit of HdrHistogram: every power of two is
+// split into SUB_BUCKETS linear buckets, so any recorded value is known to
+// within 1/SUB_BUCKETS of itself while 64-bit values fit in under a thousand
+// counters.
+class latency_histogram {
+public:
+  static constexpr unsigned SUB_BITS = 4;
+  static constexpr uint64_t SUB_BUCKETS = uint64_t{1} << SUB_BITS;
+  static constexpr size_t BUCKETS = (64 - SUB_BITS + 1) * SUB_BUCKETS;
+
+  static size_t bucketOf(uint64_t value) {
+    if (value < SUB_BUCKETS)
+      return static_cast<size_t>(value);
+    unsigned const exponent = 63u - static_cast<unsigned>(clz(value));
+    auto const sub = (value >> (exponent - SUB_BITS)) & (SUB_BUCKETS - 1);
+    return (exponent - SUB_BITS + 1) * SUB_BUCKETS + static_cast<size_t>(sub);
+  }
+  static uint64_t lowerBound(size_t bucket) {
+    if (bucket < SUB_BUCKETS)
+      return bucket;
+    auto const exponent = bucket / SUB_BUCKETS + SUB_BITS - 1;
+    auto const sub = bucket % SUB_BUCKETS;
+    return (SUB_BUCKETS + sub) << (exponent - SUB_BITS);
+  }
+
+  void record(uint64_t value) {
+    m_buckets[bucketOf(value)].fetch_add(1, std::memory_order_relaxed);
+    m_count.fetch_add(1, std::memory_order_relaxed);
+    m_sum.fetch_add(value, std::memory_order_relaxed);
+    auto max = m_max.load(std::memory_order_relaxed);
+    while (value > max &&
+           !m_max.compare_exchange_weak(max, value, std::memory_order_relaxed))
+      ;
+  }
+  uint64_t count() const { return m_count.load(std::memory_order_relaxed); }
+  uint64_t max() const { return m_max.load(std::memory_order_relaxed); }
+  double mean() const {
+    auto const n = count();
+    return n == 0 ? 0.0
+                  : static_cast<double>(m_sum.load(std::memory_order_relaxed)) /
+                        static_cast<double>(n);
+  }
+  // Lower bound of the bucket holding the given quantile (0 <= q <= 1).
+  uint64_t quantile(double q) const {
+    auto const n = count();
+    if (n == 0)
+      return 0;
+    auto const rank = static_cast<uint64_t>(q * static_cast<double>(n - 1));
+    uint64_t seen = 0;
+    for (size_t i = 0; i < BUCKETS; ++i) {
+      seen += m_buckets[i].load(std::memory_order_relaxed);
+      if (seen > rank)
+        return lowerBound(i);
+    }
+    return max();
+  }
+  void reset() {
+    for (auto &bucket : m_buckets)
+      bucket.store(0, std::memory_order_relaxed);
+    m_count.store(0, std::memory_order_relaxed);
+    m_sum.store(0, std::memory_order_relaxed);
+    m_max.store(0, std::memory_order_relaxed);
+  }
+
+private:
+  static int clz(uint64_t value) {
+#ifdef _MSC_VER
+    unsigned long idx;
+    _BitScanReverse64(&idx, value);
+    return 63 - static_cast<int>(idx);
+#else
+    return __builtin_clzll(value);
+#endif
+  }
+
+  std::atomic<uint64_t> m_buckets[BUCKETS] = {};
+  std::atomic<uint64_t> m_count{0};
+  std::atomic<uint64_t> m_sum{0};
+  std::atomic<uint64_t> m_max{0};
+};
+
+// Keeps one latency histogram per operation. Safe to share between streams
+// running on different threads.
+class histogram_tracer : public stream_tracer {
+public:
+  void record(TraceOp op, int64_t, uint64_t ticks) override {
+    m_histograms[static_cast<size_t>(op)].record(ticks);
+  }
+  latency_histogram const &histogram(TraceOp op) const {
+    return m_histograms[static_cast<size_t>(op)];
+  }
+  // Formats "op: n=.. mean=.. p50=.. p90=.. p99=.. p999=.. max=.." in ns.
+  int summary(TraceOp op, char *buffer, size_t size) const {
+    auto const &h = histogram(op);
+    auto const scale = 1.0 / trace_clock::ticks_per_ns();
+    auto ns = [&](uint64_t ticks) { return static_cast<double>(ticks) * scale; };
+    return snprintf(buffer, size,
+                    "%s: n=%llu mean=%.0fns p50=%.0fns p90=%.0fns p99=%.0fns "
+                    "p999=%.0fns max=%.0fns\n",
+                    trace_op_name(op), static_cast<unsigned long long>(h.count()),
+                    h.mean() * scale, ns(h.quantile(0.5)), ns(h.quantile(0.9)),
+                    ns(h.quantile(0.99)), ns(h.quantile(0.999)), ns(h.max()));
+  }
+
+private:
+  latency_histogram m_histograms[TRACE_OPS];
+};
+
+#endif // TRACE_HPP
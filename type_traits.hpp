@@ -200,6 +200,37 @@ template <typename T>
 concept character_type = is_character_v<T>;
 #endif
 
+template <typename T>
+struct is_integer : public false_t {};
+template <>
+struct is_integer<signed char> : public true_t {};
+template <>
+struct is_integer<unsigned char> : public true_t {};
+template <>
+struct is_integer<short> : public true_t {};
+template <>
+struct is_integer<unsigned short> : public true_t {};
+template <>
+struct is_integer<int> : public true_t {};
+template <>
+struct is_integer<unsigned int> : public true_t {};
+template <>
+struct is_integer<long> : public true_t {};
+template <>
+struct is_integer<unsigned long> : public true_t {};
+template <>
+struct is_integer<long long> : public true_t {};
+template <>
+struct is_integer<unsigned long long> : public true_t {};
+
+template <typename T>
+constexpr bool is_integer_v = is_integer<T>::value;
+
+#ifdef __cpp_concepts
+template <typename T>
+concept integer_type = is_integer_v<T>;
+#endif
+
 template <typename, typename Callable, typename... Args>
 struct is_callable_with : public false_t {};
 
@@ -235,6 +266,13 @@ T const& min(T const& a, T const& b) {
   return a < b ? a : b;
 }
 
+#undef max
+
+template<typename T>
+T const& max(T const& a, T const& b) {
+  return a < b ? b : a;
+}
+
 // template <typename Callable, typename Object_t, typename... Args>
 // requires is_callable_with_v<invoke_result_t<Callable>, Args...>
 // invoke_result_t<Callable, Args...> invoke(Callable&& functor, Args&&... args) {
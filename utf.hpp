@@ -0,0 +1,436 @@
+#ifndef UTF_HPP
+#define UTF_HPP
+
+#include "simd.hpp"
+#include "streams.hpp"
+
+// UTF-8 and UTF-16 for streams that only know bytes (`ifstream`/`ofstream`)
+// and 16-bit units (`short`, as in `iwfstream`):
+//
+//   utf::tail(line, size, 10)      byte offset of the last 10 code points
+//   utf::validate(text, size)      length of the valid UTF-8 prefix
+//   utf16_reader reader{in};       UTF-8 file read as UTF-16 units
+//   utf16_writer writer{out};      UTF-16 units written as UTF-8
+//
+// Runs of ASCII, the bulk of most logs, are checked and converted 16 bytes
+// at a time; only multi-byte sequences are decoded one by one. Decoding is
+// strict: overlong forms, surrogates and values past U+10FFFF are invalid.
+namespace utf {
+
+inline constexpr uint32_t REPLACEMENT = 0xFFFD;
+
+struct transcode_result {
+  size_t read;
+  size_t written;
+};
+
+inline bool is_continuation(unsigned char byte) {
+  return (byte & 0xC0) == 0x80;
+}
+inline bool is_high_surrogate(uint32_t unit) {
+  return unit >= 0xD800 && unit <= 0xDBFF;
+}
+inline bool is_low_surrogate(uint32_t unit) {
+  return unit >= 0xDC00 && unit <= 0xDFFF;
+}
+
+// Decodes the sequence at the start of [p, p + n) into `cp`. Returns its
+// length, 0 if it is invalid, or -1 if it is valid so far but cut off by
+// the end of the input.
+inline int decode(char const *p, size_t n, uint32_t &cp) {
+  auto const *s = reinterpret_cast<unsigned char const *>(p);
+  if (n == 0)
+    return -1;
+  auto const lead = s[0];
+  if (lead < 0x80) {
+    cp = lead;
+    return 1;
+  }
+  int length;
+  unsigned char low = 0x80, high = 0xBF;
+  if (lead >= 0xC2 && lead <= 0xDF) {
+    length = 2;
+    cp = lead & 0x1Fu;
+  } else if (lead >= 0xE0 && lead <= 0xEF) {
+    length = 3;
+    cp = lead & 0x0Fu;
+    if (lead == 0xE0)
+      low = 0xA0;
+    else if (lead == 0xED)
+      high = 0x9F;
+  } else if (lead >= 0xF0 && lead <= 0xF4) {
+    length = 4;
+    cp = lead & 0x07u;
+    if (lead == 0xF0)
+      low = 0x90;
+    else if (lead == 0xF4)
+      high = 0x8F;
+  } else {
+    return 0;
+  }
+  // Only the second byte has a narrowed range.
+  for (int i = 1; i < length; ++i) {
+    if (static_cast<size_t>(i) == n)
+      return -1;
+    auto const byte = s[i];
+    if (byte < low || byte > high)
+      return 0;
+    low = 0x80;
+    high = 0xBF;
+    cp = cp << 6 | (byte & 0x3Fu);
+  }
+  return length;
+}
+
+// Writes `cp` as UTF-8 and returns the number of bytes used.
+inline size_t encode(uint32_t cp, char *out) {
+  if (cp < 0x80) {
+    out[0] = static_cast<char>(cp);
+    return 1;
+  }
+  if (cp < 0x800) {
+    out[0] = static_cast<char>(0xC0 | cp >> 6);
+    out[1] = static_cast<char>(0x80 | (cp & 0x3F));
+    return 2;
+  }
+  if (cp < 0x10000) {
+    out[0] = static_cast<char>(0xE0 | cp >> 12);
+    out[1] = static_cast<char>(0x80 | (cp >> 6 & 0x3F));
+    out[2] = static_cast<char>(0x80 | (cp & 0x3F));
+    return 3;
+  }
+  out[0] = static_cast<char>(0xF0 | cp >> 18);
+  out[1] = static_cast<char>(0x80 | (cp >> 12 & 0x3F));
+  out[2] = static_cast<char>(0x80 | (cp >> 6 & 0x3F));
+  out[3] = static_cast<char>(0x80 | (cp & 0x3F));
+  return 4;
+}
+
+// Length of the longest valid UTF-8 prefix of [p, p + n); n if it is all
+// valid. A sequence cut off at the end counts as invalid.
+inline size_t validate(char const *p, size_t n) {
+  size_t i = 0;
+  for (;;) {
+    i += simd::ascii_run(p + i, n - i);
+    if (i == n)
+      return n;
+    uint32_t cp;
+    auto const length = decode(p + i, n - i, cp);
+    if (length <= 0)
+      return i;
+    i += static_cast<size_t>(length);
+  }
+}
+
+// Number of code points in valid UTF-8.
+inline size_t count(char const *p, size_t n) {
+  return simd::count_utf8_leads(p, n);
+}
+
+// Start of the code point that ends at `end`. Bytes that are not part of a
+// valid sequence count as one code point each, so a cut never lands inside
+// a valid sequence.
+inline size_t previous(char const *p, size_t end) {
+  auto const *s = reinterpret_cast<unsigned char const *>(p);
+  for (size_t back = 1; back <= 4 && back <= end; ++back) {
+    if (is_continuation(s[end - back]))
+      continue;
+    uint32_t cp;
+    if (decode(p + end - back, back, cp) == static_cast<int>(back))
+      return end - back;
+    break;
+  }
+  return end - 1;
+}
+
+// Start of the code point that begins at `pos`, measured as in previous().
+inline size_t next(char const *p, size_t n, size_t pos) {
+  uint32_t cp;
+  auto const length = decode(p + pos, n - pos, cp);
+  return pos + (length > 0 ? static_cast<size_t>(length) : 1);
+}
+
+// Byte offset at which the last `count` code points of [p, p + n) start.
+inline size_t tail(char const *p, size_t n, size_t count) {
+  auto pos = n;
+  for (; count != 0 && pos != 0; --count)
+    pos = previous(p, pos);
+  return pos;
+}
+
+// Byte range {offset, size} of `count` code points starting with code point
+// number `first`, clamped to the end of [p, p + n).
+inline pair<size_t, size_t> substring(char const *p, size_t n, size_t first,
+                                      size_t count) {
+  size_t begin = 0;
+  for (; first != 0 && begin != n; --first) {
+    auto const ascii = min(simd::ascii_run(p + begin, n - begin), first);
+    begin += ascii;
+    first -= ascii;
+    if (first == 0 || begin == n)
+      break;
+    begin = next(p, n, begin);
+  }
+  auto end = begin;
+  for (; count != 0 && end != n; --count) {
+    auto const ascii = min(simd::ascii_run(p + end, n - end), count);
+    end += ascii;
+    count -= ascii;
+    if (count == 0 || end == n)
+      break;
+    end = next(p, n, end);
+  }
+  return {begin, end - begin};
+}
+
+// Converts UTF-8 to UTF-16 until the input ends or an invalid or cut-off
+// sequence is reached. `out` needs room for `n` units.
+inline transcode_result to_utf16(char const *p, size_t n, short *out) {
+  size_t i = 0, o = 0;
+  for (;;) {
+    auto const ascii = simd::widen_ascii(p + i, n - i, out + o);
+    i += ascii;
+    o += ascii;
+    if (i == n)
+      break;
+    uint32_t cp;
+    auto const length = decode(p + i, n - i, cp);
+    if (length <= 0)
+      break;
+    i += static_cast<size_t>(length);
+    if (cp < 0x10000) {
+      out[o++] = static_cast<short>(cp);
+    } else {
+      cp -= 0x10000;
+      out[o++] = static_cast<short>(0xD800 | cp >> 10);
+      out[o++] = static_cast<short>(0xDC00 | (cp & 0x3FF));
+    }
+  }
+  return {i, o};
+}
+
+// Converts UTF-16 to UTF-8 until the input ends or a surrogate that is not
+// part of a complete pair is reached. `out` needs room for 3 * `n` bytes.
+inline transcode_result to_utf8(short const *p, size_t n, char *out) {
+  size_t i = 0, o = 0;
+  for (;;) {
+    auto const ascii = simd::narrow_ascii(p + i, n - i, out + o);
+    i += ascii;
+    o += ascii;
+    if (i == n)
+      break;
+    uint32_t cp = static_cast<unsigned short>(p[i]);
+    if (is_low_surrogate(cp))
+      break;
+    if (is_high_surrogate(cp)) {
+      if (i + 1 == n)
+        break;
+      uint32_t const low = static_cast<unsigned short>(p[i + 1]);
+      if (!is_low_surrogate(low))
+        break;
+      cp = 0x10000 + ((cp - 0xD800) << 10 | (low - 0xDC00));
+      ++i;
+    }
+    ++i;
+    o += encode(cp, out + o);
+  }
+  return {i, o};
+}
+
+} // namespace utf
+
+// Reads a UTF-8 byte stream, a file or an imemstream, as UTF-16 units.
+// Invalid bytes are read as U+FFFD and counted in errors().
+#ifdef __cpp_concepts
+template <input_stream Source = ifstream>
+#else
+template <typename Source = ifstream>
+#endif
+class utf16_reader {
+public:
+  static constexpr size_t BLOCK = 4096;
+
+  explicit utf16_reader(Source &source) : m_source{source} {}
+
+  size_t errors() const { return m_errors; }
+  size_t read(array<short> &buffer, size_t size) {
+    return read(buffer, 0, size);
+  }
+  size_t read(array<short> &buffer, size_t start, size_t size) {
+    size_t done = 0;
+    while (done != size && fill()) {
+      auto const n = min(m_usize - m_upos, size - done);
+      memcpy(buffer.data() + start + done, m_units.data() + m_upos,
+             n * sizeof(short));
+      m_upos += n;
+      done += n;
+    }
+    return done;
+  }
+  // Reads up to and including the next '\n', like ifstream::readline().
+  pair<array<short>, size_t> readline() {
+    array<short> line{64};
+    size_t size = 0;
+    while (fill()) {
+      auto const *units = m_units.data() + m_upos;
+      auto n = m_usize - m_upos;
+      bool found = false;
+      for (size_t i = 0; i < n; ++i)
+        if (units[i] == '\n') {
+          n = i + 1;
+          found = true;
+          break;
+        }
+      if (size + n > line.capacity()) {
+        auto capacity = line.capacity();
+        while (capacity < size + n)
+          capacity <<= 1;
+        array<short> grown{capacity};
+        memcpy(grown.data(), line.data(), size * sizeof(short));
+        line = forward<array<short>>(grown);
+      }
+      memcpy(line.data() + size, units, n * sizeof(short));
+      size += n;
+      m_upos += n;
+      if (found)
+        break;
+    }
+    return {line, size};
+  }
+
+private:
+  // Converts the buffered bytes. A cut-off sequence waits for more input
+  // unless `atEnd`.
+  bool decode(bool atEnd) {
+    auto const *bytes = m_bytes.data() + m_bpos;
+    auto const available = m_bsize - m_bpos;
+    auto const result = utf::to_utf16(bytes, available, m_units.data());
+    m_bpos += result.read;
+    m_upos = 0;
+    m_usize = result.written;
+    if (m_usize != 0 || m_bpos == m_bsize)
+      return m_usize != 0;
+    uint32_t cp;
+    if (utf::decode(bytes, available, cp) < 0) {
+      if (!atEnd)
+        return false;
+      m_bpos = m_bsize;
+    } else {
+      ++m_bpos;
+    }
+    m_units[0] = static_cast<short>(utf::REPLACEMENT);
+    m_usize = 1;
+    ++m_errors;
+    return true;
+  }
+  bool fill() {
+    while (m_upos == m_usize) {
+      if (m_bpos != m_bsize && decode(false))
+        return true;
+      memmove(m_bytes.data(), m_bytes.data() + m_bpos, m_bsize - m_bpos);
+      m_bsize -= m_bpos;
+      m_bpos = 0;
+      auto const got = m_source.read(m_bytes, m_bsize, BLOCK - m_bsize);
+      m_bsize += got;
+      if (got == 0)
+        return m_bsize != 0 && decode(true);
+    }
+    return true;
+  }
+
+  Source &m_source;
+  array<char> m_bytes{BLOCK};
+  size_t m_bpos = 0, m_bsize = 0;
+  array<short> m_units{BLOCK};
+  size_t m_upos = 0, m_usize = 0;
+  size_t m_errors = 0;
+};
+
+// Writes UTF-16 units to a byte stream, a file or an omemstream, as UTF-8.
+// A surrogate pair may be split across writes; unpaired surrogates are
+// written as U+FFFD and counted in errors().
+#ifdef __cpp_concepts
+template <output_stream Sink = ofstream>
+#else
+template <typename Sink = ofstream>
+#endif
+class utf16_writer {
+public:
+  static constexpr size_t BLOCK = 4096;
+
+  explicit utf16_writer(Sink &sink) : m_sink{sink} {}
+  utf16_writer(utf16_writer const &) = delete;
+  utf16_writer &operator=(utf16_writer const &) = delete;
+  ~utf16_writer() { finish(); }
+
+  size_t errors() const { return m_errors; }
+  size_t write(array<short> const &buffer, size_t size) {
+    return write(buffer, 0, size);
+  }
+  size_t write(array<short> const &buffer, size_t start, size_t size) {
+    auto const *units = buffer.data() + start;
+    size_t pos = 0;
+    size_t out = 0;
+    if (m_pending != 0 && size != 0) {
+      uint32_t const low = static_cast<unsigned short>(units[0]);
+      if (utf::is_low_surrogate(low)) {
+        out += utf::encode(0x10000 + ((m_pending - 0xD800) << 10 |
+                                      (low - 0xDC00)),
+                           m_bytes.data());
+        ++pos;
+      } else {
+        out += replacement(m_bytes.data());
+      }
+      m_pending = 0;
+    }
+    while (pos != size) {
+      auto const chunk = min(size - pos, BLOCK);
+      auto const result = utf::to_utf8(units + pos, chunk, m_bytes.data() + out);
+      pos += result.read;
+      out += result.written;
+      if (pos != size && result.read != chunk) {
+        uint32_t const unit = static_cast<unsigned short>(units[pos]);
+        uint32_t const low =
+            pos + 1 == size ? 0 : static_cast<unsigned short>(units[pos + 1]);
+        if (utf::is_high_surrogate(unit) && pos + 1 == size) {
+          m_pending = unit;
+        } else if (utf::is_high_surrogate(unit) && utf::is_low_surrogate(low)) {
+          // The pair straddles two chunks.
+          out += utf::encode(0x10000 + ((unit - 0xD800) << 10 | (low - 0xDC00)),
+                             m_bytes.data() + out);
+          ++pos;
+        } else {
+          out += replacement(m_bytes.data() + out);
+        }
+        ++pos;
+      }
+      if (out != 0)
+        m_sink.write(m_bytes, 0, out);
+      out = 0;
+    }
+    if (out != 0)
+      m_sink.write(m_bytes, 0, out);
+    return size;
+  }
+  // Writes a high surrogate left over from the last write as U+FFFD.
+  void finish() {
+    if (m_pending == 0)
+      return;
+    m_pending = 0;
+    m_sink.write(m_bytes, 0, replacement(m_bytes.data()));
+  }
+
+private:
+  size_t replacement(char *out) {
+    ++m_errors;
+    return utf::encode(utf::REPLACEMENT, out);
+  }
+
+  Sink &m_sink;
+  // Room for a whole chunk plus a pair or replacement either side of it.
+  array<char> m_bytes{BLOCK * 3 + 8};
+  uint32_t m_pending = 0;
+  size_t m_errors = 0;
+};
+
+#endif // UTF_HPP